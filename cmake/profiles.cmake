@@ -0,0 +1,130 @@
+include(CheckCCompilerFlag)
+
+# ------------------------------------------------------------------------------
+# Build profiles
+# ------------------------------------------------------------------------------
+
+# Debug unless chosen otherwise, eg. cmake -DCMAKE_BUILD_TYPE=Release ..
+if(NOT CMAKE_BUILD_TYPE AND NOT CMAKE_CONFIGURATION_TYPES)
+    set(CMAKE_BUILD_TYPE "Debug" CACHE STRING
+        "Build profile, Debug, RelWithDebInfo, Release or Profile" FORCE)
+endif()
+set_property(CACHE CMAKE_BUILD_TYPE PROPERTY STRINGS
+    Debug RelWithDebInfo Release Profile)
+
+# Optimised like RelWithDebInfo but keeping the frame pointers such that perf
+# and the like can walk the stack without DWARF unwinding
+set(PROFILE_FLAGS "-O2 -g -DNDEBUG -fno-omit-frame-pointer")
+check_c_compiler_flag("-mno-omit-leaf-frame-pointer" HAVE_NO_OMIT_LEAF_FP)
+if(HAVE_NO_OMIT_LEAF_FP)
+    set(PROFILE_FLAGS "${PROFILE_FLAGS} -mno-omit-leaf-frame-pointer")
+endif()
+# CMake creates an empty entry when configured with -DCMAKE_BUILD_TYPE=Profile
+if(NOT CMAKE_C_FLAGS_PROFILE)
+    set(CMAKE_C_FLAGS_PROFILE "${PROFILE_FLAGS}" CACHE STRING
+        "Flags used by the C compiler during PROFILE builds." FORCE)
+endif()
+mark_as_advanced(CMAKE_C_FLAGS_PROFILE)
+
+message(STATUS "Build profile: ${CMAKE_BUILD_TYPE}")
+
+# ------------------------------------------------------------------------------
+# Link time optimisation
+# ------------------------------------------------------------------------------
+
+option(ENABLE_LTO "Link time optimisation of the emulator")
+
+if(ENABLE_LTO)
+    if(CMAKE_VERSION VERSION_LESS 3.9)
+        message(FATAL_ERROR "ENABLE_LTO requires CMake 3.9 or newer")
+    endif()
+
+    # CMP0069 is set in CMakeLists.txt as it must be set when the target is
+    # created
+    include(CheckIPOSupported)
+    check_ipo_supported(RESULT IPO_SUPPORTED OUTPUT IPO_ERROR LANGUAGES C)
+
+    if(IPO_SUPPORTED)
+        set_target_properties(${CMAKE_PROJECT_NAME} PROPERTIES
+            INTERPROCEDURAL_OPTIMIZATION ON)
+    else()
+        message(FATAL_ERROR "LTO is not supported by the toolchain: ${IPO_ERROR}")
+    endif()
+endif()
+
+# ------------------------------------------------------------------------------
+# Profile guided optimisation
+# ------------------------------------------------------------------------------
+
+# generate: instrument the emulator, then run make pgo_train
+# use: rebuild the emulator optimised using the recorded profile
+set(PGO "off" CACHE STRING "Profile guided optimisation, off, generate or use")
+set_property(CACHE PGO PROPERTY STRINGS off generate use)
+set(PGO_PROFILE_DIR "${PROJECT_BINARY_DIR}/pgo" CACHE PATH
+    "Where the PGO profile is written to and read from")
+set(PGO_TRAIN_FRAMES 20000 CACHE STRING
+    "Frames presented by the pgo_train run")
+
+if(CMAKE_C_COMPILER_ID MATCHES "Clang")
+    find_program(LLVM_PROFDATA_BIN NAMES llvm-profdata)
+    set(PGO_USE_PROFILE "${PGO_PROFILE_DIR}/default.profdata")
+else()
+    set(PGO_USE_PROFILE "${PGO_PROFILE_DIR}")
+endif()
+
+if("${PGO}" STREQUAL "generate")
+    # The emulator's helper threads run alongside the FreeRTOS tasks, their
+    # counters must be updated atomically to not corrupt the profile
+    SET(PGO_FLAGS "-fprofile-generate=${PGO_PROFILE_DIR}")
+    if(NOT CMAKE_C_COMPILER_ID MATCHES "Clang")
+        list(APPEND PGO_FLAGS "-fprofile-update=atomic")
+    endif()
+    target_compile_options(${CMAKE_PROJECT_NAME} PRIVATE ${PGO_FLAGS})
+    list(APPEND PROJECT_LIBRARIES "-fprofile-generate=${PGO_PROFILE_DIR}")
+
+    add_custom_target(
+        pgo_train
+        COMMAND ${CMAKE_COMMAND} -E remove_directory ${PGO_PROFILE_DIR}
+        COMMAND $<TARGET_FILE:${CMAKE_PROJECT_NAME}> --headless --uncapped
+            --frames ${PGO_TRAIN_FRAMES}
+        WORKING_DIRECTORY ${CMAKE_RUNTIME_OUTPUT_DIRECTORY}
+        DEPENDS ${CMAKE_PROJECT_NAME}
+        COMMENT "Recording a PGO profile into ${PGO_PROFILE_DIR}"
+    )
+
+    if(CMAKE_C_COMPILER_ID MATCHES "Clang")
+        if(LLVM_PROFDATA_BIN STREQUAL "LLVM_PROFDATA_BIN-NOTFOUND")
+            message(FATAL_ERROR "llvm-profdata not found, it is needed to "
+                "merge Clang's PGO profiles")
+        endif()
+
+        add_custom_command(
+            TARGET pgo_train POST_BUILD
+            COMMAND ${LLVM_PROFDATA_BIN} merge -output=${PGO_USE_PROFILE}
+                ${PGO_PROFILE_DIR}/*.profraw
+            COMMENT "Merging the PGO profile"
+        )
+    endif()
+elseif("${PGO}" STREQUAL "use")
+    if(NOT EXISTS ${PGO_USE_PROFILE})
+        message(FATAL_ERROR "No PGO profile in ${PGO_PROFILE_DIR}, build "
+            "with -DPGO=generate and run make pgo_train first")
+    endif()
+
+    # Threads make the counts slightly inconsistent and functions that the
+    # training run never called have no profile, neither is an error
+    SET(PGO_FLAGS "-fprofile-use=${PGO_USE_PROFILE}")
+    if(CMAKE_C_COMPILER_ID MATCHES "Clang")
+        list(APPEND PGO_FLAGS "-Wno-profile-instr-unprofiled"
+            "-Wno-profile-instr-out-of-date")
+    else()
+        list(APPEND PGO_FLAGS "-fprofile-correction")
+        check_c_compiler_flag("-Wno-missing-profile" HAVE_NO_MISSING_PROFILE)
+        if(HAVE_NO_MISSING_PROFILE)
+            list(APPEND PGO_FLAGS "-Wno-missing-profile")
+        endif()
+    endif()
+    target_compile_options(${CMAKE_PROJECT_NAME} PRIVATE ${PGO_FLAGS})
+elseif(NOT "${PGO}" STREQUAL "off")
+    message(FATAL_ERROR "Unknown PGO '${PGO}', use off, generate or use")
+endif()
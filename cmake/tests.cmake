@@ -10,6 +10,10 @@ SET(CHECK_FILES
     ${PROJECT_SOURCE_DIR}/lib/StateMachine/include/*.h
     ${PROJECT_SOURCE_DIR}/lib/StateMachine/*.c
     ${PROJECT_SOURCE_DIR}/lib/tracer/include/*.h
+    ${PROJECT_SOURCE_DIR}/lib/tracer/*.c
+    ${PROJECT_SOURCE_DIR}/lib/tracer/tools/*.c
+    ${PROJECT_SOURCE_DIR}/lib/MemMang/include/*.h
+    ${PROJECT_SOURCE_DIR}/lib/MemMang/*.c
     ${PROJECT_SOURCE_DIR}/lib/LL/*.h
     ${PROJECT_SOURCE_DIR}/src/*.c)
 
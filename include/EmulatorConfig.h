@@ -37,4 +37,103 @@
 #define configFPS_LIMIT 1
 #define configFPS_LIMIT_RATE 50
 
+// Only recompose the regions of the screen that changed from the cached
+// static layers instead of the entire screen. SDL does not guarantee that
+// a back buffer keeps its content once it has been presented, eg. with a
+// scaled or accelerated renderer, so only enable this for a backend known
+// to preserve its back buffers between presents
+#define configDRAW_DIRTY_REGIONS 0
+// Number of frames between a back buffer being drawn into and it being
+// drawn into again, ie. 2 for double buffering
+#define configDRAW_BUFFER_AGE 2
+
+// Maximum number of commands and bytes of text a task can record per frame
+#define configDRAW_COMMAND_BUFFER_LENGTH 256
+#define configDRAW_COMMAND_TEXT_LENGTH 2048
+// Maximum number of sprites a task can record per frame in sprite batches
+#define configDRAW_COMMAND_SPRITES 512
+// Sprites of a batch, or rows of a circle, drawn per call on the renderer,
+// converted on the stack of the task presenting the frames
+#define configDRAW_COMMAND_RECTS_PER_CALL 32
+// Maximum number of tasks that record draw commands
+#define configDRAW_COMMAND_MAX_PRODUCERS 4
+// Thread local storage slot holding a task's draw command buffers
+#define configDRAW_COMMANDS_TLS_INDEX 0
+
+// Maximum width and height of a sprite atlas' pages, see sprite_atlas.h
+#define configSPRITE_ATLAS_SIZE 1024
+// Maximum number of sheets packed into one sprite atlas
+#define configSPRITE_ATLAS_MAX_SHEETS 32
+// Maximum number of pages of one sprite atlas
+#define configSPRITE_ATLAS_MAX_PAGES 4
+// Maximum number of sprites in one sprite batch
+#define configSPRITE_BATCH_LENGTH 256
+
+// Number of threads decoding assets, see assets.h
+#define configASSET_WORKERS 4
+// Maximum number of distinct assets that can be requested
+#define configASSET_MAX_ASSETS 64
+// Assets requested at startup, found like an image unless given with
+// --manifest
+#define configASSET_MANIFEST "preload.manifest"
+
+// Steps per second of the demo's simulation, see fixed_step.h. Can be
+// changed at runtime with --sim-rate
+#define configSIM_RATE_HZ 120
+// Most simulation steps caught up with at once after falling behind
+#define configSIM_MAX_SUBSTEPS 4
+
+// Maximum number of tasks that can subscribe to the frame scheduler
+#define configFRAME_SCHEDULER_MAX_SUBSCRIBERS 8
+
+// What the idle task does while no task is ready, see idle.h. Can be
+// changed at runtime with --idle
+#define configIDLE_POLICY IDLE_POLICY_FUTEX
+// How long IDLE_POLICY_SPIN_PARK spins before waiting
+#define configIDLE_SPIN_US 50
+
+// Number of buffers each receive ring owns, a multiple of 64, see rx_ring.h
+#define configRX_RING_BUFFERS 256
+// Maximum number of datagrams received with one recvmmsg call
+#define configRX_RING_BATCH 32
+
+// Number of messages each transmit ring can queue, a power of two, see
+// tx_ring.h
+#define configTX_RING_SLOTS 128
+// Longest message that can be put to a transmit ring
+#define configTX_RING_MESSAGE_SIZE 512
+// Maximum number of messages sent with one system call
+#define configTX_RING_BATCH 32
+// Time between attempts to connect a TCP transmit ring
+#define configTX_RING_RECONNECT_MS 500
+// Time a closed transmit ring keeps trying to send what is still queued
+#define configTX_RING_LINGER_MS 1000
+
+// Maximum number of sockets, connections and message queues the reactor
+// watches, see reactor.h
+#define configREACTOR_MAX_HANDLES 512
+// Number of reads that can wait to be dispatched
+#define configREACTOR_QUEUE_LENGTH 64
+// Longest read handed to a handler
+#define configREACTOR_MESSAGE_SIZE 2048
+// Maximum number of ready descriptors handled per wakeup
+#define configREACTOR_MAX_EVENTS 64
+
+// Number of scheduler events that can wait to be written, a power of two,
+// see sched_trace.h
+#define configSCHED_TRACE_EVENTS 16384
+// Maximum number of tasks shown in the scheduler trace
+#define configSCHED_TRACE_MAX_TASKS 64
+
+// How often the task statistics are sampled, see task_stats.h
+#define configTASK_STATS_PERIOD_MS 500
+// Maximum number of the busiest tasks kept in a statistics sample, all
+// tasks are sampled
+#define configTASK_STATS_MAX_TASKS 32
+// Number of tasks listed by the statistics overlay
+#define configTASK_STATS_OVERLAY_TASKS 8
+
+// Bytes the journal file is grown by whenever it is full, see journal.h
+#define configJOURNAL_GROW_SIZE (4 * 1024 * 1024)
+
 #endif //__EMULATOR_CONFIG_H__
@@ -68,10 +68,10 @@
 
 #define configUSE_PREEMPTION            1
 #define configUSE_IDLE_HOOK             1
-#define configUSE_TICK_HOOK             0
+#define configUSE_TICK_HOOK             1
 #define configTICK_RATE_HZ              ( ( TickType_t ) 1000 )
 #define configMINIMAL_STACK_SIZE        ( ( unsigned short ) 4 ) /* This can be made smaller if required. */
-#define configTOTAL_HEAP_SIZE           ( ( size_t ) ( 32 * 1024 ) )
+#define configTOTAL_HEAP_SIZE           ( ( size_t ) ( 2 * 1024 * 1024 ) ) /* Only used by the pool_tlsf HEAP_BACKEND. */
 #define configMAX_TASK_NAME_LEN         ( 16 )
 #define configUSE_TRACE_FACILITY        1
 #define configUSE_STATS_FORMATTING_FUNCTIONS 1
@@ -86,6 +86,7 @@
 #define configUSE_RECURSIVE_MUTEXES     1
 #define configCHECK_FOR_STACK_OVERFLOW  0 /* Do not use this option on the PC port. */
 #define configUSE_APPLICATION_TASK_TAG  1
+#define configNUM_THREAD_LOCAL_STORAGE_POINTERS 1
 #define configQUEUE_REGISTRY_SIZE       0
 #define configMAX_SYSCALL_INTERRUPT_PRIORITY    1
 
@@ -105,8 +106,46 @@
 #define INCLUDE_uxTaskGetStackHighWaterMark 0 /* Do not use this option on the PC port. */
 #define INCLUDE_xTaskGetSchedulerState      1
 
-extern void vMainQueueSendPassed(void);
-#define traceQUEUE_SEND( pxQueue ) vMainQueueSendPassed()
+/* The run time counter counts nanoseconds instead of the port's default of
+ clock ticks, see frame_timing.h */
+#define configRUN_TIME_COUNTER_TYPE uint64_t
+extern uint64_t ullFrameTimingNow(void);
+#define portALT_GET_RUN_TIME_COUNTER_VALUE( ulCountValue ) ( ulCountValue ) = ullFrameTimingNow()
+
+/* Context switches are counted for the task statistics, see task_stats.h */
+extern unsigned long ulTaskStatsContextSwitches;
+
+#ifdef TRACE_SCHEDULER
+/* Scheduler events are recorded into a Chrome trace, see sched_trace.h.
+ Macros taking a variable number of arguments differ between kernel
+ versions. */
+#include "sched_trace.h"
+
+#define traceTASK_CREATE( pxNewTCB ) vSchedTraceRecord( SCHED_EVENT_CREATE, pxNewTCB, NULL )
+#define traceTASK_DELETE( pxTCB ) vSchedTraceRecord( SCHED_EVENT_DELETE, pxTCB, NULL )
+#define traceTASK_SWITCHED_IN() do { ulTaskStatsContextSwitches++; vSchedTraceRecord( SCHED_EVENT_SWITCHED_IN, pxCurrentTCB, NULL ); } while( 0 )
+#define traceTASK_SWITCHED_OUT() vSchedTraceRecord( SCHED_EVENT_SWITCHED_OUT, pxCurrentTCB, NULL )
+#define traceMOVED_TASK_TO_READY_STATE( pxTCB ) vSchedTraceRecord( SCHED_EVENT_READY, pxTCB, NULL )
+#define traceTASK_DELAY() vSchedTraceRecord( SCHED_EVENT_DELAY, NULL, NULL )
+#define traceTASK_DELAY_UNTIL( ... ) vSchedTraceRecord( SCHED_EVENT_DELAY, NULL, NULL )
+#define traceTASK_SUSPEND( pxTCB ) vSchedTraceRecord( SCHED_EVENT_SUSPEND, pxTCB, NULL )
+
+#define traceBLOCKING_ON_QUEUE_RECEIVE( pxQueue ) vSchedTraceRecord( SCHED_EVENT_BLOCK_RECEIVE, NULL, pxQueue )
+#define traceBLOCKING_ON_QUEUE_PEEK( pxQueue ) vSchedTraceRecord( SCHED_EVENT_BLOCK_RECEIVE, NULL, pxQueue )
+#define traceBLOCKING_ON_QUEUE_SEND( pxQueue ) vSchedTraceRecord( SCHED_EVENT_BLOCK_SEND, NULL, pxQueue )
+#define traceQUEUE_SEND( pxQueue ) vSchedTraceRecord( SCHED_EVENT_SEND, NULL, pxQueue )
+#define traceQUEUE_SEND_FROM_ISR( pxQueue ) vSchedTraceRecord( SCHED_EVENT_SEND, NULL, pxQueue )
+#define traceQUEUE_RECEIVE( pxQueue ) vSchedTraceRecord( SCHED_EVENT_RECEIVE, NULL, pxQueue )
+#define traceQUEUE_SEMAPHORE_RECEIVE( pxQueue ) vSchedTraceRecord( SCHED_EVENT_RECEIVE, NULL, pxQueue )
+
+#define traceTASK_NOTIFY_TAKE_BLOCK( ... ) vSchedTraceRecord( SCHED_EVENT_BLOCK_NOTIFY, NULL, NULL )
+#define traceTASK_NOTIFY_WAIT_BLOCK( ... ) vSchedTraceRecord( SCHED_EVENT_BLOCK_NOTIFY, NULL, NULL )
+#define traceTASK_NOTIFY( ... ) vSchedTraceRecord( SCHED_EVENT_NOTIFY, pxTCB, NULL )
+#define traceTASK_NOTIFY_FROM_ISR( ... ) vSchedTraceRecord( SCHED_EVENT_NOTIFY, pxTCB, NULL )
+#define traceTASK_NOTIFY_GIVE_FROM_ISR( ... ) vSchedTraceRecord( SCHED_EVENT_NOTIFY, pxTCB, NULL )
+#else
+#define traceTASK_SWITCHED_IN() ulTaskStatsContextSwitches++
+#endif
 
 #define configGENERATE_RUN_TIME_STATS       1
 
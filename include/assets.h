@@ -0,0 +1,191 @@
+/**
+ * @file assets.h
+ * @author Alex Hoffman
+ * @date 23 January 2023
+ * @brief Loads images on a pool of threads while the emulator runs
+ *
+ * @verbatim
+ ----------------------------------------------------------------------
+ Copyright (C) Alexander Hoffman, 2023
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ any later version.
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ----------------------------------------------------------------------
+ @endverbatim
+ */
+
+#ifndef __ASSETS_H__
+#define __ASSETS_H__
+
+#include <stdint.h>
+
+#include "FreeRTOS.h"
+
+#include "renderer.h"
+
+/**
+ * @defgroup assets Assets
+ *
+ * @brief Loading an image with gfxDrawLoadImage decodes it in the calling
+ * task, loading all of a state's images before its first frame delays that
+ * frame by the time it takes to decode all of them. Assets are instead
+ * decoded by configASSET_WORKERS threads and requesting an asset only
+ * returns a handle to it, which is ready once the asset has been loaded.
+ *
+ * The assets listed in the preload manifest, configASSET_MANIFEST unless
+ * given with --manifest, are requested as soon as xAssetsInit is called,
+ * such that they are decoded while the rest of the emulator starts. Each
+ * line of the manifest names the type of an asset followed by its file,
+ * found the same way as gfxDrawLoadImage finds it. Empty lines and lines
+ * starting with # are ignored.
+ *
+ * \code{.unparsed}
+image freertos.jpg
+pixels ball_spritesheet.png
+ * \endcode
+ *
+ * Both types of asset are decoded into an RGBA32 SDL_Surface, the loading
+ * threads never call into the graphics library or the renderer. An image
+ * asset is drawn as a renderer texture, see renderer.h, which the task
+ * presenting the frames uploads when it first draws it. A pixels asset is
+ * kept as a surface for code that copies pixels itself, eg. a sprite
+ * atlas, and freed once all of its users have released it.
+ *
+ * The graphics library's resource lookup is not made to be called by
+ * several threads at once, code looking up resources, or loading images or
+ * fonts through the graphics library, while the loading threads run must
+ * hold vAssetsLockGfx.
+ *
+ * The loading threads are not FreeRTOS tasks, they never wake a task.
+ * Tasks either check the state of an asset every frame or poll it with
+ * xAssetWait. Tasks poll for the locks shared with the loading threads
+ * instead of blocking their thread on them.
+ *
+ * \code{.c}
+asset_handle_t logo = xAssetRequest("freertos.jpg", ASSET_IMAGE);
+
+while (1) {
+    if (xAssetGetState(logo) == ASSET_READY) {
+        xDrawCommandTexture(xAssetGetTexture(logo), 10, 10);
+    }
+    vTaskDelay(20);
+}
+ * \endcode
+ *
+ * @{
+ */
+
+/// @brief Handle to a requested asset
+typedef struct asset *asset_handle_t;
+
+/// @brief What an asset is loaded into
+typedef enum asset_type {
+    ASSET_IMAGE = 0, ///< Renderer texture
+    ASSET_PIXELS, ///< RGBA32 SDL_Surface
+} asset_type_e;
+
+/// @brief Progress of loading an asset
+typedef enum asset_state {
+    ASSET_QUEUED = 0, ///< Waiting for a loading thread
+    ASSET_LOADING, ///< Being decoded
+    ASSET_READY, ///< Can be used
+    ASSET_FAILED, ///< Could not be found or decoded
+    ASSET_RELEASED, ///< Pixels were freed, requesting them decodes again
+} asset_state_e;
+
+/// @brief Load times of all assets requested so far, in nanoseconds
+typedef struct asset_stats {
+    unsigned int requested; ///< Number of assets requested
+    unsigned int ready; ///< Number of assets loaded
+    unsigned int failed; ///< Number of assets that failed to load
+    /// From xAssetsInit until the manifest's assets were loaded, 0 while
+    /// they are still loading
+    uint64_t preload_time;
+    uint64_t queue_time; ///< Waiting for a loading thread, summed
+    uint64_t decode_time; ///< Decoding, summed over the loading threads
+    uint64_t max_decode_time; ///< Longest time taken to decode one asset
+    uint64_t wait_time; ///< Tasks being blocked in xAssetWait, summed
+} asset_stats_t;
+
+/// @brief Starts the loading threads and requests the manifest's assets
+/// @param manifest Manifest listing the assets to preload, NULL for none
+/// @return 0 on success, -1 if the threads could not be started or the
+/// manifest could not be read
+int xAssetsInit(const char *manifest);
+
+/// @brief Stops the loading threads and frees the decoded pixels
+void vAssetsExit(void);
+
+/// @brief Requests an asset to be loaded, requesting an asset that was
+/// already requested returns the same handle. Can be called before the
+/// scheduler is started.
+/// @param filename Image file, found the same way as gfxDrawLoadImage
+/// @param type What the asset is loaded into
+/// @return Handle to the asset, NULL if configASSET_MAX_ASSETS were
+/// requested
+asset_handle_t xAssetRequest(const char *filename, asset_type_e type);
+
+/// @brief Gets how far an asset has been loaded
+/// @param asset Requested asset
+/// @return State of the asset, ASSET_FAILED if asset is NULL
+asset_state_e xAssetGetState(asset_handle_t asset);
+
+/// @brief Polls an asset until it is loaded or failed to load, must be
+/// called from a task
+/// @param asset Requested asset
+/// @param timeout Ticks to wait at most, portMAX_DELAY to wait forever
+/// @return 0 if the asset is ready, -1 otherwise
+int xAssetWait(asset_handle_t asset, TickType_t timeout);
+
+/// @brief Gets the texture of a loaded ASSET_IMAGE asset, created from its
+/// pixels on the first call. Must be called from a task.
+/// @param asset Requested asset
+/// @return Texture owned by the asset, NULL unless the asset is ready
+renderer_texture_handle_t xAssetGetTexture(asset_handle_t asset);
+
+/// @brief Gets the pixels of a loaded ASSET_PIXELS asset
+/// @param asset Requested asset
+/// @return RGBA32 surface owned by the asset, NULL unless the asset is
+/// ready
+struct SDL_Surface *xAssetGetPixels(asset_handle_t asset);
+
+/// @brief Releases the pixels of an ASSET_PIXELS asset once per call to
+/// xAssetRequest, they are freed once every user has released them
+/// @param asset Requested asset
+void vAssetRelease(asset_handle_t asset);
+
+/// @brief Gets how long an asset took to load
+/// @param asset Requested asset
+/// @return Nanoseconds from the asset being requested until it was loaded
+/// or failed to load, 0 while it is still loading
+uint64_t ullAssetGetLoadTime(asset_handle_t asset);
+
+/// @brief Whether all of the manifest's assets were loaded or failed to
+/// load
+/// @return 1 once the manifest's assets are no longer loading
+int xAssetsPreloaded(void);
+
+/// @brief Takes the lock serialising the graphics library's resource
+/// lookup and image loading with the loading threads. Every call to
+/// gfxUtilFindResourcePath, gfxDrawLoadImage, gfxDrawLoadSpritesheet* and
+/// gfxFontLoadFont made outside of this module must hold it. A task polls
+/// for the lock instead of blocking its thread, such that it cannot block
+/// the task holding it from being scheduled.
+void vAssetsLockGfx(void);
+
+/// @brief Releases the lock taken with vAssetsLockGfx
+void vAssetsUnlockGfx(void);
+
+/// @brief Gets the load times of all assets
+/// @param stats Set to the load times
+void vAssetsGetStats(asset_stats_t *stats);
+
+/** @} */
+#endif //__ASSETS_H__
@@ -2,7 +2,7 @@
  * @file async_message_queues.h
  * @author Alex Hoffman
  * @date 23 January 2023
- * @brief Basic example functions on how to use the message queues in the AIO library
+ * @brief Basic example functions on how to use the message queues through the reactor
  *
  * @verbatim
  ----------------------------------------------------------------------
@@ -27,20 +27,27 @@
 /**
  * @defgroup aio_mq_examples AIO Message Queue Examples
  *
- * @brief The AIO message queue library works around opening a message queue with
+ * @brief The message queue examples work around opening a message queue with
  * a specific name whose incoming traffic is then handled by the handler function
  * specified. Sending to the message queue is simple through the use of the
- * queue's name.
+ * queue's name. The queues are watched by the reactor, see reactor.h, which
+ * calls the handlers from its dispatch task.
+ *
+ * Messages can also be exchanged through shared memory, see shm_queue.h,
+ * which has the same kind of handler but is not limited by the kernel's
+ * message queue limits. Other processes attach to the queue by its name.
  *
  * \section mq_open Opening a queue
  *
  * \code{.c}
 void vMQDemoTask(void *pvParameters)
 {
-    mq_one = aIOOpenMessageQueue(mq_one_name, MSG_QUEUE_MAX_MSG_COUNT,
-                                MSG_QUEUE_BUFFER_SIZE, MQHandlerOne, NULL);
-    mq_two = aIOOpenMessageQueue(mq_two_name, MSG_QUEUE_MAX_MSG_COUNT,
-                                MSG_QUEUE_BUFFER_SIZE, MQHanderTwo, NULL);
+    mq_one = xReactorOpenMessageQueue(mq_one_name, MSG_QUEUE_MAX_MSG_COUNT,
+                                      MSG_QUEUE_BUFFER_SIZE, MQHandlerOne,
+                                      NULL);
+    mq_two = xReactorOpenMessageQueue(mq_two_name, MSG_QUEUE_MAX_MSG_COUNT,
+                                      MSG_QUEUE_BUFFER_SIZE, MQHanderTwo,
+                                      NULL);
 
     while (1)
 
@@ -68,23 +75,39 @@ void MQHanderTwo(size_t read_size, char *buffer, void *args)
  *
  * \code{.c}
 if (mq_one) {
-    aIOMessageQueuePut(mq_one_name, "Hello MQ one");
+    xReactorMessageQueuePut(mq_one_name, "Hello MQ one");
 }
 if (mq_two) {
-    aIOMessageQueuePut(mq_two_name, "Hello MQ two");
+    xReactorMessageQueuePut(mq_two_name, "Hello MQ two");
+}
+ * \endcode
+ *
+ * \section shm_put Putting to shared memory
+ *
+ * \code{.c}
+shm_queue_handle_t shm = xShmQueueAttach(shm_one_name);
+
+if (shm) {
+    xShmQueuePut(shm, "Hello SHM one", strlen("Hello SHM one"));
 }
  * \endcode
  *
  * @{
  */
 
-#include "AsyncIO.h"
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include "reactor.h"
+#include "shm_queue.h"
 
 extern const char *mq_one_name;
 extern const char *mq_two_name;
+extern const char *shm_one_name;
 
-extern aIO_handle_t mq_one;
-extern aIO_handle_t mq_two;
+extern reactor_handle_t mq_one;
+extern reactor_handle_t mq_two;
+extern shm_queue_handle_t shm_one;
 extern TaskHandle_t MQDemoTask;
 
 /// @brief Creates the demo message queue task found in async_message_queues.c
@@ -2,7 +2,7 @@
  * @file async_sockets.h
  * @author Alex Hoffman
  * @date 23 January 2023
- * @brief Basic example functions on how to use the sockets in the AIO library
+ * @brief Basic example functions on how to use the sockets
  *
  * @verbatim
  ----------------------------------------------------------------------
@@ -25,11 +25,13 @@
 #define __ASYNC_SOCKETS_H__
 
 /**
- * @defgroup aio_socket_example AIO Socket Examples
+ * @defgroup aio_socket_example Socket Examples
  *
- * @brief The AIO socket library works around opening a socket with an
+ * @brief The socket examples work around opening a socket with an
  * attached handler that is then asynchronously called when datta is put
- * to the socket.
+ * to the socket. The UDP sockets are opened as receive rings, see rx_ring.h,
+ * which lend their buffers to the handler instead of copying each datagram.
+ * The TCP socket is watched by the reactor, see reactor.h.
  *
  * \section socket_open Opening a socket
  *
@@ -37,8 +39,8 @@
 char *addr = NULL; // Loopback
 in_port_t port = UDP_TEST_PORT_1;
 
-udp_soc_one = aIOOpenUDPSocket(addr, port, UDP_BUFFER_SIZE,
-                                vUDPHandlerOne, NULL);
+udp_soc_one = xRxRingOpenUDP(addr, port, UDP_BUFFER_SIZE,
+                              vUDPHandlerOne, NULL);
  * \endcode
  *
  * \section socket_handler Socket handler
@@ -53,9 +55,10 @@ void vTCPHandler(size_t read_size, char *buffer, void *args)
  * \section socket_put Putting to socket
  *
  * \code{.c}
+tx_ring_handle_t udp_tx_one = xTxRingOpenUDP(NULL, UDP_TEST_PORT_1);
+
 if (udp_soc_one)
-    aIOSocketPut(UDP, NULL, UDP_TEST_PORT_1, test_str_1,
-                    strlen(test_str_1));
+    xTxRingPut(udp_tx_one, test_str_1, strlen(test_str_1));
  * \endcode
  *
  * @{
@@ -64,17 +67,21 @@ if (udp_soc_one)
 #define UDP_BUFFER_SIZE 2000
 #define UDP_TEST_PORT_1 1234
 #define UDP_TEST_PORT_2 4321
-#define TCP_BUFFER_SIZE 2000
 #define TCP_TEST_PORT 2222
 
-#include "AsyncIO.h"
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include "reactor.h"
+#include "rx_ring.h"
+#include "tx_ring.h"
 
 extern TaskHandle_t UDPDemoTask;
 extern TaskHandle_t TCPDemoTask;
 
-extern aIO_handle_t udp_soc_one;
-extern aIO_handle_t udp_soc_two;
-extern aIO_handle_t tcp_soc;
+extern rx_ring_handle_t udp_soc_one;
+extern rx_ring_handle_t udp_soc_two;
+extern reactor_handle_t tcp_soc;
 
 /// @brief Creates the UDP and TCP demo tasks used for demonstration purposes
 /// @return 0 on success
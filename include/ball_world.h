@@ -0,0 +1,159 @@
+/**
+ * @file ball_world.h
+ * @author Alex Hoffman
+ * @date 23 January 2023
+ * @brief Batched physics of many balls bouncing off walls and each other
+ *
+ * @verbatim
+ ----------------------------------------------------------------------
+ Copyright (C) Alexander Hoffman, 2023
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ any later version.
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ----------------------------------------------------------------------
+ @endverbatim
+ */
+
+#ifndef __BALL_WORLD_H__
+#define __BALL_WORLD_H__
+
+#include "gfx_ball.h"
+
+/**
+ * @defgroup ball_world Ball World
+ *
+ * @brief A ball world simulates many balls at once instead of one ball_t at
+ * a time. Each property of the balls is stored in its own array, such that
+ * moving the balls is done several balls per instruction using GCC's vector
+ * extensions.
+ *
+ * The area of the world is divided into a uniform grid of square cells at
+ * least as wide as the largest ball. Every step the balls are sorted into
+ * the cells they are in, such that a ball is only tested against the balls
+ * in its own and the neighbouring cells. The walls are assigned to the
+ * cells they cover when they are added, such that a ball is only tested
+ * against the walls near it.
+ *
+ * The walls are the gfx_ball.h walls, their dampening is the share of a
+ * ball's speed lost when it bounces off them. On every collision the
+ * ball's callback is called, and on collisions with a wall also the wall's.
+ *
+ * The positions of the balls before the latest step are kept, such that
+ * the balls can be drawn in between two steps, see fixed_step.h.
+ *
+ * A world is not thread safe, it should be used by a single task or
+ * protected by a mutex.
+ *
+ * \code{.c}
+ball_world_handle_t world = xBallWorldCreate(100, 0, 0, SCREEN_WIDTH,
+                                             SCREEN_HEIGHT, 20);
+xBallWorldAddWall(world, wall);
+xBallWorldAddBall(world, 50, 50, 100, 100, 5, Black, 1000,
+                  vPlayBallSound, NULL);
+
+while (1) {
+    uBallWorldStep(world, 0.02);
+    vTaskDelay(20);
+}
+ * \endcode
+ *
+ * @{
+ */
+
+/// @brief Maximum number of walls in one world
+#define BALL_WORLD_MAX_WALLS 32
+
+/// @brief Handle to a ball world
+typedef struct ball_world *ball_world_handle_t;
+
+/// @brief Read only view of a world's balls, valid until the world is
+/// changed
+typedef struct ball_world_view {
+    unsigned int count; ///< Number of balls
+    const float *x; ///< Centres of the balls
+    const float *y;
+    const float *prev_x; ///< Centres of the balls before the latest step
+    const float *prev_y;
+    const float *dx; ///< Speeds in pixels per second
+    const float *dy;
+    const float *radius;
+    const unsigned int *colour;
+} ball_world_view_t;
+
+/// @brief Creates a world
+/// @param max_balls Maximum number of balls
+/// @param x Left edge of the area the grid covers, balls outside of it are
+/// still simulated but tested against more balls
+/// @param y Top edge of the area
+/// @param w Width of the area
+/// @param h Height of the area
+/// @param cell_size Width of a grid cell, at least the diameter of the
+/// largest ball
+/// @return Handle to the world, NULL on error
+ball_world_handle_t xBallWorldCreate(unsigned int max_balls, float x,
+                                     float y, float w, float h,
+                                     float cell_size);
+
+/// @brief Frees a world, its walls are not freed
+/// @param world World to free
+void vBallWorldDelete(ball_world_handle_t world);
+
+/// @brief Adds a wall that the balls bounce off
+/// @param world World to add the wall to
+/// @param wall Wall, must stay valid as long as the world
+/// @return 0 on success, -1 if the world has BALL_WORLD_MAX_WALLS walls
+int xBallWorldAddWall(ball_world_handle_t world, wall_t *wall);
+
+/// @brief Adds a ball
+/// @param world World to add the ball to
+/// @param x Centre of the ball
+/// @param y Centre of the ball
+/// @param dx Horizontal speed in pixels per second
+/// @param dy Vertical speed in pixels per second
+/// @param radius Radius of the ball, greater than 0 and at most half of the
+/// cell size
+/// @param colour Colour the ball is drawn in
+/// @param max_speed Speed the ball is limited to, 0 for no limit
+/// @param callback Called when the ball collides, can be NULL
+/// @param args Argument passed to the callback
+/// @return Index of the ball, -1 on error
+int xBallWorldAddBall(ball_world_handle_t world, float x, float y, float dx,
+                      float dy, float radius, unsigned int colour,
+                      float max_speed, callback_t callback, void *args);
+
+/// @brief Moves a ball, without interpolating from where it was, and sets
+/// its speed
+/// @param world World the ball is in
+/// @param index Index of the ball as returned by xBallWorldAddBall
+/// @param x Centre of the ball
+/// @param y Centre of the ball
+/// @param dx Horizontal speed in pixels per second
+/// @param dy Vertical speed in pixels per second
+/// @return 0 on success, -1 if there is no such ball
+int xBallWorldSetBall(ball_world_handle_t world, unsigned int index, float x,
+                      float y, float dx, float dy);
+
+/// @brief Removes all balls, the walls are kept
+/// @param world World to clear
+void vBallWorldClear(ball_world_handle_t world);
+
+/// @brief Moves all balls and resolves their collisions
+/// @param world World to step
+/// @param seconds Time to simulate
+/// @return Number of collisions during the step
+unsigned int uBallWorldStep(ball_world_handle_t world, float seconds);
+
+/// @brief Gets the world's balls, eg. to draw them
+/// @param world World to view
+/// @param view Set to the world's balls
+void vBallWorldGetView(ball_world_handle_t world, ball_world_view_t *view);
+
+/** @} */
+#endif //__BALL_WORLD_H__
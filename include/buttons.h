@@ -2,8 +2,8 @@
  * @file buttons.h
  * @author Alex Hoffman
  * @date 23 January 2023
- * @brief A simple implementation of managing a global lookup table containins
- * button press status information
+ * @brief Lock-free snapshots of the keyboard's button states and a ring of
+ * button press and release events
  *
  * @verbatim
  ----------------------------------------------------------------------
@@ -25,33 +25,117 @@
 #ifndef __BUTTONS_H__
 #define __BUTTONS_H__
 
-#include <SDL2/SDL_scancode.h>
+#include <stdint.h>
 
-#include "FreeRTOS.h"
-#include "semphr.h"
+#include <SDL2/SDL_mouse.h>
+#include <SDL2/SDL_scancode.h>
 
 #define KEYCODE(CHAR) SDL_SCANCODE_##CHAR
 
-/// @brief Structure containing a loopup table containing all the keyboards'
-/// buttons states and a lock for accessing said table
-typedef struct buttons_buffer {
-    unsigned char buttons[SDL_NUM_SCANCODES];
-    SemaphoreHandle_t lock;
-} buttons_buffer_t;
+#define BUTTONS_WORD_BITS 64
+#define BUTTONS_WORDS (SDL_NUM_SCANCODES / BUTTONS_WORD_BITS)
+
+/**
+ * @defgroup buttons Buttons
+ *
+ * @brief Every key press and release is caught as SDL queues it, so even a
+ * key tapped between two polls of the events is seen. The state of all
+ * buttons is published as a 512 bit set behind a sequence lock, readers
+ * take a consistent copy without blocking and without ever blocking the
+ * writer. Every press and release is also appended, with a timestamp, to
+ * a ring of edges that any number of readers can consume at their own pace
+ * using their own cursor.
+ *
+ * The mouse's position and buttons are part of the same snapshot. While a
+ * journal is replayed, see journal.h, the recorded presses, releases and
+ * mouse movements are applied instead of SDL's.
+ *
+ * \code{.c}
+static buttons_reader_t reader = { 0 };
+buttons_snapshot_t snapshot;
+button_edge_t edge;
+
+vButtonsGetSnapshot(&snapshot);
+if (xButtonsSnapshotPressed(&snapshot, KEYCODE(W)))
+    ; // W is held down
+
+while (xButtonsNextEdge(&reader, &edge))
+    if (edge.pressed && edge.scancode == KEYCODE(C))
+        ; // C was pressed, even if it was released again before this poll
+ * \endcode
+ *
+ * @{
+ */
+
+/// @brief The state of the mouse at one point in time
+typedef struct buttons_mouse {
+    int32_t x; ///< Position within the window
+    int32_t y;
+    uint32_t buttons; ///< Pressed mouse buttons, eg. SDL_BUTTON_LMASK
+} buttons_mouse_t;
+
+/// @brief The state of every button at one point in time
+typedef struct buttons_snapshot {
+    uint64_t pressed[BUTTONS_WORDS]; ///< One bit per SDL scancode
+    uint64_t timestamp; ///< Time of the most recent change, in ns, see
+                        ///< ullJournalNow
+    buttons_mouse_t mouse; ///< State of the mouse
+} buttons_snapshot_t;
+
+/// @brief A button being pressed or released
+typedef struct button_edge {
+    uint64_t timestamp; ///< Time of the event, in ns, see ullJournalNow
+    uint16_t scancode; ///< SDL scancode of the button
+    uint8_t pressed; ///< 1 if pressed, 0 if released
+} button_edge_t;
+
+/// @brief A reader's position in the ring of edges
+typedef struct buttons_reader {
+    unsigned long cursor; ///< Next edge to be read
+    unsigned long lost; ///< Edges overwritten before they were read
+} buttons_reader_t;
+
+/// @brief Copies a consistent snapshot of every button's state
+/// @param snapshot Snapshot to be filled
+void vButtonsGetSnapshot(buttons_snapshot_t *snapshot);
+
+/// @brief Copies a consistent state of the mouse
+/// @param mouse State to be filled
+void vButtonsGetMouse(buttons_mouse_t *mouse);
+
+/// @brief Checks a button in a snapshot
+/// @param snapshot Snapshot filled by vButtonsGetSnapshot
+/// @param scancode SDL scancode of the button, see KEYCODE
+/// @return 1 if the button was pressed
+static inline int xButtonsSnapshotPressed(const buttons_snapshot_t *snapshot,
+        SDL_Scancode scancode)
+{
+    return (snapshot->pressed[scancode / BUTTONS_WORD_BITS] >>
+            (scancode % BUTTONS_WORD_BITS)) & 1;
+}
+
+/// @brief Checks the current state of a single button
+/// @param scancode SDL scancode of the button, see KEYCODE
+/// @return 1 if the button is pressed
+int xButtonsPressed(SDL_Scancode scancode);
 
-extern buttons_buffer_t buttons;
+/// @brief Reads the next press or release that the reader has not yet seen.
+/// A zero initialized reader starts with the oldest edge still in the ring.
+/// @param reader Reader's cursor
+/// @param edge Set to the next edge
+/// @return 1 if an edge was read, 0 if the reader is up to date
+int xButtonsNextEdge(buttons_reader_t *reader, button_edge_t *edge);
 
-/// @brief Recieves a fresh copy of the buttons lookup table from the
-/// backend SDL events library
-void vGetButtonInput(void);
+/// @brief Moves a reader past all edges that have happened so far
+/// @param reader Reader's cursor
+void vButtonsReaderSkip(buttons_reader_t *reader);
 
-/// @brief Initializes the buttons structure that holds the user's actual
-/// copy of the buttons lookup table
+/// @brief Starts recording the button events
 /// @return 0 on success
 int xButtonsInit(void);
 
-/// @brief Deinitializes the buttons structure that holds the user's actual
-/// copy of the buttons lookup table
+/// @brief Stops recording the button events
 void vButtonsExit(void);
 
-#endif //__BUTTONS_H__
\ No newline at end of file
+/** @} */
+#endif //__BUTTONS_H__
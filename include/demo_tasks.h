@@ -27,16 +27,34 @@
 #include "FreeRTOS.h"
 #include "task.h"
 
+#include "message_schema.h"
+
 extern TaskHandle_t DemoTask1;
 extern TaskHandle_t DemoTask2;
 extern TaskHandle_t DemoSendTask;
+extern TaskHandle_t DemoSimTask;
+
+/// @brief Message sent via UDP from the demo send task to the second UDP
+/// handler, see message_schema.h
+#define DEMO_COMMON_FIELDS(X) \
+    X(I32, first_int) \
+    X(I32, second_int)
+MESSAGE_DEFINE(demo_common, DemoCommon, DEMO_COMMON_FIELDS)
+
+#define DEMO_ITEM_FIELDS(X) \
+    X(U8, populated) \
+    X(I8, x) \
+    X(I8, y)
+MESSAGE_DEFINE(demo_item, DemoItem, DEMO_ITEM_FIELDS)
+
+#define DEMO_ITEM_COUNT 3
 
-/// @brief Structure to be send via UDP, important is that
-/// that the structure is packed using __attribute__((__packed__))
-struct __attribute__((__packed__)) common_struct {
-    int first_int;
-    int second_int;
-};
+#define DEMO_MESSAGE_FIELDS(X) \
+    X(I32, my_int) \
+    X(STRING, my_string, 10) \
+    X(STRUCT, my_common_struct, demo_common, DemoCommon) \
+    X(ARRAY, my_items, demo_item, DemoItem, DEMO_ITEM_COUNT)
+MESSAGE_DEFINE(demo_message, DemoMessage, DEMO_MESSAGE_FIELDS)
 
 /// @brief Creates the demo tasks found in demo_tasks.c
 /// @return 0 on success
@@ -30,6 +30,8 @@
 #include "gfx_draw.h"
 #include "gfx_ball.h"
 
+#include "ball_world.h"
+
 #define FPS_FONT "IBMPlexSans-Bold.ttf"
 
 extern gfx_image_handle_t logo_image;
@@ -52,25 +54,29 @@ void vDrawWalls(wall_t *left_wall, wall_t *right_wall, wall_t *top_wall, wall_t
 /// @param ball Pointer to ball handle to be drawn
 void vDrawBall(ball_t *ball);
 
+/// @brief Draws all balls of a ball world
+/// @param world Handle to the world whose balls are drawn
+/// @param alpha Where between the world's two latest steps the balls are
+/// drawn, see fFixedStepAlpha
+void vDrawBallWorld(ball_world_handle_t world, float alpha);
+
 /// @brief Clears the screen to be white
 void vDrawClearScreen(void);
 
-/// @brief Draws the ball moved by the mouse and its bounding box
+/// @brief Draws the ball moved by the mouse
 /// @param ball_color_inverted
-void vDrawMouseBallAndBoundingBox(unsigned char ball_color_inverted);
+void vDrawMouseBall(unsigned char ball_color_inverted);
 
-/// @brief Draws the FPS value on the screen
+/// @brief Draws the recent FPS and the 99th percentile frame time on the screen
 void vDrawFPS(void);
 
-/// @brief Draws the help text and FreeRTOS logo on the screen
-void vDrawStaticItems(void);
+/// @brief Draws the busiest tasks' CPU share and free stack, see
+/// task_stats.h, if enabled with --stats-overlay
+void vDrawTaskStats(void);
 
 /// @brief Draws the status information of the button presses on the screen
 void vDrawButtonText(void);
 
-/// @brief Draws the static sprite to the bottom right corner of the screen
-void vDrawSpriteStatic();
-
 /// @brief Resets the downward animation sequence for example purposes
 void vDrawSpriteResetDownwardSequence();
 
@@ -81,4 +87,18 @@ void vDrawSpriteAnimations(TickType_t xLastFrameTime);
 /// @brief Loads images, sprite sheets and creates the annimation sequences needed
 void vDrawInitResources(void);
 
+/// @brief Prepares the screen for a frame of state one. The help text, logo,
+/// cave bounding box and static sprite are retained between frames and only
+/// recomposed where the previous frames' dynamic content damaged them.
+void vDrawComposeStateOne(void);
+
+/// @brief Prepares the screen for a frame of state two. The help text, logo
+/// and walls are retained between frames.
+/// @param left_wall Pointer to the wall handle for the left wall
+/// @param right_wall Pointer to the wall handle for the right wall
+/// @param top_wall Pointer to the wall handle for the top wall
+/// @param bottom_wall Pointer to the wall handle for the bottom wall
+void vDrawComposeStateTwo(wall_t *left_wall, wall_t *right_wall,
+                          wall_t *top_wall, wall_t *bottom_wall);
+
 #endif //__DRAW_H__
\ No newline at end of file
@@ -0,0 +1,184 @@
+/**
+ * @file draw_commands.h
+ * @author Alex Hoffman
+ * @date 23 January 2023
+ * @brief Per-task draw command buffers that are executed as one sorted
+ * batch by the task presenting the frames
+ *
+ * @verbatim
+ ----------------------------------------------------------------------
+ Copyright (C) Alexander Hoffman, 2023
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ any later version.
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ----------------------------------------------------------------------
+ @endverbatim
+ */
+
+#ifndef __DRAW_COMMANDS_H__
+#define __DRAW_COMMANDS_H__
+
+#include <sys/types.h>
+
+#include "gfx_draw.h"
+
+#include "renderer.h"
+
+/**
+ * @defgroup draw_commands Draw Commands
+ *
+ * @brief A task that draws part of a frame records its draw calls into a
+ * command buffer that is private to the task, instead of issuing them to
+ * the Gfx library directly. Once the task's part of the frame is complete
+ * the buffer is submitted. The task presenting the frames executes all of
+ * the buffers submitted for a frame as a single batch, sorted such that
+ * commands using the same primitive type and texture are issued together.
+ *
+ * Commands are ordered by their depth first. Commands of the
+ * DRAW_DEPTH_BACKGROUND depth are executed in the order they were recorded,
+ * commands of the other depths must not depend on the order in which they
+ * are drawn relative to the other commands of the same depth.
+ *
+ * The task presenting the frames draws clears, boxes, circles, renderer
+ * textures, sprite batches and text directly on the renderer, see
+ * renderer.h. The other commands are handed to the Gfx library, which
+ * renders them when the screen is updated and thus on top of everything
+ * drawn on the renderer.
+ *
+ * When the calling task has no bound buffer the xDrawCommand functions draw
+ * directly, through the Gfx library unless the calling task is the one
+ * presenting the frames.
+ *
+ * \code{.c}
+xDrawCommandsBegin();
+xDrawCommandsSetDepth(DRAW_DEPTH_SCENE);
+xDrawCommandCircle(x, y, radius, Black);
+vDrawCommandsSubmit();
+ * \endcode
+ *
+ * @{
+ */
+
+/// @brief Depth that subsequent commands are drawn at, lowest first
+typedef enum draw_depth {
+    DRAW_DEPTH_BACKGROUND = 0, ///< Executed in recording order
+    DRAW_DEPTH_SCENE, ///< Sorted by primitive type and texture
+    DRAW_DEPTH_OVERLAY, ///< Sorted by primitive type and texture
+    DRAW_DEPTH_COUNT,
+} draw_depth_e;
+
+/// @brief A sprite drawn as part of xDrawCommandSprites
+typedef struct draw_sprite {
+    signed short x;
+    signed short y;
+    // Where the sprite is in the command's texture
+    unsigned short source_x;
+    unsigned short source_y;
+    unsigned short width;
+    unsigned short height;
+} draw_sprite_t;
+
+/// @brief Initializes the queue that buffers are submitted to
+/// @return 0 on success
+int xDrawCommandsInit(void);
+
+/// @brief Frees the submission queue and all command buffers
+void vDrawCommandsExit(void);
+
+/// @brief Binds an empty command buffer to the calling task, subsequent
+/// xDrawCommand calls made by the task are recorded into it. Blocks until
+/// one of the task's buffers has been executed if both are in flight.
+/// @return 0 on success
+int xDrawCommandsBegin(void);
+
+/// @brief Whether the calling task has a bound buffer
+/// @return 1 if the calling task's commands are recorded
+int xDrawCommandsRecording(void);
+
+/// @brief Sets the depth that the calling task's subsequent commands are
+/// recorded at. The depth is reset to DRAW_DEPTH_SCENE by
+/// xDrawCommandsBegin.
+/// @param depth New depth
+/// @return The previous depth
+draw_depth_e xDrawCommandsSetDepth(draw_depth_e depth);
+
+/// @brief Submits the calling task's bound buffer for execution and unbinds
+/// it
+void vDrawCommandsSubmit(void);
+
+/// @brief Executes every submitted buffer, must be called by the task
+/// presenting the frames before it calls gfxDrawUpdateScreen
+void vDrawCommandsExecute(void);
+
+/// @brief Records gfxDrawClear
+int xDrawCommandClear(unsigned int colour);
+
+/// @brief Records gfxDrawFilledBox
+int xDrawCommandFilledBox(ssize_t x, ssize_t y, ssize_t w, ssize_t h,
+                          unsigned int colour);
+
+/// @brief Records gfxDrawBox
+int xDrawCommandBox(ssize_t x, ssize_t y, ssize_t w, ssize_t h,
+                    unsigned int colour);
+
+/// @brief Records gfxDrawCircle
+int xDrawCommandCircle(ssize_t x, ssize_t y, ssize_t radius,
+                       unsigned int colour);
+
+/// @brief Records xTextCacheDrawText, the string is copied
+int xDrawCommandText(const char *font_name, ssize_t size,
+                     unsigned int colour, const char *str, ssize_t x,
+                     ssize_t y);
+
+/// @brief Records gfxDrawSprite
+int xDrawCommandSprite(gfx_spritesheet_handle_t spritesheet, char column,
+                       char row, signed short x, signed short y);
+
+/// @brief Records many sprites as one command, the sprites are copied. The
+/// sprites are drawn on the renderer with one SDL_RenderGeometry call per
+/// configDRAW_COMMAND_RECTS_PER_CALL sprites, drawing them fails unless the
+/// command is executed by the task presenting the frames.
+/// @param texture Texture that all of the sprites are cut from, eg. a page
+/// of a sprite atlas, such that the command is sorted next to other
+/// commands using the same texture
+/// @param sprites Sprites to be drawn, in order
+/// @param count Number of sprites
+int xDrawCommandSprites(renderer_texture_handle_t texture,
+                        const draw_sprite_t *sprites, unsigned int count);
+
+/// @brief Records gfxDrawLoadedImage
+int xDrawCommandImage(gfx_image_handle_t image, signed short x,
+                      signed short y);
+
+/// @brief Records drawing a renderer texture at its size, drawing it fails
+/// unless the command is executed by the task presenting the frames
+int xDrawCommandTexture(renderer_texture_handle_t texture, signed short x,
+                        signed short y);
+
+/// @brief Records drawing a region of a renderer texture at the same
+/// position on the screen, see xDrawCommandTexture
+int xDrawCommandTextureRegion(renderer_texture_handle_t texture, ssize_t x,
+                              ssize_t y, ssize_t w, ssize_t h);
+
+/// @brief Records switching the target that the following commands draw
+/// into, drawing fails unless the command is executed by the task
+/// presenting the frames. Must be recorded at DRAW_DEPTH_BACKGROUND, as
+/// the commands drawn into the target depend on their order.
+/// @param target Texture created with xRendererTargetCreate, NULL for the
+/// screen
+int xDrawCommandTarget(renderer_texture_handle_t target);
+
+/// @brief Records gfxDrawAnimationDrawFrame, the sequence is advanced when
+/// the command is executed
+int xDrawCommandAnimationFrame(gfx_sequence_handle_t sequence,
+                               unsigned ms, ssize_t x, ssize_t y);
+
+/** @} */
+#endif //__DRAW_COMMANDS_H__
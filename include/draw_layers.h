@@ -0,0 +1,100 @@
+/**
+ * @file draw_layers.h
+ * @author Alex Hoffman
+ * @date 23 January 2023
+ * @brief Retained static layers and dirty region tracking for the draw path
+ *
+ * @verbatim
+ ----------------------------------------------------------------------
+ Copyright (C) Alexander Hoffman, 2023
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ any later version.
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ----------------------------------------------------------------------
+ @endverbatim
+ */
+
+#ifndef __DRAW_LAYERS_H__
+#define __DRAW_LAYERS_H__
+
+#include <sys/types.h>
+
+/**
+ * @defgroup draw_layers Draw Layers
+ *
+ * @brief Instead of clearing the screen and redrawing everything each
+ * frame, content that does not change is described by static layers. The
+ * layers are drawn once into a render target texture over the background
+ * and each frame is started by copying that texture onto the screen. The
+ * texture is only drawn again when the set of layers changes or
+ * vDrawLayersInvalidate is called.
+ *
+ * Anything that changes reports the region it touches as damaged. With
+ * configDRAW_DIRTY_REGIONS set, the next time the same back buffer is drawn
+ * into only the damaged regions are copied from the texture, which is only
+ * correct for a renderer that preserves its back buffers between presents.
+ * SDL does not guarantee that, damage tracking is therefore off by default
+ * and the whole texture is copied every frame.
+ *
+ * Layers must be composed by a task recording draw commands, see
+ * draw_commands.h. Without render target support, or when composed by a
+ * task that is not recording, the layers are redrawn directly: every frame
+ * or, with configDRAW_DIRTY_REGIONS set, those intersecting damaged
+ * regions after clearing them.
+ *
+ * \code{.c}
+static draw_layer_t *layers[] = { &background_layer, &logo_layer };
+
+vDrawLayersCompose(layers, 2, White);
+gfxDrawCircle(x, y, r, Black);
+vDrawLayersDamage(x - r, y - r, 2 * r + 1, 2 * r + 1);
+ * \endcode
+ *
+ * @{
+ */
+
+/// @brief Axis aligned rectangle in screen coordinates
+typedef struct draw_rect {
+    ssize_t x;
+    ssize_t y;
+    ssize_t w;
+    ssize_t h;
+} draw_rect_t;
+
+/// @brief Static content that only needs to be redrawn when it is damaged
+typedef struct draw_layer {
+    draw_rect_t bounds; ///< Region covered by everything the layer draws
+    void (*draw)(void *args); ///< Draws the layer's content
+    void *args; ///< Passed to draw
+} draw_layer_t;
+
+/// @brief Prepares the back buffer for a new frame by copying the cached
+/// layers onto the regions damaged in the frames since this back buffer was
+/// last drawn into, everything else is left untouched. Changing the set of
+/// layers draws them into the cache again and copies the entire screen.
+/// @param layers Static layers, drawn in the order given
+/// @param count Number of layers
+/// @param background Colour that the layers are drawn over
+void vDrawLayersCompose(draw_layer_t **layers, unsigned int count,
+                        unsigned int background);
+
+/// @brief Reports that the dynamic content drawn this frame covers a region
+/// @param x Top left x of the damaged region
+/// @param y Top left y of the damaged region
+/// @param w Width of the damaged region
+/// @param h Height of the damaged region
+void vDrawLayersDamage(ssize_t x, ssize_t y, ssize_t w, ssize_t h);
+
+/// @brief Forces the layers to be drawn into the cache again and the entire
+/// screen to be recomposed for the next frames
+void vDrawLayersInvalidate(void);
+
+/** @} */
+#endif //__DRAW_LAYERS_H__
@@ -0,0 +1,115 @@
+/**
+ * @file fixed_step.h
+ * @author Alex Hoffman
+ * @date 23 January 2023
+ * @brief Runs a simulation in steps of a fixed length, independent of the
+ * frame rate
+ *
+ * @verbatim
+ ----------------------------------------------------------------------
+ Copyright (C) Alexander Hoffman, 2023
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ any later version.
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ----------------------------------------------------------------------
+ @endverbatim
+ */
+
+#ifndef __FIXED_STEP_H__
+#define __FIXED_STEP_H__
+
+#include <stdint.h>
+
+#include "FreeRTOS.h"
+
+/**
+ * @defgroup fixed_step Fixed Time Step
+ *
+ * @brief A fixed step clock tells a simulation task how many steps of
+ * 1/rate seconds are due, such that the simulation advances at the same
+ * rate and in the same increments no matter how fast frames are drawn.
+ *
+ * If the simulation falls behind, eg. after a slow frame, the missed steps
+ * are caught up but at most max_substeps at once. Beyond that the missed
+ * time is dropped and the simulation runs slower than real time instead of
+ * spending ever more time catching up.
+ *
+ * The clock follows ullJournalNow. While a journal is replayed no step is
+ * dropped, and the simulation is expected to be stepped once per frame from
+ * the frame's update stage, see frame_scheduler.h. It then takes the same
+ * steps by each frame as the recording did, unless the recording dropped
+ * steps.
+ *
+ * The drawing task shows the simulation one step in the past, between the
+ * two latest steps, using fFixedStepAlpha to interpolate between them. The
+ * frame rate can thereby be above or below the simulation's rate while
+ * objects still move smoothly.
+ *
+ * \code{.c}
+fixed_step_t step;
+
+vFixedStepInit(&step, 120, 4);
+
+while (1) {
+    for (unsigned int i = uFixedStepDue(&step); i; i--)
+        simulate(1.0f / 120);
+    vTaskDelay(xFixedStepTicksUntilNext(&step));
+}
+ * \endcode
+ *
+ * @{
+ */
+
+/// @brief State of a fixed step clock
+typedef struct fixed_step {
+    uint64_t period; ///< Length of a step in nanoseconds
+    uint64_t time; ///< Time, see ullJournalNow, that the latest step
+                   ///< simulated up to
+    unsigned int max_substeps; ///< Most steps that are due at once
+    unsigned long steps; ///< Steps that were due
+    unsigned long dropped; ///< Steps dropped as the simulation fell behind
+} fixed_step_t;
+
+/// @brief Starts a fixed step clock from the current time
+/// @param step Clock to start
+/// @param rate Steps per second
+/// @param max_substeps Most steps caught up with at once
+void vFixedStepInit(fixed_step_t *step, unsigned int rate,
+                    unsigned int max_substeps);
+
+/// @brief Restarts the clock from the current time, eg. after the
+/// simulation was paused, such that the pause is not caught up
+/// @param step Clock to restart
+void vFixedStepReset(fixed_step_t *step);
+
+/// @brief Takes the steps that are due since the previous call
+/// @param step Clock to advance
+/// @return Number of steps that the simulation must take now, at most
+/// max_substeps unless replaying
+unsigned int uFixedStepDue(fixed_step_t *step);
+
+/// @brief How far the current time is between the two latest steps
+/// @param step Clock of the simulation
+/// @return 0 to show the state before the latest step, 1 to show the latest
+/// step
+float fFixedStepAlpha(const fixed_step_t *step);
+
+/// @brief Time until the next step is due
+/// @param step Clock of the simulation
+/// @return Ticks to wait, rounded up
+TickType_t xFixedStepTicksUntilNext(const fixed_step_t *step);
+
+/// @brief Length of one step
+/// @param step Clock of the simulation
+/// @return Seconds simulated by each step
+float fFixedStepSeconds(const fixed_step_t *step);
+
+/** @} */
+#endif //__FIXED_STEP_H__
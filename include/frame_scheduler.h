@@ -0,0 +1,134 @@
+/**
+ * @file frame_scheduler.h
+ * @author Alex Hoffman
+ * @date 23 January 2023
+ * @brief Drives the tasks that take part in producing each frame
+ *
+ * @verbatim
+ ----------------------------------------------------------------------
+ Copyright (C) Alexander Hoffman, 2023
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ any later version.
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ----------------------------------------------------------------------
+ @endverbatim
+ */
+
+#ifndef __FRAME_SCHEDULER_H__
+#define __FRAME_SCHEDULER_H__
+
+#include "FreeRTOS.h"
+
+/**
+ * @defgroup frame_scheduler Frame Scheduler
+ *
+ * @brief Tasks that take part in producing a frame subscribe to one of the
+ * frame's stages. Each frame the task presenting the frames releases the
+ * enabled subscribers of each stage in turn, update, then draw, and waits
+ * for all of them to finish before moving on to the next stage. The
+ * present stage's subscribers are released once the frame has been
+ * presented.
+ *
+ * Every frame has a deadline, one frame period after it started. A
+ * subscriber that has not finished its stage by the deadline is counted as
+ * having missed it and the frame continues without it. A subscriber is
+ * never released again before it has finished its previous frame, so frames
+ * are neither doubled nor do subscribers fall further and further behind.
+ * While a journal is replayed there are no deadlines, every stage waits for
+ * all of its subscribers, see journal.h.
+ *
+ * \code{.c}
+frame_subscriber_handle_t sub = xFrameSchedulerSubscribe(FRAME_STAGE_DRAW,
+                                                         "Drawing");
+frame_info_t frame;
+
+vFrameSchedulerEnable(sub);
+
+while (1)
+    if (xFrameSchedulerWait(sub, &frame) == 0) {
+        // Draw frame.number
+        vFrameSchedulerDone(sub);
+    }
+ * \endcode
+ *
+ * @{
+ */
+
+/// @brief Stages of a frame, subscribers are released in this order
+typedef enum frame_stage {
+    FRAME_STAGE_UPDATE = 0, ///< Updating the state shown in the frame
+    FRAME_STAGE_DRAW, ///< Recording the frame's draw commands
+    FRAME_STAGE_PRESENT, ///< After the frame has been presented
+    FRAME_STAGE_COUNT,
+} frame_stage_e;
+
+/// @brief Handle to a subscriber
+typedef struct frame_subscriber *frame_subscriber_handle_t;
+
+/// @brief Frame that a subscriber has been released for
+typedef struct frame_info {
+    unsigned long number; ///< Frame number, starting at 1
+    TickType_t start; ///< Tick at which the frame started
+    TickType_t deadline; ///< Tick by which the frame must be finished
+} frame_info_t;
+
+/// @brief Initializes the frame scheduler
+/// @param period Frame period in ticks
+/// @return 0 on success
+int xFrameSchedulerInit(TickType_t period);
+
+/// @brief Frees all subscribers
+void vFrameSchedulerExit(void);
+
+/// @brief Adds a subscriber, subscribers start disabled
+/// @param stage Stage that the subscriber takes part in
+/// @param name Name of the subscriber, used in error messages
+/// @return Handle to the subscriber, NULL on error
+frame_subscriber_handle_t xFrameSchedulerSubscribe(frame_stage_e stage,
+        const char *name);
+
+/// @brief Allows the subscriber to be released in the following frames
+/// @param subscriber Subscriber handle
+void vFrameSchedulerEnable(frame_subscriber_handle_t subscriber);
+
+/// @brief Stops the subscriber being released, a frame that it has already
+/// been released for still needs to be finished with vFrameSchedulerDone
+/// @param subscriber Subscriber handle
+void vFrameSchedulerDisable(frame_subscriber_handle_t subscriber);
+
+/// @brief Blocks the calling task until the subscriber is released
+/// @param subscriber Subscriber handle
+/// @param frame Set to the frame the subscriber was released for, may be NULL
+/// @return 0 on success
+int xFrameSchedulerWait(frame_subscriber_handle_t subscriber,
+                        frame_info_t *frame);
+
+/// @brief Signals that the subscriber has finished its stage of the frame
+/// it was released for
+/// @param subscriber Subscriber handle
+void vFrameSchedulerDone(frame_subscriber_handle_t subscriber);
+
+/// @brief Starts a new frame, must be called once per frame by the task
+/// presenting the frames
+/// @return The new frame
+frame_info_t xFrameSchedulerBeginFrame(void);
+
+/// @brief Releases the enabled subscribers of a stage and waits until they
+/// have all finished or the frame's deadline has passed
+/// @param stage Stage to be run
+void vFrameSchedulerRunStage(frame_stage_e stage);
+
+/// @brief Number of times a subscriber did not finish its stage before the
+/// frame's deadline
+/// @return Missed deadlines since the scheduler was initialized
+unsigned long ulFrameSchedulerGetMissedDeadlines(void);
+
+/** @} */
+#endif //__FRAME_SCHEDULER_H__
@@ -0,0 +1,104 @@
+/**
+ * @file frame_timing.h
+ * @author Alex Hoffman
+ * @date 23 January 2023
+ * @brief Nanosecond resolution frame timing with per phase histograms
+ *
+ * @verbatim
+ ----------------------------------------------------------------------
+ Copyright (C) Alexander Hoffman, 2023
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ any later version.
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ----------------------------------------------------------------------
+ @endverbatim
+ */
+
+#ifndef __FRAME_TIMING_H__
+#define __FRAME_TIMING_H__
+
+#include <stdint.h>
+
+/**
+ * @defgroup frame_timing Frame Timing
+ *
+ * @brief Records the wall-clock duration of each frame, and of the phases
+ * that make up a frame, into log-linear (HDR style) histograms. Each
+ * histogram has a relative precision of roughly 1.5% across the range
+ * of a nanosecond to several minutes.
+ *
+ * \code{.c}
+uint64_t start = ullFrameTimingNow();
+gfxDrawUpdateScreen();
+vFrameTimingRecordPhase(FRAME_PHASE_PRESENT, start);
+ * \endcode
+ *
+ * @{
+ */
+
+/// @brief The parts of a frame that are timed individually
+typedef enum frame_phase {
+    FRAME_PHASE_FRAME = 0, ///< Complete frame, present to present
+    FRAME_PHASE_DRAW, ///< Drawing task building the frame
+    FRAME_PHASE_RENDER, ///< Executing the frame's draw commands
+    FRAME_PHASE_PRESENT, ///< gfxDrawUpdateScreen
+    FRAME_PHASE_EVENTS, ///< gfxEventFetchEvents
+    FRAME_PHASE_COUNT,
+} frame_phase_e;
+
+/// @brief Summary statistics of a single phase's histogram, all times in ns
+typedef struct frame_timing_summary {
+    uint64_t count;
+    uint64_t min;
+    uint64_t mean;
+    uint64_t p50;
+    uint64_t p95;
+    uint64_t p99;
+    uint64_t max;
+} frame_timing_summary_t;
+
+/// @brief Initializes the frame timing histograms
+/// @param dump_filename If not NULL the histograms are written to this file
+/// when the emulator exits
+/// @return 0 on success
+int xFrameTimingInit(const char *dump_filename);
+
+/// @brief Monotonic wall-clock time
+/// @return Time in nanoseconds
+uint64_t ullFrameTimingNow(void);
+
+/// @brief Marks the start of a new frame, the time since the previous mark is
+/// recorded as the frame's duration. Should be called once per frame by the
+/// task presenting the frames.
+void vFrameTimingMarkFrame(void);
+
+/// @brief Records the duration of a phase that started at start and ends now
+/// @param phase Phase being recorded
+/// @param start Value of ullFrameTimingNow() when the phase started
+void vFrameTimingRecordPhase(frame_phase_e phase, uint64_t start);
+
+/// @brief Calculates the summary statistics of a phase's histogram
+/// @param phase Phase to be summarised
+/// @param summary Summary to be filled
+void vFrameTimingGetSummary(frame_phase_e phase,
+                            frame_timing_summary_t *summary);
+
+/// @brief Average frame rate over the most recent frames
+/// @return Frames per second
+double dFrameTimingGetRecentFPS(void);
+
+/// @brief Writes a summary and the populated buckets of each phase's
+/// histogram to a file
+/// @param filename File to be written
+/// @return 0 on success
+int xFrameTimingDump(const char *filename);
+
+/** @} */
+#endif //__FRAME_TIMING_H__
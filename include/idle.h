@@ -0,0 +1,67 @@
+/**
+ * @file idle.h
+ * @author Alex Hoffman
+ * @date 23 January 2023
+ * @brief Policies for what the host thread does while FreeRTOS is idle
+ *
+ * @verbatim
+ ----------------------------------------------------------------------
+ Copyright (C) Alexander Hoffman, 2023
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ any later version.
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ----------------------------------------------------------------------
+ @endverbatim
+ */
+
+#ifndef __IDLE_H__
+#define __IDLE_H__
+
+/**
+ * @defgroup idle Idle Policy
+ *
+ * @brief The idle hook gives the host's CPU back while no task is ready to
+ * run. The idle task never sleeps past the next tick, so a task that
+ * unblocks on a tick is not delayed. Sources of asynchronous events, such
+ * as the socket and message queue handlers, call vIdleWake so that the
+ * policies that can wait for events return as soon as one happens.
+ *
+ * @{
+ */
+
+/// @brief What the idle hook does while waiting
+typedef enum idle_policy {
+    IDLE_POLICY_SLEEP = 0, ///< Sleep until the next tick
+    IDLE_POLICY_FUTEX, ///< Wait until the next tick or vIdleWake
+    IDLE_POLICY_SPIN_PARK, ///< Spin for configIDLE_SPIN_US checking for
+                           ///< vIdleWake, then wait as IDLE_POLICY_FUTEX
+    IDLE_POLICY_COUNT,
+} idle_policy_e;
+
+/// @brief Name of a policy, as used on the command line
+/// @param policy Idle policy
+/// @return Name of the policy
+const char *pcIdlePolicyName(idle_policy_e policy);
+
+/// @brief Looks up a policy by its name
+/// @param name Name of the policy, eg. "futex"
+/// @return The policy, IDLE_POLICY_COUNT if there is no such policy
+idle_policy_e xIdlePolicyFromName(const char *name);
+
+/// @brief Waits according to the policy, to be called from the idle hook
+/// @param policy Idle policy
+void vIdleWait(idle_policy_e policy);
+
+/// @brief Wakes the idle task if it is waiting for an event, async signal
+/// safe
+void vIdleWake(void);
+
+/** @} */
+#endif //__IDLE_H__
@@ -0,0 +1,143 @@
+/**
+ * @file journal.h
+ * @author Alex Hoffman
+ * @date 23 January 2023
+ * @brief Records the emulator's input and received data to replay a run
+ *
+ * @verbatim
+ ----------------------------------------------------------------------
+ Copyright (C) Alexander Hoffman, 2023
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ any later version.
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ----------------------------------------------------------------------
+ @endverbatim
+ */
+
+#ifndef __JOURNAL_H__
+#define __JOURNAL_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @defgroup journal Journal
+ *
+ * @brief While recording, every key press and release, mouse movement,
+ * received UDP datagram and read from a TCP connection or message queue is
+ * appended to a journal, stamped with the number of the frame it happened
+ * in. The journal is a file mapped into memory, appending a record is a
+ * copy into the mapping, the file only grows once every
+ * configJOURNAL_GROW_SIZE bytes.
+ *
+ * When replaying, nothing is read from SDL or from real sockets and
+ * message queues. At the start of each frame the records of the previous
+ * frame are handed, in the order they were recorded, to the modules they
+ * came from, which pass them on as if they had just happened. The emulator runs
+ * headless and uncapped, so a long session is replayed as fast as the
+ * frames can be drawn, and exits after the last recorded frame.
+ *
+ * Every record also holds the time the event happened, which the modules
+ * pass on in place of the time it is replayed at. Code that measures time
+ * in the events' clock uses ullJournalNow, while replaying it follows the
+ * journal: it is the time of the record being played, or the time the
+ * current frame was started at when it was recorded. Debouncing the state
+ * machine and stepping the demo's fixed step simulation then behave as
+ * they did while recording, no matter how fast the replay runs.
+ *
+ * \code{.sh}
+./FreeRTOS_Emulator --record session.journal
+./FreeRTOS_Emulator --replay session.journal --frame-stats replay.csv
+ * \endcode
+ *
+ * @{
+ */
+
+/// @brief Kinds of records
+typedef enum journal_type {
+    JOURNAL_FRAME = 0, ///< A frame started, source is the tick count,
+                       ///< played by the journal itself
+    JOURNAL_BUTTON, ///< Source is the scancode, flags 1 if pressed
+    JOURNAL_MOUSE, ///< Source is x | y << 16, flags the pressed buttons
+    JOURNAL_DATAGRAM, ///< Source is the port the datagram was received on
+    JOURNAL_READ, ///< Source identifies the reactor handle, see reactor.h
+    JOURNAL_TYPE_COUNT,
+} journal_type_e;
+
+/// @brief Header of a record, followed by length bytes of data and padded
+/// to a multiple of 8 bytes
+typedef struct journal_record {
+    uint64_t time; ///< Time the event happened, see ullJournalNow
+    uint32_t frame; ///< Frame the event happened in
+    uint32_t source; ///< Depends on the type
+    uint16_t length; ///< Bytes of data following the header
+    uint8_t type; ///< See journal_type_e
+    uint8_t flags; ///< Depends on the type
+} journal_record_t;
+
+/// @brief Called while replaying with a record of the type the player was
+/// set for, from the task presenting the frames
+typedef void (*journal_player_t)(const journal_record_t *record,
+                                 const char *data);
+
+/// @brief Opens the journal, at most one of the files can be given
+/// @param record_file Journal to record into, NULL to not record
+/// @param replay_file Journal to replay, NULL to not replay
+/// @return 0 on success
+int xJournalInit(const char *record_file, const char *replay_file);
+
+/// @brief Closes the journal, a recording is truncated to what was recorded
+void vJournalExit(void);
+
+/// @brief Whether a journal is being recorded
+/// @return 1 if recording
+int xJournalRecording(void);
+
+/// @brief Whether a journal is being replayed, modules then do not read
+/// their real input
+/// @return 1 if replaying
+int xJournalReplaying(void);
+
+/// @brief Appends a record stamped with the current frame, does nothing
+/// unless recording. Can be called from any thread or task.
+/// @param type Kind of the record
+/// @param source Depends on the type
+/// @param flags Depends on the type
+/// @param time Time the event happened, see ullJournalNow
+/// @param data Data of the record, can be NULL if length is 0
+/// @param length Length of the data, truncated to UINT16_MAX
+void vJournalRecord(journal_type_e type, uint32_t source, uint8_t flags,
+                    uint64_t time, const void *data, size_t length);
+
+/// @brief Time in the clock of the events, ullFrameTimingNow unless
+/// replaying. While replaying, the time of the record being played or of
+/// the start of the current frame, as they were recorded.
+/// @return Time in nanoseconds
+uint64_t ullJournalNow(void);
+
+/// @brief Sets the function that replays one type of record
+/// @param type Kind of the records
+/// @param player Function replaying the records
+void vJournalSetPlayer(journal_type_e type, journal_player_t player);
+
+/// @brief Starts a frame, to be called at the start of every frame by the
+/// task presenting the frames. Records the frame or replays the records of
+/// the frames before it.
+/// @param frame Number of the frame
+/// @return 0 to continue, 1 if the whole journal has been replayed
+int xJournalFrame(unsigned long frame);
+
+/// @brief Identifies a named source, eg. a message queue, across runs
+/// @param name Name of the source
+/// @return Hash of the name
+uint32_t ulJournalSource(const char *name);
+
+/** @} */
+#endif //__JOURNAL_H__
@@ -28,6 +28,4 @@
 
 #include "state_machine.h"
 
-extern SemaphoreHandle_t DrawSignal;
-
 #endif //__MAIN_H__
\ No newline at end of file
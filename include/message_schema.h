@@ -0,0 +1,228 @@
+/**
+ * @file message_schema.h
+ * @author Alex Hoffman
+ * @date 23 January 2023
+ * @brief Generates encode and decode functions for packed network messages
+ *
+ * @verbatim
+ ----------------------------------------------------------------------
+ Copyright (C) Alexander Hoffman, 2023
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ any later version.
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ----------------------------------------------------------------------
+ @endverbatim
+ */
+
+#ifndef __MESSAGE_SCHEMA_H__
+#define __MESSAGE_SCHEMA_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/**
+ * @defgroup message_schema Message Schema
+ *
+ * @brief A message is described once by a list of its fields, which both
+ * the sender and the receiver include. MESSAGE_DEFINE then generates
+ * - name_t, the decoded message
+ * - xNameDecode, which checks the length of a received buffer once and then
+ *   reads every field from its fixed offset
+ * - xNameEncode, which writes a message into a buffer
+ * - MESSAGE_SIZE(name), the size of the message on the wire
+ *
+ * Integers are sent little endian. Strings are fixed length fields that are
+ * padded with zeros, decoding them does not copy them, the decoded string
+ * points into the received buffer and is only valid as long as the buffer
+ * is. Fields can also be other messages or fixed length arrays of messages.
+ *
+ * Fields are listed as X(type, name, ...) with one of the types
+ * - U8, I8, U16, I16, U32 or I32
+ * - STRING, length
+ * - STRUCT, message name, MessageName
+ * - ARRAY, message name, MessageName, count
+ *
+ * \code{.c}
+#define POINT_FIELDS(X) \
+    X(I16, x) \
+    X(I16, y)
+MESSAGE_DEFINE(point, Point, POINT_FIELDS)
+
+#define PATH_FIELDS(X) \
+    X(STRING, name, 8) \
+    X(U8, count) \
+    X(ARRAY, points, point, Point, 4)
+MESSAGE_DEFINE(path, Path, PATH_FIELDS)
+
+path_t path;
+
+if (xPathDecode(buffer, length, &path) == 0)
+    printf("%.*s has %d points\n", (int)path.name.length, path.name.data,
+           path.count);
+ * \endcode
+ *
+ * @{
+ */
+
+/// @brief String field of a decoded message
+typedef struct message_string {
+    const char *data; ///< Start of the string, not null terminated
+    size_t length; ///< Length of the string without its padding
+} message_string_t;
+
+/// @brief Creates a message_string_t from a string literal
+#define MESSAGE_STRING(str) ((message_string_t){ (str), sizeof(str) - 1 })
+
+/// @brief Size of a message on the wire
+#define MESSAGE_SIZE(name) sizeof(struct name##_wire)
+
+static inline uint16_t usMessageGetLE16(const unsigned char *p)
+{
+    return (uint16_t)(p[0] | p[1] << 8);
+}
+
+static inline uint32_t ulMessageGetLE32(const unsigned char *p)
+{
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 |
+           (uint32_t)p[3] << 24;
+}
+
+static inline void vMessagePutLE16(unsigned char *p, uint16_t value)
+{
+    p[0] = value;
+    p[1] = value >> 8;
+}
+
+static inline void vMessagePutLE32(unsigned char *p, uint32_t value)
+{
+    p[0] = value;
+    p[1] = value >> 8;
+    p[2] = value >> 16;
+    p[3] = value >> 24;
+}
+
+static inline void vMessagePutString(unsigned char *p, size_t size,
+                                     message_string_t str)
+{
+    size_t length = str.length < size ? str.length : size;
+
+    memcpy(p, str.data, length);
+    memset(p + length, 0, size - length);
+}
+
+// Members of the decoded message
+#define MESSAGE_MEMBER(type, ...) MESSAGE_MEMBER_##type(__VA_ARGS__)
+#define MESSAGE_MEMBER_U8(field) uint8_t field;
+#define MESSAGE_MEMBER_I8(field) int8_t field;
+#define MESSAGE_MEMBER_U16(field) uint16_t field;
+#define MESSAGE_MEMBER_I16(field) int16_t field;
+#define MESSAGE_MEMBER_U32(field) uint32_t field;
+#define MESSAGE_MEMBER_I32(field) int32_t field;
+#define MESSAGE_MEMBER_STRING(field, size) message_string_t field;
+#define MESSAGE_MEMBER_STRUCT(field, name, Name) name##_t field;
+#define MESSAGE_MEMBER_ARRAY(field, name, Name, count) name##_t field[count];
+
+// Layout of the message on the wire, only made of bytes so that a received
+// buffer can be read through it no matter its alignment
+#define MESSAGE_WIRE(type, ...) MESSAGE_WIRE_##type(__VA_ARGS__)
+#define MESSAGE_WIRE_U8(field) unsigned char field[1];
+#define MESSAGE_WIRE_I8(field) unsigned char field[1];
+#define MESSAGE_WIRE_U16(field) unsigned char field[2];
+#define MESSAGE_WIRE_I16(field) unsigned char field[2];
+#define MESSAGE_WIRE_U32(field) unsigned char field[4];
+#define MESSAGE_WIRE_I32(field) unsigned char field[4];
+#define MESSAGE_WIRE_STRING(field, size) unsigned char field[size];
+#define MESSAGE_WIRE_STRUCT(field, name, Name) struct name##_wire field;
+#define MESSAGE_WIRE_ARRAY(field, name, Name, count) \
+    struct name##_wire field[count];
+
+#define MESSAGE_DECODE(type, ...) MESSAGE_DECODE_##type(__VA_ARGS__)
+#define MESSAGE_DECODE_U8(field) msg->field = wire->field[0];
+#define MESSAGE_DECODE_I8(field) msg->field = (int8_t)wire->field[0];
+#define MESSAGE_DECODE_U16(field) msg->field = usMessageGetLE16(wire->field);
+#define MESSAGE_DECODE_I16(field) \
+    msg->field = (int16_t)usMessageGetLE16(wire->field);
+#define MESSAGE_DECODE_U32(field) msg->field = ulMessageGetLE32(wire->field);
+#define MESSAGE_DECODE_I32(field) \
+    msg->field = (int32_t)ulMessageGetLE32(wire->field);
+#define MESSAGE_DECODE_STRING(field, size) \
+    msg->field.data = (const char *)wire->field; \
+    msg->field.length = strnlen((const char *)wire->field, size);
+#define MESSAGE_DECODE_STRUCT(field, name, Name) \
+    v##Name##DecodeWire(&wire->field, &msg->field);
+#define MESSAGE_DECODE_ARRAY(field, name, Name, count) \
+    for (size_t i = 0; i < count; i++) \
+        v##Name##DecodeWire(&wire->field[i], &msg->field[i]);
+
+#define MESSAGE_ENCODE(type, ...) MESSAGE_ENCODE_##type(__VA_ARGS__)
+#define MESSAGE_ENCODE_U8(field) wire->field[0] = msg->field;
+#define MESSAGE_ENCODE_I8(field) wire->field[0] = (uint8_t)msg->field;
+#define MESSAGE_ENCODE_U16(field) vMessagePutLE16(wire->field, msg->field);
+#define MESSAGE_ENCODE_I16(field) \
+    vMessagePutLE16(wire->field, (uint16_t)msg->field);
+#define MESSAGE_ENCODE_U32(field) vMessagePutLE32(wire->field, msg->field);
+#define MESSAGE_ENCODE_I32(field) \
+    vMessagePutLE32(wire->field, (uint32_t)msg->field);
+#define MESSAGE_ENCODE_STRING(field, size) \
+    vMessagePutString(wire->field, size, msg->field);
+#define MESSAGE_ENCODE_STRUCT(field, name, Name) \
+    v##Name##EncodeWire(&msg->field, &wire->field);
+#define MESSAGE_ENCODE_ARRAY(field, name, Name, count) \
+    for (size_t i = 0; i < count; i++) \
+        v##Name##EncodeWire(&msg->field[i], &wire->field[i]);
+
+/// @brief Defines a message and generates its encode and decode functions
+/// @param name Lower case name of the message, eg. my_message
+/// @param Name Camel case name of the message, eg. MyMessage
+/// @param FIELDS Macro listing the message's fields
+#define MESSAGE_DEFINE(name, Name, FIELDS) \
+    typedef struct name { \
+        FIELDS(MESSAGE_MEMBER) \
+    } name##_t; \
+    \
+    struct __attribute__((__packed__)) name##_wire { \
+        FIELDS(MESSAGE_WIRE) \
+    }; \
+    \
+    static inline void v##Name##DecodeWire(const struct name##_wire *wire, \
+                                           name##_t *msg) \
+    { \
+        FIELDS(MESSAGE_DECODE) \
+    } \
+    \
+    static inline void v##Name##EncodeWire(const name##_t *msg, \
+                                           struct name##_wire *wire) \
+    { \
+        FIELDS(MESSAGE_ENCODE) \
+    } \
+    \
+    /* Returns 0 on success, -1 if the buffer is too short */ \
+    static inline int x##Name##Decode(const char *buffer, size_t length, \
+                                      name##_t *msg) \
+    { \
+        if (length < MESSAGE_SIZE(name)) \
+            return -1; \
+        v##Name##DecodeWire((const struct name##_wire *)buffer, msg); \
+        return 0; \
+    } \
+    \
+    /* Returns the number of bytes written, -1 if the buffer is too short */ \
+    static inline int x##Name##Encode(const name##_t *msg, char *buffer, \
+                                      size_t length) \
+    { \
+        if (length < MESSAGE_SIZE(name)) \
+            return -1; \
+        v##Name##EncodeWire(msg, (struct name##_wire *)buffer); \
+        return MESSAGE_SIZE(name); \
+    }
+
+/** @} */
+#endif //__MESSAGE_SCHEMA_H__
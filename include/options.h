@@ -0,0 +1,73 @@
+/**
+ * @file options.h
+ * @author Alex Hoffman
+ * @date 23 January 2023
+ * @brief Command line options used to configure the emulator at startup
+ *
+ * @verbatim
+ ----------------------------------------------------------------------
+ Copyright (C) Alexander Hoffman, 2023
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ any later version.
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ----------------------------------------------------------------------
+ @endverbatim
+ */
+
+#ifndef __OPTIONS_H__
+#define __OPTIONS_H__
+
+#include "idle.h"
+
+/// @brief Backend that the graphics library renders into
+typedef enum render_backend {
+    RENDER_BACKEND_WINDOW = 0, ///< Normal SDL window on the host's display
+    RENDER_BACKEND_HEADLESS, ///< Offscreen, in-memory framebuffer, no display needed
+} render_backend_e;
+
+/// @brief How vSwapBuffers paces the presentation of frames
+typedef enum frame_pacing {
+    FRAME_PACING_FIXED = 0, ///< Limited to configFPS_LIMIT_RATE
+    FRAME_PACING_UNCAPPED, ///< Present as soon as the drawing task is done
+} frame_pacing_e;
+
+/// @brief Options that can be set from the command line when starting the
+/// emulator
+typedef struct emulator_options {
+    render_backend_e backend;
+    frame_pacing_e pacing;
+    unsigned long frame_limit; ///< Exit after this many frames, 0 runs forever
+    const char *frame_stats_file; ///< Frame timing histograms are dumped here on exit
+    const char *sched_trace_file; ///< Scheduler events are traced into this file
+    int stats_overlay; ///< Task statistics are drawn on the screen
+    unsigned short stats_udp_port; ///< Task statistics are sent to this UDP port
+    idle_policy_e idle_policy; ///< What the idle task does while waiting
+    unsigned int sim_rate; ///< Steps per second of the demo's simulation
+    const char *record_file; ///< Input and received data are recorded here
+    const char *replay_file; ///< Recording that is replayed instead of input
+    const char *asset_manifest; ///< Assets that are loaded while starting
+} emulator_options_t;
+
+extern emulator_options_t emulator_options;
+
+/// @brief Parses the command line options given to the emulator and stores
+/// them in emulator_options
+/// @param argc Argument count as passed to main
+/// @param argv Argument vector as passed to main
+/// @return 0 on success, 1 if the emulator should exit without error (eg.
+/// --help), -1 on invalid options
+int xOptionsParse(int argc, char *argv[]);
+
+/// @brief Configures the SDL backend through its environment hints so that
+/// the graphics, event and sound libraries pick up the selected backend.
+/// Must be called before gfxDrawInit.
+void vOptionsApplyRenderBackend(void);
+
+#endif //__OPTIONS_H__
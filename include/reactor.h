@@ -0,0 +1,197 @@
+/**
+ * @file reactor.h
+ * @author Alex Hoffman
+ * @date 23 January 2023
+ * @brief Single thread multiplexing all sockets and message queues
+ *
+ * @verbatim
+ ----------------------------------------------------------------------
+ Copyright (C) Alexander Hoffman, 2023
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ any later version.
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ----------------------------------------------------------------------
+ @endverbatim
+ */
+
+#ifndef __REACTOR_H__
+#define __REACTOR_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <netinet/in.h>
+
+/**
+ * @defgroup reactor Reactor
+ *
+ * @brief The reactor is one thread that waits on all open sockets and
+ * message queues with epoll, no matter how many there are. Data read from a
+ * TCP connection or message queue is put into a bounded dispatch queue and
+ * the reactor's dispatch task then calls the handle's handler from within
+ * FreeRTOS, so handlers can use the FreeRTOS API like any other task.
+ *
+ * The reactor's thread is not a task and cannot notify the dispatch task,
+ * it wakes the idle task instead, see vIdleWake, whose hook passes the
+ * notification on with vReactorWake. While other tasks keep the idle task
+ * from running the tick hook passes it on with vReactorWakeFromISR, so a
+ * read waits at most one tick.
+ *
+ * While the dispatch queue is full the reactor stops reading, the data waits
+ * in the socket or message queue instead of being dropped, and the handles
+ * are read again once the dispatch task has made room.
+ *
+ * Other modules can also hand their own file descriptors to the reactor.
+ * Their ready functions are called from the reactor's thread whenever the
+ * descriptor can be read, they read what is waiting and post it with
+ * xReactorPost, their handlers are then called from the dispatch task like
+ * any other.
+ *
+ * Every read handed to a handler is recorded into the journal, see
+ * journal.h. While a journal is replayed no message queue or socket is
+ * opened and nothing is put to message queues, the recorded reads are
+ * handed to the handlers from the task presenting the frames instead.
+ *
+ * \code{.c}
+void vHandler(size_t read_size, char *buffer, void *args)
+{
+    prints("Recv: %s\n", buffer);
+}
+
+reactor_handle_t mq = xReactorOpenMessageQueue("FreeRTOS_MQ", 10, 1000,
+                                               vHandler, NULL);
+reactor_handle_t tcp = xReactorOpenTCPSocket(NULL, 2222, vHandler, NULL);
+
+xReactorMessageQueuePut("FreeRTOS_MQ", "Hello");
+ * \endcode
+ *
+ * @{
+ */
+
+/// @brief Handle to a file descriptor watched by the reactor
+typedef struct reactor_handle *reactor_handle_t;
+
+/// @brief Handler called from the dispatch task with the data that was read,
+/// the buffer is null terminated and only valid during the call
+typedef void (*reactor_callback_t)(size_t read_size, char *buffer,
+                                   void *args);
+
+/// @brief Called from the reactor's thread when a descriptor added with
+/// xReactorAddFd can be read, posts what it reads with at most one call to
+/// xReactorPost. Must not block nor call into FreeRTOS. The descriptor is
+/// not watched again until vReactorRearm is called.
+typedef void (*reactor_ready_t)(reactor_handle_t handle, void *args);
+
+/// @brief Counters of a handle
+typedef struct reactor_handle_stats {
+    unsigned long ready; ///< Times the descriptor was ready
+    unsigned long dispatched; ///< Reads handed to the handler
+    unsigned long parked; ///< Times the dispatch queue was full
+    uint64_t total_latency; ///< Sum of the times between reading and
+                            ///< dispatching, in nanoseconds
+    uint64_t max_latency; ///< Longest time between reading and dispatching
+} reactor_handle_stats_t;
+
+/// @brief Counters of the reactor
+typedef struct reactor_stats {
+    unsigned long wakeups; ///< Times the reactor's thread woke up
+    unsigned long events; ///< Ready descriptors handled
+    unsigned int handles; ///< Handles currently open
+    unsigned int queued; ///< Reads waiting in the dispatch queue
+    unsigned int max_queued; ///< Most reads that waited at once
+} reactor_stats_t;
+
+/// @brief Starts the reactor's thread and creates its dispatch task
+/// @return 0 on success
+int xReactorInit(void);
+
+/// @brief Stops the reactor, prints its counters and closes all handles
+void vReactorExit(void);
+
+/// @brief Notifies the dispatch task if reads are waiting, called from the
+/// idle hook
+void vReactorWake(void);
+
+/// @brief Notifies the dispatch task if reads are waiting, called from the
+/// tick hook
+void vReactorWakeFromISR(void);
+
+/// @brief Watches a descriptor, its ready function is called from the
+/// reactor's thread and its handler from the dispatch task
+/// @param fd File descriptor, stays owned by the caller
+/// @param ready Called when the descriptor can be read
+/// @param callback Handler called with what the ready function posted
+/// @param args Passed to the ready function and the handler
+/// @return Handle, NULL on error
+reactor_handle_t xReactorAddFd(int fd, reactor_ready_t ready,
+                               reactor_callback_t callback, void *args);
+
+/// @brief Queues data for the handle's handler, which is called with a
+/// copy of it from the dispatch task. Must only be called from the handle's
+/// ready function, at most once per call, there is then always room for it.
+/// @param handle Handle passed to the ready function
+/// @param data Data to copy
+/// @param length Length of data, at most configREACTOR_MESSAGE_SIZE
+/// @return 0 on success, -1 if the data is too long
+int xReactorPost(reactor_handle_t handle, const void *data, size_t length);
+
+/// @brief Watches a descriptor added with xReactorAddFd again, can be called
+/// from any thread or task
+/// @param handle Handle
+void vReactorRearm(reactor_handle_t handle);
+
+/// @brief Stops watching a handle and closes it, unless it was added with
+/// xReactorAddFd. Can be called from a handler, must not be called from a
+/// ready function.
+/// @param handle Handle
+void vReactorRemove(reactor_handle_t handle);
+
+/// @brief Opens or creates a POSIX message queue
+/// @param name Name of the queue
+/// @param max_messages Number of messages the queue can hold
+/// @param message_size Maximum size of a message, at most
+/// configREACTOR_MESSAGE_SIZE
+/// @param callback Handler called with each message
+/// @param args Passed to the handler
+/// @return Handle, NULL on error
+reactor_handle_t xReactorOpenMessageQueue(const char *name, long max_messages,
+        long message_size,
+        reactor_callback_t callback,
+        void *args);
+
+/// @brief Sends a null terminated string to a message queue opened with
+/// xReactorOpenMessageQueue
+/// @param name Name of the queue
+/// @param buffer String to be sent
+/// @return 0 on success
+int xReactorMessageQueuePut(const char *name, char *buffer);
+
+/// @brief Opens a listening TCP socket, each accepted connection is watched
+/// by the reactor and passes what it reads to the handler
+/// @param addr Address to bind to, NULL for loopback
+/// @param port Port to bind to
+/// @param callback Handler called with the data read from the connections
+/// @param args Passed to the handler
+/// @return Handle to the listening socket, NULL on error
+reactor_handle_t xReactorOpenTCPSocket(char *addr, in_port_t port,
+                                       reactor_callback_t callback,
+                                       void *args);
+
+/// @brief Gets a handle's counters
+/// @param handle Handle
+/// @param stats Set to the handle's counters
+void vReactorGetHandleStats(reactor_handle_t handle,
+                            reactor_handle_stats_t *stats);
+
+/// @brief Gets the reactor's counters
+/// @param stats Set to the reactor's counters
+void vReactorGetStats(reactor_stats_t *stats);
+
+/** @} */
+#endif //__REACTOR_H__
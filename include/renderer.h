@@ -0,0 +1,125 @@
+/**
+ * @file renderer.h
+ * @author Alex Hoffman
+ * @date 23 January 2023
+ * @brief Direct access to the SDL renderer for the task presenting frames
+ *
+ * @verbatim
+ ----------------------------------------------------------------------
+ Copyright (C) Alexander Hoffman, 2023
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ any later version.
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ----------------------------------------------------------------------
+ @endverbatim
+ */
+
+#ifndef __RENDERER_H__
+#define __RENDERER_H__
+
+#include <SDL2/SDL.h>
+
+/**
+ * @defgroup renderer Renderer
+ *
+ * @brief The Gfx library queues its draw calls and renders them when the
+ * screen is updated, one call per image or sprite. The renderer gives the
+ * task presenting the frames the SDL renderer that the Gfx library draws
+ * with, such that it can draw many rectangles of a texture with one call
+ * or draw into a texture. The renderer is found through the Gfx library's
+ * window.
+ *
+ * Whatever is drawn on the renderer in a frame is drawn before, ie. below,
+ * the draw calls that the Gfx library queued for that frame.
+ *
+ * SDL textures may only be created and used by the task that renders. A
+ * renderer texture is created by any task from pixels in memory and
+ * uploaded into an SDL texture the first time the rendering task uses it.
+ * Deleting a renderer texture destroys its SDL texture once the rendering
+ * task calls vRendererCollect.
+ *
+ * \code{.c}
+renderer_texture_handle_t logo = xRendererTextureCreate(surface);
+
+// In the task presenting the frames
+SDL_Renderer *renderer = pxRendererGet();
+SDL_Texture *texture = pxRendererTextureGet(logo);
+SDL_Rect dst = { 10, 10, surface_width, surface_height };
+
+if (renderer && texture)
+    SDL_RenderCopy(renderer, texture, NULL, &dst);
+ * \endcode
+ *
+ * @{
+ */
+
+/// @brief Handle to a texture created from pixels in memory
+typedef struct renderer_texture *renderer_texture_handle_t;
+
+/// @brief Finds the renderer of the Gfx library's window, must be called
+/// after gfxDrawInit
+/// @return 0 on success
+int xRendererInit(void);
+
+/// @brief Makes the calling task the task that renders, ie. the task
+/// presenting the frames
+void vRendererBind(void);
+
+/// @brief Gets the renderer if the calling task is the one that renders
+/// @return The renderer, NULL if the calling task may not render
+SDL_Renderer *pxRendererGet(void);
+
+/// @brief Whether textures created with xRendererTargetCreate can be drawn
+/// into
+/// @return 1 if render targets are supported
+int xRendererTargetsSupported(void);
+
+/// @brief Creates a texture from pixels, must be called from a task
+/// @param surface Pixels of the texture, owned by the texture from now on
+/// and freed once they have been uploaded
+/// @return Handle to the texture, NULL on error
+renderer_texture_handle_t xRendererTextureCreate(SDL_Surface *surface);
+
+/// @brief Creates a texture that can be drawn into with
+/// SDL_SetRenderTarget, its content is undefined until it is first drawn
+/// into. Must be called from a task.
+/// @param width Width of the texture in pixels
+/// @param height Height of the texture in pixels
+/// @return Handle to the texture, NULL on error
+renderer_texture_handle_t xRendererTargetCreate(int width, int height);
+
+/// @brief Deletes a texture, must be called from a task. Commands drawing
+/// the texture must no longer be recorded.
+/// @param texture Texture to delete, may be NULL
+void vRendererTextureDelete(renderer_texture_handle_t texture);
+
+/// @brief Gets the SDL texture of a texture, uploading it on first use
+/// @param texture Texture to get
+/// @return The SDL texture, NULL if the calling task may not render or the
+/// texture could not be created
+SDL_Texture *pxRendererTextureGet(renderer_texture_handle_t texture);
+
+/// @brief Gets the size of a texture, can be called by any task
+/// @param texture Texture to measure
+/// @param width Set to the width of the texture, may be NULL
+/// @param height Set to the height of the texture, may be NULL
+void vRendererTextureGetSize(renderer_texture_handle_t texture, int *width,
+                             int *height);
+
+/// @brief Destroys the SDL textures of deleted textures, called by the task
+/// that renders once per frame
+void vRendererCollect(void);
+
+/// @brief Presents the frame drawn on the renderer, for frames in which
+/// the Gfx library had nothing to draw
+void vRendererPresent(void);
+
+/** @} */
+#endif //__RENDERER_H__
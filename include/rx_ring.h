@@ -0,0 +1,122 @@
+/**
+ * @file rx_ring.h
+ * @author Alex Hoffman
+ * @date 23 January 2023
+ * @brief Zero-copy receive path for UDP sockets
+ *
+ * @verbatim
+ ----------------------------------------------------------------------
+ Copyright (C) Alexander Hoffman, 2023
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ any later version.
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ----------------------------------------------------------------------
+ @endverbatim
+ */
+
+#ifndef __RX_RING_H__
+#define __RX_RING_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <netinet/in.h>
+
+/**
+ * @defgroup rx_ring Receive Ring
+ *
+ * @brief A receive ring owns a UDP socket and a fixed set of buffers that
+ * are allocated when the socket is opened. Once the reactor sees datagrams
+ * waiting, see reactor.h, a batch of them is read straight into free buffers
+ * with a single recvmmsg call and each buffer is then lent to the socket's
+ * handler. The handler works on the datagram in place and gives the buffer
+ * back with vRxRingRelease once it is done with it, which may be after the
+ * handler has returned, eg. once a task has processed the datagram.
+ *
+ * Each batch is handed to the reactor's dispatch task, which lends the
+ * buffers to the handler, so handlers can use the FreeRTOS API and may close
+ * their own ring. They should not block for long, as the other sockets and
+ * message queues wait meanwhile. Datagrams that arrive while all buffers
+ * are lent out wait in the socket until a buffer is released.
+ *
+ * Received datagrams are recorded into the journal, see journal.h. While a
+ * journal is replayed no socket is opened, the recorded datagrams are lent
+ * to the handlers from the task presenting the frames, without the address
+ * they were sent from, and are dropped if all buffers are lent out.
+ *
+ * \code{.c}
+void vHandler(rx_buffer_t *buffer, void *args)
+{
+    prints("Recv %zu bytes: %s\n", buffer->length, buffer->data);
+    vRxRingRelease(buffer);
+}
+
+rx_ring_handle_t ring = xRxRingOpenUDP(NULL, 1234, 2000, vHandler, NULL);
+ * \endcode
+ *
+ * @{
+ */
+
+/// @brief Buffer holding one received datagram
+typedef struct rx_buffer {
+    char *data; ///< Datagram, followed by a null terminator
+    size_t length; ///< Length of the datagram in bytes
+    unsigned char truncated; ///< Datagram was longer than the buffer
+    struct sockaddr_in source; ///< Address the datagram was sent from
+    uint64_t timestamp; ///< Time of reception, see ullJournalNow
+    struct rx_ring *ring; ///< Ring that owns the buffer
+    unsigned int index; ///< Index of the buffer in its ring
+} rx_buffer_t;
+
+/// @brief Handle to a receive ring
+typedef struct rx_ring *rx_ring_handle_t;
+
+/// @brief Handler that received datagrams are lent to
+typedef void (*rx_ring_callback_t)(rx_buffer_t *buffer, void *args);
+
+/// @brief Counters of a receive ring
+typedef struct rx_ring_stats {
+    unsigned long received; ///< Datagrams received
+    unsigned long batches; ///< recvmmsg calls that returned datagrams
+    unsigned long truncated; ///< Datagrams longer than the buffers
+    unsigned long starved; ///< Times all buffers were lent out
+    unsigned long errors; ///< Failed recvmmsg calls
+} rx_ring_stats_t;
+
+/// @brief Opens a UDP socket and starts receiving on it
+/// @param addr Address to bind to, NULL for loopback
+/// @param port Port to bind to
+/// @param buffer_size Size of each of the ring's buffers, datagrams longer
+/// than this are truncated
+/// @param callback Handler that received datagrams are lent to
+/// @param args Passed to the handler
+/// @return Handle to the ring, NULL on error
+rx_ring_handle_t xRxRingOpenUDP(char *addr, in_port_t port,
+                                size_t buffer_size,
+                                rx_ring_callback_t callback, void *args);
+
+/// @brief Returns a buffer to its ring, can be called from any thread or task
+/// @param buffer Buffer lent to a handler
+void vRxRingRelease(rx_buffer_t *buffer);
+
+/// @brief Stops receiving and closes the socket, all buffers must have been
+/// released
+/// @param ring Ring handle
+void vRxRingClose(rx_ring_handle_t ring);
+
+/// @brief Closes all open rings, to be called at exit
+void vRxRingDeinit(void);
+
+/// @brief Gets a ring's counters
+/// @param ring Ring handle
+/// @param stats Set to the ring's counters
+void vRxRingGetStats(rx_ring_handle_t ring, rx_ring_stats_t *stats);
+
+/** @} */
+#endif //__RX_RING_H__
@@ -0,0 +1,87 @@
+/**
+ * @file sched_trace.h
+ * @author Alex Hoffman
+ * @date 23 January 2023
+ * @brief Records FreeRTOS scheduler events into a Chrome trace timeline
+ *
+ * @verbatim
+ ----------------------------------------------------------------------
+ Copyright (C) Alexander Hoffman, 2023
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ any later version.
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ----------------------------------------------------------------------
+ @endverbatim
+ */
+
+#ifndef __SCHED_TRACE_H__
+#define __SCHED_TRACE_H__
+
+/**
+ * @defgroup sched_trace Scheduler Trace
+ *
+ * @brief When built with -DTRACE_SCHEDULER=ON the FreeRTOS trace macros,
+ * see FreeRTOSConfig.h, record task switches, tasks becoming ready or
+ * blocking, as well as queue, semaphore and notification operations. Each
+ * event is a timestamp and a couple of pointers put into a lock-free ring,
+ * a background thread turns the events into a Chrome trace that can be
+ * opened using chrome://tracing or https://ui.perfetto.dev.
+ *
+ * Each task is shown as a thread whose timeline is split into the spans
+ * that the task was running, ready or blocked, with what it was blocked on.
+ * Queue operations and notifications are shown as instant events on the task
+ * performing them.
+ *
+ * This header is included by FreeRTOSConfig.h and must therefore not
+ * include any FreeRTOS headers itself.
+ *
+ * \code{.sh}
+./FreeRTOS_Emulator --sched-trace sched.json
+ * \endcode
+ *
+ * @{
+ */
+
+/// @brief Scheduler events, as recorded by the trace macros
+typedef enum sched_event {
+    SCHED_EVENT_CREATE = 0, ///< Task was created
+    SCHED_EVENT_DELETE, ///< Task was deleted
+    SCHED_EVENT_SWITCHED_IN, ///< Task started running
+    SCHED_EVENT_SWITCHED_OUT, ///< Task stopped running
+    SCHED_EVENT_READY, ///< Task was moved to the ready list
+    SCHED_EVENT_DELAY, ///< Running task is about to be delayed
+    SCHED_EVENT_SUSPEND, ///< Task was suspended
+    SCHED_EVENT_BLOCK_RECEIVE, ///< Running task blocks on receiving or taking
+    SCHED_EVENT_BLOCK_SEND, ///< Running task blocks on sending or giving
+    SCHED_EVENT_BLOCK_NOTIFY, ///< Running task waits for a notification
+    SCHED_EVENT_SEND, ///< Running task sent to a queue or gave a semaphore
+    SCHED_EVENT_RECEIVE, ///< Running task received from a queue or took a
+                         ///< semaphore
+    SCHED_EVENT_NOTIFY, ///< Task was notified
+    SCHED_EVENT_COUNT,
+} sched_event_e;
+
+/// @brief Starts recording scheduler events
+/// @param filename Trace file to be written, recording is disabled if NULL
+/// @return 0 on success
+int xSchedTraceInit(const char *filename);
+
+/// @brief Stops recording and finishes the trace file
+void vSchedTraceExit(void);
+
+/// @brief Records an event, called from the trace macros within the kernel,
+/// never blocks
+/// @param event Event
+/// @param task Task the event concerns, NULL for the running task
+/// @param object Queue or semaphore the event concerns, if any
+void vSchedTraceRecord(sched_event_e event, void *task, void *object);
+
+/** @} */
+#endif //__SCHED_TRACE_H__
@@ -0,0 +1,134 @@
+/**
+ * @file shm_queue.h
+ * @author Alex Hoffman
+ * @date 23 January 2023
+ * @brief Shared memory message queues for communicating with local processes
+ *
+ * @verbatim
+ ----------------------------------------------------------------------
+ Copyright (C) Alexander Hoffman, 2023
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ any later version.
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ----------------------------------------------------------------------
+ @endverbatim
+ */
+
+#ifndef __SHM_QUEUE_H__
+#define __SHM_QUEUE_H__
+
+#include <stddef.h>
+
+/**
+ * @defgroup shm_queue Shared Memory Queues
+ *
+ * @brief A shared memory queue is a ring of fixed size slots in a POSIX
+ * shared memory object, an alternative to POSIX message queues that is not
+ * bound by the kernel's limits on the number and size of messages and that
+ * does not copy messages through the kernel.
+ *
+ * The process that opens the queue receives from it, any number of threads
+ * and processes can attach to the queue and put to it. Messages are written
+ * straight into the shared memory, either by copying them in with
+ * xShmQueuePut or by building them in a reserved slot. The receiver's handler
+ * is called with a pointer into the slot, which is reused once the handler
+ * returns. Putting only makes a system call, a futex wake, if the receiver
+ * is waiting for messages.
+ *
+ * Handlers are called from the queue's receiving thread, not from a FreeRTOS
+ * task, so they must not block.
+ *
+ * \code{.c}
+void vHandler(size_t read_size, char *buffer, void *args)
+{
+    prints("SHM Recv: %.*s\n", (int)read_size, buffer);
+}
+
+shm_queue_handle_t rx = xShmQueueOpen("FreeRTOS_SHM", 256, 1024, vHandler,
+                                      NULL);
+
+// Possibly in another process
+shm_queue_handle_t tx = xShmQueueAttach("FreeRTOS_SHM");
+char *slot = pcShmQueueReserve(tx);
+
+if (slot)
+    vShmQueueCommit(tx, slot, sprintf(slot, "Hello"));
+ * \endcode
+ *
+ * @{
+ */
+
+/// @brief Handle to a shared memory queue
+typedef struct shm_queue *shm_queue_handle_t;
+
+/// @brief Handler called with each message, the buffer is only valid during
+/// the call
+typedef void (*shm_queue_callback_t)(size_t read_size, char *buffer,
+                                     void *args);
+
+/// @brief Counters of a shared memory queue
+typedef struct shm_queue_stats {
+    unsigned long received; ///< Messages handled by the receiver
+    unsigned long wakeups; ///< Times the receiver was woken by a put
+    unsigned long dropped; ///< Puts that failed because the queue was full,
+                           ///< counted across all processes
+    unsigned long invalid; ///< Messages dropped by the receiver because
+                           ///< they claimed to be longer than a slot
+} shm_queue_stats_t;
+
+/// @brief Creates a queue and starts receiving from it
+/// @param name Name of the shared memory object
+/// @param slot_count Number of messages the queue can hold, a power of two
+/// @param slot_size Maximum size of a message
+/// @param callback Handler called with each message
+/// @param args Passed to the handler
+/// @return Handle, NULL on error
+shm_queue_handle_t xShmQueueOpen(const char *name, unsigned int slot_count,
+                                 size_t slot_size,
+                                 shm_queue_callback_t callback, void *args);
+
+/// @brief Attaches to a queue created with xShmQueueOpen so that it can be
+/// put to
+/// @param name Name of the shared memory object
+/// @return Handle, NULL on error
+shm_queue_handle_t xShmQueueAttach(const char *name);
+
+/// @brief Copies a message into the queue, never blocks
+/// @param queue Handle
+/// @param data Message
+/// @param length Length of the message
+/// @return 0 on success, -1 if the queue is full or the message too long
+int xShmQueuePut(shm_queue_handle_t queue, const char *data, size_t length);
+
+/// @brief Reserves a slot for a message to be built in, never blocks
+/// @param queue Handle
+/// @return Slot that can hold up to the queue's slot size, NULL if the queue
+/// is full
+char *pcShmQueueReserve(shm_queue_handle_t queue);
+
+/// @brief Hands a reserved slot to the receiver
+/// @param queue Handle
+/// @param slot Slot returned by pcShmQueueReserve
+/// @param length Length of the message written to the slot, a slot
+/// committed with more than the queue's slot size is dropped
+void vShmQueueCommit(shm_queue_handle_t queue, char *slot, size_t length);
+
+/// @brief Stops receiving or detaches from a queue, the queue is removed if
+/// it was opened with xShmQueueOpen
+/// @param queue Handle
+void vShmQueueClose(shm_queue_handle_t queue);
+
+/// @brief Gets a queue's counters
+/// @param queue Handle
+/// @param stats Set to the queue's counters
+void vShmQueueGetStats(shm_queue_handle_t queue, shm_queue_stats_t *stats);
+
+/** @} */
+#endif //__SHM_QUEUE_H__
@@ -0,0 +1,204 @@
+/**
+ * @file sprite_atlas.h
+ * @author Alex Hoffman
+ * @date 23 January 2023
+ * @brief Packs spritesheets into shared textures and draws their sprites
+ * in batches
+ *
+ * @verbatim
+ ----------------------------------------------------------------------
+ Copyright (C) Alexander Hoffman, 2023
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ any later version.
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ----------------------------------------------------------------------
+ @endverbatim
+ */
+
+#ifndef __SPRITE_ATLAS_H__
+#define __SPRITE_ATLAS_H__
+
+#include "EmulatorConfig.h"
+#include "draw_commands.h"
+
+/**
+ * @defgroup sprite_atlas Sprite Atlas
+ *
+ * @brief Every spritesheet loaded with gfxDrawLoadImage is its own texture,
+ * drawing sprites from several sheets switches between textures with every
+ * sprite. A sprite atlas instead takes the sprites of many sheets, possibly
+ * portions of the same image, and packs them at load time into as few
+ * images as possible, its pages. The pages are kept in memory as renderer
+ * textures, see renderer.h, such that all of a page's sprites are drawn
+ * from one texture.
+ *
+ * The sheets' images are requested as pixels assets when they are added,
+ * see assets.h, such that they are decoded by the loading threads while
+ * the atlas' owner does other things. Building the atlas waits for them,
+ * xSpriteAtlasLoaded tells when building will not have to wait.
+ *
+ * A sprite batch collects the sprites that a task draws in a frame, eg.
+ * the frames of many animations, and records them as one draw command per
+ * page, see xDrawCommandSprites. A page's sprites are drawn on the renderer
+ * by the task presenting the frames, batches must therefore be submitted
+ * by a task recording draw commands. Animations are stepped by the task
+ * that owns them using sprite sequences, instead of each draw advancing
+ * the animation as gfxDrawAnimationDrawFrame does.
+ *
+ * \code{.c}
+sprite_atlas_handle_t atlas = xSpriteAtlasCreate();
+int ball = xSpriteAtlasAddSheet(atlas, "ball_spritesheet.png", 25, 1, 0, 0,
+                                0, 0, 0, 0);
+static sprite_sequence_t spin;
+static sprite_batch_t batch;
+
+xSpriteAtlasBuild(atlas);
+vSpriteSequenceInit(&spin, ball, 0, 0, SPRITE_SEQUENCE_HORIZONTAL_POS, 24,
+                    40);
+
+while (1) {
+    vSpriteSequenceStep(&spin, 20);
+
+    vSpriteBatchBegin(&batch, atlas);
+    xSpriteBatchAddSequence(&batch, &spin, 100, 100);
+    xSpriteBatchSubmit(&batch);
+    vTaskDelay(20);
+}
+ * \endcode
+ *
+ * @{
+ */
+
+/// @brief Handle to a sprite atlas
+typedef struct sprite_atlas *sprite_atlas_handle_t;
+
+/// @brief An animation through the sprites of one sheet of an atlas
+typedef struct sprite_sequence {
+    int sheet; ///< Sheet of the atlas, as returned by xSpriteAtlasAddSheet
+    unsigned char column; ///< Sprite of the first frame
+    unsigned char row;
+    int direction; ///< SPRITE_SEQUENCE_*, direction of the following frames
+    unsigned int frames; ///< Number of frames in the sequence
+    unsigned int period; ///< Milliseconds each frame is shown for
+    unsigned long elapsed; ///< Milliseconds since the sequence was started
+} sprite_sequence_t;
+
+/// @brief Sprites drawn by one task in one frame
+typedef struct sprite_batch {
+    sprite_atlas_handle_t atlas;
+    unsigned int count;
+    unsigned char pages[configSPRITE_BATCH_LENGTH];
+    draw_sprite_t sprites[configSPRITE_BATCH_LENGTH];
+} sprite_batch_t;
+
+/// @brief Creates an empty atlas
+/// @return Handle to the atlas, NULL on error
+sprite_atlas_handle_t xSpriteAtlasCreate(void);
+
+/// @brief Frees an atlas and deletes its pages' textures. Its sprites must
+/// no longer be drawn.
+/// @param atlas Atlas to free
+void vSpriteAtlasDelete(sprite_atlas_handle_t atlas);
+
+/// @brief Adds a sheet of equally sized sprites to be packed and requests
+/// its image to be decoded
+/// @param atlas Atlas that has not been built yet
+/// @param filename Image file, found using gfxUtilFindResourcePath
+/// @param columns Number of sprites per row
+/// @param rows Number of rows of sprites
+/// @param width Width of a sprite, 0 to divide the image's width by columns
+/// @param height Height of a sprite, 0 to divide the image's height by rows
+/// @param x Left edge of the first sprite in the image
+/// @param y Top edge of the first sprite in the image
+/// @param spacing_x Pixels between two sprites in a row
+/// @param spacing_y Pixels between two rows of sprites
+/// @return Index of the sheet, -1 on error
+int xSpriteAtlasAddSheet(sprite_atlas_handle_t atlas, const char *filename,
+                         unsigned int columns, unsigned int rows,
+                         unsigned int width, unsigned int height,
+                         unsigned int x, unsigned int y,
+                         unsigned int spacing_x, unsigned int spacing_y);
+
+/// @brief Waits for the sheets' images and packs their sprites into pages
+/// of at most configSPRITE_ATLAS_SIZE pixels squared, must be called from
+/// a task
+/// @param atlas Atlas to build
+/// @return 0 on success
+int xSpriteAtlasBuild(sprite_atlas_handle_t atlas);
+
+/// @brief Whether the images of all sheets were decoded, or failed to be
+/// @param atlas Atlas to check
+/// @return 1 if building the atlas would not wait
+int xSpriteAtlasLoaded(sprite_atlas_handle_t atlas);
+
+/// @brief Gets the size of a sheet's sprites
+/// @param atlas Atlas the sheet is in
+/// @param sheet Index of the sheet
+/// @param width Set to the width of a sprite, may be NULL
+/// @param height Set to the height of a sprite, may be NULL
+/// @return 0 on success, -1 if the atlas was not built
+int xSpriteAtlasGetSpriteSize(sprite_atlas_handle_t atlas, int sheet,
+                              unsigned int *width, unsigned int *height);
+
+/// @brief Starts a sequence at its first frame
+/// @param sequence Sequence to initialise
+/// @param sheet Sheet of the atlas that the sequence's sprites are in
+/// @param column Column of the first frame's sprite
+/// @param row Row of the first frame's sprite
+/// @param direction SPRITE_SEQUENCE_*, where the next frame's sprite is
+/// @param frames Number of frames
+/// @param period Milliseconds each frame is shown for
+void vSpriteSequenceInit(sprite_sequence_t *sequence, int sheet,
+                         unsigned char column, unsigned char row,
+                         int direction, unsigned int frames,
+                         unsigned int period);
+
+/// @brief Advances a sequence
+/// @param sequence Sequence to advance
+/// @param ms Milliseconds that have passed
+void vSpriteSequenceStep(sprite_sequence_t *sequence, unsigned int ms);
+
+/// @brief Returns a sequence to its first frame
+/// @param sequence Sequence to reset
+void vSpriteSequenceReset(sprite_sequence_t *sequence);
+
+/// @brief Empties a batch
+/// @param batch Batch to empty
+/// @param atlas Built atlas the batch's sprites are drawn from
+void vSpriteBatchBegin(sprite_batch_t *batch, sprite_atlas_handle_t atlas);
+
+/// @brief Adds a sprite to a batch
+/// @param batch Batch to add to
+/// @param sheet Sheet of the sprite
+/// @param column Column of the sprite in its sheet
+/// @param row Row of the sprite in its sheet
+/// @param x Top left x of the sprite on the screen
+/// @param y Top left y of the sprite on the screen
+/// @return 0 on success, -1 if the batch is full
+int xSpriteBatchAdd(sprite_batch_t *batch, int sheet, unsigned char column,
+                    unsigned char row, signed short x, signed short y);
+
+/// @brief Adds a sequence's current frame to a batch
+/// @param batch Batch to add to
+/// @param sequence Sequence to draw
+/// @param x Top left x of the sprite on the screen
+/// @param y Top left y of the sprite on the screen
+/// @return 0 on success, -1 if the batch is full
+int xSpriteBatchAddSequence(sprite_batch_t *batch,
+                            const sprite_sequence_t *sequence,
+                            signed short x, signed short y);
+
+/// @brief Records the batch's sprites, one draw command per page
+/// @param batch Batch to record, can be reused once this returns
+/// @return 0 on success
+int xSpriteBatchSubmit(sprite_batch_t *batch);
+
+/** @} */
+#endif //__SPRITE_ATLAS_H__
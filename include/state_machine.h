@@ -25,24 +25,49 @@
 #ifndef __STATE_MACHINE_H__
 #define __STATE_MACHINE_H__
 
+#include <stdint.h>
+
 #include "FreeRTOS.h"
 #include "queue.h"
 
 #define STARTING_STATE STATE_ONE
 #define STATE_DEBOUNCE_DELAY 300
-#define STATE_QUEUE_LENGTH 1
+#define STATE_QUEUE_LENGTH 8
 
 #define STATE_ONE 0
 #define STATE_TWO 1
 
-#define STATE_MACHINE_PERIOD 10
+/// @brief Events that can be posted to the state machine
+typedef enum state_event_type {
+    STATE_EVENT_NEXT = 0, ///< Move to the next state
+    STATE_EVENT_PREVIOUS, ///< Move to the previous state
+} state_event_type_e;
+
+/// @brief Transition latency statistics, from an event being caused (eg. a
+/// button being pressed) to the state machine having entered the new state
+typedef struct state_machine_stats {
+    unsigned long transitions; ///< Number of transitions made
+    unsigned long debounced; ///< Events ignored due to STATE_DEBOUNCE_DELAY
+    unsigned long dropped; ///< Events lost because the queue was full
+    uint64_t total_latency; ///< Sum of all transitions' latencies in ns
+    uint64_t max_latency; ///< Longest transition latency in ns
+} state_machine_stats_t;
 
-/// @brief Checks if the button C was pressed and if so increments the system's state
+/// @brief Checks if the button C was pressed and if so posts a
+/// STATE_EVENT_NEXT to the state machine
 /// @return 0 on success
 int vCheckStateInput(void);
 
-/// @brief Function to be run as the state machine's task, orchestrates a periodic call to
-/// states run.
+/// @brief Posts an event to the state machine without blocking
+/// @param type Event to be posted
+/// @param timestamp Time at which the event was caused, as returned by
+/// ullJournalNow(), used to debounce the transitions and to measure their
+/// latency
+/// @return 0 on success, -1 if the state machine's queue is full
+int xStateMachinePostEvent(state_event_type_e type, uint64_t timestamp);
+
+/// @brief Function to be run as the state machine's task, enters the
+/// starting state and then blocks until events are posted to it
 /// @param pvParameters
 void vStateMachineTask(void *pvParameters);
 
@@ -50,4 +75,8 @@ void vStateMachineTask(void *pvParameters);
 /// @return 0 on success
 int xStateMachineInit(void);
 
+/// @brief Copies the state machine's transition statistics
+/// @param stats Structure to be filled
+void vStateMachineGetStats(state_machine_stats_t *stats);
+
 #endif // __STATE_MACHINE_H__
\ No newline at end of file
@@ -0,0 +1,100 @@
+/**
+ * @file task_stats.h
+ * @author Alex Hoffman
+ * @date 23 January 2023
+ * @brief Periodic sampling of each task's CPU share and stack usage
+ *
+ * @verbatim
+ ----------------------------------------------------------------------
+ Copyright (C) Alexander Hoffman, 2023
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ any later version.
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ----------------------------------------------------------------------
+ @endverbatim
+ */
+
+#ifndef __TASK_STATS_H__
+#define __TASK_STATS_H__
+
+#include <stdint.h>
+#include <netinet/in.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+/**
+ * @defgroup task_stats Task Statistics
+ *
+ * @brief The kernel's run time counter, see FreeRTOSConfig.h, counts in
+ * nanoseconds. The statistics task samples the run time of every task
+ * every configTASK_STATS_PERIOD_MS and turns it into each task's share of
+ * the CPU over the last period, along with the rate of context switches
+ * and the number of tasks waiting to run.
+ *
+ * Stack high water marks are not sampled, on the POSIX port tasks run on
+ * their threads' stacks and the kernel's high water mark means nothing,
+ * see INCLUDE_uxTaskGetStackHighWaterMark in FreeRTOSConfig.h.
+ *
+ * The latest sample can be drawn as an overlay, see vDrawTaskStats, or
+ * streamed as lines of text to a UDP port.
+ *
+ * \code{.sh}
+./FreeRTOS_Emulator --stats-overlay --stats-udp 5555
+nc -ul 5555
+ * \endcode
+ *
+ * @{
+ */
+
+/// @brief One task's statistics
+typedef struct task_stats_entry {
+    char name[configMAX_TASK_NAME_LEN];
+    eTaskState state;
+    UBaseType_t priority;
+    float cpu; ///< Percent of the run time over the last period
+} task_stats_entry_t;
+
+/// @brief Statistics of all tasks at one point in time
+typedef struct task_stats_sample {
+    uint64_t timestamp; ///< See ullFrameTimingNow
+    float switches; ///< Context switches per second
+    unsigned int ready; ///< Tasks ready but not running
+    unsigned int count; ///< Number of entries in tasks
+    unsigned int total_tasks; ///< Number of tasks, the least busy are
+                              ///< left out of tasks if there are more than
+                              ///< configTASK_STATS_MAX_TASKS
+    size_t heap_total; ///< Size of the heap, 0 unless built with the
+                       ///< pool_tlsf HEAP_BACKEND, see heap_stats.h
+    size_t heap_peak; ///< Most bytes of the heap in use at once
+    float heap_fragmentation; ///< Fragmentation of the heap's free memory
+    task_stats_entry_t tasks[configTASK_STATS_MAX_TASKS]; ///< Busiest
+                                                          ///< tasks, by CPU
+                                                          ///< share
+} task_stats_sample_t;
+
+/// @brief Starts the statistics task if the statistics are used
+/// @param overlay Statistics are drawn by vDrawTaskStats
+/// @param udp_port Each sample is sent to this port on the loopback
+/// interface, 0 to not send the samples
+/// @return 0 on success
+int xTaskStatsInit(int overlay, in_port_t udp_port);
+
+/// @brief Whether the statistics overlay is enabled
+/// @return 1 if it is drawn
+int xTaskStatsOverlayEnabled(void);
+
+/// @brief Copies the latest sample
+/// @param sample Set to the latest sample
+/// @return 0 on success, -1 if there is no sample yet
+int xTaskStatsGetSample(task_stats_sample_t *sample);
+
+/** @} */
+#endif //__TASK_STATS_H__
@@ -0,0 +1,86 @@
+/**
+ * @file text_cache.h
+ * @author Alex Hoffman
+ * @date 23 January 2023
+ * @brief Glyph atlases and a string layout cache for drawing HUD text
+ *
+ * @verbatim
+ ----------------------------------------------------------------------
+ Copyright (C) Alexander Hoffman, 2023
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ any later version.
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ----------------------------------------------------------------------
+ @endverbatim
+ */
+
+#ifndef __TEXT_CACHE_H__
+#define __TEXT_CACHE_H__
+
+#include <sys/types.h>
+
+/**
+ * @defgroup text_cache Text Cache
+ *
+ * @brief gfxDrawText rasterises its string with SDL_ttf every time it is
+ * called. For text that is drawn every frame the text cache instead
+ * rasterises the printable ASCII glyphs of a font once, in white into an
+ * atlas surface per (font, size) kept in memory. Recently drawn strings
+ * are cached by content, each is composed from the atlas into a renderer
+ * texture once, see renderer.h, and drawn with a single copy tinted to the
+ * text's colour. Unchanged text is neither measured, laid out nor
+ * rendered again.
+ *
+ * Strings are drawn on the renderer by the task presenting the frames. If
+ * called by another task, or if an atlas cannot be built, the text is
+ * drawn using gfxDrawText.
+ *
+ * \code{.c}
+int width;
+
+if (!xTextCacheGetTextSize(FPS_FONT, DEFAULT_FONT_SIZE, str, &width, NULL))
+    xTextCacheDrawText(FPS_FONT, DEFAULT_FONT_SIZE, Skyblue, str,
+                       SCREEN_WIDTH - width - 10, 10);
+ * \endcode
+ *
+ * @{
+ */
+
+/// @brief Initializes the text cache
+/// @return 0 on success
+int xTextCacheInit(void);
+
+/// @brief Frees all atlases and cached strings
+void vTextCacheExit(void);
+
+/// @brief Measures a string as it would be drawn by xTextCacheDrawText
+/// @param font_name Filename of the font, eg. DEFAULT_FONT
+/// @param size Font size in points
+/// @param str String to be measured
+/// @param width Set to the width of the string in pixels, may be NULL
+/// @param height Set to the height of the string in pixels, may be NULL
+/// @return 0 on success
+int xTextCacheGetTextSize(const char *font_name, ssize_t size,
+                          const char *str, int *width, int *height);
+
+/// @brief Draws a string from the cached texture of its content
+/// @param font_name Filename of the font, eg. DEFAULT_FONT
+/// @param size Font size in points
+/// @param colour Colour of the text
+/// @param str String to be drawn
+/// @param x Top left x of the text
+/// @param y Top left y of the text
+/// @return 0 on success
+int xTextCacheDrawText(const char *font_name, ssize_t size,
+                       unsigned int colour, const char *str, ssize_t x,
+                       ssize_t y);
+
+/** @} */
+#endif //__TEXT_CACHE_H__
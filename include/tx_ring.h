@@ -0,0 +1,120 @@
+/**
+ * @file tx_ring.h
+ * @author Alex Hoffman
+ * @date 23 January 2023
+ * @brief Batched transmit path for UDP and TCP sockets
+ *
+ * @verbatim
+ ----------------------------------------------------------------------
+ Copyright (C) Alexander Hoffman, 2023
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ any later version.
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ----------------------------------------------------------------------
+ @endverbatim
+ */
+
+#ifndef __TX_RING_H__
+#define __TX_RING_H__
+
+#include <stddef.h>
+#include <netinet/in.h>
+
+/**
+ * @defgroup tx_ring Transmit Ring
+ *
+ * @brief A transmit ring queues outgoing messages for one destination.
+ * Putting a message copies it into the ring and returns without making a
+ * system call, so tasks never block on the network. A single I/O thread
+ * sends everything that has been queued, all messages waiting in a UDP ring
+ * with one sendmmsg call and all bytes waiting in a TCP ring with one
+ * scatter/gather write.
+ *
+ * The sockets never block the I/O thread. While a TCP ring is connecting,
+ * or its socket cannot take more data, the messages wait in the ring and
+ * the thread polls the socket. If the connection fails or breaks, the
+ * messages wait in the ring until connecting again works, attempts are
+ * configTX_RING_RECONNECT_MS apart. Only the message that was partly
+ * written to a broken connection is discarded.
+ *
+ * Any number of tasks can put to the same ring. When a ring is full the
+ * message is dropped and counted, the caller can use uTxRingQueued to back
+ * off before that happens.
+ *
+ * While a journal is replayed, see journal.h, nothing is sent, messages put
+ * to a ring are only counted as sent.
+ *
+ * \code{.c}
+tx_ring_handle_t ring = xTxRingOpenUDP(NULL, 1234);
+
+if (xTxRingPut(ring, "Hello", 5))
+    prints("Dropped, %u messages still queued\n", uTxRingQueued(ring));
+ * \endcode
+ *
+ * @{
+ */
+
+/// @brief Handle to a transmit ring
+typedef struct tx_ring *tx_ring_handle_t;
+
+/// @brief Counters of a transmit ring
+typedef struct tx_ring_stats {
+    unsigned long queued; ///< Messages put to the ring
+    unsigned long sent; ///< Messages sent
+    unsigned long dropped; ///< Messages dropped because the ring was full
+    unsigned long errors; ///< Messages discarded because sending failed or
+                          ///< they could not be sent before the ring was
+                          ///< closed
+    unsigned long batches; ///< System calls made to send the messages
+    unsigned int max_queued; ///< Most messages waiting at once
+} tx_ring_stats_t;
+
+/// @brief Opens a ring that sends datagrams to a UDP port
+/// @param addr Destination address, NULL for loopback
+/// @param port Destination port
+/// @return Handle to the ring, NULL on error
+tx_ring_handle_t xTxRingOpenUDP(char *addr, in_port_t port);
+
+/// @brief Opens a ring that sends to a TCP port, the I/O thread connects
+/// once there is something to send and connects again after errors
+/// @param addr Destination address, NULL for loopback
+/// @param port Destination port
+/// @return Handle to the ring, NULL on error
+tx_ring_handle_t xTxRingOpenTCP(char *addr, in_port_t port);
+
+/// @brief Queues a message, never blocks
+/// @param ring Ring handle
+/// @param data Message, copied into the ring
+/// @param length Length of the message, at most configTX_RING_MESSAGE_SIZE
+/// @return 0 on success, -1 if the ring is full or the message too long
+int xTxRingPut(tx_ring_handle_t ring, const char *data, size_t length);
+
+/// @brief Number of messages waiting to be sent
+/// @param ring Ring handle
+/// @return Messages queued but not yet sent
+unsigned int uTxRingQueued(tx_ring_handle_t ring);
+
+/// @brief Sends what is still queued and closes the ring, messages that
+/// cannot be sent within configTX_RING_LINGER_MS are discarded
+/// @param ring Ring handle
+void vTxRingClose(tx_ring_handle_t ring);
+
+/// @brief Closes all open rings and stops the I/O thread, to be called at
+/// exit. Waits at most configTX_RING_LINGER_MS for the queued messages to
+/// be sent.
+void vTxRingDeinit(void);
+
+/// @brief Gets a ring's counters
+/// @param ring Ring handle
+/// @param stats Set to the ring's counters
+void vTxRingGetStats(tx_ring_handle_t ring, tx_ring_stats_t *stats);
+
+/** @} */
+#endif //__TX_RING_H__
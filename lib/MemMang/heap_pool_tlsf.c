@@ -0,0 +1,523 @@
+/**
+ * @file heap_pool_tlsf.c
+ * @author Alex Hoffman
+ * @date 23 January 2023
+ * @brief FreeRTOS heap made of fixed size pools on top of a TLSF allocator
+ *
+ * @verbatim
+ ----------------------------------------------------------------------
+ Copyright (C) Alexander Hoffman, 2023
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ any later version.
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ----------------------------------------------------------------------
+ @endverbatim
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+// Defining MPU_WRAPPERS_INCLUDED_FROM_API_FILE prevents task.h from
+// redefining all the API functions to use the MPU wrappers
+#define MPU_WRAPPERS_INCLUDED_FROM_API_FILE
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+#undef MPU_WRAPPERS_INCLUDED_FROM_API_FILE
+
+#include "heap_stats.h"
+
+#if (configSUPPORT_DYNAMIC_ALLOCATION == 0)
+#error This file must not be used if configSUPPORT_DYNAMIC_ALLOCATION is 0
+#endif
+
+// Blocks of the general heap are binned first by the power of two below
+// their size and then linearly into SL_INDEX_COUNT bins within that range
+#define ALIGN_LOG2 3
+#define ALIGN_SIZE (1UL << ALIGN_LOG2)
+#define SL_INDEX_COUNT_LOG2 4
+#define SL_INDEX_COUNT (1U << SL_INDEX_COUNT_LOG2)
+#define FL_INDEX_SHIFT (SL_INDEX_COUNT_LOG2 + ALIGN_LOG2)
+#define FL_INDEX_MAX 32
+#define FL_INDEX_COUNT (FL_INDEX_MAX - FL_INDEX_SHIFT + 1)
+#define SMALL_BLOCK_SIZE (1UL << FL_INDEX_SHIFT)
+
+// Flags kept in the low bits of a block's size, which is always aligned
+#define BLOCK_FREE 1UL
+// Set in the header of a pool block, never in that of a heap block
+#define BLOCK_POOL 4UL
+#define BLOCK_FLAGS (ALIGN_SIZE - 1)
+
+#define POOL_MIN_SIZE 32
+#define POOL_MAX_SIZE (POOL_MIN_SIZE << (HEAP_POOL_COUNT - 1))
+// Number of blocks a pool takes from the general heap at once
+#define POOL_REFILL_BLOCKS 16
+
+// A block of the general heap. Blocks are kept in address order, each knows
+// the one before it so that neighbouring free blocks can be merged. The free
+// list links overlap the memory handed out once the block is allocated.
+struct heap_block {
+    struct heap_block *prev_phys;
+    size_t size;
+    struct heap_block *next_free;
+    struct heap_block *prev_free;
+};
+
+#define BLOCK_OVERHEAD offsetof(struct heap_block, next_free)
+#define BLOCK_MIN_SIZE (sizeof(struct heap_block) - BLOCK_OVERHEAD)
+
+// A pool block's header tells vPortFree which pool it belongs to, the free
+// list link overlaps the memory handed out
+struct pool_block {
+    size_t tag;
+    struct pool_block *next_free;
+};
+
+#define POOL_OVERHEAD offsetof(struct pool_block, next_free)
+
+static uint8_t ucHeap[configTOTAL_HEAP_SIZE]
+__attribute__((aligned(ALIGN_SIZE)));
+
+static struct {
+    int initialised;
+    uint32_t fl_bitmap;
+    uint32_t sl_bitmap[FL_INDEX_COUNT];
+    struct heap_block *blocks[FL_INDEX_COUNT][SL_INDEX_COUNT];
+
+    struct {
+        struct pool_block *free;
+        heap_pool_stats_t stats;
+    } pools[HEAP_POOL_COUNT];
+
+    size_t used;
+    size_t peak_used;
+    unsigned long allocations;
+    unsigned long frees;
+    unsigned long failures;
+} heap;
+
+static inline size_t xBlockSize(const struct heap_block *block)
+{
+    return block->size & ~BLOCK_FLAGS;
+}
+
+static inline int xBlockIsFree(const struct heap_block *block)
+{
+    return block->size & BLOCK_FREE;
+}
+
+static inline struct heap_block *pxBlockNext(const struct heap_block *block)
+{
+    return (struct heap_block *)((uint8_t *)block + BLOCK_OVERHEAD +
+                                 xBlockSize(block));
+}
+
+static inline int xHeapFLS(size_t value)
+{
+    return (int)(sizeof(unsigned long) * 8 - 1) - __builtin_clzl(value);
+}
+
+static void vHeapMapping(size_t size, int *fl, int *sl)
+{
+    int bit;
+
+    if (size < SMALL_BLOCK_SIZE) {
+        *fl = 0;
+        *sl = size / (SMALL_BLOCK_SIZE / SL_INDEX_COUNT);
+    }
+    else {
+        bit = xHeapFLS(size);
+        *sl = (size >> (bit - SL_INDEX_COUNT_LOG2)) ^ SL_INDEX_COUNT;
+        *fl = bit - (FL_INDEX_SHIFT - 1);
+    }
+}
+
+static void vHeapInsert(struct heap_block *block)
+{
+    int fl, sl;
+
+    vHeapMapping(xBlockSize(block), &fl, &sl);
+
+    block->prev_free = NULL;
+    block->next_free = heap.blocks[fl][sl];
+    if (block->next_free) {
+        block->next_free->prev_free = block;
+    }
+    heap.blocks[fl][sl] = block;
+
+    heap.fl_bitmap |= 1U << fl;
+    heap.sl_bitmap[fl] |= 1U << sl;
+}
+
+static void vHeapRemove(struct heap_block *block)
+{
+    int fl, sl;
+
+    vHeapMapping(xBlockSize(block), &fl, &sl);
+
+    if (block->next_free) {
+        block->next_free->prev_free = block->prev_free;
+    }
+    if (block->prev_free) {
+        block->prev_free->next_free = block->next_free;
+    }
+    else {
+        heap.blocks[fl][sl] = block->next_free;
+        if (!heap.blocks[fl][sl]) {
+            heap.sl_bitmap[fl] &= ~(1U << sl);
+            if (!heap.sl_bitmap[fl]) {
+                heap.fl_bitmap &= ~(1U << fl);
+            }
+        }
+    }
+}
+
+// Any block in the first non-empty bin at or above the size's bin is large
+// enough, as the size is rounded up to the next bin first
+static struct heap_block *pxHeapFind(size_t size)
+{
+    uint32_t sl_map, fl_map;
+    int fl, sl;
+
+    if (size >= SMALL_BLOCK_SIZE) {
+        size += (1UL << (xHeapFLS(size) - SL_INDEX_COUNT_LOG2)) - 1;
+    }
+    vHeapMapping(size, &fl, &sl);
+    if (fl >= FL_INDEX_COUNT) {
+        return NULL;
+    }
+
+    sl_map = heap.sl_bitmap[fl] & (~0U << sl);
+    if (!sl_map) {
+        fl_map = fl + 1 < FL_INDEX_COUNT ? heap.fl_bitmap & (~0U << (fl + 1))
+                 : 0;
+        if (!fl_map) {
+            return NULL;
+        }
+        fl = __builtin_ctz(fl_map);
+        sl_map = heap.sl_bitmap[fl];
+    }
+    sl = __builtin_ctz(sl_map);
+
+    return heap.blocks[fl][sl];
+}
+
+static void vHeapInit(void)
+{
+    struct heap_block *first = (struct heap_block *)ucHeap;
+    struct heap_block *sentinel;
+
+    // The last block is an empty, allocated block that stops merging
+    first->prev_phys = NULL;
+    first->size = ((sizeof(ucHeap) & ~BLOCK_FLAGS) - BLOCK_OVERHEAD -
+                   sizeof(struct heap_block)) | BLOCK_FREE;
+    sentinel = pxBlockNext(first);
+    sentinel->prev_phys = first;
+    sentinel->size = 0;
+
+    vHeapInsert(first);
+
+    heap.used = heap.peak_used = sizeof(ucHeap) - xBlockSize(first);
+    heap.initialised = 1;
+}
+
+static void *pvHeapAlloc(size_t size)
+{
+    struct heap_block *block, *rest;
+    size_t remaining;
+
+    // Checked before rounding up, which wraps for sizes close to SIZE_MAX
+    if (size > sizeof(ucHeap)) {
+        return NULL;
+    }
+
+    size = (size + ALIGN_SIZE - 1) & ~BLOCK_FLAGS;
+    if (size < BLOCK_MIN_SIZE) {
+        size = BLOCK_MIN_SIZE;
+    }
+    if (size > sizeof(ucHeap)) {
+        return NULL;
+    }
+
+    block = pxHeapFind(size);
+    if (!block) {
+        return NULL;
+    }
+    vHeapRemove(block);
+
+    // The rest of the block is returned to the heap if it is large enough
+    // to be a block of its own
+    remaining = xBlockSize(block) - size;
+    if (remaining >= sizeof(struct heap_block)) {
+        rest = (struct heap_block *)((uint8_t *)block + BLOCK_OVERHEAD +
+                                     size);
+        rest->prev_phys = block;
+        rest->size = (remaining - BLOCK_OVERHEAD) | BLOCK_FREE;
+        pxBlockNext(rest)->prev_phys = rest;
+        block->size = size;
+        vHeapInsert(rest);
+    }
+    else {
+        block->size = xBlockSize(block);
+    }
+
+    heap.used += xBlockSize(block) + BLOCK_OVERHEAD;
+    if (heap.used > heap.peak_used) {
+        heap.peak_used = heap.used;
+    }
+
+    return (uint8_t *)block + BLOCK_OVERHEAD;
+}
+
+static void vHeapFree(struct heap_block *block)
+{
+    struct heap_block *neighbour;
+
+    configASSERT(!xBlockIsFree(block));
+
+    heap.used -= xBlockSize(block) + BLOCK_OVERHEAD;
+    block->size |= BLOCK_FREE;
+
+    neighbour = block->prev_phys;
+    if (neighbour && xBlockIsFree(neighbour)) {
+        vHeapRemove(neighbour);
+        neighbour->size = (xBlockSize(neighbour) + BLOCK_OVERHEAD +
+                           xBlockSize(block)) | BLOCK_FREE;
+        pxBlockNext(neighbour)->prev_phys = neighbour;
+        block = neighbour;
+    }
+
+    neighbour = pxBlockNext(block);
+    if (xBlockIsFree(neighbour)) {
+        vHeapRemove(neighbour);
+        block->size = (xBlockSize(block) + BLOCK_OVERHEAD +
+                       xBlockSize(neighbour)) | BLOCK_FREE;
+        pxBlockNext(block)->prev_phys = block;
+    }
+
+    vHeapInsert(block);
+}
+
+static void *pvPoolAlloc(unsigned int index)
+{
+    size_t stride = POOL_OVERHEAD + (POOL_MIN_SIZE << index);
+    struct pool_block *block;
+    uint8_t *refill;
+
+    if (!heap.pools[index].free) {
+        refill = pvHeapAlloc(POOL_REFILL_BLOCKS * stride);
+        if (!refill) {
+            return NULL;
+        }
+
+        for (int i = POOL_REFILL_BLOCKS - 1; i >= 0; i--) {
+            block = (struct pool_block *)(refill + i * stride);
+            block->tag = (index << ALIGN_LOG2) | BLOCK_POOL;
+            block->next_free = heap.pools[index].free;
+            heap.pools[index].free = block;
+        }
+        heap.pools[index].stats.blocks += POOL_REFILL_BLOCKS;
+    }
+
+    block = heap.pools[index].free;
+    heap.pools[index].free = block->next_free;
+
+    heap.pools[index].stats.allocations++;
+    if (++heap.pools[index].stats.in_use > heap.pools[index].stats.peak) {
+        heap.pools[index].stats.peak = heap.pools[index].stats.in_use;
+    }
+
+    return (uint8_t *)block + POOL_OVERHEAD;
+}
+
+static void vPoolFree(struct pool_block *block)
+{
+    unsigned int index = block->tag >> ALIGN_LOG2;
+
+    block->next_free = heap.pools[index].free;
+    heap.pools[index].free = block;
+    heap.pools[index].stats.in_use--;
+}
+
+void *pvPortMalloc(size_t xWantedSize)
+{
+    void *pvReturn = NULL;
+    unsigned int index = 0;
+
+    vTaskSuspendAll();
+    {
+        if (!heap.initialised) {
+            vHeapInit();
+        }
+
+        if (xWantedSize && xWantedSize <= POOL_MAX_SIZE) {
+            while ((size_t)(POOL_MIN_SIZE << index) < xWantedSize) {
+                index++;
+            }
+            pvReturn = pvPoolAlloc(index);
+        }
+
+        // Also used if the pool could not be refilled
+        if (xWantedSize && !pvReturn) {
+            pvReturn = pvHeapAlloc(xWantedSize);
+        }
+
+        if (pvReturn) {
+            heap.allocations++;
+        }
+        else {
+            heap.failures++;
+        }
+
+        traceMALLOC(pvReturn, xWantedSize);
+    }
+    (void)xTaskResumeAll();
+
+#if (configUSE_MALLOC_FAILED_HOOK == 1)
+    if (!pvReturn) {
+        extern void vApplicationMallocFailedHook(void);
+        vApplicationMallocFailedHook();
+    }
+#endif
+
+    return pvReturn;
+}
+
+void vPortFree(void *pv)
+{
+    size_t tag;
+
+    if (!pv) {
+        return;
+    }
+
+    // Both kinds of blocks keep their size or tag right before the memory
+    // handed out
+    tag = ((size_t *)pv)[-1];
+
+    vTaskSuspendAll();
+    {
+        if (tag & BLOCK_POOL) {
+            vPoolFree((struct pool_block *)((uint8_t *)pv - POOL_OVERHEAD));
+        }
+        else {
+            vHeapFree((struct heap_block *)((uint8_t *)pv - BLOCK_OVERHEAD));
+        }
+        heap.frees++;
+
+        traceFREE(pv, 0);
+    }
+    (void)xTaskResumeAll();
+}
+
+void *pvPortCalloc(size_t xNum, size_t xSize)
+{
+    void *pv;
+
+    if (xSize && xNum > SIZE_MAX / xSize) {
+        return NULL;
+    }
+
+    pv = pvPortMalloc(xNum * xSize);
+    if (pv) {
+        memset(pv, 0, xNum * xSize);
+    }
+
+    return pv;
+}
+
+size_t xPortGetFreeHeapSize(void)
+{
+    return heap.initialised ? sizeof(ucHeap) - heap.used : sizeof(ucHeap);
+}
+
+size_t xPortGetMinimumEverFreeHeapSize(void)
+{
+    return heap.initialised ? sizeof(ucHeap) - heap.peak_used :
+           sizeof(ucHeap);
+}
+
+void vPortInitialiseBlocks(void)
+{
+    // Only required when heap_1.c is used
+}
+
+// Walks all blocks, the statistics are not meant to be read often
+static void vHeapScan(size_t *free, size_t *largest, size_t *smallest,
+                      unsigned long *count)
+{
+    struct heap_block *block = (struct heap_block *)ucHeap;
+
+    *free = *largest = *count = 0;
+    *smallest = heap.initialised ? SIZE_MAX : 0;
+
+    for (; heap.initialised && xBlockSize(block); block = pxBlockNext(block)) {
+        if (!xBlockIsFree(block)) {
+            continue;
+        }
+        *free += xBlockSize(block);
+        (*count)++;
+        if (xBlockSize(block) > *largest) {
+            *largest = xBlockSize(block);
+        }
+        if (xBlockSize(block) < *smallest) {
+            *smallest = xBlockSize(block);
+        }
+    }
+}
+
+void vPortGetHeapStats(HeapStats_t *pxHeapStats)
+{
+    size_t free, largest, smallest;
+    unsigned long count;
+
+    vTaskSuspendAll();
+    {
+        vHeapScan(&free, &largest, &smallest, &count);
+
+        pxHeapStats->xAvailableHeapSpaceInBytes = xPortGetFreeHeapSize();
+        pxHeapStats->xSizeOfLargestFreeBlockInBytes = largest;
+        pxHeapStats->xSizeOfSmallestFreeBlockInBytes = smallest;
+        pxHeapStats->xNumberOfFreeBlocks = count;
+        pxHeapStats->xMinimumEverFreeBytesRemaining =
+            xPortGetMinimumEverFreeHeapSize();
+        pxHeapStats->xNumberOfSuccessfulAllocations = heap.allocations;
+        pxHeapStats->xNumberOfSuccessfulFrees = heap.frees;
+    }
+    (void)xTaskResumeAll();
+}
+
+void vHeapGetStats(heap_stats_t *stats)
+{
+    size_t free, smallest;
+
+    vTaskSuspendAll();
+    {
+        vHeapScan(&free, &stats->largest_free, &smallest,
+                  &stats->free_blocks);
+
+        stats->total = sizeof(ucHeap);
+        stats->free = xPortGetFreeHeapSize();
+        stats->peak_used = heap.initialised ? heap.peak_used : 0;
+        stats->fragmentation = free ? 1.0f - (float)stats->largest_free /
+                               free : 0.0f;
+        stats->allocations = heap.allocations;
+        stats->frees = heap.frees;
+        stats->failures = heap.failures;
+
+        for (int i = 0; i < HEAP_POOL_COUNT; i++) {
+            stats->pools[i] = heap.pools[i].stats;
+            stats->pools[i].block_size = POOL_MIN_SIZE << i;
+        }
+    }
+    (void)xTaskResumeAll();
+}
@@ -0,0 +1,90 @@
+/**
+ * @file heap_stats.h
+ * @author Alex Hoffman
+ * @date 23 January 2023
+ * @brief Statistics of the pooled TLSF FreeRTOS heap
+ *
+ * @verbatim
+ ----------------------------------------------------------------------
+ Copyright (C) Alexander Hoffman, 2023
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ any later version.
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ----------------------------------------------------------------------
+ @endverbatim
+ */
+
+#ifndef __HEAP_STATS_H__
+#define __HEAP_STATS_H__
+
+#include <stddef.h>
+
+/**
+ * @defgroup heap_pool_tlsf Pooled TLSF Heap
+ *
+ * @brief When built with -DHEAP_BACKEND=pool_tlsf, pvPortMalloc and
+ * vPortFree allocate from a static heap of configTOTAL_HEAP_SIZE bytes
+ * instead of wrapping malloc, such that the emulator is bound by the same
+ * amount of memory as the target.
+ *
+ * Small allocations, such as the kernel's task control blocks, queues and
+ * list items, come from pools of fixed size blocks. The pools are refilled
+ * from, but never give memory back to, the general heap, which is a two
+ * level segregated fit (TLSF) allocator. Both allocating and freeing take a
+ * constant time, no matter how many blocks the heap holds.
+ *
+ * Like all of the FreeRTOS heaps, the heap must only be used from tasks or
+ * before the scheduler has started.
+ *
+ * \code{.c}
+heap_stats_t stats;
+
+vHeapGetStats(&stats);
+prints("Heap: %zu of %zu bytes used at most, %.0f%% fragmented\n",
+       stats.peak_used, stats.total, stats.fragmentation * 100);
+ * \endcode
+ *
+ * @{
+ */
+
+/// @brief Number of pools, their block sizes are 32, 64, 128, ... bytes
+#define HEAP_POOL_COUNT 4
+
+/// @brief Counters of one pool
+typedef struct heap_pool_stats {
+    size_t block_size; ///< Largest allocation the pool serves
+    unsigned long blocks; ///< Blocks taken from the general heap
+    unsigned long in_use; ///< Blocks currently allocated
+    unsigned long peak; ///< Most blocks allocated at once
+    unsigned long allocations; ///< Allocations served
+} heap_pool_stats_t;
+
+/// @brief Counters of the heap
+typedef struct heap_stats {
+    size_t total; ///< Size of the heap
+    size_t free; ///< Bytes free in the general heap
+    size_t peak_used; ///< Most bytes that were in use at once, the high
+                      ///< water mark
+    size_t largest_free; ///< Largest block that can be allocated
+    unsigned long free_blocks; ///< Number of free blocks
+    float fragmentation; ///< 0 if all free memory is one block, close to 1
+                         ///< if it is split into many small blocks
+    unsigned long allocations; ///< Successful allocations
+    unsigned long frees; ///< Frees
+    unsigned long failures; ///< Failed allocations
+    heap_pool_stats_t pools[HEAP_POOL_COUNT];
+} heap_stats_t;
+
+/// @brief Gets the heap's counters
+/// @param stats Set to the heap's counters
+void vHeapGetStats(heap_stats_t *stats);
+
+/** @} */
+#endif //__HEAP_STATS_H__
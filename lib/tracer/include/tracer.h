@@ -1,35 +1,100 @@
+/**
+ * @file tracer.h
+ * @author Alex Hoffman
+ * @date 23 January 2023
+ * @brief Binary function tracer driven by GCC's function instrumentation
+ *
+ * @verbatim
+ ----------------------------------------------------------------------
+ Copyright (C) Alexander Hoffman, 2023
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ any later version.
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ----------------------------------------------------------------------
+ @endverbatim
+ */
+
 #ifndef __TRACER_H__
 #define __TRACER_H__
-#include <time.h>
-#include <stdio.h>
-
-static FILE *fp_trace = NULL;
-
-void __attribute__((constructor)) trace_begin(void)
-{
-    fp_trace = fopen("trace.out", "w");
-}
-
-void __attribute__((destructor)) trace_end(void)
-{
-    if (fp_trace) {
-        fclose(fp_trace);
-    }
-}
-
-void __attribute((no_instrument_function))
-__cyg_profile_func_enter(void *func, void *caller)
-{
-    if (fp_trace) {
-        fprintf(fp_trace, "e %p %p %lu\n", func, caller, time(NULL));
-    }
-}
-
-void __attribute((no_instrument_function))
-__cyg_profile_func_exit(void *func, void *caller)
-{
-    if (fp_trace) {
-        fprintf(fp_trace, "x %p %p %lu\n", func, caller, time(NULL));
-    }
-}
-#endif
+
+#include <stdint.h>
+
+/**
+ * @defgroup tracer Function Tracer
+ *
+ * @brief When built with -DTRACE_FUNCTIONS=ON every instrumented function
+ * entry and exit is recorded into a lock-free ring belonging to the calling
+ * thread, with a nanosecond timestamp taken from CLOCK_MONOTONIC_RAW. A
+ * background thread drains the rings into a binary trace file, a thread
+ * whose ring is full drops records, it is never blocked.
+ *
+ * The tracer is configured through the environment
+ * - TRACER_FILE, the trace file to write, trace.out by default
+ * - TRACER_SAMPLE=N, only one in every N calls is recorded
+ * - TRACER_ALLOW=func1,func2, only the listed functions are recorded. The
+ *   functions must not be static as they are looked up with dlsym.
+ *
+ * The file starts with a trace_file_header followed by chunks, each a
+ * trace_chunk_header followed by the records of one thread. Functions and
+ * callers are stored as offsets from the executable's load address.
+ *
+ * \code{.sh}
+TRACER_SAMPLE=10 TRACER_ALLOW=vDemoTask1,vDemoTask2 ./FreeRTOS_Emulator
+ * \endcode
+ *
+ * @{
+ */
+
+/// @brief Identifies a trace file
+#define TRACE_FILE_MAGIC 0x46435254
+/// @brief Identifies a chunk of records within a trace file
+#define TRACE_CHUNK_MAGIC 0x4B435254
+/// @brief Version of the file format
+#define TRACE_FILE_VERSION 1
+
+/// @brief Set in a record's timestamp if the record is a function exit
+#define TRACE_EXIT (1ULL << 63)
+/// @brief Caller of a record that lies outside of the executable
+#define TRACE_NO_CALLER UINT32_MAX
+
+/// @brief Written once at the start of a trace file
+struct trace_file_header {
+    uint32_t magic; ///< TRACE_FILE_MAGIC
+    uint32_t version; ///< TRACE_FILE_VERSION
+    uint64_t base; ///< Load address of the executable
+    uint64_t start; ///< Time tracing started, in nanoseconds
+    uint32_t sample; ///< One in how many calls were recorded
+    uint32_t reserved;
+};
+
+/// @brief Precedes the records of one thread
+struct trace_chunk_header {
+    uint32_t magic; ///< TRACE_CHUNK_MAGIC
+    uint32_t thread; ///< Kernel thread ID of the thread
+    uint32_t count; ///< Number of records following the header
+    uint32_t dropped; ///< Records the thread dropped since its last chunk
+};
+
+/// @brief One function entry or exit
+struct trace_record {
+    uint64_t timestamp; ///< Nanoseconds, or'd with TRACE_EXIT on exit
+    uint32_t function; ///< Offset of the function
+    uint32_t caller; ///< Offset of the call site, or TRACE_NO_CALLER
+};
+
+/// @brief Starts tracing, called before main
+void trace_begin(void);
+
+/// @brief Writes out all remaining records and closes the trace file,
+/// called at exit
+void trace_end(void);
+
+/** @} */
+#endif //__TRACER_H__
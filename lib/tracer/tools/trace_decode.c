@@ -0,0 +1,552 @@
+/**
+ * @file trace_decode.c
+ * @author Alex Hoffman
+ * @date 23 January 2023
+ * @brief Decodes binary function traces into a flat profile and Chrome
+ * trace events
+ *
+ * @verbatim
+ ----------------------------------------------------------------------
+ Copyright (C) Alexander Hoffman, 2023
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ any later version.
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ----------------------------------------------------------------------
+ @endverbatim
+ */
+
+#include <elf.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "tracer.h"
+
+// Records read from the trace file at once
+#define READ_RECORDS 65536
+// Entries of the direct mapped offset to symbol cache, a power of two
+#define SYMBOL_CACHE_SIZE 65536
+#define UNKNOWN_SYMBOL "??"
+
+struct symbol {
+    uint64_t address;
+    uint64_t size;
+    const char *name;
+    // Flat profile
+    unsigned long calls;
+    uint64_t self;
+    uint64_t inclusive;
+};
+
+struct frame {
+    unsigned int symbol;
+    uint64_t start;
+    uint64_t children;
+};
+
+struct thread {
+    uint32_t id;
+    struct frame *stack;
+    unsigned int depth;
+    unsigned int max_depth;
+    // How often each symbol is on the stack, so that recursive calls are
+    // only counted once towards the inclusive time
+    unsigned int *active;
+    unsigned long dropped;
+    unsigned long unmatched;
+};
+
+static struct {
+    void *elf;
+    size_t elf_size;
+    // Sorted by address, the last symbol collects unknown functions
+    struct symbol *symbols;
+    unsigned int symbol_count;
+    uint64_t bias;
+    struct {
+        uint32_t offset;
+        unsigned int symbol;
+    } cache[SYMBOL_CACHE_SIZE];
+    struct thread *threads;
+    unsigned int thread_count;
+    uint64_t start;
+    uint64_t end;
+    unsigned long records;
+    FILE *json;
+    int json_first;
+} decoder;
+
+static int compare_symbols(const void *a, const void *b)
+{
+    const struct symbol *x = a, *y = b;
+
+    return (x->address > y->address) - (x->address < y->address);
+}
+
+// Whether a section lies entirely within the mapped file
+static int section_in_file(const Elf64_Shdr *section)
+{
+    return section->sh_offset <= decoder.elf_size &&
+           section->sh_size <= decoder.elf_size - section->sh_offset;
+}
+
+static int load_symbols(const char *path, uint64_t base)
+{
+    Elf64_Ehdr *ehdr;
+    Elf64_Shdr *shdr, *symtab = NULL, *strsec;
+    Elf64_Sym *sym;
+    const char *strtab;
+    size_t count;
+    struct stat st;
+    int fd;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0 || fstat(fd, &st)) {
+        fprintf(stderr, "Failed to open '%s'\n", path);
+        goto err_open;
+    }
+
+    decoder.elf_size = st.st_size;
+    decoder.elf = mmap(NULL, decoder.elf_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (decoder.elf == MAP_FAILED) {
+        fprintf(stderr, "Failed to map '%s'\n", path);
+        goto err_open;
+    }
+    close(fd);
+
+    ehdr = decoder.elf;
+    if (decoder.elf_size < sizeof(Elf64_Ehdr) ||
+        memcmp(ehdr->e_ident, ELFMAG, SELFMAG) ||
+        ehdr->e_ident[EI_CLASS] != ELFCLASS64 ||
+        ehdr->e_shoff > decoder.elf_size ||
+        (size_t)ehdr->e_shnum * sizeof(Elf64_Shdr) >
+        decoder.elf_size - ehdr->e_shoff) {
+        fprintf(stderr, "'%s' is not a 64 bit ELF file\n", path);
+        goto err_elf;
+    }
+
+    // The dynamic symbols are only used if the executable was stripped
+    shdr = (Elf64_Shdr *)((char *)decoder.elf + ehdr->e_shoff);
+    for (int i = 0; i < ehdr->e_shnum; i++) {
+        if (shdr[i].sh_type == SHT_SYMTAB ||
+            (shdr[i].sh_type == SHT_DYNSYM && !symtab)) {
+            symtab = &shdr[i];
+        }
+    }
+    if (!symtab || symtab->sh_link >= ehdr->e_shnum) {
+        fprintf(stderr, "'%s' has no symbols\n", path);
+        goto err_elf;
+    }
+
+    // A truncated or corrupt file must not make us read past the mapping,
+    // the string table must end in a terminator for its names to be used
+    strsec = &shdr[symtab->sh_link];
+    if (!section_in_file(symtab) || !section_in_file(strsec) ||
+        !strsec->sh_size ||
+        ((char *)decoder.elf)[strsec->sh_offset + strsec->sh_size - 1]) {
+        fprintf(stderr, "'%s' has damaged symbol tables\n", path);
+        goto err_elf;
+    }
+
+    sym = (Elf64_Sym *)((char *)decoder.elf + symtab->sh_offset);
+    strtab = (char *)decoder.elf + strsec->sh_offset;
+    count = symtab->sh_size / sizeof(Elf64_Sym);
+
+    decoder.symbols = calloc(count + 1, sizeof(struct symbol));
+    if (!decoder.symbols) {
+        goto err_elf;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        if (ELF64_ST_TYPE(sym[i].st_info) != STT_FUNC || !sym[i].st_value ||
+            sym[i].st_name >= strsec->sh_size) {
+            continue;
+        }
+        decoder.symbols[decoder.symbol_count].address = sym[i].st_value;
+        decoder.symbols[decoder.symbol_count].size = sym[i].st_size;
+        decoder.symbols[decoder.symbol_count].name = strtab + sym[i].st_name;
+        decoder.symbol_count++;
+    }
+
+    qsort(decoder.symbols, decoder.symbol_count, sizeof(struct symbol),
+          compare_symbols);
+    decoder.symbols[decoder.symbol_count].name = UNKNOWN_SYMBOL;
+
+    // Traced offsets are relative to the load address, which is also what
+    // the symbols of a position independent executable are
+    decoder.bias = ehdr->e_type == ET_EXEC ? base : 0;
+
+    for (int i = 0; i < SYMBOL_CACHE_SIZE; i++) {
+        decoder.cache[i].offset = TRACE_NO_CALLER;
+    }
+
+    return 0;
+
+err_elf:
+    munmap(decoder.elf, decoder.elf_size);
+    return -1;
+err_open:
+    if (fd >= 0) {
+        close(fd);
+    }
+    return -1;
+}
+
+static unsigned int lookup_symbol(uint32_t offset)
+{
+    unsigned int slot = (offset >> 2) & (SYMBOL_CACHE_SIZE - 1);
+    uint64_t address = offset + decoder.bias;
+    unsigned int low = 0, high = decoder.symbol_count, mid;
+
+    if (decoder.cache[slot].offset == offset) {
+        return decoder.cache[slot].symbol;
+    }
+
+    // Last symbol starting at or before the address
+    while (low < high) {
+        mid = low + (high - low) / 2;
+        if (decoder.symbols[mid].address <= address) {
+            low = mid + 1;
+        }
+        else {
+            high = mid;
+        }
+    }
+
+    if (!low || address >= decoder.symbols[low - 1].address +
+        (decoder.symbols[low - 1].size ? decoder.symbols[low - 1].size : 1)) {
+        low = decoder.symbol_count;
+    }
+    else {
+        low--;
+    }
+
+    decoder.cache[slot].offset = offset;
+    decoder.cache[slot].symbol = low;
+
+    return low;
+}
+
+static struct thread *get_thread(uint32_t id)
+{
+    struct thread *threads;
+
+    for (unsigned int i = 0; i < decoder.thread_count; i++) {
+        if (decoder.threads[i].id == id) {
+            return &decoder.threads[i];
+        }
+    }
+
+    threads = realloc(decoder.threads,
+                      (decoder.thread_count + 1) * sizeof(struct thread));
+    if (!threads) {
+        return NULL;
+    }
+    decoder.threads = threads;
+
+    threads = &decoder.threads[decoder.thread_count];
+    memset(threads, 0, sizeof(struct thread));
+    threads->id = id;
+    threads->active = calloc(decoder.symbol_count + 1, sizeof(unsigned int));
+    if (!threads->active) {
+        return NULL;
+    }
+    decoder.thread_count++;
+
+    return threads;
+}
+
+static double to_us(uint64_t timestamp)
+{
+    return (timestamp - decoder.start) / 1000.0;
+}
+
+static void json_event(struct thread *thread, unsigned int symbol, char phase,
+                       uint64_t timestamp)
+{
+    if (!decoder.json) {
+        return;
+    }
+
+    fprintf(decoder.json,
+            "%s\n{\"name\":\"%s\",\"ph\":\"%c\",\"pid\":1,\"tid\":%u,"
+            "\"ts\":%.3f}",
+            decoder.json_first ? "" : ",", decoder.symbols[symbol].name,
+            phase, thread->id, to_us(timestamp));
+    decoder.json_first = 0;
+}
+
+static int push_frame(struct thread *thread, unsigned int symbol,
+                      uint64_t timestamp)
+{
+    struct frame *stack;
+
+    if (thread->depth == thread->max_depth) {
+        thread->max_depth = thread->max_depth ? thread->max_depth * 2 : 64;
+        stack = realloc(thread->stack,
+                        thread->max_depth * sizeof(struct frame));
+        if (!stack) {
+            return -1;
+        }
+        thread->stack = stack;
+    }
+
+    thread->stack[thread->depth++] = (struct frame) {
+        .symbol = symbol, .start = timestamp
+    };
+    thread->active[symbol]++;
+    decoder.symbols[symbol].calls++;
+
+    json_event(thread, symbol, 'B', timestamp);
+
+    return 0;
+}
+
+static void pop_frame(struct thread *thread, uint64_t timestamp)
+{
+    struct frame *frame = &thread->stack[--thread->depth];
+    struct symbol *symbol = &decoder.symbols[frame->symbol];
+    uint64_t elapsed = timestamp - frame->start;
+
+    symbol->self += elapsed - frame->children;
+    if (!--thread->active[frame->symbol]) {
+        symbol->inclusive += elapsed;
+    }
+    if (thread->depth) {
+        thread->stack[thread->depth - 1].children += elapsed;
+    }
+
+    json_event(thread, frame->symbol, 'E', timestamp);
+}
+
+static void exit_frame(struct thread *thread, unsigned int symbol,
+                       uint64_t timestamp)
+{
+    unsigned int depth = thread->depth;
+
+    while (depth && thread->stack[depth - 1].symbol != symbol) {
+        depth--;
+    }
+
+    // An exit whose entry was dropped or recorded before the trace started
+    if (!depth) {
+        thread->unmatched++;
+        return;
+    }
+
+    // Exits that were dropped are assumed to have happened with this one
+    while (thread->depth >= depth) {
+        pop_frame(thread, timestamp);
+    }
+}
+
+static void decode_record(struct thread *thread, struct trace_record *record)
+{
+    uint64_t timestamp = record->timestamp & ~TRACE_EXIT;
+    unsigned int symbol = lookup_symbol(record->function);
+
+    if (timestamp > decoder.end) {
+        decoder.end = timestamp;
+    }
+
+    if (record->timestamp & TRACE_EXIT) {
+        exit_frame(thread, symbol, timestamp);
+    }
+    else if (push_frame(thread, symbol, timestamp)) {
+        thread->unmatched++;
+    }
+}
+
+static int decode_trace(FILE *fp)
+{
+    struct trace_chunk_header chunk;
+    struct trace_record *records;
+    struct thread *thread;
+    size_t count;
+
+    records = malloc(READ_RECORDS * sizeof(struct trace_record));
+    if (!records) {
+        return -1;
+    }
+
+    while (fread(&chunk, sizeof(chunk), 1, fp) == 1) {
+        if (chunk.magic != TRACE_CHUNK_MAGIC) {
+            fprintf(stderr, "Corrupt trace chunk\n");
+            goto err;
+        }
+
+        thread = get_thread(chunk.thread);
+        if (!thread) {
+            goto err;
+        }
+
+        while (chunk.count) {
+            count = chunk.count < READ_RECORDS ? chunk.count : READ_RECORDS;
+            if (fread(records, sizeof(struct trace_record), count, fp) !=
+                count) {
+                fprintf(stderr, "Truncated trace chunk\n");
+                goto err;
+            }
+            for (size_t i = 0; i < count; i++) {
+                decode_record(thread, &records[i]);
+            }
+            chunk.count -= count;
+            decoder.records += count;
+        }
+
+        thread->dropped += chunk.dropped;
+    }
+
+    free(records);
+    return 0;
+
+err:
+    free(records);
+    return -1;
+}
+
+static int compare_self(const void *a, const void *b)
+{
+    const struct symbol *x = *(struct symbol *const *)a;
+    const struct symbol *y = *(struct symbol *const *)b;
+
+    return (x->self < y->self) - (x->self > y->self);
+}
+
+static void print_profile(FILE *out, unsigned int sample)
+{
+    struct symbol **sorted;
+    unsigned long dropped = 0, unmatched = 0;
+    unsigned int count = 0;
+    uint64_t total = 0;
+
+    // Functions still running at the end of the trace
+    for (unsigned int i = 0; i < decoder.thread_count; i++) {
+        while (decoder.threads[i].depth) {
+            pop_frame(&decoder.threads[i], decoder.end);
+        }
+        dropped += decoder.threads[i].dropped;
+        unmatched += decoder.threads[i].unmatched;
+    }
+
+    sorted = malloc((decoder.symbol_count + 1) * sizeof(struct symbol *));
+    if (!sorted) {
+        return;
+    }
+    for (unsigned int i = 0; i <= decoder.symbol_count; i++) {
+        if (decoder.symbols[i].calls) {
+            sorted[count++] = &decoder.symbols[i];
+            total += decoder.symbols[i].self;
+        }
+    }
+    qsort(sorted, count, sizeof(struct symbol *), compare_self);
+
+    fprintf(out, "%lu records from %u threads over %.3f ms, one in %u calls "
+            "recorded, %lu dropped, %lu unmatched\n\n", decoder.records,
+            decoder.thread_count,
+            (decoder.end - decoder.start) / 1000000.0, sample, dropped,
+            unmatched);
+    fprintf(out, "%7s %12s %12s %10s  %s\n", "self %", "self ms",
+            "incl ms", "calls", "function");
+    for (unsigned int i = 0; i < count; i++) {
+        fprintf(out, "%7.2f %12.3f %12.3f %10lu  %s\n",
+                total ? 100.0 * sorted[i]->self / total : 0.0,
+                sorted[i]->self / 1000000.0,
+                sorted[i]->inclusive / 1000000.0, sorted[i]->calls,
+                sorted[i]->name);
+    }
+
+    free(sorted);
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [-p profile] [-j chrome.json] "
+            "executable trace\n", name);
+}
+
+int main(int argc, char *argv[])
+{
+    struct trace_file_header header;
+    FILE *fp, *profile = stdout;
+    int opt, ret = EXIT_FAILURE;
+
+    while ((opt = getopt(argc, argv, "p:j:")) != -1) {
+        switch (opt) {
+            case 'p':
+                profile = fopen(optarg, "w");
+                if (!profile) {
+                    fprintf(stderr, "Failed to open '%s'\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'j':
+                decoder.json = fopen(optarg, "w");
+                if (!decoder.json) {
+                    fprintf(stderr, "Failed to open '%s'\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            default:
+                usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+
+    if (argc - optind != 2) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    fp = fopen(argv[optind + 1], "rb");
+    if (!fp) {
+        fprintf(stderr, "Failed to open '%s'\n", argv[optind + 1]);
+        return EXIT_FAILURE;
+    }
+
+    if (fread(&header, sizeof(header), 1, fp) != 1 ||
+        header.magic != TRACE_FILE_MAGIC ||
+        header.version != TRACE_FILE_VERSION) {
+        fprintf(stderr, "'%s' is not a trace file\n", argv[optind + 1]);
+        goto out;
+    }
+    decoder.start = decoder.end = header.start;
+
+    if (load_symbols(argv[optind], header.base)) {
+        goto out;
+    }
+
+    if (decoder.json) {
+        fprintf(decoder.json, "{\"traceEvents\":[");
+        decoder.json_first = 1;
+    }
+
+    if (!decode_trace(fp)) {
+        print_profile(profile, header.sample);
+        ret = EXIT_SUCCESS;
+    }
+
+    if (decoder.json) {
+        fprintf(decoder.json, "\n]}\n");
+        fclose(decoder.json);
+    }
+
+out:
+    fclose(fp);
+    if (profile != stdout) {
+        fclose(profile);
+    }
+    return ret;
+}
@@ -0,0 +1,457 @@
+/**
+ * @file tracer.c
+ * @author Alex Hoffman
+ * @date 23 January 2023
+ * @brief Binary function tracer driven by GCC's function instrumentation
+ *
+ * @verbatim
+ ----------------------------------------------------------------------
+ Copyright (C) Alexander Hoffman, 2023
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ any later version.
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ----------------------------------------------------------------------
+ @endverbatim
+ */
+
+#define _GNU_SOURCE
+
+#include <dlfcn.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include "tracer.h"
+
+// Everything called from the instrumentation hooks must not be instrumented
+// itself
+#define NO_TRACE __attribute__((no_instrument_function))
+
+#define TRACE_DEFAULT_FILE "trace.out"
+// Records each thread can hold until the flusher writes them out, must be a
+// power of two
+#define TRACE_RING_RECORDS 16384
+// Calls nested deeper than this are not recorded
+#define TRACE_MAX_DEPTH 1024
+// Free rings the flusher keeps allocated for threads that start tracing, a
+// ring cannot be allocated by the thread itself as its first traced call
+// can be made from a signal handler
+#define TRACE_SPARE_RINGS 8
+#define TRACE_MAX_ALLOWED 64
+#define TRACE_FLUSH_INTERVAL_NS 10000000L
+#define TRACE_FILE_BUFFER (1 << 20)
+#define CACHE_LINE 64
+
+enum trace_ring_state { TRACE_RING_FREE, TRACE_RING_USED, TRACE_RING_RETIRED };
+
+// Single producer, the owning thread, and single consumer, the flusher.
+// Signal handlers run on the owning thread, records made while the thread
+// is already recording are dropped such that the thread never produces
+// twice at once. Rings are never freed, once the flusher has drained the
+// ring of a thread that exited it is reused by the next thread that starts.
+struct trace_ring {
+    struct trace_ring *next;
+    uint32_t state;
+    uint32_t thread;
+    uint32_t dropped;
+    uint32_t head __attribute__((aligned(CACHE_LINE)));
+    uint32_t tail __attribute__((aligned(CACHE_LINE)));
+    struct trace_record records[TRACE_RING_RECORDS];
+};
+
+// Which calls on the current thread's stack were recorded, such that each
+// recorded entry has a matching exit
+struct trace_thread {
+    struct trace_ring *ring;
+    volatile sig_atomic_t recording;
+    unsigned int depth;
+    unsigned int countdown;
+    uint64_t recorded[TRACE_MAX_DEPTH / 64];
+};
+
+static struct {
+    volatile int tracing;
+    volatile int running;
+    FILE *fp;
+    uintptr_t base;
+    unsigned int sample;
+    uintptr_t allowed[TRACE_MAX_ALLOWED];
+    size_t allowed_count;
+    struct trace_ring *rings;
+    pthread_key_t key;
+    pthread_t flusher;
+} tracer;
+
+static __thread struct trace_thread self;
+
+static NO_TRACE uint64_t trace_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static NO_TRACE int trace_compare(const void *a, const void *b)
+{
+    uintptr_t x = *(const uintptr_t *)a, y = *(const uintptr_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+static NO_TRACE int trace_allowed(void *func)
+{
+    uintptr_t key = (uintptr_t)func;
+
+    if (!tracer.allowed_count) {
+        return 1;
+    }
+
+    return bsearch(&key, tracer.allowed, tracer.allowed_count,
+                   sizeof(uintptr_t), trace_compare) != NULL;
+}
+
+static NO_TRACE void trace_retire(void *ring)
+{
+    __atomic_store_n(&((struct trace_ring *)ring)->state, TRACE_RING_RETIRED,
+                     __ATOMIC_RELEASE);
+}
+
+// Only called by the flusher and before it is started, the list of rings is
+// only ever pushed to
+static NO_TRACE void trace_add_spares(void)
+{
+    struct trace_ring *ring;
+    unsigned int spare = 0;
+
+    for (ring = tracer.rings; ring; ring = ring->next)
+        if (__atomic_load_n(&ring->state, __ATOMIC_RELAXED) ==
+            TRACE_RING_FREE) {
+            spare++;
+        }
+
+    for (; spare < TRACE_SPARE_RINGS; spare++) {
+        ring = aligned_alloc(CACHE_LINE, sizeof(struct trace_ring));
+        if (!ring) {
+            return;
+        }
+        memset(ring, 0, sizeof(struct trace_ring));
+        ring->state = TRACE_RING_FREE;
+
+        ring->next = tracer.rings;
+        __atomic_store_n(&tracer.rings, ring, __ATOMIC_RELEASE);
+    }
+}
+
+// Async signal safe, takes a free ring without allocating. Returns NULL if
+// the flusher has not yet replaced the spare rings taken by other threads,
+// the thread then tries again with its next record.
+static NO_TRACE struct trace_ring *trace_claim(void)
+{
+    struct trace_ring *ring;
+    uint32_t expected;
+
+    for (ring = __atomic_load_n(&tracer.rings, __ATOMIC_ACQUIRE); ring;
+         ring = ring->next) {
+        expected = TRACE_RING_FREE;
+        if (__atomic_compare_exchange_n(&ring->state, &expected,
+                                        TRACE_RING_USED, 0,
+                                        __ATOMIC_ACQUIRE,
+                                        __ATOMIC_RELAXED)) {
+            break;
+        }
+    }
+
+    if (!ring) {
+        return NULL;
+    }
+
+    // Only read by the flusher once records have been published
+    ring->thread = syscall(SYS_gettid);
+    pthread_setspecific(tracer.key, ring);
+
+    return ring;
+}
+
+// Returns 1 if the call was recorded
+static NO_TRACE int trace_record(void *func, void *caller, uint64_t exit)
+{
+    struct trace_ring *ring = self.ring;
+    struct trace_record *record;
+    uintptr_t offset;
+    uint32_t tail;
+
+    // A signal handler interrupted this thread while it was recording, it
+    // must not claim the same slot of the ring
+    if (self.recording) {
+        if (ring) {
+            __atomic_fetch_add(&ring->dropped, 1, __ATOMIC_RELAXED);
+        }
+        return 0;
+    }
+    self.recording = 1;
+    __atomic_signal_fence(__ATOMIC_SEQ_CST);
+
+    if (!ring) {
+        ring = self.ring = trace_claim();
+        if (!ring) {
+            goto out;
+        }
+    }
+
+    tail = ring->tail;
+    if (tail - __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) ==
+        TRACE_RING_RECORDS) {
+        __atomic_fetch_add(&ring->dropped, 1, __ATOMIC_RELAXED);
+        ring = NULL;
+        goto out;
+    }
+
+    record = &ring->records[tail & (TRACE_RING_RECORDS - 1)];
+    record->timestamp = trace_now() | exit;
+    record->function = (uintptr_t)func - tracer.base;
+    offset = (uintptr_t)caller - tracer.base;
+    record->caller = offset < TRACE_NO_CALLER ? offset : TRACE_NO_CALLER;
+
+    __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+
+out:
+    __atomic_signal_fence(__ATOMIC_SEQ_CST);
+    self.recording = 0;
+
+    return ring != NULL;
+}
+
+NO_TRACE void __cyg_profile_func_enter(void *func, void *caller)
+{
+    unsigned int depth = self.depth++;
+
+    if (!tracer.tracing || depth >= TRACE_MAX_DEPTH) {
+        return;
+    }
+
+    self.recorded[depth / 64] &= ~(1ULL << depth % 64);
+
+    if (!trace_allowed(func)) {
+        return;
+    }
+
+    if (self.countdown) {
+        self.countdown--;
+        return;
+    }
+    self.countdown = tracer.sample - 1;
+
+    // Only calls whose entry was recorded have their exit recorded
+    if (trace_record(func, caller, 0)) {
+        self.recorded[depth / 64] |= 1ULL << depth % 64;
+    }
+}
+
+NO_TRACE void __cyg_profile_func_exit(void *func, void *caller)
+{
+    unsigned int depth;
+
+    // Calls that were entered before tracing started
+    if (!self.depth) {
+        return;
+    }
+    depth = --self.depth;
+
+    if (!tracer.tracing || depth >= TRACE_MAX_DEPTH) {
+        return;
+    }
+
+    if (self.recorded[depth / 64] & 1ULL << depth % 64) {
+        trace_record(func, caller, TRACE_EXIT);
+    }
+}
+
+static NO_TRACE void trace_drain(struct trace_ring *ring)
+{
+    struct trace_chunk_header chunk = { .magic = TRACE_CHUNK_MAGIC };
+    uint32_t state, head, tail, first;
+
+    state = __atomic_load_n(&ring->state, __ATOMIC_ACQUIRE);
+    if (state == TRACE_RING_FREE) {
+        return;
+    }
+
+    head = ring->head;
+    tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    chunk.count = tail - head;
+    chunk.dropped = __atomic_exchange_n(&ring->dropped, 0, __ATOMIC_RELAXED);
+
+    if (chunk.count || chunk.dropped) {
+        chunk.thread = ring->thread;
+        fwrite(&chunk, sizeof(chunk), 1, tracer.fp);
+
+        // The records can wrap around the end of the ring
+        head &= TRACE_RING_RECORDS - 1;
+        first = TRACE_RING_RECORDS - head;
+        if (first > chunk.count) {
+            first = chunk.count;
+        }
+        fwrite(&ring->records[head], sizeof(struct trace_record), first,
+               tracer.fp);
+        fwrite(ring->records, sizeof(struct trace_record),
+               chunk.count - first, tracer.fp);
+
+        __atomic_store_n(&ring->head, tail, __ATOMIC_RELEASE);
+    }
+
+    // A retired ring's thread has exited, what was read is all it recorded
+    if (state == TRACE_RING_RETIRED) {
+        __atomic_store_n(&ring->state, TRACE_RING_FREE, __ATOMIC_RELEASE);
+    }
+}
+
+static NO_TRACE void trace_drain_all(void)
+{
+    for (struct trace_ring *ring =
+             __atomic_load_n(&tracer.rings, __ATOMIC_ACQUIRE);
+         ring; ring = ring->next) {
+        trace_drain(ring);
+    }
+}
+
+static NO_TRACE void *trace_flusher(void *args)
+{
+    struct timespec interval = { .tv_nsec = TRACE_FLUSH_INTERVAL_NS };
+
+    while (tracer.running) {
+        nanosleep(&interval, NULL);
+        trace_drain_all();
+        trace_add_spares();
+    }
+
+    return NULL;
+}
+
+static NO_TRACE void trace_parse_allowed(char *list)
+{
+    char *saveptr, *name;
+    void *func;
+
+    for (name = strtok_r(list, ",", &saveptr); name;
+         name = strtok_r(NULL, ",", &saveptr)) {
+        func = dlsym(RTLD_DEFAULT, name);
+        if (!func) {
+            fprintf(stderr, "[TRACER] Function '%s' not found\n", name);
+            continue;
+        }
+        if (tracer.allowed_count == TRACE_MAX_ALLOWED) {
+            fprintf(stderr, "[TRACER] Too many allowed functions\n");
+            break;
+        }
+        tracer.allowed[tracer.allowed_count++] = (uintptr_t)func;
+    }
+
+    qsort(tracer.allowed, tracer.allowed_count, sizeof(uintptr_t),
+          trace_compare);
+}
+
+NO_TRACE void __attribute__((constructor)) trace_begin(void)
+{
+    struct trace_file_header header = {
+        .magic = TRACE_FILE_MAGIC,
+        .version = TRACE_FILE_VERSION,
+    };
+    const char *file = getenv("TRACER_FILE");
+    const char *sample = getenv("TRACER_SAMPLE");
+    char *allow = getenv("TRACER_ALLOW");
+    sigset_t all, old;
+    Dl_info info;
+    int ret;
+
+    tracer.sample = sample ? strtoul(sample, NULL, 10) : 1;
+    if (!tracer.sample) {
+        tracer.sample = 1;
+    }
+
+    if (allow && *allow) {
+        allow = strdup(allow);
+        trace_parse_allowed(allow);
+        free(allow);
+        // Nothing on the list was found, trace nothing rather than everything
+        if (!tracer.allowed_count) {
+            return;
+        }
+    }
+
+    if (dladdr((void *)trace_begin, &info) && info.dli_fbase) {
+        tracer.base = (uintptr_t)info.dli_fbase;
+    }
+
+    tracer.fp = fopen(file ? file : TRACE_DEFAULT_FILE, "wb");
+    if (!tracer.fp) {
+        fprintf(stderr, "[TRACER] Failed to open trace file\n");
+        return;
+    }
+    setvbuf(tracer.fp, NULL, _IOFBF, TRACE_FILE_BUFFER);
+
+    header.base = tracer.base;
+    header.start = trace_now();
+    header.sample = tracer.sample;
+    fwrite(&header, sizeof(header), 1, tracer.fp);
+
+    // Rings of exiting threads are handed back to the flusher
+    if (pthread_key_create(&tracer.key, trace_retire)) {
+        goto err_key;
+    }
+
+    trace_add_spares();
+
+    // The flusher must not handle the signals that drive the FreeRTOS
+    // scheduler
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &old);
+    tracer.running = 1;
+    ret = pthread_create(&tracer.flusher, NULL, trace_flusher, NULL);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (ret) {
+        tracer.running = 0;
+        goto err_flusher;
+    }
+
+    tracer.tracing = 1;
+
+    return;
+
+err_flusher:
+    pthread_key_delete(tracer.key);
+err_key:
+    fprintf(stderr, "[TRACER] Failed to start tracing\n");
+    fclose(tracer.fp);
+    tracer.fp = NULL;
+}
+
+NO_TRACE void __attribute__((destructor)) trace_end(void)
+{
+    if (!tracer.fp) {
+        return;
+    }
+
+    tracer.tracing = 0;
+    tracer.running = 0;
+    pthread_join(tracer.flusher, NULL);
+
+    trace_drain_all();
+
+    fclose(tracer.fp);
+    tracer.fp = NULL;
+}
@@ -0,0 +1,526 @@
+/**
+ * @file assets.c
+ * @author Alex Hoffman
+ * @date 23 January 2023
+ * @brief Loads images on a pool of threads while the emulator runs
+ *
+ * @verbatim
+ ----------------------------------------------------------------------
+ Copyright (C) Alexander Hoffman, 2023
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ any later version.
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ----------------------------------------------------------------------
+ @endverbatim
+ */
+
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <SDL2/SDL.h>
+#include <SDL2/SDL_image.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include "gfx_print.h"
+#include "gfx_utils.h"
+
+#include "EmulatorConfig.h"
+#include "assets.h"
+#include "frame_timing.h"
+#include "renderer.h"
+
+#define ASSET_NAME_LENGTH 128
+#define MANIFEST_LINE_LENGTH 256
+
+struct asset {
+    char filename[ASSET_NAME_LENGTH];
+    asset_type_e type;
+    asset_state_e state;
+    unsigned char preloading; ///< Counted in preload_pending
+    unsigned int users; ///< Requests of the pixels not yet released
+    renderer_texture_handle_t texture; ///< Owns the pixels once created
+    SDL_Surface *pixels;
+    uint64_t requested;
+    uint64_t started;
+    uint64_t finished;
+};
+
+static struct assets {
+    pthread_mutex_t lock;
+    pthread_cond_t queued;
+    // The graphics library's image loading and resource lookup are not
+    // made to be called by several threads at once, see vAssetsLockGfx
+    pthread_mutex_t gfx_lock;
+    int running;
+    unsigned int worker_count;
+    pthread_t workers[configASSET_WORKERS];
+    unsigned int count;
+    struct asset assets[configASSET_MAX_ASSETS];
+    // Assets waiting for a loading thread, each is queued at most once
+    unsigned int queue[configASSET_MAX_ASSETS];
+    unsigned int queue_head;
+    unsigned int queue_length;
+    unsigned int preload_pending;
+    uint64_t init_time;
+    asset_stats_t stats;
+} assets = { .lock = PTHREAD_MUTEX_INITIALIZER,
+             .queued = PTHREAD_COND_INITIALIZER,
+             .gfx_lock = PTHREAD_MUTEX_INITIALIZER
+           };
+
+// A task blocked in pthread_mutex_lock would keep running as far as the
+// scheduler knows, a task holding the lock would never run again. Tasks
+// poll for the locks instead, the loading threads block on them.
+static void vAssetsLock(pthread_mutex_t *lock)
+{
+    while (pthread_mutex_trylock(lock)) {
+        if (xTaskGetSchedulerState() == taskSCHEDULER_RUNNING) {
+            vTaskDelay(1);
+        }
+        else {
+            sched_yield();
+        }
+    }
+}
+
+// Called with the lock held
+static void vAssetQueue(struct asset *asset)
+{
+    assets.queue[(assets.queue_head + assets.queue_length) %
+                 configASSET_MAX_ASSETS] = asset - assets.assets;
+    assets.queue_length++;
+    asset->requested = ullFrameTimingNow();
+    asset->finished = 0;
+    __atomic_store_n(&asset->state, ASSET_QUEUED, __ATOMIC_RELEASE);
+
+    pthread_cond_signal(&assets.queued);
+}
+
+// Called with the lock held
+static struct asset *pxAssetFind(const char *filename, asset_type_e type)
+{
+    for (unsigned int i = 0; i < assets.count; i++)
+        if (assets.assets[i].type == type &&
+            !strcmp(assets.assets[i].filename, filename)) {
+            return &assets.assets[i];
+        }
+
+    return NULL;
+}
+
+static struct asset *pxAssetRequest(const char *filename, asset_type_e type,
+                                    int preload)
+{
+    struct asset *asset;
+
+    if (strlen(filename) >= ASSET_NAME_LENGTH) {
+        return NULL;
+    }
+
+    vAssetsLock(&assets.lock);
+
+    if (!(asset = pxAssetFind(filename, type))) {
+        if (assets.count == configASSET_MAX_ASSETS) {
+            goto out;
+        }
+
+        asset = &assets.assets[assets.count++];
+        memset(asset, 0, sizeof(struct asset));
+        strcpy(asset->filename, filename);
+        asset->type = type;
+        assets.stats.requested++;
+        vAssetQueue(asset);
+    }
+    else if (asset->state == ASSET_RELEASED) {
+        vAssetQueue(asset);
+    }
+
+    if (preload && !asset->finished && !asset->preloading) {
+        asset->preloading = 1;
+        assets.preload_pending++;
+    }
+    else if (!preload && type == ASSET_PIXELS) {
+        asset->users++;
+    }
+
+out:
+    pthread_mutex_unlock(&assets.lock);
+
+    return asset;
+}
+
+asset_handle_t xAssetRequest(const char *filename, asset_type_e type)
+{
+    return pxAssetRequest(filename, type, 0);
+}
+
+// Images are decoded the same as pixels, their texture is only created
+// once a task asks for it
+static int xAssetLoadPixels(struct asset *asset)
+{
+    char path[PATH_MAX];
+    SDL_Surface *loaded;
+    char *found;
+
+    pthread_mutex_lock(&assets.gfx_lock);
+    found = gfxUtilFindResourcePath(asset->filename);
+    if (found) {
+        snprintf(path, sizeof(path), "%s", found);
+    }
+    pthread_mutex_unlock(&assets.gfx_lock);
+
+    if (!found || !(loaded = IMG_Load(path))) {
+        return -1;
+    }
+
+    asset->pixels = SDL_ConvertSurfaceFormat(loaded, SDL_PIXELFORMAT_RGBA32,
+                    0);
+    SDL_FreeSurface(loaded);
+
+    return asset->pixels ? 0 : -1;
+}
+
+// Called with the lock held
+static void vAssetsPreloadDone(uint64_t now)
+{
+    if (!--assets.preload_pending) {
+        assets.stats.preload_time = now - assets.init_time;
+    }
+}
+
+// Called with the lock held
+static void vAssetFinish(struct asset *asset, int failed)
+{
+    uint64_t decode_time;
+
+    asset->finished = ullFrameTimingNow();
+    decode_time = asset->finished - asset->started;
+
+    assets.stats.queue_time += asset->started - asset->requested;
+    assets.stats.decode_time += decode_time;
+    if (decode_time > assets.stats.max_decode_time) {
+        assets.stats.max_decode_time = decode_time;
+    }
+
+    if (failed) {
+        assets.stats.failed++;
+    }
+    else {
+        assets.stats.ready++;
+    }
+
+    if (asset->preloading) {
+        asset->preloading = 0;
+        vAssetsPreloadDone(asset->finished);
+    }
+
+    __atomic_store_n(&asset->state, failed ? ASSET_FAILED : ASSET_READY,
+                     __ATOMIC_RELEASE);
+}
+
+static void *vAssetsWorker(void *args)
+{
+    struct asset *asset;
+    int ret;
+
+    pthread_mutex_lock(&assets.lock);
+
+    while (1) {
+        while (assets.running && !assets.queue_length) {
+            pthread_cond_wait(&assets.queued, &assets.lock);
+        }
+
+        if (!assets.running) {
+            break;
+        }
+
+        asset = &assets.assets[assets.queue[assets.queue_head]];
+        assets.queue_head = (assets.queue_head + 1) % configASSET_MAX_ASSETS;
+        assets.queue_length--;
+
+        asset->started = ullFrameTimingNow();
+        __atomic_store_n(&asset->state, ASSET_LOADING, __ATOMIC_RELAXED);
+
+        // Decoding is done without the lock, tasks can keep requesting
+        pthread_mutex_unlock(&assets.lock);
+        ret = xAssetLoadPixels(asset);
+        pthread_mutex_lock(&assets.lock);
+
+        vAssetFinish(asset, ret);
+    }
+
+    pthread_mutex_unlock(&assets.lock);
+
+    return NULL;
+}
+
+static int xAssetsReadManifest(const char *manifest)
+{
+    char line[MANIFEST_LINE_LENGTH], type[16], filename[ASSET_NAME_LENGTH];
+    unsigned int line_number = 0;
+    asset_type_e asset_type;
+    const char *path;
+    char *start;
+    FILE *file;
+    int ret = 0;
+
+    // Relative to the working directory, otherwise in the resources
+    if (!(file = fopen(manifest, "r"))) {
+        vAssetsLockGfx();
+        path = gfxUtilFindResourcePath((char *)manifest);
+        file = path ? fopen(path, "r") : NULL;
+        vAssetsUnlockGfx();
+    }
+
+    if (!file) {
+        PRINT_ERROR("Failed to open asset manifest '%s'", manifest);
+        return -1;
+    }
+
+    // Preloading is not done before the whole manifest was read
+    vAssetsLock(&assets.lock);
+    assets.preload_pending++;
+    pthread_mutex_unlock(&assets.lock);
+
+    while (fgets(line, sizeof(line), file)) {
+        line_number++;
+
+        for (start = line; isspace((unsigned char)*start); start++)
+            ;
+        if (!*start || *start == '#') {
+            continue;
+        }
+
+        if (sscanf(start, "%15s %127s", type, filename) != 2) {
+            goto err_line;
+        }
+
+        if (!strcmp(type, "image")) {
+            asset_type = ASSET_IMAGE;
+        }
+        else if (!strcmp(type, "pixels")) {
+            asset_type = ASSET_PIXELS;
+        }
+        else {
+            goto err_line;
+        }
+
+        if (!pxAssetRequest(filename, asset_type, 1)) {
+            PRINT_ERROR("Cannot preload '%s', more than %d assets",
+                        filename, configASSET_MAX_ASSETS);
+            ret = -1;
+            break;
+        }
+        continue;
+
+err_line:
+        PRINT_ERROR("%s:%u: expected 'image <file>' or 'pixels <file>'",
+                    manifest, line_number);
+        ret = -1;
+        break;
+    }
+
+    fclose(file);
+
+    vAssetsLock(&assets.lock);
+    vAssetsPreloadDone(ullFrameTimingNow());
+    pthread_mutex_unlock(&assets.lock);
+
+    return ret;
+}
+
+int xAssetsInit(const char *manifest)
+{
+    sigset_t all, old;
+    int ret;
+
+    // SDL_image loads its decoders on first use, which is not thread safe
+    IMG_Init(IMG_INIT_JPG | IMG_INIT_PNG);
+
+    assets.init_time = ullFrameTimingNow();
+
+    // The loading threads must not handle the signals that drive the
+    // FreeRTOS scheduler
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &old);
+    assets.running = 1;
+    for (assets.worker_count = 0; assets.worker_count < configASSET_WORKERS;
+         assets.worker_count++) {
+        ret = pthread_create(&assets.workers[assets.worker_count], NULL,
+                             vAssetsWorker, NULL);
+        if (ret) {
+            break;
+        }
+    }
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    if (!assets.worker_count) {
+        PRINT_ERROR("Failed to start asset threads: %s", strerror(ret));
+        assets.running = 0;
+        return -1;
+    }
+
+    if (manifest && xAssetsReadManifest(manifest)) {
+        vAssetsExit();
+        return -1;
+    }
+
+    return 0;
+}
+
+void vAssetsExit(void)
+{
+    vAssetsLock(&assets.lock);
+    if (!assets.running) {
+        pthread_mutex_unlock(&assets.lock);
+        return;
+    }
+    assets.running = 0;
+    pthread_cond_broadcast(&assets.queued);
+    pthread_mutex_unlock(&assets.lock);
+
+    for (unsigned int i = 0; i < assets.worker_count; i++) {
+        pthread_join(assets.workers[i], NULL);
+    }
+
+    for (unsigned int i = 0; i < assets.count; i++)
+        if (assets.assets[i].pixels) {
+            SDL_FreeSurface(assets.assets[i].pixels);
+            assets.assets[i].pixels = NULL;
+        }
+}
+
+asset_state_e xAssetGetState(asset_handle_t asset)
+{
+    if (!asset) {
+        return ASSET_FAILED;
+    }
+
+    return __atomic_load_n(&asset->state, __ATOMIC_ACQUIRE);
+}
+
+int xAssetWait(asset_handle_t asset, TickType_t timeout)
+{
+    TickType_t start = xTaskGetTickCount();
+    uint64_t wait_start = ullFrameTimingNow();
+    asset_state_e state;
+
+    // The loading threads cannot notify a task
+    while ((state = xAssetGetState(asset)) == ASSET_QUEUED ||
+           state == ASSET_LOADING) {
+        if (xTaskGetTickCount() - start >= timeout) {
+            break;
+        }
+        vTaskDelay(1);
+    }
+
+    __atomic_fetch_add(&assets.stats.wait_time,
+                       ullFrameTimingNow() - wait_start, __ATOMIC_RELAXED);
+
+    return state == ASSET_READY ? 0 : -1;
+}
+
+renderer_texture_handle_t xAssetGetTexture(asset_handle_t asset)
+{
+    renderer_texture_handle_t texture;
+
+    if (xAssetGetState(asset) != ASSET_READY ||
+        asset->type != ASSET_IMAGE) {
+        return NULL;
+    }
+
+    vAssetsLock(&assets.lock);
+    if (!asset->texture && asset->pixels) {
+        // The texture frees the pixels once they are uploaded
+        asset->texture = xRendererTextureCreate(asset->pixels);
+        asset->pixels = NULL;
+    }
+    texture = asset->texture;
+    pthread_mutex_unlock(&assets.lock);
+
+    return texture;
+}
+
+struct SDL_Surface *xAssetGetPixels(asset_handle_t asset)
+{
+    if (xAssetGetState(asset) != ASSET_READY ||
+        asset->type != ASSET_PIXELS) {
+        return NULL;
+    }
+
+    return asset->pixels;
+}
+
+void vAssetRelease(asset_handle_t asset)
+{
+    if (!asset || asset->type != ASSET_PIXELS) {
+        return;
+    }
+
+    vAssetsLock(&assets.lock);
+
+    if (asset->users && !--asset->users && asset->state == ASSET_READY) {
+        SDL_FreeSurface(asset->pixels);
+        asset->pixels = NULL;
+        __atomic_store_n(&asset->state, ASSET_RELEASED, __ATOMIC_RELEASE);
+    }
+
+    pthread_mutex_unlock(&assets.lock);
+}
+
+uint64_t ullAssetGetLoadTime(asset_handle_t asset)
+{
+    uint64_t load_time = 0;
+
+    if (!asset) {
+        return 0;
+    }
+
+    vAssetsLock(&assets.lock);
+    if (asset->finished) {
+        load_time = asset->finished - asset->requested;
+    }
+    pthread_mutex_unlock(&assets.lock);
+
+    return load_time;
+}
+
+int xAssetsPreloaded(void)
+{
+    return !__atomic_load_n(&assets.preload_pending, __ATOMIC_RELAXED);
+}
+
+void vAssetsLockGfx(void)
+{
+    vAssetsLock(&assets.gfx_lock);
+}
+
+void vAssetsUnlockGfx(void)
+{
+    pthread_mutex_unlock(&assets.gfx_lock);
+}
+
+void vAssetsGetStats(asset_stats_t *stats)
+{
+    vAssetsLock(&assets.lock);
+    *stats = assets.stats;
+    pthread_mutex_unlock(&assets.lock);
+
+    stats->wait_time = __atomic_load_n(&assets.stats.wait_time,
+                                       __ATOMIC_RELAXED);
+}
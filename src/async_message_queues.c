@@ -2,7 +2,7 @@
  * @file async_message_queues.c
  * @author Alex Hoffman
  * @date 23 January 2023
- * @brief Basic example functions on how to use the message queues in the AIO library
+ * @brief Basic example functions on how to use the message queues through the reactor
  *
  * @verbatim
  ----------------------------------------------------------------------
@@ -32,12 +32,16 @@
 
 #define MSG_QUEUE_BUFFER_SIZE 1000
 #define MSG_QUEUE_MAX_MSG_COUNT 10
+#define SHM_QUEUE_SLOT_SIZE 1000
+#define SHM_QUEUE_SLOT_COUNT 256
 
 const char *mq_one_name = "FreeRTOS_MQ_one_1";
 const char *mq_two_name = "FreeRTOS_MQ_two_1";
+const char *shm_one_name = "FreeRTOS_SHM_one_1";
 
-aIO_handle_t mq_one = NULL;
-aIO_handle_t mq_two = NULL;
+reactor_handle_t mq_one = NULL;
+reactor_handle_t mq_two = NULL;
+shm_queue_handle_t shm_one = NULL;
 
 TaskHandle_t MQDemoTask = NULL;
 
@@ -51,12 +55,23 @@ void MQHanderTwo(size_t read_size, char *buffer, void *args)
     prints("MQ Recv in second handler: %s\n", buffer);
 }
 
+void SHMHandlerOne(size_t read_size, char *buffer, void *args)
+{
+    // The message is read straight out of shared memory, it is not null
+    // terminated
+    prints("SHM Recv in first handler: %.*s\n", (int)read_size, buffer);
+}
+
 void vMQDemoTask(void *pvParameters)
 {
-    mq_one = aIOOpenMessageQueue(mq_one_name, MSG_QUEUE_MAX_MSG_COUNT,
-                                 MSG_QUEUE_BUFFER_SIZE, MQHandlerOne, NULL);
-    mq_two = aIOOpenMessageQueue(mq_two_name, MSG_QUEUE_MAX_MSG_COUNT,
-                                 MSG_QUEUE_BUFFER_SIZE, MQHanderTwo, NULL);
+    mq_one = xReactorOpenMessageQueue(mq_one_name, MSG_QUEUE_MAX_MSG_COUNT,
+                                      MSG_QUEUE_BUFFER_SIZE, MQHandlerOne,
+                                      NULL);
+    mq_two = xReactorOpenMessageQueue(mq_two_name, MSG_QUEUE_MAX_MSG_COUNT,
+                                      MSG_QUEUE_BUFFER_SIZE, MQHanderTwo,
+                                      NULL);
+    shm_one = xShmQueueOpen(shm_one_name, SHM_QUEUE_SLOT_COUNT,
+                            SHM_QUEUE_SLOT_SIZE, SHMHandlerOne, NULL);
 
     while (1)
 
@@ -2,7 +2,7 @@
  * @file async_sockets.c
  * @author Alex Hoffman
  * @date 23 January 2023
- * @brief Basic example functions on how to use the sockets in the AIO library
+ * @brief Basic example functions on how to use the sockets
 
  *
  * @verbatim
@@ -33,85 +33,62 @@
 #include "async_sockets.h"
 #include "demo_tasks.h"
 
-aIO_handle_t udp_soc_one = NULL;
-aIO_handle_t udp_soc_two = NULL;
-aIO_handle_t tcp_soc = NULL;
+rx_ring_handle_t udp_soc_one = NULL;
+rx_ring_handle_t udp_soc_two = NULL;
+reactor_handle_t tcp_soc = NULL;
 
 TaskHandle_t UDPDemoTask = NULL;
 TaskHandle_t TCPDemoTask = NULL;
 
-void vUDPHandlerOne(size_t read_size, char *buffer, void *args)
+void vUDPHandlerOne(rx_buffer_t *buffer, void *args)
 {
-    prints("UDP Recv in first handler: %s\n", buffer);
-}
+    prints("UDP Recv in first handler: %s\n", buffer->data);
 
-#define FIRST_INT buffer
-#define FIRST_STRING (FIRST_INT + sizeof(int))
-#define COMMON_STRUCT (FIRST_STRING + sizeof(char) * 10)
-#define ITEM_ARRAY (COMMON_STRUCT + sizeof(struct common_struct))
-#define ITEM_ARRAY_ITEM(index) (ITEM_ARRAY + index * sizeof(char) * 3)
+    // The buffer is only lent to the handler, it must be given back once we
+    // are done with it so that it can receive the next datagram
+    vRxRingRelease(buffer);
+}
 
-void vUDPHandlerTwo(size_t read_size, char *buffer, void *args)
+void vUDPHandlerTwo(rx_buffer_t *buffer, void *args)
 {
-    // Here we can either include a shared definition of the incomming
-    // data structure and type cast it, eg. what we will do for "my_common_struct"
-    // defined in demo_tasks.h
-
-    // First item is an integer, ie. there is a sizeof(int) number of bytes at
-    // address buffer that we want to cast into an int variable.
-    // More specifically what we are doing here is casting buffer, ie. a char *,
-    // to an int * so that the compiler knows that at location buffer we have an int,
-    // we then dereference this address and read an int since we use * on the casted
-    // address. The outside bracket here is important, it makes sure that we first cast
-    // the address and then dereference it.
-
-    int my_int = *((int *)FIRST_INT);
-    printf("My int: %d\n", my_int);
-
-    // We then want to get our char array of length 10 that starts after the int
-    // Thus we know we need to move in memory sizeof(int) bytes on from the start
-    // of the buffer. As we know, strings only need a pointer to the beginning,
-    // functions such as printf will then simply traverse the string in memeory
-    // until we hit the termination character. If we wanted to copy the string
-    // we would have to use a function such as memcpy or strcpy to create a copy.
-
-    // Pointer to string in struct
-    char *my_string = (char *)FIRST_STRING;
-
-    // Our own copy of the string
-    // Please note the casting of the char array here, to find out more why read
-    // https://stackoverflow.com/questions/1461432/what-is-array-to-pointer-decay
-    char my_string_copy[10];
-    strcpy((char *)my_string_copy, FIRST_STRING);
-
-    printf("My string: %s\nand the copy: %s\n", my_string,
-           (char *)my_string_copy);
-
-    // The next chunk of the packet is a struct who's definition we have in
-    // demo_tasks.h, thus we can just cast the region of memory, this is possible
-    // because we made sure our structs are packed, ie. the compiler doesn't add
-    // padding.
-    struct common_struct *my_common_struct =
-        (struct common_struct *)(COMMON_STRUCT);
-
-    printf("First int: %d\nsecond int: %d\n", my_common_struct->first_int,
-           my_common_struct->second_int);
-
-    // We now have an array of items that we need to parse, if the item is used
-    // then we have set the .populated member to 1 so we know that the item
-    // contains valid data
-    struct item_data {
-        char x;
-        char y;
-    };
-
-    for (int i = 0; i < 3; i++) {
-        if (*(char *)ITEM_ARRAY_ITEM(i)) {
-            struct item_data *tmp =
-                (struct item_data *)(ITEM_ARRAY_ITEM(i) + sizeof(char));
-            printf("Items values: %d, %d\n", tmp->x, tmp->y);
+    demo_message_t message;
+
+    // The message's layout is defined in demo_tasks.h, shared with the
+    // sender. Decoding checks that the whole message was received before
+    // reading any of it, so a short or malformed packet can never make us
+    // read past the end of the buffer. Integers are converted from the
+    // little endian byte order they are sent in.
+    if (xDemoMessageDecode(buffer->data, buffer->length, &message)) {
+        prints("UDP Recv in second handler: short packet of %zu bytes\n",
+               buffer->length);
+        goto release;
+    }
+
+    printf("My int: %d\n", message.my_int);
+
+    // The string is not copied, it points into the ring's buffer and stays
+    // there until we release it. If we wanted to keep the string after that
+    // we would have to use a function such as memcpy to create a copy. The
+    // field is not necessarily terminated so its length is used to print it.
+    printf("My string: %.*s\n", (int)message.my_string.length,
+           message.my_string.data);
+
+    printf("First int: %d\nsecond int: %d\n",
+           message.my_common_struct.first_int,
+           message.my_common_struct.second_int);
+
+    // We now have an array of items, if the item is used then the sender has
+    // set the .populated member to 1 so we know that the item contains valid
+    // data
+    for (int i = 0; i < DEMO_ITEM_COUNT; i++) {
+        if (message.my_items[i].populated) {
+            printf("Items values: %d, %d\n", message.my_items[i].x,
+                   message.my_items[i].y);
         }
     }
+
+release:
+    vRxRingRelease(buffer);
 }
 
 void vUDPDemoTask(void *pvParameters)
@@ -119,8 +96,8 @@ void vUDPDemoTask(void *pvParameters)
     char *addr = NULL; // Loopback
     in_port_t port = UDP_TEST_PORT_1;
 
-    udp_soc_one = aIOOpenUDPSocket(addr, port, UDP_BUFFER_SIZE,
-                                   vUDPHandlerOne, NULL);
+    udp_soc_one = xRxRingOpenUDP(addr, port, UDP_BUFFER_SIZE,
+                                 vUDPHandlerOne, NULL);
 
     prints("UDP socket opened on port %d\n", port);
     prints("Demo UDP Socket can be tested using\n");
@@ -128,8 +105,8 @@ void vUDPDemoTask(void *pvParameters)
 
     port = UDP_TEST_PORT_2;
 
-    udp_soc_two = aIOOpenUDPSocket(addr, port, UDP_BUFFER_SIZE,
-                                   vUDPHandlerTwo, NULL);
+    udp_soc_two = xRxRingOpenUDP(addr, port, UDP_BUFFER_SIZE,
+                                 vUDPHandlerTwo, NULL);
 
     prints("UDP socket opened on port %d\n", port);
     prints("Demo UDP Socket can be tested using\n");
@@ -150,8 +127,7 @@ void vTCPDemoTask(void *pvParameters)
     char *addr = NULL; // Loopback
     in_port_t port = TCP_TEST_PORT;
 
-    tcp_soc = aIOOpenTCPSocket(addr, port, TCP_BUFFER_SIZE, vTCPHandler,
-                               NULL);
+    tcp_soc = xReactorOpenTCPSocket(addr, port, vTCPHandler, NULL);
 
     prints("TCP socket opened on port %d\n", port);
     prints("Demo TCP socket can be tested using\n");
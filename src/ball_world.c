@@ -0,0 +1,539 @@
+/**
+ * @file ball_world.c
+ * @author Alex Hoffman
+ * @date 23 January 2023
+ * @brief Batched physics of many balls bouncing off walls and each other
+ *
+ * @verbatim
+ ----------------------------------------------------------------------
+ Copyright (C) Alexander Hoffman, 2023
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ any later version.
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ----------------------------------------------------------------------
+ @endverbatim
+ */
+
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "FreeRTOS.h"
+
+#include "gfx_print.h"
+
+#include "ball_world.h"
+
+// Balls moved per vector operation, GCC splits the vectors into whatever
+// the target supports, eg. two SSE or one AVX operation
+#define BALL_WORLD_LANES 8
+#define BALL_WORLD_ALIGN (BALL_WORLD_LANES * sizeof(float))
+
+typedef float vfloat_t
+__attribute__((vector_size(BALL_WORLD_LANES * sizeof(float))));
+typedef int32_t vint_t
+__attribute__((vector_size(BALL_WORLD_LANES * sizeof(int32_t))));
+
+#if BALL_WORLD_MAX_WALLS > 32
+#error "The walls of a cell are a 32 bit mask"
+#endif
+
+struct ball_world {
+    unsigned int count;
+    unsigned int capacity; // A multiple of BALL_WORLD_LANES
+
+    // Read by every step, each aligned to a vector
+    float *x;
+    float *y;
+    float *dx;
+    float *dy;
+    float *radius;
+    int32_t *cell; // Grid cell each ball's centre was in this step
+    float *prev_x; // Positions before the step, to interpolate between
+    float *prev_y;
+
+    float *max_speed;
+    unsigned int *colour;
+    callback_t *callback;
+    void **args;
+
+    // Grid, the balls in cell c are sorted[cell_start[c]] up to
+    // sorted[cell_start[c + 1]]
+    float grid_x;
+    float grid_y;
+    float cell_size;
+    int32_t columns;
+    int32_t rows;
+    uint32_t *cell_start;
+    uint32_t *cell_next;
+    uint32_t *sorted;
+    uint32_t *cell_walls; // Bit n set if walls[n] is near the cell
+
+    wall_t *walls[BALL_WORLD_MAX_WALLS];
+    unsigned int wall_count;
+
+    void *memory; // Aligned start of allocation
+    void *allocation;
+};
+
+// Lanes of a where mask is set, else of b
+#define VEC_SELECT(mask, a, b) \
+    ((vfloat_t)(((vint_t)(a) & (mask)) | ((vint_t)(b) & ~(mask))))
+#define VEC_CLAMP(v, min, max) \
+    VEC_SELECT((v) > (float)(max), (vfloat_t) {} + (float)(max), \
+               VEC_SELECT((v) < (float)(min), (vfloat_t) {} + (float)(min), \
+                          (v)))
+
+static inline float fClamp(float v, float min, float max)
+{
+    return v < min ? min : v > max ? max : v;
+}
+
+// Takes the next aligned array from the world's memory, or only counts its
+// size while there is no memory yet
+static void *pvBallWorldCarve(char *memory, size_t *offset, size_t size)
+{
+    size_t ret = *offset;
+
+    *offset += (size + BALL_WORLD_ALIGN - 1) & ~(BALL_WORLD_ALIGN - 1);
+
+    return memory ? memory + ret : NULL;
+}
+
+static size_t xBallWorldLayout(struct ball_world *world, char *memory)
+{
+    size_t offset = 0;
+    size_t balls = world->capacity;
+    size_t cells = (size_t)world->columns * world->rows;
+
+#define CARVE(size) pvBallWorldCarve(memory, &offset, size)
+    world->x = CARVE(balls * sizeof(float));
+    world->y = CARVE(balls * sizeof(float));
+    world->dx = CARVE(balls * sizeof(float));
+    world->dy = CARVE(balls * sizeof(float));
+    world->radius = CARVE(balls * sizeof(float));
+    world->cell = CARVE(balls * sizeof(int32_t));
+    world->prev_x = CARVE(balls * sizeof(float));
+    world->prev_y = CARVE(balls * sizeof(float));
+    world->max_speed = CARVE(balls * sizeof(float));
+    world->colour = CARVE(balls * sizeof(unsigned int));
+    world->callback = CARVE(balls * sizeof(callback_t));
+    world->args = CARVE(balls * sizeof(void *));
+    world->sorted = CARVE(balls * sizeof(uint32_t));
+    world->cell_start = CARVE((cells + 1) * sizeof(uint32_t));
+    world->cell_next = CARVE(cells * sizeof(uint32_t));
+    world->cell_walls = CARVE(cells * sizeof(uint32_t));
+#undef CARVE
+
+    return offset;
+}
+
+ball_world_handle_t xBallWorldCreate(unsigned int max_balls, float x,
+                                     float y, float w, float h,
+                                     float cell_size)
+{
+    struct ball_world *world;
+    size_t size;
+
+    if (!max_balls || w <= 0 || h <= 0 || cell_size <= 0) {
+        fprints(stderr, "Invalid ball world size\n");
+        goto err_world;
+    }
+
+    world = pvPortMalloc(sizeof(struct ball_world));
+    if (!world) {
+        fprints(stderr, "Failed to allocate ball world\n");
+        goto err_world;
+    }
+    memset(world, 0, sizeof(struct ball_world));
+
+    world->capacity = (max_balls + BALL_WORLD_LANES - 1) &
+                      ~(BALL_WORLD_LANES - 1);
+    world->grid_x = x;
+    world->grid_y = y;
+    world->cell_size = cell_size;
+    world->columns = ceilf(w / cell_size);
+    world->rows = ceilf(h / cell_size);
+
+    // The FreeRTOS heap only aligns to 8 bytes, the arrays are aligned to a
+    // vector within a larger allocation
+    size = xBallWorldLayout(world, NULL);
+    world->allocation = pvPortMalloc(size + BALL_WORLD_ALIGN - 1);
+    if (!world->allocation) {
+        fprints(stderr, "Failed to allocate %zu bytes for ball world\n",
+                size);
+        goto err_memory;
+    }
+    world->memory = (void *)(((uintptr_t)world->allocation +
+                              BALL_WORLD_ALIGN - 1) &
+                             ~(uintptr_t)(BALL_WORLD_ALIGN - 1));
+    memset(world->memory, 0, size);
+    xBallWorldLayout(world, world->memory);
+
+    return world;
+
+err_memory:
+    vPortFree(world);
+err_world:
+    return NULL;
+}
+
+void vBallWorldDelete(ball_world_handle_t world)
+{
+    if (world) {
+        vPortFree(world->allocation);
+        vPortFree(world);
+    }
+}
+
+static int32_t xBallWorldColumn(struct ball_world *world, float x)
+{
+    return fClamp((x - world->grid_x) / world->cell_size, 0,
+                  world->columns - 1);
+}
+
+static int32_t xBallWorldRow(struct ball_world *world, float y)
+{
+    return fClamp((y - world->grid_y) / world->cell_size, 0,
+                  world->rows - 1);
+}
+
+int xBallWorldAddWall(ball_world_handle_t world, wall_t *wall)
+{
+    // A ball's centre is at most half a cell from the edge of what it
+    // touches
+    float margin = world->cell_size / 2;
+    int32_t left, right, top, bottom;
+    uint32_t bit;
+
+    if (world->wall_count == BALL_WORLD_MAX_WALLS) {
+        fprints(stderr, "Ball world has too many walls\n");
+        return -1;
+    }
+
+    left = xBallWorldColumn(world, wall->x1 - margin);
+    right = xBallWorldColumn(world, wall->x1 + wall->w + margin);
+    top = xBallWorldRow(world, wall->y1 - margin);
+    bottom = xBallWorldRow(world, wall->y1 + wall->h + margin);
+
+    bit = 1U << world->wall_count;
+    for (int32_t row = top; row <= bottom; row++) {
+        for (int32_t column = left; column <= right; column++) {
+            world->cell_walls[row * world->columns + column] |= bit;
+        }
+    }
+
+    world->walls[world->wall_count++] = wall;
+
+    return 0;
+}
+
+int xBallWorldAddBall(ball_world_handle_t world, float x, float y, float dx,
+                      float dy, float radius, unsigned int colour,
+                      float max_speed, callback_t callback, void *args)
+{
+    unsigned int i = world->count;
+
+    if (i == world->capacity) {
+        fprints(stderr, "Ball world is full\n");
+        return -1;
+    }
+    if (radius <= 0) {
+        fprints(stderr, "Ball of radius %.0f has no area\n", radius);
+        return -1;
+    }
+    if (radius * 2 > world->cell_size) {
+        fprints(stderr, "Ball of radius %.0f is larger than the grid's "
+                "cells\n", radius);
+        return -1;
+    }
+
+    world->radius[i] = radius;
+    world->max_speed[i] = max_speed;
+    world->colour[i] = colour;
+    world->callback[i] = callback;
+    world->args[i] = args;
+    world->count++;
+
+    xBallWorldSetBall(world, i, x, y, dx, dy);
+
+    return i;
+}
+
+int xBallWorldSetBall(ball_world_handle_t world, unsigned int index, float x,
+                      float y, float dx, float dy)
+{
+    if (index >= world->count) {
+        return -1;
+    }
+
+    world->x[index] = x;
+    world->y[index] = y;
+    world->prev_x[index] = x;
+    world->prev_y[index] = y;
+    world->dx[index] = dx;
+    world->dy[index] = dy;
+
+    return 0;
+}
+
+void vBallWorldClear(ball_world_handle_t world)
+{
+    size_t size = world->capacity * sizeof(float);
+
+    // Unused lanes are still moved, they must stay still
+    memset(world->x, 0, size);
+    memset(world->y, 0, size);
+    memset(world->dx, 0, size);
+    memset(world->dy, 0, size);
+    world->count = 0;
+}
+
+void vBallWorldGetView(ball_world_handle_t world, ball_world_view_t *view)
+{
+    view->count = world->count;
+    view->x = world->x;
+    view->y = world->y;
+    view->prev_x = world->prev_x;
+    view->prev_y = world->prev_y;
+    view->dx = world->dx;
+    view->dy = world->dy;
+    view->radius = world->radius;
+    view->colour = world->colour;
+}
+
+static void vBallWorldIntegrate(struct ball_world *world, float seconds)
+{
+    unsigned int end = (world->count + BALL_WORLD_LANES - 1) &
+                       ~(BALL_WORLD_LANES - 1);
+
+    for (unsigned int i = 0; i < end; i += BALL_WORLD_LANES) {
+        vfloat_t *x = (vfloat_t *)&world->x[i];
+        vfloat_t *y = (vfloat_t *)&world->y[i];
+
+        *(vfloat_t *)&world->prev_x[i] = *x;
+        *(vfloat_t *)&world->prev_y[i] = *y;
+        *x += *(vfloat_t *)&world->dx[i] * seconds;
+        *y += *(vfloat_t *)&world->dy[i] * seconds;
+    }
+}
+
+// Finds the cell of every ball, then sorts the balls by cell
+static void vBallWorldBin(struct ball_world *world)
+{
+    unsigned int end = (world->count + BALL_WORLD_LANES - 1) &
+                       ~(BALL_WORLD_LANES - 1);
+    uint32_t cells = world->columns * world->rows;
+    float scale = 1 / world->cell_size;
+
+    for (unsigned int i = 0; i < end; i += BALL_WORLD_LANES) {
+        vfloat_t column = (*(vfloat_t *)&world->x[i] - world->grid_x) * scale;
+        vfloat_t row = (*(vfloat_t *)&world->y[i] - world->grid_y) * scale;
+
+        // Balls outside of the grid are kept in the cells along its edges
+        column = VEC_CLAMP(column, 0, world->columns - 1);
+        row = VEC_CLAMP(row, 0, world->rows - 1);
+
+        *(vint_t *)&world->cell[i] =
+            __builtin_convertvector(row, vint_t) * world->columns +
+            __builtin_convertvector(column, vint_t);
+    }
+
+    memset(world->cell_start, 0, (cells + 1) * sizeof(uint32_t));
+    for (unsigned int i = 0; i < world->count; i++) {
+        world->cell_start[world->cell[i] + 1]++;
+    }
+    for (uint32_t c = 0; c < cells; c++) {
+        world->cell_start[c + 1] += world->cell_start[c];
+        world->cell_next[c] = world->cell_start[c];
+    }
+    for (unsigned int i = 0; i < world->count; i++) {
+        world->sorted[world->cell_next[world->cell[i]]++] = i;
+    }
+}
+
+static void vBallWorldLimitSpeed(struct ball_world *world, unsigned int i)
+{
+    float max = world->max_speed[i];
+    float speed2 = world->dx[i] * world->dx[i] + world->dy[i] * world->dy[i];
+    float scale;
+
+    if (max > 0 && speed2 > max * max) {
+        scale = max / sqrtf(speed2);
+        world->dx[i] *= scale;
+        world->dy[i] *= scale;
+    }
+}
+
+static void vBallWorldCallback(struct ball_world *world, unsigned int i)
+{
+    if (world->callback[i]) {
+        world->callback[i](world->args[i]);
+    }
+}
+
+static int xBallWorldCollideWall(struct ball_world *world, unsigned int i,
+                                 wall_t *wall)
+{
+    float left = wall->x1, right = wall->x1 + wall->w;
+    float top = wall->y1, bottom = wall->y1 + wall->h;
+    float x = world->x[i], y = world->y[i], r = world->radius[i];
+    float nx, ny, depth, distance, speed;
+    // Point of the wall closest to the ball's centre
+    float px = fClamp(x, left, right), py = fClamp(y, top, bottom);
+    float distance2 = (x - px) * (x - px) + (y - py) * (y - py);
+
+    if (distance2 >= r * r) {
+        return 0;
+    }
+
+    if (distance2 > 0) {
+        distance = sqrtf(distance2);
+        nx = (x - px) / distance;
+        ny = (y - py) / distance;
+        depth = r - distance;
+    }
+    else {
+        // The centre is inside the wall, leave through the closest side
+        float sides[4] = { x - left, right - x, y - top, bottom - y };
+        float normals[4][2] = { { -1, 0 }, { 1, 0 }, { 0, -1 }, { 0, 1 } };
+        unsigned int closest = 0;
+
+        for (unsigned int s = 1; s < 4; s++) {
+            if (sides[s] < sides[closest]) {
+                closest = s;
+            }
+        }
+        nx = normals[closest][0];
+        ny = normals[closest][1];
+        depth = sides[closest] + r;
+    }
+
+    world->x[i] += nx * depth;
+    world->y[i] += ny * depth;
+
+    // Reflects the speed towards the wall, less the wall's dampening
+    speed = world->dx[i] * nx + world->dy[i] * ny;
+    if (speed < 0) {
+        world->dx[i] -= (2 - wall->dampening) * speed * nx;
+        world->dy[i] -= (2 - wall->dampening) * speed * ny;
+        vBallWorldLimitSpeed(world, i);
+    }
+
+    if (wall->callback) {
+        wall->callback(wall->args);
+    }
+    vBallWorldCallback(world, i);
+
+    return 1;
+}
+
+static int xBallWorldCollideBalls(struct ball_world *world, unsigned int i,
+                                  unsigned int j)
+{
+    float x = world->x[j] - world->x[i], y = world->y[j] - world->y[i];
+    float r = world->radius[i] + world->radius[j];
+    float distance2 = x * x + y * y;
+    float distance, nx = 1, ny = 0, inv_mi, inv_mj, speed, impulse, push;
+
+    if (distance2 >= r * r) {
+        return 0;
+    }
+
+    distance = sqrtf(distance2);
+    if (distance > 0) {
+        nx = x / distance;
+        ny = y / distance;
+    }
+
+    // Balls are flat discs, their mass is proportional to their area. The
+    // inverse masses are used such that a heavier ball moves less, radii
+    // are never 0.
+    inv_mi = 1 / (world->radius[i] * world->radius[i]);
+    inv_mj = 1 / (world->radius[j] * world->radius[j]);
+
+    // Separates the balls, the lighter one moves further
+    push = (r - distance) / (inv_mi + inv_mj);
+    world->x[i] -= nx * push * inv_mi;
+    world->y[i] -= ny * push * inv_mi;
+    world->x[j] += nx * push * inv_mj;
+    world->y[j] += ny * push * inv_mj;
+
+    // Elastic bounce if they are moving towards each other
+    speed = (world->dx[j] - world->dx[i]) * nx +
+            (world->dy[j] - world->dy[i]) * ny;
+    if (speed < 0) {
+        impulse = -2 * speed / (inv_mi + inv_mj);
+        world->dx[i] -= impulse * inv_mi * nx;
+        world->dy[i] -= impulse * inv_mi * ny;
+        world->dx[j] += impulse * inv_mj * nx;
+        world->dy[j] += impulse * inv_mj * ny;
+        vBallWorldLimitSpeed(world, i);
+        vBallWorldLimitSpeed(world, j);
+    }
+
+    vBallWorldCallback(world, i);
+    vBallWorldCallback(world, j);
+
+    return 1;
+}
+
+static unsigned int uBallWorldCollide(struct ball_world *world,
+                                      unsigned int i)
+{
+    int32_t column = world->cell[i] % world->columns;
+    int32_t row = world->cell[i] / world->columns;
+    uint32_t walls = world->cell_walls[world->cell[i]];
+    unsigned int collisions = 0;
+
+    while (walls) {
+        collisions += xBallWorldCollideWall(world, i,
+                                            world->walls[__builtin_ctz(walls)]);
+        walls &= walls - 1;
+    }
+
+    // Each pair is tested once, by the ball with the lower index
+    for (int32_t r = row - 1; r <= row + 1; r++) {
+        if (r < 0 || r >= world->rows) {
+            continue;
+        }
+        for (int32_t c = column - 1; c <= column + 1; c++) {
+            if (c < 0 || c >= world->columns) {
+                continue;
+            }
+            int32_t cell = r * world->columns + c;
+            for (uint32_t k = world->cell_start[cell];
+                 k < world->cell_start[cell + 1]; k++) {
+                if (world->sorted[k] > i) {
+                    collisions += xBallWorldCollideBalls(world, i,
+                                                         world->sorted[k]);
+                }
+            }
+        }
+    }
+
+    return collisions;
+}
+
+unsigned int uBallWorldStep(ball_world_handle_t world, float seconds)
+{
+    unsigned int collisions = 0;
+
+    vBallWorldIntegrate(world, seconds);
+    vBallWorldBin(world);
+
+    // In cell order, such that the balls tested against each other are
+    // close together in memory
+    for (unsigned int k = 0; k < world->count; k++) {
+        collisions += uBallWorldCollide(world, world->sorted[k]);
+    }
+
+    return collisions;
+}
@@ -3,8 +3,8 @@
  * @file buttons.c
  * @author Alex Hoffman
  * @date 23 January 2023
- * @brief A simple implementation of managing a global lookup table containins
- * button press status information
+ * @brief Lock-free snapshots of the keyboard's button states and a ring of
+ * button press and release events
  *
  * @verbatim
  ----------------------------------------------------------------------
@@ -23,33 +23,244 @@
  @endverbatim
  */
 
-#include "gfx_event.h"
+#include <SDL2/SDL.h>
+
 #include "gfx_print.h"
 
 #include "buttons.h"
+#include "frame_timing.h"
+#include "journal.h"
+
+// Must be a power of two
+#define EDGE_RING_LENGTH 256
+
+static struct buttons {
+    // Odd while the snapshot is being written
+    unsigned long sequence;
+    buttons_snapshot_t snapshot;
+    // Number of edges ever written, the next edge goes into
+    // edges[head % EDGE_RING_LENGTH]
+    unsigned long head;
+    button_edge_t edges[EDGE_RING_LENGTH];
+} buttons = { 0 };
+
+// Only ever called by one writer at a time, see xButtonsEventWatch
+static void vButtonsApplyKey(unsigned int scancode, int pressed,
+                             uint64_t now)
+{
+    button_edge_t *edge;
+    uint64_t word, bit;
+    unsigned long head;
+
+    bit = 1ULL << (scancode % BUTTONS_WORD_BITS);
+
+    __atomic_store_n(&buttons.sequence, buttons.sequence + 1,
+                     __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    word = buttons.snapshot.pressed[scancode / BUTTONS_WORD_BITS];
+    word = pressed ? word | bit : word & ~bit;
+    __atomic_store_n(&buttons.snapshot.pressed[scancode / BUTTONS_WORD_BITS],
+                     word, __ATOMIC_RELAXED);
+    __atomic_store_n(&buttons.snapshot.timestamp, now, __ATOMIC_RELAXED);
 
-buttons_buffer_t buttons = { 0 };
+    __atomic_store_n(&buttons.sequence, buttons.sequence + 1,
+                     __ATOMIC_RELEASE);
 
-void vGetButtonInput(void)
+    head = buttons.head;
+    edge = &buttons.edges[head % EDGE_RING_LENGTH];
+    __atomic_store_n(&edge->timestamp, now, __ATOMIC_RELAXED);
+    __atomic_store_n(&edge->scancode, scancode, __ATOMIC_RELAXED);
+    __atomic_store_n(&edge->pressed, pressed, __ATOMIC_RELAXED);
+    __atomic_store_n(&buttons.head, head + 1, __ATOMIC_RELEASE);
+}
+
+static void vButtonsApplyMouse(int32_t x, int32_t y, uint32_t mask)
+{
+    __atomic_store_n(&buttons.sequence, buttons.sequence + 1,
+                     __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    __atomic_store_n(&buttons.snapshot.mouse.x, x, __ATOMIC_RELAXED);
+    __atomic_store_n(&buttons.snapshot.mouse.y, y, __ATOMIC_RELAXED);
+    __atomic_store_n(&buttons.snapshot.mouse.buttons, mask,
+                     __ATOMIC_RELAXED);
+
+    __atomic_store_n(&buttons.sequence, buttons.sequence + 1,
+                     __ATOMIC_RELEASE);
+}
+
+static void vButtonsPlayKey(const journal_record_t *record,
+                            const char *data)
 {
-    if (xSemaphoreTake(buttons.lock, 0) == pdTRUE) {
-        xQueueReceive(buttonInputQueue, &buttons.buttons, 0);
-        xSemaphoreGive(buttons.lock);
+    // Stamped with the time of the press, not of the replay
+    if (record->source < SDL_NUM_SCANCODES) {
+        vButtonsApplyKey(record->source, record->flags, record->time);
     }
 }
 
-int xButtonsInit(void)
+static void vButtonsPlayMouse(const journal_record_t *record,
+                              const char *data)
 {
-    buttons.lock = xSemaphoreCreateMutex(); // Locking mechanism
-    if (!buttons.lock) {
-        PRINT_ERROR("Failed to create buttons lock");
-        return -1;
+    vButtonsApplyMouse((int16_t)(record->source & 0xffff),
+                       (int16_t)(record->source >> 16), record->flags);
+}
+
+static void vButtonsMouseEvent(int32_t x, int32_t y, uint32_t mask)
+{
+    vJournalRecord(JOURNAL_MOUSE, (uint16_t)x | (uint32_t)(uint16_t)y << 16,
+                   mask, ullFrameTimingNow(), NULL, 0);
+    vButtonsApplyMouse(x, y, mask);
+}
+
+// Called by SDL for every event as it is queued, from whichever task is
+// pumping the events. SDL serializes event watchers so there is only ever
+// one writer. While replaying SDL's events are ignored and the journal,
+// played by the task presenting the frames, is the only writer.
+static int xButtonsEventWatch(void *userdata, SDL_Event *event)
+{
+    unsigned int scancode;
+    uint64_t now;
+    uint32_t mask;
+
+    if (xJournalReplaying()) {
+        return 0;
+    }
+
+    switch (event->type) {
+        case SDL_KEYDOWN:
+        case SDL_KEYUP:
+            scancode = event->key.keysym.scancode;
+            if (event->key.repeat || scancode >= SDL_NUM_SCANCODES) {
+                return 0;
+            }
+
+            now = ullFrameTimingNow();
+            vJournalRecord(JOURNAL_BUTTON, scancode,
+                           event->type == SDL_KEYDOWN, now, NULL, 0);
+            vButtonsApplyKey(scancode, event->type == SDL_KEYDOWN, now);
+            break;
+        case SDL_MOUSEMOTION:
+            vButtonsMouseEvent(event->motion.x, event->motion.y,
+                               event->motion.state);
+            break;
+        case SDL_MOUSEBUTTONDOWN:
+        case SDL_MOUSEBUTTONUP:
+            mask = buttons.snapshot.mouse.buttons;
+            mask = event->type == SDL_MOUSEBUTTONDOWN ?
+                   mask | SDL_BUTTON(event->button.button) :
+                   mask & ~SDL_BUTTON(event->button.button);
+            vButtonsMouseEvent(event->button.x, event->button.y, mask);
+            break;
+        default:
+            break;
     }
 
     return 0;
 }
 
+void vButtonsGetSnapshot(buttons_snapshot_t *snapshot)
+{
+    unsigned long start;
+
+    do {
+        start = __atomic_load_n(&buttons.sequence, __ATOMIC_ACQUIRE);
+
+        for (int i = 0; i < BUTTONS_WORDS; i++)
+            snapshot->pressed[i] = __atomic_load_n(
+                                       &buttons.snapshot.pressed[i],
+                                       __ATOMIC_RELAXED);
+        snapshot->timestamp = __atomic_load_n(&buttons.snapshot.timestamp,
+                                              __ATOMIC_RELAXED);
+        snapshot->mouse.x = __atomic_load_n(&buttons.snapshot.mouse.x,
+                                            __ATOMIC_RELAXED);
+        snapshot->mouse.y = __atomic_load_n(&buttons.snapshot.mouse.y,
+                                            __ATOMIC_RELAXED);
+        snapshot->mouse.buttons = __atomic_load_n(
+                                      &buttons.snapshot.mouse.buttons,
+                                      __ATOMIC_RELAXED);
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while ((start & 1) ||
+             start != __atomic_load_n(&buttons.sequence, __ATOMIC_RELAXED));
+}
+
+void vButtonsGetMouse(buttons_mouse_t *mouse)
+{
+    unsigned long start;
+
+    do {
+        start = __atomic_load_n(&buttons.sequence, __ATOMIC_ACQUIRE);
+
+        mouse->x = __atomic_load_n(&buttons.snapshot.mouse.x,
+                                   __ATOMIC_RELAXED);
+        mouse->y = __atomic_load_n(&buttons.snapshot.mouse.y,
+                                   __ATOMIC_RELAXED);
+        mouse->buttons = __atomic_load_n(&buttons.snapshot.mouse.buttons,
+                                         __ATOMIC_RELAXED);
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while ((start & 1) ||
+             start != __atomic_load_n(&buttons.sequence, __ATOMIC_RELAXED));
+}
+
+int xButtonsPressed(SDL_Scancode scancode)
+{
+    return (__atomic_load_n(&buttons.snapshot.pressed[scancode /
+                                                     BUTTONS_WORD_BITS],
+                            __ATOMIC_ACQUIRE) >>
+            (scancode % BUTTONS_WORD_BITS)) & 1;
+}
+
+int xButtonsNextEdge(buttons_reader_t *reader, button_edge_t *edge)
+{
+    button_edge_t *slot;
+    unsigned long head;
+
+    while (1) {
+        head = __atomic_load_n(&buttons.head, __ATOMIC_ACQUIRE);
+
+        if (reader->cursor == head) {
+            return 0;
+        }
+
+        // The slot after the newest edge may already be being overwritten
+        if (head - reader->cursor >= EDGE_RING_LENGTH) {
+            reader->lost += head - reader->cursor - (EDGE_RING_LENGTH - 1);
+            reader->cursor = head - (EDGE_RING_LENGTH - 1);
+        }
+
+        slot = &buttons.edges[reader->cursor % EDGE_RING_LENGTH];
+        edge->timestamp = __atomic_load_n(&slot->timestamp, __ATOMIC_RELAXED);
+        edge->scancode = __atomic_load_n(&slot->scancode, __ATOMIC_RELAXED);
+        edge->pressed = __atomic_load_n(&slot->pressed, __ATOMIC_RELAXED);
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+        // Check the edge was not overwritten while it was being copied
+        head = __atomic_load_n(&buttons.head, __ATOMIC_RELAXED);
+        if (head - reader->cursor < EDGE_RING_LENGTH) {
+            reader->cursor++;
+            return 1;
+        }
+    }
+}
+
+void vButtonsReaderSkip(buttons_reader_t *reader)
+{
+    reader->cursor = __atomic_load_n(&buttons.head, __ATOMIC_ACQUIRE);
+}
+
+int xButtonsInit(void)
+{
+    vJournalSetPlayer(JOURNAL_BUTTON, vButtonsPlayKey);
+    vJournalSetPlayer(JOURNAL_MOUSE, vButtonsPlayMouse);
+    SDL_AddEventWatch(xButtonsEventWatch, NULL);
+
+    return 0;
+}
+
 void vButtonsExit(void)
 {
-    vSemaphoreDelete(buttons.lock);
-}
\ No newline at end of file
+    SDL_DelEventWatch(xButtonsEventWatch, NULL);
+}
@@ -22,6 +22,8 @@
  @endverbatim
  */
 
+#include <string.h>
+
 #include "gfx_event.h"
 #include "gfx_ball.h"
 #include "gfx_sound.h"
@@ -32,30 +34,51 @@
 #include "demo_tasks.h"
 #include "async_message_queues.h"
 #include "async_sockets.h"
+#include "ball_world.h"
 #include "buttons.h"
 #include "state_machine.h"
 #include "draw.h"
+#include "draw_commands.h"
+#include "fixed_step.h"
+#include "frame_scheduler.h"
+#include "frame_timing.h"
+#include "journal.h"
+#include "options.h"
+#include "tx_ring.h"
 
 #define mainGENERIC_PRIORITY (tskIDLE_PRIORITY)
 #define mainGENERIC_STACK_SIZE ((unsigned short)2560)
 
+// The ball that plays a sound when it bounces plus smaller balls, each ball
+// is one draw command, see configDRAW_COMMAND_BUFFER_LENGTH
+#define DEMO_BALL_RADIUS 20
+#define DEMO_SMALL_BALLS 100
+#define DEMO_SMALL_BALL_RADIUS 5
+
 TaskHandle_t DemoTask1 = NULL;
 TaskHandle_t DemoTask2 = NULL;
 TaskHandle_t DemoSendTask = NULL;
+TaskHandle_t DemoSimTask = NULL;
 
-struct locked_ball {
-    ball_t *ball;
+static frame_subscriber_handle_t DemoTask1Frames = NULL;
+static frame_subscriber_handle_t DemoTask2Frames = NULL;
+static frame_subscriber_handle_t DemoSimFrames = NULL;
+
+struct locked_balls {
+    ball_world_handle_t world;
+    fixed_step_t step;
+    int running; // Simulated while state two is shown
     SemaphoreHandle_t lock;
-} my_ball = { 0 };
+} my_balls = { 0 };
 
 void vStateOneEnter(void)
 {
-    vTaskResume(DemoTask1);
+    vFrameSchedulerEnable(DemoTask1Frames);
 }
 
 void vStateOneExit(void)
 {
-    vTaskSuspend(DemoTask1);
+    vFrameSchedulerDisable(DemoTask1Frames);
 }
 
 void vDemoTask1(void *pvParameters)
@@ -64,37 +87,41 @@ void vDemoTask1(void *pvParameters)
 
     TickType_t xLastResetTime = xTaskGetTickCount();
     TickType_t xLastFrameTime = xTaskGetTickCount();
+    buttons_mouse_t mouse;
+    uint64_t draw_start;
 
     while (1) {
-        if (DrawSignal)
-            if (xSemaphoreTake(DrawSignal, portMAX_DELAY) ==
-                pdTRUE) {
-                gfxEventFetchEvents(FETCH_EVENT_BLOCK |
-                                    FETCH_EVENT_NO_GL_CHECK);
-                vGetButtonInput(); // Update global input
-
-                vDrawClearScreen();
-                vDrawStaticItems();
-                vDrawMouseBallAndBoundingBox(
-                    gfxEventGetMouseLeft());
-                vDrawButtonText();
-                vDrawSpriteStatic();
-
-                // Reset the downwards animation sequence every 500ms
-                if ((xTaskGetTickCount() - xLastResetTime) > 500) {
-                    xLastResetTime = xTaskGetTickCount();
-                    vDrawSpriteResetDownwardSequence();
-                }
-                vDrawSpriteAnimations(xLastFrameTime);
-
-                xLastFrameTime = xTaskGetTickCount();
-
-                // Draw FPS in lower right corner
-                vDrawFPS();
-
-                // Get input and check for state change
-                vCheckStateInput();
+        if (xFrameSchedulerWait(DemoTask1Frames, NULL) == 0) {
+            draw_start = ullFrameTimingNow();
+            xDrawCommandsBegin();
+
+            gfxEventFetchEvents(FETCH_EVENT_BLOCK |
+                                FETCH_EVENT_NO_GL_CHECK);
+            vDrawComposeStateOne();
+            vButtonsGetMouse(&mouse);
+            vDrawMouseBall(mouse.buttons & SDL_BUTTON_LMASK);
+            vDrawButtonText();
+
+            // Reset the downwards animation sequence every 500ms
+            if ((xTaskGetTickCount() - xLastResetTime) > 500) {
+                xLastResetTime = xTaskGetTickCount();
+                vDrawSpriteResetDownwardSequence();
             }
+            vDrawSpriteAnimations(xLastFrameTime);
+
+            xLastFrameTime = xTaskGetTickCount();
+
+            // Draw FPS in lower right corner
+            vDrawFPS();
+            vDrawTaskStats();
+
+            // Get input and check for state change
+            vCheckStateInput();
+
+            vDrawCommandsSubmit();
+            vFrameTimingRecordPhase(FRAME_PHASE_DRAW, draw_start);
+            vFrameSchedulerDone(DemoTask1Frames);
+        }
     }
 }
 
@@ -105,90 +132,165 @@ void vPlayBallSound(void *args)
 
 void vResetBall(void)
 {
-    if (xSemaphoreTake(my_ball.lock, portMAX_DELAY) == pdTRUE) {
-        gfxSetBallSpeed(my_ball.ball, 100, 100, 0, SET_BALL_SPEED_AXES);
-        gfxSetBallLocation(my_ball.ball, SCREEN_WIDTH / 2,
-                           SCREEN_HEIGHT / 2);
-        xSemaphoreGive(my_ball.lock);
+    if (xSemaphoreTake(my_balls.lock, portMAX_DELAY) == pdTRUE) {
+        xBallWorldSetBall(my_balls.world, 0, SCREEN_WIDTH / 2,
+                          SCREEN_HEIGHT / 2, 100, 100);
+
+        // Spread along the top of the cave, flying in different directions
+        for (unsigned int i = 1; i <= DEMO_SMALL_BALLS; i++) {
+            xBallWorldSetBall(my_balls.world, i,
+                              SCREEN_WIDTH / 4 + 10 + (i % 20) * 15,
+                              SCREEN_HEIGHT / 4 + 10 + (i / 20) * 15,
+                              (int)(i * 37 % 200) - 100,
+                              (int)(i * 53 % 200) - 100);
+        }
+        xSemaphoreGive(my_balls.lock);
     }
 }
 
 void vStateTwoInit(void)
 {
-    my_ball.lock = xSemaphoreCreateMutex();
-    if (xSemaphoreTake(my_ball.lock, portMAX_DELAY) == pdTRUE) {
-        my_ball.ball =
-            gfxCreateBall(SCREEN_WIDTH / 2, SCREEN_HEIGHT / 2, Black,
-                          20, 1000, &vPlayBallSound, NULL, NULL);
-        xSemaphoreGive(my_ball.lock);
-        vResetBall();
+    my_balls.lock = xSemaphoreCreateMutex();
+    if (xSemaphoreTake(my_balls.lock, portMAX_DELAY) == pdTRUE) {
+        // Covers the cave, the walls are added by vDemoTask2
+        vFixedStepInit(&my_balls.step, emulator_options.sim_rate,
+                       configSIM_MAX_SUBSTEPS);
+        my_balls.world = xBallWorldCreate(DEMO_SMALL_BALLS + 1,
+                                          SCREEN_WIDTH / 4,
+                                          SCREEN_HEIGHT / 4,
+                                          SCREEN_WIDTH / 2,
+                                          SCREEN_HEIGHT / 2,
+                                          DEMO_BALL_RADIUS * 2);
+        if (my_balls.world) {
+            xBallWorldAddBall(my_balls.world, 0, 0, 0, 0, DEMO_BALL_RADIUS,
+                              Black, 1000, &vPlayBallSound, NULL);
+            for (unsigned int i = 0; i < DEMO_SMALL_BALLS; i++)
+                xBallWorldAddBall(my_balls.world, 0, 0, 0, 0,
+                                  DEMO_SMALL_BALL_RADIUS, TUMBlue, 1000,
+                                  NULL, NULL);
+        }
+        xSemaphoreGive(my_balls.lock);
+        if (my_balls.world) {
+            vResetBall();
+        }
     }
 }
 
 void vStateTwoEnter(void)
 {
     vResetBall();
-    vTaskResume(DemoTask2);
+
+    // The time spent in the other state is not caught up
+    if (xSemaphoreTake(my_balls.lock, portMAX_DELAY) == pdTRUE) {
+        vFixedStepReset(&my_balls.step);
+        my_balls.running = 1;
+        xSemaphoreGive(my_balls.lock);
+    }
+    xTaskNotifyGive(DemoSimTask);
+
+    vFrameSchedulerEnable(DemoTask2Frames);
 }
 
 void vStateTwoExit(void)
 {
-    vTaskSuspend(DemoTask2);
+    my_balls.running = 0;
+    vFrameSchedulerDisable(DemoTask2Frames);
+}
+
+// Returns the ticks until the next step is due
+static TickType_t xDemoSimStep(void)
+{
+    TickType_t wait = 1;
+
+    if (xSemaphoreTake(my_balls.lock, portMAX_DELAY) == pdTRUE) {
+        // Moves the balls and bounces them off the walls and each other in
+        // steps of the same length, however long the frames take, the big
+        // ball plays a sound when it bounces
+        if (my_balls.running && my_balls.world) {
+            for (unsigned int steps = uFixedStepDue(&my_balls.step); steps;
+                 steps--)
+                uBallWorldStep(my_balls.world,
+                               fFixedStepSeconds(&my_balls.step));
+        }
+
+        wait = xFixedStepTicksUntilNext(&my_balls.step);
+        xSemaphoreGive(my_balls.lock);
+    }
+
+    return wait;
+}
+
+void vDemoSimTask(void *pvParameters)
+{
+    TickType_t wait;
+
+    while (1) {
+        // A replay runs faster than the ticks, the steps due by each frame's
+        // recorded start are taken before the frame is drawn instead
+        if (xJournalReplaying()) {
+            if (xFrameSchedulerWait(DemoSimFrames, NULL) == 0) {
+                xDemoSimStep();
+                vFrameSchedulerDone(DemoSimFrames);
+            }
+            continue;
+        }
+
+        if (!my_balls.running || !my_balls.world) {
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            continue;
+        }
+
+        wait = xDemoSimStep();
+        vTaskDelay(wait ? wait : 1);
+    }
 }
 
 void vDemoTask2(void *pvParameters)
 {
-    TickType_t xLastWakeTime, prevWakeTime;
-    xLastWakeTime = xTaskGetTickCount();
-    prevWakeTime = xLastWakeTime;
+    uint64_t draw_start;
 
     wall_t *left_wall = NULL, *right_wall = NULL, *top_wall = NULL,
             *bottom_wall = NULL;
     vCreateWalls(&left_wall, &right_wall, &top_wall, &bottom_wall);
 
+    if (xSemaphoreTake(my_balls.lock, portMAX_DELAY) == pdTRUE) {
+        if (my_balls.world) {
+            xBallWorldAddWall(my_balls.world, left_wall);
+            xBallWorldAddWall(my_balls.world, right_wall);
+            xBallWorldAddWall(my_balls.world, top_wall);
+            xBallWorldAddWall(my_balls.world, bottom_wall);
+        }
+        xSemaphoreGive(my_balls.lock);
+    }
+
     while (1) {
-        if (DrawSignal)
-            if (xSemaphoreTake(DrawSignal, portMAX_DELAY) ==
-                pdTRUE) {
-                xLastWakeTime = xTaskGetTickCount();
-
-                vGetButtonInput(); // Update global button data
-
-                vDrawClearScreen();
-                vDrawStaticItems();
-                vDrawWalls(left_wall, right_wall, top_wall,
-                           bottom_wall);
-
-                if (xSemaphoreTake(my_ball.lock,
-                                   portMAX_DELAY) == pdTRUE) {
-                    // Check if ball has made a collision
-                    if (gfxCheckBallCollisions(my_ball.ball,
-                                               NULL, NULL)) {
-                        prints("Collision\n");
-                    }
-
-                    // Update the balls position now that possible collisions have
-                    // updated its speeds
-                    gfxUpdateBallPosition(
-                        my_ball.ball,
-                        xLastWakeTime - prevWakeTime);
-
-                    vDrawBall(my_ball.ball);
-
-                    xSemaphoreGive(my_ball.lock);
-                }
-
-                // Draw FPS in lower right corner
-                vDrawFPS();
-
-                // Check for state change
-                vCheckStateInput();
-
-                // Keep track of when task last ran so that you know how many ticks
-                //(in our case miliseconds) have passed so that the balls position
-                // can be updated appropriatley
-                prevWakeTime = xLastWakeTime;
+        if (xFrameSchedulerWait(DemoTask2Frames, NULL) == 0) {
+            draw_start = ullFrameTimingNow();
+            xDrawCommandsBegin();
+
+            vDrawComposeStateTwo(left_wall, right_wall, top_wall,
+                                 bottom_wall);
+
+            // The balls are simulated by vDemoSimTask, they are drawn
+            // between its two latest steps
+            if (my_balls.world &&
+                xSemaphoreTake(my_balls.lock, portMAX_DELAY) == pdTRUE) {
+                vDrawBallWorld(my_balls.world,
+                               fFixedStepAlpha(&my_balls.step));
+                xSemaphoreGive(my_balls.lock);
             }
+
+            // Draw FPS in lower right corner
+            vDrawFPS();
+            vDrawTaskStats();
+
+            // Check for state change
+            vCheckStateInput();
+
+            vDrawCommandsSubmit();
+            vFrameTimingRecordPhase(FRAME_PHASE_DRAW, draw_start);
+            vFrameSchedulerDone(DemoTask2Frames);
+        }
     }
 }
 
@@ -196,53 +298,58 @@ void vDemoSendTask(void *pvParameters)
 {
     static char *test_str_1 = "UDP test 1";
 
-    struct __attribute__((__packed__)) my_item {
-        char populated;
-        char x;
-        char y;
-    };
-
-    // Attribute packed will guarentee that the compiler
-    // doesnt pad the struct to align members with address
-    // doundaries. Explination can be found here
-    // https://stackoverflow.com/questions/4306186/structure-padding-and-packing
-    struct __attribute__((__packed__)) my_struct {
-        int my_int;
-        char my_string[10];
-        struct common_struct my_common_struct;
-        struct my_item my_items[3];
-    };
-
-    struct my_struct test_struct = {
+    // The message's layout is defined once in demo_tasks.h, the generated
+    // encode function writes it into the buffer in the order and byte order
+    // that the receiver expects
+    demo_message_t test_message = {
         .my_int = 85,
-        .my_string = "testing",
+        .my_string = MESSAGE_STRING("testing"),
         .my_common_struct = {.first_int = 420, .second_int = 100},
         .my_items = { { .populated = 1, .x = 10, .y = 15 },
             { .populated = 1, .x = 50, .y = 100 },
             { .populated = 0 }
         }
     };
+    char test_buffer[MESSAGE_SIZE(demo_message)];
+    int test_length = xDemoMessageEncode(&test_message, test_buffer,
+                                         sizeof(test_buffer));
 
     static char *test_str_2 = "TCP test";
 
+    // Sending only queues the messages, the tasks never wait on the network
+    tx_ring_handle_t udp_tx_one = xTxRingOpenUDP(NULL, UDP_TEST_PORT_1);
+    tx_ring_handle_t udp_tx_two = xTxRingOpenUDP(NULL, UDP_TEST_PORT_2);
+    tx_ring_handle_t tcp_tx = xTxRingOpenTCP(NULL, TCP_TEST_PORT);
+    shm_queue_handle_t shm_tx = NULL;
+    static char *test_str_3 = "Hello SHM one";
+
     while (1) {
         prints("*****TICK******\n");
         if (mq_one) {
-            aIOMessageQueuePut(mq_one_name, "Hello MQ one");
+            xReactorMessageQueuePut(mq_one_name, "Hello MQ one");
         }
         if (mq_two) {
-            aIOMessageQueuePut(mq_two_name, "Hello MQ two");
+            xReactorMessageQueuePut(mq_two_name, "Hello MQ two");
         }
 
-        if (udp_soc_one)
-            aIOSocketPut(UDP, NULL, UDP_TEST_PORT_1, test_str_1,
-                         strlen(test_str_1));
-        if (udp_soc_two)
-            aIOSocketPut(UDP, NULL, UDP_TEST_PORT_2, (char *) &test_struct,
-                         sizeof(test_struct));
-        if (tcp_soc)
-            aIOSocketPut(TCP, NULL, TCP_TEST_PORT, test_str_2,
-                         strlen(test_str_2));
+        // Attaches once the receiving side has created the queue, like a
+        // separate process would
+        if (shm_one && !shm_tx) {
+            shm_tx = xShmQueueAttach(shm_one_name);
+        }
+        if (shm_tx) {
+            xShmQueuePut(shm_tx, test_str_3, strlen(test_str_3));
+        }
+
+        if (udp_soc_one && udp_tx_one) {
+            xTxRingPut(udp_tx_one, test_str_1, strlen(test_str_1));
+        }
+        if (udp_soc_two && udp_tx_two && test_length > 0) {
+            xTxRingPut(udp_tx_two, test_buffer, test_length);
+        }
+        if (tcp_soc && tcp_tx) {
+            xTxRingPut(tcp_tx, test_str_2, strlen(test_str_2));
+        }
 
         vTaskDelay(pdMS_TO_TICKS(1000));
     }
@@ -250,6 +357,18 @@ void vDemoSendTask(void *pvParameters)
 
 int xCreateDemoTasks(void)
 {
+    DemoTask1Frames = xFrameSchedulerSubscribe(FRAME_STAGE_DRAW, "DemoTask1");
+    DemoTask2Frames = xFrameSchedulerSubscribe(FRAME_STAGE_DRAW, "DemoTask2");
+    DemoSimFrames = xFrameSchedulerSubscribe(FRAME_STAGE_UPDATE, "DemoSim");
+    if (!DemoTask1Frames || !DemoTask2Frames || !DemoSimFrames) {
+        goto err_subscribe;
+    }
+
+    // Only stepped by the frames while replaying, see vDemoSimTask
+    if (xJournalReplaying()) {
+        vFrameSchedulerEnable(DemoSimFrames);
+    }
+
     if (xTaskCreate(vDemoTask1, "DemoTask1", mainGENERIC_STACK_SIZE * 2,
                     NULL, mainGENERIC_PRIORITY + 1, &DemoTask1) != pdPASS) {
         PRINT_TASK_ERROR("DemoTask1");
@@ -261,6 +380,13 @@ int xCreateDemoTasks(void)
         goto err_task2;
     }
 
+    // Above the drawing tasks such that the steps are taken on time
+    if (xTaskCreate(vDemoSimTask, "DemoSimTask", mainGENERIC_STACK_SIZE,
+                    NULL, mainGENERIC_PRIORITY + 2, &DemoSimTask) != pdPASS) {
+        PRINT_TASK_ERROR("DemoSimTask");
+        goto err_sim_task;
+    }
+
     if (xTaskCreate(vDemoSendTask, "DemoSendTask",
                     mainGENERIC_STACK_SIZE * 2, NULL,
                     configMAX_PRIORITIES - 1, &DemoSendTask) != pdPASS) {
@@ -268,16 +394,16 @@ int xCreateDemoTasks(void)
         goto err_send_task;
     }
 
-    vTaskSuspend(DemoTask1);
-    vTaskSuspend(DemoTask2);
-
     return 0;
 
 err_send_task:
+    vTaskDelete(DemoSimTask);
+err_sim_task:
     vTaskDelete(DemoTask2);
 err_task2:
     vTaskDelete(DemoTask1);
 err_task1:
+err_subscribe:
     return -1;
 }
 
@@ -289,6 +415,9 @@ void vDeleteDemoTasks(void)
     if (DemoTask2) {
         vTaskDelete(DemoTask2);
     }
+    if (DemoSimTask) {
+        vTaskDelete(DemoSimTask);
+    }
     if (DemoSendTask) {
         vTaskDelete(DemoSendTask);
     }
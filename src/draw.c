@@ -27,6 +27,7 @@
 #include "FreeRTOS.h"
 #include "task.h"
 #include "semaphore.h"
+#include "semphr.h"
 
 #include "gfx_ball.h"
 #include "gfx_font.h"
@@ -37,8 +38,15 @@
 
 #include "buttons.h"
 #include "draw.h"
+#include "draw_commands.h"
+#include "draw_layers.h"
+#include "frame_timing.h"
+#include "renderer.h"
+#include "assets.h"
+#include "sprite_atlas.h"
+#include "task_stats.h"
+#include "text_cache.h"
 
-#define FPS_AVERAGE_COUNT 50
 #define LOGO_FILENAME "freertos.jpg"
 
 #define CAVE_SIZE_X SCREEN_WIDTH / 2
@@ -47,23 +55,41 @@
 #define CAVE_Y CAVE_SIZE_Y / 2
 #define CAVE_THICKNESS 25
 
+#define MOUSE_BALL_RADIUS 20
+#define BALL_SPRITE_SIZE 40
+#define HELP_TEXT_AREA_HEIGHT 45
+#define HELP_TEXT_FONT_SIZE 30
+
+#define FPS_REFRESH_PERIOD_NS 250000000ULL
+
+#define TASK_STATS_X (SCREEN_WIDTH - 230)
+#define TASK_STATS_Y 10
+#define TASK_STATS_WIDTH 220
+#define TASK_STATS_LINE_HEIGHT (DEFAULT_FONT_SIZE + 2)
+#define TASK_STATS_LINES (configTASK_STATS_OVERLAY_TASKS + 2)
+
 struct images {
     SemaphoreHandle_t lock;
-    gfx_image_handle_t logo_image;
+    asset_handle_t logo;
+    renderer_texture_handle_t logo_texture; ///< NULL until loaded
 } my_images = { 0 };
 
 struct animations {
     SemaphoreHandle_t lock;
-    gfx_spritesheet_handle_t ball_spritesheet;
-    gfx_sequence_handle_t forward_sequence;
-    gfx_sequence_handle_t reverse_sequence;
-    gfx_spritesheet_handle_t ball_spritesheet_rotated;
-    gfx_sequence_handle_t downward_sequence;
-    gfx_sequence_handle_t upward_sequence;
-    gfx_spritesheet_handle_t mario_run_spritesheet;
-    gfx_sequence_handle_t mario_running_sequence;
-    gfx_spritesheet_handle_t barrel_spritesheet;
-    gfx_sequence_handle_t barrel_sequence;
+    sprite_atlas_handle_t atlas;
+    int atlas_built; ///< 1 once built, -1 if it failed to build
+    int ball_sheet;
+    int ball_rotated_sheet;
+    int mario_run_sheet;
+    int barrel_sheet;
+    sprite_sequence_t forward_sequence;
+    sprite_sequence_t reverse_sequence;
+    sprite_sequence_t downward_sequence;
+    sprite_sequence_t upward_sequence;
+    sprite_sequence_t mario_running_sequence;
+    sprite_sequence_t barrel_sequence;
+    sprite_batch_t batch;
+    sprite_batch_t static_batch;
 } my_animations = { 0 };
 
 void vCheckDraw(unsigned char status, const char *msg)
@@ -80,19 +106,39 @@ void vCheckDraw(unsigned char status, const char *msg)
 
 void vDrawClearScreen(void)
 {
-    vCheckDraw(gfxDrawClear(White), __FUNCTION__);
+    vCheckDraw(xDrawCommandClear(White), __FUNCTION__);
+}
+
+// Draws text and reports the area it covers as damaged
+static void vDrawDamagedText(char *str, ssize_t x, ssize_t y,
+                             unsigned int colour)
+{
+    int text_width, text_height;
+
+    if (!xTextCacheGetTextSize(DEFAULT_FONT, DEFAULT_FONT_SIZE, str,
+                               &text_width, &text_height)) {
+        vDrawLayersDamage(x, y, text_width, text_height);
+    }
+
+    draw_depth_e prev_depth = xDrawCommandsSetDepth(DRAW_DEPTH_OVERLAY);
+
+    vCheckDraw(xDrawCommandText(DEFAULT_FONT, DEFAULT_FONT_SIZE, colour,
+                                str, x, y),
+               __FUNCTION__);
+
+    xDrawCommandsSetDepth(prev_depth);
 }
 
 void vDrawCaveBoundingBox(void)
 {
-    vCheckDraw(gfxDrawFilledBox(CAVE_X - CAVE_THICKNESS,
-                                CAVE_Y - CAVE_THICKNESS,
-                                CAVE_SIZE_X + CAVE_THICKNESS * 2,
-                                CAVE_SIZE_Y + CAVE_THICKNESS * 2, TUMBlue),
+    vCheckDraw(xDrawCommandFilledBox(CAVE_X - CAVE_THICKNESS,
+                                     CAVE_Y - CAVE_THICKNESS,
+                                     CAVE_SIZE_X + CAVE_THICKNESS * 2,
+                                     CAVE_SIZE_Y + CAVE_THICKNESS * 2, TUMBlue),
                __FUNCTION__);
 
-    vCheckDraw(gfxDrawFilledBox(CAVE_X, CAVE_Y, CAVE_SIZE_X, CAVE_SIZE_Y,
-                                Aqua),
+    vCheckDraw(xDrawCommandFilledBox(CAVE_X, CAVE_Y, CAVE_SIZE_X, CAVE_SIZE_Y,
+                                     Aqua),
                __FUNCTION__);
 }
 
@@ -122,187 +168,270 @@ void vCreateWalls(wall_t **left_wall, wall_t **right_wall, wall_t **top_wall,
 void vDrawWalls(wall_t *left_wall, wall_t *right_wall, wall_t *top_wall,
                 wall_t *bottom_wall)
 {
-    vCheckDraw(gfxDrawFilledBox(left_wall->x1, left_wall->y1, left_wall->w,
-                                left_wall->h, left_wall->colour),
+    vCheckDraw(xDrawCommandFilledBox(left_wall->x1, left_wall->y1, left_wall->w,
+                                     left_wall->h, left_wall->colour),
                __FUNCTION__);
-    vCheckDraw(gfxDrawFilledBox(right_wall->x1, right_wall->y1,
-                                right_wall->w, right_wall->h,
-                                right_wall->colour),
+    vCheckDraw(xDrawCommandFilledBox(right_wall->x1, right_wall->y1,
+                                     right_wall->w, right_wall->h,
+                                     right_wall->colour),
                __FUNCTION__);
-    vCheckDraw(gfxDrawFilledBox(top_wall->x1, top_wall->y1, top_wall->w,
-                                top_wall->h, top_wall->colour),
+    vCheckDraw(xDrawCommandFilledBox(top_wall->x1, top_wall->y1, top_wall->w,
+                                     top_wall->h, top_wall->colour),
                __FUNCTION__);
-    vCheckDraw(gfxDrawFilledBox(bottom_wall->x1, bottom_wall->y1,
-                                bottom_wall->w, bottom_wall->h,
-                                bottom_wall->colour),
+    vCheckDraw(xDrawCommandFilledBox(bottom_wall->x1, bottom_wall->y1,
+                                     bottom_wall->w, bottom_wall->h,
+                                     bottom_wall->colour),
                __FUNCTION__);
 }
 
 void vDrawBall(ball_t *ball)
 {
-    vCheckDraw(gfxDrawCircle(ball->x, ball->y, ball->radius, ball->colour),
+    vCheckDraw(xDrawCommandCircle(ball->x, ball->y, ball->radius, ball->colour),
                __FUNCTION__);
+    vDrawLayersDamage(ball->x - ball->radius - 1, ball->y - ball->radius - 1,
+                      ball->radius * 2 + 3, ball->radius * 2 + 3);
 }
 
-void vDrawMouseBallAndBoundingBox(unsigned char ball_color_inverted)
+void vDrawBallWorld(ball_world_handle_t world, float alpha)
 {
-    static unsigned short circlePositionX, circlePositionY;
+    ball_world_view_t balls;
+    float x, y;
 
-    vDrawCaveBoundingBox();
+    vBallWorldGetView(world, &balls);
+
+    for (unsigned int i = 0; i < balls.count; i++) {
+        x = balls.prev_x[i] + (balls.x[i] - balls.prev_x[i]) * alpha;
+        y = balls.prev_y[i] + (balls.y[i] - balls.prev_y[i]) * alpha;
+
+        vCheckDraw(xDrawCommandCircle(x, y, balls.radius[i],
+                                      balls.colour[i]),
+                   __FUNCTION__);
+        vDrawLayersDamage(x - balls.radius[i] - 1, y - balls.radius[i] - 1,
+                          balls.radius[i] * 2 + 3, balls.radius[i] * 2 + 3);
+    }
+}
+
+void vDrawMouseBall(unsigned char ball_color_inverted)
+{
+    static unsigned short circlePositionX, circlePositionY;
+    buttons_mouse_t mouse;
 
-    circlePositionX = CAVE_X + gfxEventGetMouseX() / 2;
-    circlePositionY = CAVE_Y + gfxEventGetMouseY() / 2;
+    vButtonsGetMouse(&mouse);
+    circlePositionX = CAVE_X + mouse.x / 2;
+    circlePositionY = CAVE_Y + mouse.y / 2;
 
     if (ball_color_inverted)
-        vCheckDraw(gfxDrawCircle(circlePositionX, circlePositionY, 20,
-                                 Black),
+        vCheckDraw(xDrawCommandCircle(circlePositionX, circlePositionY,
+                                      MOUSE_BALL_RADIUS, Black),
                    __FUNCTION__);
     else
-        vCheckDraw(gfxDrawCircle(circlePositionX, circlePositionY, 20,
-                                 Silver),
+        vCheckDraw(xDrawCommandCircle(circlePositionX, circlePositionY,
+                                      MOUSE_BALL_RADIUS, Silver),
                    __FUNCTION__);
+
+    vDrawLayersDamage(circlePositionX - MOUSE_BALL_RADIUS - 1,
+                      circlePositionY - MOUSE_BALL_RADIUS - 1,
+                      MOUSE_BALL_RADIUS * 2 + 3, MOUSE_BALL_RADIUS * 2 + 3);
 }
 
 void vDrawHelpText(void)
 {
     static char str[100] = { 0 };
     static int text_width;
-    ssize_t prev_font_size = gfxFontGetCurFontSize();
-
-    gfxFontSetSize((ssize_t)30);
 
     sprintf(str, "[Q]uit, [C]hange State");
 
-    if (!gfxGetTextSize((char *)str, &text_width, NULL))
-        vCheckDraw(gfxDrawText(str, SCREEN_WIDTH - text_width - 10,
-                               DEFAULT_FONT_SIZE * 0.5, Black),
+    if (!xTextCacheGetTextSize(DEFAULT_FONT, HELP_TEXT_FONT_SIZE, str,
+                               &text_width, NULL))
+        vCheckDraw(xDrawCommandText(DEFAULT_FONT, HELP_TEXT_FONT_SIZE,
+                                    Black, str,
+                                    SCREEN_WIDTH - text_width - 10,
+                                    DEFAULT_FONT_SIZE * 0.5),
                    __FUNCTION__);
-
-    gfxFontSetSize(prev_font_size);
 }
 
 void vDrawFPS(void)
 {
-    static unsigned int periods[FPS_AVERAGE_COUNT] = { 0 };
-    static unsigned int periods_total = 0;
-    static unsigned int index = 0;
-    static unsigned int average_count = 0;
-    static TickType_t xLastWakeTime = 0, prevWakeTime = 0;
-    static char str[10] = { 0 };
-    static int text_width;
-    int fps = 0;
-    font_handle_t cur_font = gfxFontGetCurFontHandle();
-
-    if (average_count < FPS_AVERAGE_COUNT) {
-        average_count++;
-    }
-    else {
-        periods_total -= periods[index];
+    static char str[40] = { 0 };
+    static int text_width, text_height;
+    static uint64_t last_update = 0;
+    frame_timing_summary_t frame_summary;
+    uint64_t now = ullFrameTimingNow();
+
+    // Only re-format the string a few times a second, in between the
+    // cached layout of the unchanged string is reused
+    if (!str[0] || now - last_update >= FPS_REFRESH_PERIOD_NS) {
+        vFrameTimingGetSummary(FRAME_PHASE_FRAME, &frame_summary);
+        sprintf(str, "FPS: %2.0f | p99: %.1f ms", dFrameTimingGetRecentFPS(),
+                frame_summary.p99 / 1e6);
+        last_update = now;
+
+        if (xTextCacheGetTextSize(FPS_FONT, DEFAULT_FONT_SIZE, str,
+                                  &text_width, &text_height)) {
+            str[0] = '\0';
+            return;
+        }
     }
 
-    xLastWakeTime = xTaskGetTickCount();
+    draw_depth_e prev_depth = xDrawCommandsSetDepth(DRAW_DEPTH_OVERLAY);
 
-    if (prevWakeTime != xLastWakeTime) {
-        periods[index] =
-            configTICK_RATE_HZ / (xLastWakeTime - prevWakeTime);
-        prevWakeTime = xLastWakeTime;
-    }
-    else {
-        periods[index] = 0;
-    }
+    vCheckDraw(xDrawCommandText(FPS_FONT, DEFAULT_FONT_SIZE, Skyblue, str,
+                                SCREEN_WIDTH - text_width - 10,
+                                SCREEN_HEIGHT - DEFAULT_FONT_SIZE * 1.5),
+               __FUNCTION__);
 
-    periods_total += periods[index];
+    xDrawCommandsSetDepth(prev_depth);
+    vDrawLayersDamage(SCREEN_WIDTH - text_width - 10,
+                      SCREEN_HEIGHT - DEFAULT_FONT_SIZE * 1.5, text_width,
+                      text_height);
+}
 
-    if (index == (FPS_AVERAGE_COUNT - 1)) {
-        index = 0;
-    }
-    else {
-        index++;
+void vDrawTaskStats(void)
+{
+    static char lines[TASK_STATS_LINES][48];
+    static uint64_t last_sample = 0;
+    static task_stats_sample_t sample;
+    unsigned int count;
+
+    if (!xTaskStatsOverlayEnabled()) {
+        return;
+    }
+
+    // The lines are only re-formatted once there is a new sample
+    if (xTaskStatsGetSample(&sample)) {
+        return;
+    }
+    if (sample.timestamp != last_sample) {
+        last_sample = sample.timestamp;
+
+        snprintf(lines[0], sizeof(lines[0]),
+                 "Switches/s: %.0f | Ready: %u/%u", sample.switches,
+                 sample.ready, sample.total_tasks);
+        if (sample.heap_total) {
+            snprintf(lines[1], sizeof(lines[1]),
+                     "Heap peak: %zu KB | Frag: %.0f%%",
+                     sample.heap_peak / 1024,
+                     sample.heap_fragmentation * 100);
+        }
+        else {
+            snprintf(lines[1], sizeof(lines[1]), "Heap: malloc");
+        }
+        for (unsigned int i = 2; i < TASK_STATS_LINES; i++) {
+            if (i - 2 >= sample.count) {
+                lines[i][0] = '\0';
+                continue;
+            }
+            snprintf(lines[i], sizeof(lines[i]), "%5.1f%% P%-3lu %s",
+                     sample.tasks[i - 2].cpu,
+                     (unsigned long)sample.tasks[i - 2].priority,
+                     sample.tasks[i - 2].name);
+        }
     }
 
-    fps = periods_total / average_count;
-
-    gfxFontSelectFontFromName(FPS_FONT);
-
-    sprintf(str, "FPS: %2d", fps);
+    draw_depth_e prev_depth = xDrawCommandsSetDepth(DRAW_DEPTH_OVERLAY);
 
-    if (!gfxGetTextSize((char *)str, &text_width, NULL))
-        vCheckDraw(gfxDrawText(str, SCREEN_WIDTH - text_width - 10,
-                               SCREEN_HEIGHT - DEFAULT_FONT_SIZE * 1.5,
-                               Skyblue),
+    count = 0;
+    for (unsigned int i = 0; i < TASK_STATS_LINES && lines[i][0]; i++) {
+        vCheckDraw(xDrawCommandText(FPS_FONT, DEFAULT_FONT_SIZE, Skyblue,
+                                    lines[i], TASK_STATS_X,
+                                    TASK_STATS_Y +
+                                    i * TASK_STATS_LINE_HEIGHT),
                    __FUNCTION__);
+        count++;
+    }
 
-    gfxFontSelectFontFromHandle(cur_font);
-    gfxFontPutFontHandle(cur_font);
+    xDrawCommandsSetDepth(prev_depth);
+    vDrawLayersDamage(TASK_STATS_X, TASK_STATS_Y, TASK_STATS_WIDTH,
+                      count * TASK_STATS_LINE_HEIGHT);
 }
 
+void vDrawInitLogoLayer(void);
+
 void vDrawLogo(void)
 {
-    if (my_images.lock)
-        if (xSemaphoreTake(my_images.lock, 0) == pdTRUE) {
-            static int image_height;
-
-            if ((image_height = gfxDrawGetLoadedImageHeight(
-                                    my_images.logo_image)) != -1)
-                vCheckDraw(gfxDrawLoadedImage(
-                               my_images.logo_image, 10,
-                               SCREEN_HEIGHT - 10 -
-                               image_height),
-                           __FUNCTION__);
-            else {
-                fprints(stderr,
-                        "Failed to get size of image '%s', does it exist?\n",
-                        LOGO_FILENAME);
+    if (!my_images.lock) {
+        return;
+    }
+
+    if (xSemaphoreTake(my_images.lock, 0) == pdTRUE) {
+        int image_height;
+
+        if (!my_images.logo_texture) {
+            switch (xAssetGetState(my_images.logo)) {
+                case ASSET_READY:
+                    my_images.logo_texture =
+                        xAssetGetTexture(my_images.logo);
+                    vDrawInitLogoLayer();
+                    // The layer shrinks to the logo, clear what it covered
+                    vDrawLayersInvalidate();
+                    break;
+                case ASSET_FAILED:
+                    break;
+                default:
+                    // Still loading, the logo layer is retained, make sure
+                    // it gets drawn again
+                    vDrawLayersInvalidate();
+                    xSemaphoreGive(my_images.lock);
+                    return;
             }
-            xSemaphoreGive(my_images.lock);
         }
-}
 
-void vDrawStaticItems(void)
-{
-    vDrawHelpText();
-    vDrawLogo();
+        if (my_images.logo_texture) {
+            vRendererTextureGetSize(my_images.logo_texture, NULL,
+                                    &image_height);
+            vCheckDraw(xDrawCommandTexture(my_images.logo_texture, 10,
+                                           SCREEN_HEIGHT - 10 -
+                                           image_height),
+                       __FUNCTION__);
+        }
+        else {
+            fprints(stderr,
+                    "Failed to get size of image '%s', does it exist?\n",
+                    LOGO_FILENAME);
+        }
+        xSemaphoreGive(my_images.lock);
+    }
+    else {
+        // The logo layer is retained, make sure it gets drawn next time
+        vDrawLayersInvalidate();
+    }
 }
 
 void vDrawButtonText(void)
 {
     static char str[100] = { 0 };
+    buttons_snapshot_t snapshot;
 
-    sprintf(str, "Axis 1: %5d | Axis 2: %5d", gfxEventGetMouseX(),
-            gfxEventGetMouseY());
+    vButtonsGetSnapshot(&snapshot);
 
-    vCheckDraw(gfxDrawText(str, 10, DEFAULT_FONT_SIZE * 0.5, Black),
-               __FUNCTION__);
+    sprintf(str, "Axis 1: %5d | Axis 2: %5d", (int)snapshot.mouse.x,
+            (int)snapshot.mouse.y);
 
-    if (xSemaphoreTake(buttons.lock, 0) == pdTRUE) {
-        sprintf(str, "W: %d | S: %d | A: %d | D: %d",
-                buttons.buttons[KEYCODE(W)],
-                buttons.buttons[KEYCODE(S)],
-                buttons.buttons[KEYCODE(A)],
-                buttons.buttons[KEYCODE(D)]);
-        xSemaphoreGive(buttons.lock);
-        vCheckDraw(gfxDrawText(str, 10, DEFAULT_FONT_SIZE * 2, Black),
-                   __FUNCTION__);
-    }
+    vDrawDamagedText(str, 10, DEFAULT_FONT_SIZE * 0.5, Black);
 
-    if (xSemaphoreTake(buttons.lock, 0) == pdTRUE) {
-        sprintf(str, "UP: %d | DOWN: %d | LEFT: %d | RIGHT: %d",
-                buttons.buttons[KEYCODE(UP)],
-                buttons.buttons[KEYCODE(DOWN)],
-                buttons.buttons[KEYCODE(LEFT)],
-                buttons.buttons[KEYCODE(RIGHT)]);
-        xSemaphoreGive(buttons.lock);
-        vCheckDraw(gfxDrawText(str, 10, DEFAULT_FONT_SIZE * 3.5, Black),
-                   __FUNCTION__);
-    }
+    sprintf(str, "W: %d | S: %d | A: %d | D: %d",
+            xButtonsSnapshotPressed(&snapshot, KEYCODE(W)),
+            xButtonsSnapshotPressed(&snapshot, KEYCODE(S)),
+            xButtonsSnapshotPressed(&snapshot, KEYCODE(A)),
+            xButtonsSnapshotPressed(&snapshot, KEYCODE(D)));
+    vDrawDamagedText(str, 10, DEFAULT_FONT_SIZE * 2, Black);
+
+    sprintf(str, "UP: %d | DOWN: %d | LEFT: %d | RIGHT: %d",
+            xButtonsSnapshotPressed(&snapshot, KEYCODE(UP)),
+            xButtonsSnapshotPressed(&snapshot, KEYCODE(DOWN)),
+            xButtonsSnapshotPressed(&snapshot, KEYCODE(LEFT)),
+            xButtonsSnapshotPressed(&snapshot, KEYCODE(RIGHT)));
+    vDrawDamagedText(str, 10, DEFAULT_FONT_SIZE * 3.5, Black);
 }
 
 void vDrawInitImages(void)
 {
     my_images.lock = xSemaphoreCreateMutex();
 
-    if (my_images.logo_image == NULL) {
-        my_images.logo_image = gfxDrawLoadImage(LOGO_FILENAME);
+    // Already preloaded if listed in the manifest, the logo is drawn once
+    // it is ready
+    if (my_images.logo == NULL) {
+        my_images.logo = xAssetRequest(LOGO_FILENAME, ASSET_IMAGE);
     }
 }
 
@@ -312,120 +441,45 @@ void vDrawInitImages(void)
 
 void vDrawInitBallHorizontalAnimations(void)
 {
-    // Get path to image
-    char *ball_spritesheet_path =
-        gfxUtilFindResourcePath("ball_spritesheet.png");
-
-    // Load image into emulator
-    gfx_image_handle_t ball_spritesheet_image = NULL;
-    if ((ball_spritesheet_image =
-             gfxDrawLoadImage(ball_spritesheet_path)) == NULL) {
-        PRINT_ERROR("Failed to load ball_spritesheet.png");
-    }
-
-    // Create spritesheet from image
-    if ((my_animations.ball_spritesheet =
-             gfxDrawLoadSpritesheetFromEntireImageUnpadded(
-                 ball_spritesheet_image,
-                 TOTAL_NUMBER_OF_BALL_SPRITES, 1)) == NULL) {
-        PRINT_ERROR("Failed to create ball spritesheet");
-    }
-
-    // Create animation sequence, referencing spritesheet containing frame images
-    gfx_animation_handle_t ball_animation = NULL;
-    if ((ball_animation = gfxDrawAnimationCreate(
-                              my_animations.ball_spritesheet)) == NULL) {
-        PRINT_ERROR("Failed to create ball animation");
-    }
-
-    // Create animation sequences
-    if (gfxDrawAnimationAddSequence(ball_animation, "FORWARDS", 0, 0,
-                                    SPRITE_SEQUENCE_HORIZONTAL_POS,
-                                    NUMBER_OF_BALL_FRAMES)) {
-        PRINT_ERROR(
-            "Failed to create forwards ball animation sequence");
-    }
-    if (gfxDrawAnimationAddSequence(ball_animation, "REVERSE", 0, 23,
-                                    SPRITE_SEQUENCE_HORIZONTAL_NEG,
-                                    NUMBER_OF_BALL_FRAMES)) {
-        PRINT_ERROR(
-            "Failed to create forwards ball animation sequence");
-    }
-
-    // Create instances of the defined animation sequences
-    if ((my_animations.forward_sequence =
-             gfxDrawAnimationSequenceInstantiate(
-                 ball_animation, "FORWARDS",
-                 BALL_FRAME_PERIOD_MS)) == NULL) {
-        PRINT_ERROR(
-            "Failed to instantiate forwards ball animation sequence");
-    }
-    if ((my_animations.reverse_sequence =
-             gfxDrawAnimationSequenceInstantiate(
-                 ball_animation, "REVERSE",
-                 BALL_FRAME_PERIOD_MS)) == NULL) {
-        PRINT_ERROR(
-            "Failed to instantiate forwards ball animation sequence");
-    }
+    // Add the spritesheet's sprites to the atlas, they are drawn from the
+    // same texture as all other sprites in the atlas
+    if ((my_animations.ball_sheet =
+             xSpriteAtlasAddSheet(my_animations.atlas,
+                                  "ball_spritesheet.png",
+                                  TOTAL_NUMBER_OF_BALL_SPRITES, 1,
+                                  0, 0, 0, 0, 0, 0)) < 0) {
+        PRINT_ERROR("Failed to add ball spritesheet");
+    }
+
+    // Create the animation sequences, stepped by the drawing task
+    vSpriteSequenceInit(&my_animations.forward_sequence,
+                        my_animations.ball_sheet, 0, 0,
+                        SPRITE_SEQUENCE_HORIZONTAL_POS,
+                        NUMBER_OF_BALL_FRAMES, BALL_FRAME_PERIOD_MS);
+    vSpriteSequenceInit(&my_animations.reverse_sequence,
+                        my_animations.ball_sheet, 23, 0,
+                        SPRITE_SEQUENCE_HORIZONTAL_NEG,
+                        NUMBER_OF_BALL_FRAMES, BALL_FRAME_PERIOD_MS);
 }
 
 void vDrawInitBallVerticalAnimations(void)
 {
-    // Get path to image
-    char *ball_spritesheet_path =
-        gfxUtilFindResourcePath("ball_spritesheet_rotated.png");
-
-    // Load image into emulator
-    gfx_image_handle_t ball_spritesheet_image = NULL;
-    if ((ball_spritesheet_image =
-             gfxDrawLoadImage(ball_spritesheet_path)) == NULL) {
-        PRINT_ERROR("Failed to load ball_spritesheet_rotated.png");
-    }
-
-    // Create spritesheet from image
-    if ((my_animations.ball_spritesheet_rotated =
-             gfxDrawLoadSpritesheetFromEntireImageUnpadded(
-                 ball_spritesheet_image, 1,
-                 TOTAL_NUMBER_OF_BALL_SPRITES)) == NULL) {
-        PRINT_ERROR("Failed to create rotated ball spritesheet");
-    }
-
-    // Create animation sequence, referencing spritesheet containing frame images
-    gfx_animation_handle_t ball_animation_rotated = NULL;
-    if ((ball_animation_rotated = gfxDrawAnimationCreate(
-                                      my_animations.ball_spritesheet_rotated)) == NULL) {
-        PRINT_ERROR("Failed to create rotated ball animation");
-    }
-
-    // Create animation sequences
-    if (gfxDrawAnimationAddSequence(ball_animation_rotated, "DOWNWARDS", 0,
-                                    0, SPRITE_SEQUENCE_VERTICAL_POS,
-                                    NUMBER_OF_BALL_FRAMES)) {
-        PRINT_ERROR(
-            "Failed to create downwards rotated ball animation sequence");
-    }
-    if (gfxDrawAnimationAddSequence(ball_animation_rotated, "UPWARDS", 23,
-                                    0, SPRITE_SEQUENCE_VERTICAL_NEG,
-                                    NUMBER_OF_BALL_FRAMES)) {
-        PRINT_ERROR(
-            "Failed to create upwards rotated ball animation sequence");
-    }
-
-    // Create instances of the defined animation sequences
-    if ((my_animations.upward_sequence =
-             gfxDrawAnimationSequenceInstantiate(
-                 ball_animation_rotated, "DOWNWARDS",
-                 BALL_FRAME_PERIOD_MS)) == NULL) {
-        PRINT_ERROR(
-            "Failed to instantiate forwards ball animation sequence");
-    }
-    if ((my_animations.downward_sequence =
-             gfxDrawAnimationSequenceInstantiate(
-                 ball_animation_rotated, "UPWARDS",
-                 BALL_FRAME_PERIOD_MS)) == NULL) {
-        PRINT_ERROR(
-            "Failed to instantiate forwards ball animation sequence");
-    }
+    if ((my_animations.ball_rotated_sheet =
+             xSpriteAtlasAddSheet(my_animations.atlas,
+                                  "ball_spritesheet_rotated.png", 1,
+                                  TOTAL_NUMBER_OF_BALL_SPRITES,
+                                  0, 0, 0, 0, 0, 0)) < 0) {
+        PRINT_ERROR("Failed to add rotated ball spritesheet");
+    }
+
+    vSpriteSequenceInit(&my_animations.upward_sequence,
+                        my_animations.ball_rotated_sheet, 0, 0,
+                        SPRITE_SEQUENCE_VERTICAL_POS,
+                        NUMBER_OF_BALL_FRAMES, BALL_FRAME_PERIOD_MS);
+    vSpriteSequenceInit(&my_animations.downward_sequence,
+                        my_animations.ball_rotated_sheet, 0, 23,
+                        SPRITE_SEQUENCE_VERTICAL_NEG,
+                        NUMBER_OF_BALL_FRAMES, BALL_FRAME_PERIOD_MS);
 }
 
 // To get these values one can use a program like GIMP,
@@ -443,37 +497,21 @@ void vDrawInitBallVerticalAnimations(void)
 #define MARIO_HEIGHT 16
 #define MARIO_RUN_FRAME_PERIOD 200
 
-void vDrawInitMarioRunAnimation(gfx_image_handle_t donkey_kong_image)
+void vDrawInitMarioRunAnimation(const char *donkey_kong_filename)
 {
-    if ((my_animations.mario_run_spritesheet =
-             gfxDrawLoadSpritesheetFromPortionOfImagePaddedSpacing(
-                 donkey_kong_image, MARIO_SEQUENCE_IMAGES, 1,
-                 MARIO_WIDTH, MARIO_HEIGHT, MARIO_X_SPACING,
-                 MARIO_Y_SPACING, MARIO_START_IMAGE_X,
-                 MARIO_START_IMAGE_Y)) == NULL) {
-        PRINT_ERROR("Failed to create Mario run spritesheet");
-    }
-
-    gfx_animation_handle_t mario_run_animation = NULL;
-    if ((mario_run_animation = gfxDrawAnimationCreate(
-                                   my_animations.mario_run_spritesheet)) == NULL) {
-        PRINT_ERROR("Failed to create Mario run animation");
-    }
-
-    if (gfxDrawAnimationAddSequence(mario_run_animation, "Mario Run", 0, 0,
-                                    SPRITE_SEQUENCE_HORIZONTAL_POS,
-                                    MARIO_SEQUENCE_IMAGES)) {
-        PRINT_ERROR(
-            "Failed to create Mario running animation sequence");
-    }
-
-    if ((my_animations.mario_running_sequence =
-             gfxDrawAnimationSequenceInstantiate(
-                 mario_run_animation, "Mario Run",
-                 MARIO_RUN_FRAME_PERIOD)) == NULL) {
-        PRINT_ERROR(
-            "Failed to instantiate Mario running animation sequence");
-    }
+    if ((my_animations.mario_run_sheet =
+             xSpriteAtlasAddSheet(my_animations.atlas, donkey_kong_filename,
+                                  MARIO_SEQUENCE_IMAGES, 1, MARIO_WIDTH,
+                                  MARIO_HEIGHT, MARIO_START_IMAGE_X,
+                                  MARIO_START_IMAGE_Y, MARIO_X_SPACING,
+                                  MARIO_Y_SPACING)) < 0) {
+        PRINT_ERROR("Failed to add Mario run spritesheet");
+    }
+
+    vSpriteSequenceInit(&my_animations.mario_running_sequence,
+                        my_animations.mario_run_sheet, 0, 0,
+                        SPRITE_SEQUENCE_HORIZONTAL_POS,
+                        MARIO_SEQUENCE_IMAGES, MARIO_RUN_FRAME_PERIOD);
 }
 
 #define BARREL_SEQUENCE_IMAGES 4
@@ -485,59 +523,64 @@ void vDrawInitMarioRunAnimation(gfx_image_handle_t donkey_kong_image)
 #define BARREL_HEIGHT 12
 #define BARREL_FRAME_PERIOD 100
 
-void vDrawInitBarrelAnimation(gfx_image_handle_t donkey_kong_image)
+void vDrawInitBarrelAnimation(const char *donkey_kong_filename)
 {
-    if ((my_animations.barrel_spritesheet =
-             gfxDrawLoadSpritesheetFromPortionOfImagePadded(
-                 donkey_kong_image, BARREL_SEQUENCE_IMAGES, 1,
-                 BARREL_WIDTH, BARREL_HEIGHT, BARREL_X_PADDING,
-                 BARREL_Y_PADDING, BARREL_START_IMAGE_X,
-                 BARREL_START_IMAGE_Y)) == NULL) {
-        PRINT_ERROR("Failed to create barrel spritesheet");
-    }
-
-    gfx_animation_handle_t barrel_animation = NULL;
-    if ((barrel_animation = gfxDrawAnimationCreate(
-                                my_animations.barrel_spritesheet)) == NULL) {
-        PRINT_ERROR("Failed to create barrel animation");
-    }
-
-    if (gfxDrawAnimationAddSequence(barrel_animation, "Barrel Forward", 0,
-                                    0, SPRITE_SEQUENCE_HORIZONTAL_POS,
-                                    BARREL_SEQUENCE_IMAGES)) {
-        PRINT_ERROR(
-            "Failed to create barrel forward animation sequence");
-    }
-
-    if ((my_animations.barrel_sequence =
-             gfxDrawAnimationSequenceInstantiate(
-                 barrel_animation, "Barrel Forward",
-                 BARREL_FRAME_PERIOD)) == NULL) {
-        PRINT_ERROR(
-            "Failed to instantiate barrel forward animation sequence");
-    }
+    if ((my_animations.barrel_sheet =
+             xSpriteAtlasAddSheet(my_animations.atlas, donkey_kong_filename,
+                                  BARREL_SEQUENCE_IMAGES, 1, BARREL_WIDTH,
+                                  BARREL_HEIGHT, BARREL_START_IMAGE_X,
+                                  BARREL_START_IMAGE_Y, BARREL_X_PADDING,
+                                  BARREL_Y_PADDING)) < 0) {
+        PRINT_ERROR("Failed to add barrel spritesheet");
+    }
+
+    vSpriteSequenceInit(&my_animations.barrel_sequence,
+                        my_animations.barrel_sheet, 0, 0,
+                        SPRITE_SEQUENCE_HORIZONTAL_POS,
+                        BARREL_SEQUENCE_IMAGES, BARREL_FRAME_PERIOD);
 }
 
 void vDrawInitDonkeyKongAnimations(void)
 {
-    char *donkey_kong_path =
-        gfxUtilFindResourcePath("donkey_kong_spritesheet.png");
-    gfx_image_handle_t donkey_kong_image = NULL;
-    if ((donkey_kong_image = gfxDrawLoadImage(donkey_kong_path)) == NULL) {
-        PRINT_ERROR("Failed to load donkey_kong_spritesheet.png");
-    }
-
-    vDrawInitMarioRunAnimation(donkey_kong_image);
-    vDrawInitBarrelAnimation(donkey_kong_image);
+    // Both sheets are cut from the same image, it is only loaded once
+    vDrawInitMarioRunAnimation("donkey_kong_spritesheet.png");
+    vDrawInitBarrelAnimation("donkey_kong_spritesheet.png");
 }
 
 void vDrawInitAnnimations(void)
 {
     my_animations.lock = xSemaphoreCreateMutex();
 
+    if (!(my_animations.atlas = xSpriteAtlasCreate())) {
+        return;
+    }
+
     vDrawInitBallHorizontalAnimations();
     vDrawInitBallVerticalAnimations();
     vDrawInitDonkeyKongAnimations();
+
+    // The atlas is built by vDrawSpriteAnimations once the sheets' images
+    // are decoded, such that the first frames are not delayed
+}
+
+// Packs all of the sheets' sprites into a single texture once their images
+// are decoded, the animations are not drawn until then
+static int xDrawAnimationsReady(void)
+{
+    if (!my_animations.atlas_built && my_animations.atlas &&
+        xSpriteAtlasLoaded(my_animations.atlas)) {
+        if (xSpriteAtlasBuild(my_animations.atlas)) {
+            fprints(stderr, "Failed to build sprite atlas\n");
+            my_animations.atlas_built = -1;
+        }
+        else {
+            my_animations.atlas_built = 1;
+            // The static sprite layer is retained, draw it now
+            vDrawLayersInvalidate();
+        }
+    }
+
+    return my_animations.atlas_built == 1;
 }
 
 void vDrawInitResources(void)
@@ -548,54 +591,205 @@ void vDrawInitResources(void)
 
 void vDrawSpriteStatic()
 {
-    // Static sprite example
-    vCheckDraw(gfxDrawSprite(my_animations.ball_spritesheet,
-                             5, 0, SCREEN_WIDTH - 130,
-                             SCREEN_HEIGHT - 60),
-               __FUNCTION__);
+    // Static sprite example, a batch of one sprite
+    sprite_batch_t *batch = &my_animations.static_batch;
+
+    // Drawn once the atlas has been built
+    if (my_animations.atlas_built != 1) {
+        return;
+    }
 
+    vSpriteBatchBegin(batch, my_animations.atlas);
+    if (!xSpriteBatchAdd(batch, my_animations.ball_sheet, 5, 0,
+                         SCREEN_WIDTH - 130, SCREEN_HEIGHT - 60)) {
+        vCheckDraw(xSpriteBatchSubmit(batch), __FUNCTION__);
+    }
 }
 
 void vDrawSpriteResetDownwardSequence()
 {
     // Show what resetting does
-    gfxDrawAnimationReset(my_animations.downward_sequence);
+    if (my_animations.lock)
+        if (xSemaphoreTake(my_animations.lock, 0) == pdTRUE) {
+            vSpriteSequenceReset(&my_animations.downward_sequence);
+            xSemaphoreGive(my_animations.lock);
+        }
 }
 
 void vDrawSpriteAnimations(TickType_t xLastFrameTime)
 {
+    sprite_batch_t *batch = &my_animations.batch;
+    TickType_t elapsed;
+
     if (my_animations.lock)
         if (xSemaphoreTake(my_animations.lock, 0) == pdTRUE) {
+            if (!xDrawAnimationsReady()) {
+                xSemaphoreGive(my_animations.lock);
+                return;
+            }
+
+            elapsed = xTaskGetTickCount() - xLastFrameTime;
+
+            vSpriteSequenceStep(&my_animations.forward_sequence, elapsed);
+            vSpriteSequenceStep(&my_animations.reverse_sequence, elapsed);
+            vSpriteSequenceStep(&my_animations.downward_sequence, elapsed);
+            vSpriteSequenceStep(&my_animations.upward_sequence, elapsed);
+            vSpriteSequenceStep(&my_animations.mario_running_sequence,
+                                elapsed);
+            vSpriteSequenceStep(&my_animations.barrel_sequence, elapsed);
 
             // Show all four directions you can use for creating an
-            // animation
-            TickType_t current_tick = xTaskGetTickCount();
-            gfxDrawAnimationDrawFrame(
-                my_animations.forward_sequence,
-                current_tick - xLastFrameTime,
-                SCREEN_WIDTH - 50, SCREEN_HEIGHT - 60);
-            gfxDrawAnimationDrawFrame(
-                my_animations.reverse_sequence,
-                current_tick - xLastFrameTime,
-                SCREEN_WIDTH - 90, SCREEN_HEIGHT - 60);
-            gfxDrawAnimationDrawFrame(
-                my_animations.downward_sequence,
-                current_tick - xLastFrameTime,
-                SCREEN_WIDTH - 50, SCREEN_HEIGHT - 200);
-            gfxDrawAnimationDrawFrame(my_animations.upward_sequence,
-                                      current_tick - xLastFrameTime,
-                                      SCREEN_WIDTH - 90,
-                                      SCREEN_HEIGHT - 100);
+            // animation, all of the frames are drawn by one command
+            vSpriteBatchBegin(batch, my_animations.atlas);
+            xSpriteBatchAddSequence(batch, &my_animations.forward_sequence,
+                                    SCREEN_WIDTH - 50, SCREEN_HEIGHT - 60);
+            xSpriteBatchAddSequence(batch, &my_animations.reverse_sequence,
+                                    SCREEN_WIDTH - 90, SCREEN_HEIGHT - 60);
+            xSpriteBatchAddSequence(batch, &my_animations.downward_sequence,
+                                    SCREEN_WIDTH - 50, SCREEN_HEIGHT - 200);
+            xSpriteBatchAddSequence(batch, &my_animations.upward_sequence,
+                                    SCREEN_WIDTH - 90, SCREEN_HEIGHT - 100);
 
             // Mario examples
-            gfxDrawAnimationDrawFrame(
-                my_animations.mario_running_sequence,
-                current_tick - xLastFrameTime,
-                SCREEN_WIDTH - 180, SCREEN_HEIGHT - 50);
-            gfxDrawAnimationDrawFrame(my_animations.barrel_sequence,
-                                      current_tick - xLastFrameTime,
-                                      SCREEN_WIDTH - 150,
-                                      SCREEN_HEIGHT - 50);
+            xSpriteBatchAddSequence(batch,
+                                    &my_animations.mario_running_sequence,
+                                    SCREEN_WIDTH - 180, SCREEN_HEIGHT - 50);
+            xSpriteBatchAddSequence(batch, &my_animations.barrel_sequence,
+                                    SCREEN_WIDTH - 150, SCREEN_HEIGHT - 50);
+
+            vCheckDraw(xSpriteBatchSubmit(batch), __FUNCTION__);
             xSemaphoreGive(my_animations.lock);
+
+            vDrawLayersDamage(SCREEN_WIDTH - 50, SCREEN_HEIGHT - 60,
+                              BALL_SPRITE_SIZE, BALL_SPRITE_SIZE);
+            vDrawLayersDamage(SCREEN_WIDTH - 90, SCREEN_HEIGHT - 60,
+                              BALL_SPRITE_SIZE, BALL_SPRITE_SIZE);
+            vDrawLayersDamage(SCREEN_WIDTH - 50, SCREEN_HEIGHT - 200,
+                              BALL_SPRITE_SIZE, BALL_SPRITE_SIZE);
+            vDrawLayersDamage(SCREEN_WIDTH - 90, SCREEN_HEIGHT - 100,
+                              BALL_SPRITE_SIZE, BALL_SPRITE_SIZE);
+            vDrawLayersDamage(SCREEN_WIDTH - 180, SCREEN_HEIGHT - 50,
+                              MARIO_WIDTH, MARIO_HEIGHT);
+            vDrawLayersDamage(SCREEN_WIDTH - 150, SCREEN_HEIGHT - 50,
+                              BARREL_WIDTH, BARREL_HEIGHT);
         }
 }
+
+static void vDrawHelpTextLayer(void *args)
+{
+    vDrawHelpText();
+}
+
+static void vDrawLogoLayer(void *args)
+{
+    vDrawLogo();
+}
+
+static void vDrawCaveLayer(void *args)
+{
+    vDrawCaveBoundingBox();
+}
+
+static void vDrawSpriteStaticLayer(void *args)
+{
+    vDrawSpriteStatic();
+}
+
+struct walls {
+    wall_t *left;
+    wall_t *right;
+    wall_t *top;
+    wall_t *bottom;
+} my_walls = { 0 };
+
+static void vDrawWallsLayer(void *args)
+{
+    struct walls *walls = (struct walls *)args;
+
+    vDrawWalls(walls->left, walls->right, walls->top, walls->bottom);
+}
+
+static draw_layer_t help_text_layer = {
+    .bounds = { SCREEN_WIDTH / 2, 0, SCREEN_WIDTH / 2, HELP_TEXT_AREA_HEIGHT },
+    .draw = vDrawHelpTextLayer,
+};
+
+// Bounds are updated to the size of the logo once it is loaded
+static draw_layer_t logo_layer = {
+    .bounds = { 0, SCREEN_HEIGHT / 2, SCREEN_WIDTH / 2, SCREEN_HEIGHT / 2 },
+    .draw = vDrawLogoLayer,
+};
+
+static draw_layer_t cave_layer = {
+    .bounds = { CAVE_X - CAVE_THICKNESS, CAVE_Y - CAVE_THICKNESS,
+                CAVE_SIZE_X + CAVE_THICKNESS * 2,
+                CAVE_SIZE_Y + CAVE_THICKNESS * 2 },
+    .draw = vDrawCaveLayer,
+};
+
+static draw_layer_t static_sprite_layer = {
+    .bounds = { SCREEN_WIDTH - 130, SCREEN_HEIGHT - 60, BALL_SPRITE_SIZE,
+                BALL_SPRITE_SIZE },
+    .draw = vDrawSpriteStaticLayer,
+};
+
+// Walls are the same size as the cave's bounding box
+static draw_layer_t walls_layer = {
+    .bounds = { CAVE_X - CAVE_THICKNESS, CAVE_Y - CAVE_THICKNESS,
+                CAVE_SIZE_X + CAVE_THICKNESS * 2,
+                CAVE_SIZE_Y + CAVE_THICKNESS * 2 },
+    .draw = vDrawWallsLayer,
+    .args = &my_walls,
+};
+
+static draw_layer_t *state_one_layers[] = { &help_text_layer, &logo_layer,
+                                            &cave_layer, &static_sprite_layer
+                                          };
+
+static draw_layer_t *state_two_layers[] = { &help_text_layer, &logo_layer,
+                                            &walls_layer
+                                          };
+
+void vDrawInitLogoLayer(void)
+{
+    int width, height;
+
+    vRendererTextureGetSize(my_images.logo_texture, &width, &height);
+
+    if (width && height) {
+        logo_layer.bounds.x = 10;
+        logo_layer.bounds.y = SCREEN_HEIGHT - 10 - height;
+        logo_layer.bounds.w = width;
+        logo_layer.bounds.h = height;
+    }
+}
+
+void vDrawComposeStateOne(void)
+{
+    // Clearing damaged regions and recomposing the layers on top of them
+    // must happen in order
+    draw_depth_e prev_depth = xDrawCommandsSetDepth(DRAW_DEPTH_BACKGROUND);
+
+    vDrawLayersCompose(state_one_layers,
+                       sizeof(state_one_layers) / sizeof(state_one_layers[0]),
+                       White);
+
+    xDrawCommandsSetDepth(prev_depth);
+}
+
+void vDrawComposeStateTwo(wall_t *left_wall, wall_t *right_wall,
+                          wall_t *top_wall, wall_t *bottom_wall)
+{
+    my_walls.left = left_wall;
+    my_walls.right = right_wall;
+    my_walls.top = top_wall;
+    my_walls.bottom = bottom_wall;
+
+    draw_depth_e prev_depth = xDrawCommandsSetDepth(DRAW_DEPTH_BACKGROUND);
+
+    vDrawLayersCompose(state_two_layers,
+                       sizeof(state_two_layers) / sizeof(state_two_layers[0]),
+                       White);
+
+    xDrawCommandsSetDepth(prev_depth);
+}
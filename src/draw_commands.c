@@ -0,0 +1,734 @@
+/**
+ * @file draw_commands.c
+ * @author Alex Hoffman
+ * @date 23 January 2023
+ * @brief Per-task draw command buffers that are executed as one sorted
+ * batch by the task presenting the frames
+ *
+ * @verbatim
+ ----------------------------------------------------------------------
+ Copyright (C) Alexander Hoffman, 2023
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ any later version.
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ----------------------------------------------------------------------
+ @endverbatim
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <SDL2/SDL.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+#include "queue.h"
+#include "semphr.h"
+
+#include "gfx_draw.h"
+#include "gfx_print.h"
+
+#include "EmulatorConfig.h"
+#include "draw_commands.h"
+#include "renderer.h"
+#include "text_cache.h"
+
+#define BUFFERS_PER_PRODUCER 2
+#define MAX_SUBMITTED_BUFFERS                                          \
+    (configDRAW_COMMAND_MAX_PRODUCERS * BUFFERS_PER_PRODUCER)
+
+// Sort key, from most to least significant: depth, primitive type, texture
+// and the order in which the command was submitted
+#define KEY_DEPTH_SHIFT 56
+#define KEY_TYPE_SHIFT 52
+#define KEY_TEXTURE_SHIFT 28
+#define KEY_TEXTURE_MASK 0xFFFFFF
+#define KEY_BUFFER_SHIFT 16
+
+typedef enum draw_command_type {
+    DRAW_COMMAND_CLEAR = 0,
+    DRAW_COMMAND_FILLED_BOX,
+    DRAW_COMMAND_BOX,
+    DRAW_COMMAND_CIRCLE,
+    DRAW_COMMAND_IMAGE,
+    DRAW_COMMAND_TEXTURE,
+    DRAW_COMMAND_TARGET,
+    DRAW_COMMAND_SPRITE,
+    DRAW_COMMAND_SPRITES,
+    DRAW_COMMAND_ANIMATION_FRAME,
+    DRAW_COMMAND_TEXT,
+} draw_command_type_e;
+
+typedef struct draw_command {
+    uint64_t key;
+    draw_command_type_e type;
+    union {
+        unsigned int clear_colour;
+        struct {
+            ssize_t x;
+            ssize_t y;
+            ssize_t w;
+            ssize_t h;
+            unsigned int colour;
+        } box;
+        struct {
+            ssize_t x;
+            ssize_t y;
+            ssize_t radius;
+            unsigned int colour;
+        } circle;
+        struct {
+            const char *font_name;
+            ssize_t size;
+            unsigned int colour;
+            const char *str;
+            ssize_t x;
+            ssize_t y;
+        } text;
+        struct {
+            gfx_spritesheet_handle_t spritesheet;
+            char column;
+            char row;
+            signed short x;
+            signed short y;
+        } sprite;
+        struct {
+            renderer_texture_handle_t texture;
+            const draw_sprite_t *sprites;
+            unsigned int count;
+        } sprites;
+        struct {
+            gfx_image_handle_t image;
+            signed short x;
+            signed short y;
+        } image;
+        struct {
+            renderer_texture_handle_t texture;
+            signed short x;
+            signed short y;
+            // Region of the texture drawn at the same position on the
+            // screen, all of the texture is drawn at x, y if empty
+            SDL_Rect region;
+        } texture;
+        renderer_texture_handle_t target;
+        struct {
+            gfx_sequence_handle_t sequence;
+            unsigned ms;
+            ssize_t x;
+            ssize_t y;
+        } animation;
+    };
+} draw_command_t;
+
+typedef struct draw_producer draw_producer_t;
+
+typedef struct draw_command_buffer {
+    draw_producer_t *owner;
+    draw_depth_e depth;
+    unsigned int count;
+    unsigned int text_length;
+    unsigned int sprite_count;
+    unsigned int dropped;
+    draw_command_t commands[configDRAW_COMMAND_BUFFER_LENGTH];
+    char text[configDRAW_COMMAND_TEXT_LENGTH];
+    draw_sprite_t sprites[configDRAW_COMMAND_SPRITES];
+} draw_command_buffer_t;
+
+// A task that records commands, it alternates between two buffers so that
+// it can record the next frame while its previous frame is still waiting to
+// be executed
+struct draw_producer {
+    SemaphoreHandle_t free_buffers;
+    unsigned int next;
+    draw_command_buffer_t *bound;
+    draw_command_buffer_t buffers[BUFFERS_PER_PRODUCER];
+};
+
+static struct draw_commands {
+    QueueHandle_t submitted;
+    draw_producer_t *producers[configDRAW_COMMAND_MAX_PRODUCERS];
+    unsigned int producer_count;
+    draw_command_t *sorted[MAX_SUBMITTED_BUFFERS *
+                           configDRAW_COMMAND_BUFFER_LENGTH];
+} commands = { 0 };
+
+static uint32_t ulTextureID(const void *texture)
+{
+    return ((uint32_t)((uintptr_t)texture >> 4) * 2654435761u) >> 8;
+}
+
+static void vDrawCommandSetColour(SDL_Renderer *renderer,
+                                  unsigned int colour)
+{
+    SDL_SetRenderDrawColor(renderer, (colour >> 16) & 0xFF,
+                           (colour >> 8) & 0xFF, colour & 0xFF, 0xFF);
+}
+
+// Fills the circle with one span per row, the spans are converted on the
+// stack a few at a time
+static int xDrawCommandRunCircle(SDL_Renderer *renderer,
+                                 draw_command_t *cmd)
+{
+    SDL_Rect spans[configDRAW_COMMAND_RECTS_PER_CALL];
+    ssize_t radius = cmd->circle.radius, half = radius;
+    unsigned int count = 0;
+    int ret = 0;
+
+    vDrawCommandSetColour(renderer, cmd->circle.colour);
+
+    // The rows above and below the centre are as wide, a span only shrinks
+    // moving away from the centre
+    for (ssize_t dy = 0; dy <= radius; dy++) {
+        while (half > 0 && half * half + dy * dy > radius * radius) {
+            half--;
+        }
+
+        spans[count].x = cmd->circle.x - half;
+        spans[count].y = cmd->circle.y + dy;
+        spans[count].w = 2 * half + 1;
+        spans[count].h = 1;
+        if (dy) {
+            spans[count + 1] = spans[count];
+            spans[++count].y = cmd->circle.y - dy;
+        }
+        count++;
+
+        if (count + 2 > configDRAW_COMMAND_RECTS_PER_CALL || dy == radius) {
+            ret |= SDL_RenderFillRects(renderer, spans, count);
+            count = 0;
+        }
+    }
+
+    return ret;
+}
+
+static void vSetVertex(SDL_Vertex *vertex, float x, float y, float u,
+                       float v)
+{
+    vertex->position.x = x;
+    vertex->position.y = y;
+    vertex->color.r = vertex->color.g = vertex->color.b = 0xFF;
+    vertex->color.a = 0xFF;
+    vertex->tex_coord.x = u;
+    vertex->tex_coord.y = v;
+}
+
+// Draws the sprites as two triangles each, with one SDL_RenderGeometry call
+// per configDRAW_COMMAND_RECTS_PER_CALL sprites
+static int xDrawCommandRunSprites(SDL_Renderer *renderer,
+                                  draw_command_t *cmd)
+{
+    SDL_Vertex vertices[configDRAW_COMMAND_RECTS_PER_CALL * 4];
+    int indices[configDRAW_COMMAND_RECTS_PER_CALL * 6];
+    SDL_Texture *texture = pxRendererTextureGet(cmd->sprites.texture);
+    const draw_sprite_t *sprite = cmd->sprites.sprites;
+    unsigned int count = 0;
+    int width, height, ret = 0;
+    SDL_Vertex *corners;
+    int *index;
+
+    if (!texture) {
+        return -1;
+    }
+
+    vRendererTextureGetSize(cmd->sprites.texture, &width, &height);
+
+    for (unsigned int i = 0; i < cmd->sprites.count; i++, sprite++) {
+        float left = (float)sprite->source_x / width;
+        float top = (float)sprite->source_y / height;
+        float right = (float)(sprite->source_x + sprite->width) / width;
+        float bottom = (float)(sprite->source_y + sprite->height) / height;
+
+        corners = &vertices[count * 4];
+        vSetVertex(&corners[0], sprite->x, sprite->y, left, top);
+        vSetVertex(&corners[1], sprite->x + sprite->width, sprite->y, right,
+                   top);
+        vSetVertex(&corners[2], sprite->x + sprite->width,
+                   sprite->y + sprite->height, right, bottom);
+        vSetVertex(&corners[3], sprite->x, sprite->y + sprite->height, left,
+                   bottom);
+
+        index = &indices[count * 6];
+        index[0] = index[3] = count * 4;
+        index[1] = count * 4 + 1;
+        index[2] = index[4] = count * 4 + 2;
+        index[5] = count * 4 + 3;
+
+        if (++count == configDRAW_COMMAND_RECTS_PER_CALL ||
+            i + 1 == cmd->sprites.count) {
+            ret |= SDL_RenderGeometry(renderer, texture, vertices, count * 4,
+                                      indices, count * 6);
+            count = 0;
+        }
+    }
+
+    return ret;
+}
+
+static int xDrawCommandRunTexture(SDL_Renderer *renderer,
+                                  draw_command_t *cmd)
+{
+    SDL_Texture *texture = pxRendererTextureGet(cmd->texture.texture);
+    SDL_Rect dst = { cmd->texture.x, cmd->texture.y, 0, 0 };
+
+    if (!texture) {
+        return -1;
+    }
+
+    if (cmd->texture.region.w) {
+        return SDL_RenderCopy(renderer, texture, &cmd->texture.region,
+                              &cmd->texture.region);
+    }
+
+    vRendererTextureGetSize(cmd->texture.texture, &dst.w, &dst.h);
+
+    return SDL_RenderCopy(renderer, texture, NULL, &dst);
+}
+
+static int xDrawCommandRunTarget(SDL_Renderer *renderer,
+                                 draw_command_t *cmd)
+{
+    SDL_Texture *target = NULL;
+
+    if (cmd->target && !(target = pxRendererTextureGet(cmd->target))) {
+        return -1;
+    }
+
+    return SDL_SetRenderTarget(renderer, target);
+}
+
+// The task that renders draws what the renderer can draw itself, other
+// tasks and the remaining commands go through the Gfx library
+static int xDrawCommandRun(draw_command_t *cmd)
+{
+    SDL_Renderer *renderer = pxRendererGet();
+    SDL_Rect rect = { cmd->box.x, cmd->box.y, cmd->box.w, cmd->box.h };
+
+    switch (cmd->type) {
+        case DRAW_COMMAND_CLEAR:
+            if (renderer) {
+                vDrawCommandSetColour(renderer, cmd->clear_colour);
+                return SDL_RenderClear(renderer);
+            }
+            return gfxDrawClear(cmd->clear_colour);
+        case DRAW_COMMAND_FILLED_BOX:
+            if (renderer) {
+                vDrawCommandSetColour(renderer, cmd->box.colour);
+                return SDL_RenderFillRect(renderer, &rect);
+            }
+            return gfxDrawFilledBox(cmd->box.x, cmd->box.y, cmd->box.w,
+                                    cmd->box.h, cmd->box.colour);
+        case DRAW_COMMAND_BOX:
+            if (renderer) {
+                vDrawCommandSetColour(renderer, cmd->box.colour);
+                return SDL_RenderDrawRect(renderer, &rect);
+            }
+            return gfxDrawBox(cmd->box.x, cmd->box.y, cmd->box.w, cmd->box.h,
+                              cmd->box.colour);
+        case DRAW_COMMAND_CIRCLE:
+            if (renderer) {
+                return xDrawCommandRunCircle(renderer, cmd);
+            }
+            return gfxDrawCircle(cmd->circle.x, cmd->circle.y,
+                                 cmd->circle.radius, cmd->circle.colour);
+        case DRAW_COMMAND_IMAGE:
+            return gfxDrawLoadedImage(cmd->image.image, cmd->image.x,
+                                      cmd->image.y);
+        case DRAW_COMMAND_TEXTURE:
+            return renderer ? xDrawCommandRunTexture(renderer, cmd) : -1;
+        case DRAW_COMMAND_TARGET:
+            return renderer ? xDrawCommandRunTarget(renderer, cmd) : -1;
+        case DRAW_COMMAND_SPRITE:
+            return gfxDrawSprite(cmd->sprite.spritesheet, cmd->sprite.column,
+                                 cmd->sprite.row, cmd->sprite.x,
+                                 cmd->sprite.y);
+        case DRAW_COMMAND_SPRITES:
+            // Atlas pages only exist as renderer textures
+            return renderer ? xDrawCommandRunSprites(renderer, cmd) : -1;
+        case DRAW_COMMAND_ANIMATION_FRAME:
+            return gfxDrawAnimationDrawFrame(cmd->animation.sequence,
+                                             cmd->animation.ms,
+                                             cmd->animation.x,
+                                             cmd->animation.y);
+        case DRAW_COMMAND_TEXT:
+            return xTextCacheDrawText(cmd->text.font_name, cmd->text.size,
+                                      cmd->text.colour, cmd->text.str,
+                                      cmd->text.x, cmd->text.y);
+        default:
+            return -1;
+    }
+}
+
+static draw_command_buffer_t *pxBoundBuffer(void)
+{
+    draw_producer_t *producer = pvTaskGetThreadLocalStoragePointer(
+                                    NULL, configDRAW_COMMANDS_TLS_INDEX);
+
+    return producer ? producer->bound : NULL;
+}
+
+// Records the command into the calling task's bound buffer, or runs it
+// straight away if the task is not recording
+static int xDrawCommandRecord(draw_command_t *cmd, uint32_t texture)
+{
+    draw_command_buffer_t *buffer = pxBoundBuffer();
+    size_t length;
+
+    if (!buffer) {
+        return xDrawCommandRun(cmd);
+    }
+
+    if (buffer->count == configDRAW_COMMAND_BUFFER_LENGTH) {
+        buffer->dropped++;
+        return -1;
+    }
+
+    if (cmd->type == DRAW_COMMAND_TEXT) {
+        length = strlen(cmd->text.str) + 1;
+        if (buffer->text_length + length > configDRAW_COMMAND_TEXT_LENGTH) {
+            buffer->dropped++;
+            return -1;
+        }
+        memcpy(&buffer->text[buffer->text_length], cmd->text.str, length);
+        cmd->text.str = &buffer->text[buffer->text_length];
+        buffer->text_length += length;
+    }
+
+    if (cmd->type == DRAW_COMMAND_SPRITES) {
+        if (buffer->sprite_count + cmd->sprites.count >
+            configDRAW_COMMAND_SPRITES) {
+            buffer->dropped++;
+            return -1;
+        }
+        memcpy(&buffer->sprites[buffer->sprite_count], cmd->sprites.sprites,
+               cmd->sprites.count * sizeof(draw_sprite_t));
+        cmd->sprites.sprites = &buffer->sprites[buffer->sprite_count];
+        buffer->sprite_count += cmd->sprites.count;
+    }
+
+    cmd->key = (uint64_t)buffer->depth << KEY_DEPTH_SHIFT;
+    if (buffer->depth != DRAW_DEPTH_BACKGROUND)
+        cmd->key |= (uint64_t)cmd->type << KEY_TYPE_SHIFT |
+                    (uint64_t)(texture & KEY_TEXTURE_MASK)
+                    << KEY_TEXTURE_SHIFT;
+
+    buffer->commands[buffer->count++] = *cmd;
+
+    return 0;
+}
+
+static draw_producer_t *pxDrawCommandsAddProducer(void)
+{
+    draw_producer_t *producer = NULL;
+
+    vTaskSuspendAll();
+    if (commands.producer_count < configDRAW_COMMAND_MAX_PRODUCERS) {
+        producer = pvPortMalloc(sizeof(draw_producer_t));
+        if (producer) {
+            commands.producers[commands.producer_count++] = producer;
+        }
+    }
+    xTaskResumeAll();
+
+    if (!producer) {
+        PRINT_ERROR("Failed to allocate draw command buffers for '%s'",
+                    pcTaskGetName(NULL));
+        return NULL;
+    }
+
+    memset(producer, 0, sizeof(draw_producer_t));
+    for (int i = 0; i < BUFFERS_PER_PRODUCER; i++) {
+        producer->buffers[i].owner = producer;
+    }
+
+    producer->free_buffers = xSemaphoreCreateCounting(BUFFERS_PER_PRODUCER,
+                             BUFFERS_PER_PRODUCER);
+    if (!producer->free_buffers) {
+        PRINT_ERROR("Failed to create draw command buffer semaphore");
+        return NULL;
+    }
+
+    vTaskSetThreadLocalStoragePointer(NULL, configDRAW_COMMANDS_TLS_INDEX,
+                                      producer);
+
+    return producer;
+}
+
+int xDrawCommandsBegin(void)
+{
+    draw_producer_t *producer = pvTaskGetThreadLocalStoragePointer(
+                                    NULL, configDRAW_COMMANDS_TLS_INDEX);
+    draw_command_buffer_t *buffer;
+
+    if (!producer && !(producer = pxDrawCommandsAddProducer())) {
+        return -1;
+    }
+
+    if (!producer->bound) {
+        if (xSemaphoreTake(producer->free_buffers, portMAX_DELAY) !=
+            pdTRUE) {
+            return -1;
+        }
+        producer->bound = &producer->buffers[producer->next];
+        producer->next = (producer->next + 1) % BUFFERS_PER_PRODUCER;
+    }
+
+    buffer = producer->bound;
+    buffer->depth = DRAW_DEPTH_SCENE;
+    buffer->count = 0;
+    buffer->text_length = 0;
+    buffer->sprite_count = 0;
+    buffer->dropped = 0;
+
+    return 0;
+}
+
+int xDrawCommandsRecording(void)
+{
+    return pxBoundBuffer() != NULL;
+}
+
+draw_depth_e xDrawCommandsSetDepth(draw_depth_e depth)
+{
+    draw_command_buffer_t *buffer = pxBoundBuffer();
+    draw_depth_e prev;
+
+    if (!buffer) {
+        return DRAW_DEPTH_SCENE;
+    }
+
+    prev = buffer->depth;
+    buffer->depth = depth;
+
+    return prev;
+}
+
+void vDrawCommandsSubmit(void)
+{
+    draw_producer_t *producer = pvTaskGetThreadLocalStoragePointer(
+                                    NULL, configDRAW_COMMANDS_TLS_INDEX);
+
+    if (!producer || !producer->bound) {
+        return;
+    }
+
+    xQueueSend(commands.submitted, &producer->bound, portMAX_DELAY);
+    producer->bound = NULL;
+}
+
+static int xDrawCommandCompare(const void *a, const void *b)
+{
+    uint64_t key_a = (*(draw_command_t *const *)a)->key;
+    uint64_t key_b = (*(draw_command_t *const *)b)->key;
+
+    return (key_a > key_b) - (key_a < key_b);
+}
+
+void vDrawCommandsExecute(void)
+{
+    draw_command_buffer_t *buffers[MAX_SUBMITTED_BUFFERS];
+    unsigned int buffer_count = 0, count = 0;
+    SDL_Renderer *renderer;
+
+    if (!commands.submitted) {
+        return;
+    }
+
+    while (buffer_count < MAX_SUBMITTED_BUFFERS &&
+           xQueueReceive(commands.submitted, &buffers[buffer_count], 0) ==
+           pdTRUE) {
+        buffer_count++;
+    }
+
+    for (unsigned int i = 0; i < buffer_count; i++)
+        for (unsigned int j = 0; j < buffers[i]->count; j++) {
+            buffers[i]->commands[j].key |= i << KEY_BUFFER_SHIFT | j;
+            commands.sorted[count++] = &buffers[i]->commands[j];
+        }
+
+    qsort(commands.sorted, count, sizeof(commands.sorted[0]),
+          xDrawCommandCompare);
+
+    for (unsigned int i = 0; i < count; i++)
+        if (xDrawCommandRun(commands.sorted[i]))
+            fprints(stderr, "[ERROR] %s, %s\n", __FUNCTION__,
+                    gfxGetErrorMessage());
+
+    // A buffer that dropped the command switching back to the screen
+    // would leave the next frame drawing into a texture
+    if ((renderer = pxRendererGet())) {
+        SDL_SetRenderTarget(renderer, NULL);
+    }
+
+    for (unsigned int i = 0; i < buffer_count; i++) {
+        if (buffers[i]->dropped)
+            fprints(stderr, "[ERROR] %s, dropped %u draw commands\n",
+                    __FUNCTION__, buffers[i]->dropped);
+        xSemaphoreGive(buffers[i]->owner->free_buffers);
+    }
+}
+
+int xDrawCommandClear(unsigned int colour)
+{
+    draw_command_t cmd = { .type = DRAW_COMMAND_CLEAR,
+                           .clear_colour = colour
+                         };
+
+    return xDrawCommandRecord(&cmd, 0);
+}
+
+int xDrawCommandFilledBox(ssize_t x, ssize_t y, ssize_t w, ssize_t h,
+                          unsigned int colour)
+{
+    draw_command_t cmd = { .type = DRAW_COMMAND_FILLED_BOX,
+                           .box = { x, y, w, h, colour }
+                         };
+
+    return xDrawCommandRecord(&cmd, 0);
+}
+
+int xDrawCommandBox(ssize_t x, ssize_t y, ssize_t w, ssize_t h,
+                    unsigned int colour)
+{
+    draw_command_t cmd = { .type = DRAW_COMMAND_BOX,
+                           .box = { x, y, w, h, colour }
+                         };
+
+    return xDrawCommandRecord(&cmd, 0);
+}
+
+int xDrawCommandCircle(ssize_t x, ssize_t y, ssize_t radius,
+                       unsigned int colour)
+{
+    draw_command_t cmd = { .type = DRAW_COMMAND_CIRCLE,
+                           .circle = { x, y, radius, colour }
+                         };
+
+    return xDrawCommandRecord(&cmd, 0);
+}
+
+int xDrawCommandText(const char *font_name, ssize_t size,
+                     unsigned int colour, const char *str, ssize_t x,
+                     ssize_t y)
+{
+    draw_command_t cmd = { .type = DRAW_COMMAND_TEXT,
+                           .text = { font_name, size, colour, str, x, y }
+                         };
+
+    // Each string is its own texture, text of the same font is kept
+    // together
+    return xDrawCommandRecord(&cmd, ulTextureID(font_name) ^ size);
+}
+
+int xDrawCommandSprite(gfx_spritesheet_handle_t spritesheet, char column,
+                       char row, signed short x, signed short y)
+{
+    draw_command_t cmd = { .type = DRAW_COMMAND_SPRITE,
+                           .sprite = { spritesheet, column, row, x, y }
+                         };
+
+    return xDrawCommandRecord(&cmd, ulTextureID(spritesheet));
+}
+
+int xDrawCommandSprites(renderer_texture_handle_t texture,
+                        const draw_sprite_t *sprites, unsigned int count)
+{
+    draw_command_t cmd = { .type = DRAW_COMMAND_SPRITES,
+                           .sprites = { texture, sprites, count }
+                         };
+
+    if (!count) {
+        return 0;
+    }
+
+    return xDrawCommandRecord(&cmd, ulTextureID(texture));
+}
+
+int xDrawCommandImage(gfx_image_handle_t image, signed short x,
+                      signed short y)
+{
+    draw_command_t cmd = { .type = DRAW_COMMAND_IMAGE,
+                           .image = { image, x, y }
+                         };
+
+    return xDrawCommandRecord(&cmd, ulTextureID(image));
+}
+
+int xDrawCommandTexture(renderer_texture_handle_t texture, signed short x,
+                        signed short y)
+{
+    draw_command_t cmd = { .type = DRAW_COMMAND_TEXTURE,
+                           .texture = { texture, x, y }
+                         };
+
+    return xDrawCommandRecord(&cmd, ulTextureID(texture));
+}
+
+int xDrawCommandTextureRegion(renderer_texture_handle_t texture, ssize_t x,
+                              ssize_t y, ssize_t w, ssize_t h)
+{
+    draw_command_t cmd = { .type = DRAW_COMMAND_TEXTURE,
+                           .texture = { texture, x, y, { x, y, w, h } }
+                         };
+
+    if (w <= 0 || h <= 0) {
+        return 0;
+    }
+
+    return xDrawCommandRecord(&cmd, ulTextureID(texture));
+}
+
+int xDrawCommandTarget(renderer_texture_handle_t target)
+{
+    draw_command_t cmd = { .type = DRAW_COMMAND_TARGET,
+                           .target = target
+                         };
+
+    return xDrawCommandRecord(&cmd, ulTextureID(target));
+}
+
+int xDrawCommandAnimationFrame(gfx_sequence_handle_t sequence, unsigned ms,
+                               ssize_t x, ssize_t y)
+{
+    draw_command_t cmd = { .type = DRAW_COMMAND_ANIMATION_FRAME,
+                           .animation = { sequence, ms, x, y }
+                         };
+
+    return xDrawCommandRecord(&cmd, ulTextureID(sequence));
+}
+
+int xDrawCommandsInit(void)
+{
+    commands.submitted = xQueueCreate(MAX_SUBMITTED_BUFFERS,
+                                      sizeof(draw_command_buffer_t *));
+    if (!commands.submitted) {
+        PRINT_ERROR("Failed to create draw command queue");
+        return -1;
+    }
+
+    return 0;
+}
+
+void vDrawCommandsExit(void)
+{
+    for (unsigned int i = 0; i < commands.producer_count; i++) {
+        if (commands.producers[i]->free_buffers) {
+            vSemaphoreDelete(commands.producers[i]->free_buffers);
+        }
+        vPortFree(commands.producers[i]);
+    }
+    commands.producer_count = 0;
+
+    if (commands.submitted) {
+        vQueueDelete(commands.submitted);
+        commands.submitted = NULL;
+    }
+}
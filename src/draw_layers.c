@@ -0,0 +1,280 @@
+/**
+ * @file draw_layers.c
+ * @author Alex Hoffman
+ * @date 23 January 2023
+ * @brief Retained static layers and dirty region tracking for the draw path
+ *
+ * @verbatim
+ ----------------------------------------------------------------------
+ Copyright (C) Alexander Hoffman, 2023
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ any later version.
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ----------------------------------------------------------------------
+ @endverbatim
+ */
+
+#include <string.h>
+
+#include "gfx_draw.h"
+#include "gfx_print.h"
+
+#include "EmulatorConfig.h"
+#include "draw_commands.h"
+#include "draw_layers.h"
+#include "renderer.h"
+
+#define MAX_DAMAGE_RECTS 32
+// Once the damaged area covers this percentage of the screen a full clear
+// or copy is cheaper than one per rectangle
+#define FULL_CLEAR_PERCENT 60
+
+typedef struct damage_list {
+    draw_rect_t rects[MAX_DAMAGE_RECTS];
+    unsigned int count;
+} damage_list_t;
+
+static struct draw_layers {
+    // Damage reported in the last configDRAW_BUFFER_AGE frames plus the
+    // frame currently being drawn
+    damage_list_t frames[configDRAW_BUFFER_AGE + 1];
+    unsigned int current;
+    unsigned int full_redraws;
+    draw_layer_t **prev_layers;
+    unsigned int prev_count;
+    // The layers drawn over the background, recomposed from by copying
+    renderer_texture_handle_t cache;
+    unsigned char cache_valid;
+    unsigned char cache_failed;
+} damage = { .full_redraws = configDRAW_BUFFER_AGE };
+
+static int xRectsIntersect(const draw_rect_t *a, const draw_rect_t *b)
+{
+    return a->x < b->x + b->w && b->x < a->x + a->w && a->y < b->y + b->h &&
+           b->y < a->y + a->h;
+}
+
+static void vRectUnion(draw_rect_t *dst, const draw_rect_t *src)
+{
+    ssize_t x2 = dst->x + dst->w > src->x + src->w ? dst->x + dst->w
+                 : src->x + src->w;
+    ssize_t y2 = dst->y + dst->h > src->y + src->h ? dst->y + dst->h
+                 : src->y + src->h;
+
+    dst->x = dst->x < src->x ? dst->x : src->x;
+    dst->y = dst->y < src->y ? dst->y : src->y;
+    dst->w = x2 - dst->x;
+    dst->h = y2 - dst->y;
+}
+
+static int xRectClip(draw_rect_t *rect)
+{
+    if (rect->x < 0) {
+        rect->w += rect->x;
+        rect->x = 0;
+    }
+    if (rect->y < 0) {
+        rect->h += rect->y;
+        rect->y = 0;
+    }
+    if (rect->x + rect->w > SCREEN_WIDTH) {
+        rect->w = SCREEN_WIDTH - rect->x;
+    }
+    if (rect->y + rect->h > SCREEN_HEIGHT) {
+        rect->h = SCREEN_HEIGHT - rect->y;
+    }
+
+    return rect->w > 0 && rect->h > 0;
+}
+
+// Adds a rectangle, merging it with any rectangle it overlaps so that no
+// pixel is cleared twice. If the list is full the rectangle is merged into
+// the last entry, over-clearing is harmless.
+static void vDamageListAdd(damage_list_t *list, draw_rect_t rect)
+{
+    unsigned int i = 0;
+
+    if (!xRectClip(&rect)) {
+        return;
+    }
+
+    while (i < list->count) {
+        if (xRectsIntersect(&list->rects[i], &rect)) {
+            vRectUnion(&rect, &list->rects[i]);
+            list->rects[i] = list->rects[--list->count];
+            i = 0;
+        }
+        else {
+            i++;
+        }
+    }
+
+    if (list->count == MAX_DAMAGE_RECTS) {
+        vRectUnion(&list->rects[list->count - 1], &rect);
+    }
+    else {
+        list->rects[list->count++] = rect;
+    }
+}
+
+void vDrawLayersDamage(ssize_t x, ssize_t y, ssize_t w, ssize_t h)
+{
+    draw_rect_t rect = { .x = x, .y = y, .w = w, .h = h };
+
+    vDamageListAdd(&damage.frames[damage.current], rect);
+}
+
+void vDrawLayersInvalidate(void)
+{
+    damage.full_redraws = configDRAW_BUFFER_AGE;
+    damage.cache_valid = 0;
+}
+
+static void vDrawLayersRedrawAll(draw_layer_t **layers, unsigned int count,
+                                 unsigned int background)
+{
+    if (xDrawCommandClear(background)) {
+        fprints(stderr, "[ERROR] %s, %s\n", __FUNCTION__,
+                gfxGetErrorMessage());
+    }
+
+    for (unsigned int i = 0; i < count; i++) {
+        layers[i]->draw(layers[i]->args);
+    }
+}
+
+// The cache is only drawn into by commands executed on the task that
+// renders, layers composed without recording are drawn directly
+static int xDrawLayersCacheReady(void)
+{
+    if (damage.cache_failed || !xDrawCommandsRecording()) {
+        return 0;
+    }
+
+    if (!damage.cache &&
+        !(damage.cache = xRendererTargetCreate(SCREEN_WIDTH,
+                         SCREEN_HEIGHT))) {
+        damage.cache_failed = 1;
+        return 0;
+    }
+
+    return 1;
+}
+
+static void vDrawLayersRenderCache(draw_layer_t **layers, unsigned int count,
+                                   unsigned int background)
+{
+    // Invalidating while a layer is drawn, eg. as its content is still
+    // loading, renders the cache again next frame
+    damage.cache_valid = 1;
+
+    if (xDrawCommandTarget(damage.cache)) {
+        fprints(stderr, "[ERROR] %s, failed to record target\n",
+                __FUNCTION__);
+    }
+
+    vDrawLayersRedrawAll(layers, count, background);
+
+    if (xDrawCommandTarget(NULL)) {
+        fprints(stderr, "[ERROR] %s, failed to record target\n",
+                __FUNCTION__);
+    }
+}
+
+static void vDrawLayersCopy(const draw_rect_t *rect)
+{
+    if (xDrawCommandTextureRegion(damage.cache, rect->x, rect->y, rect->w,
+                                  rect->h))
+        fprints(stderr, "[ERROR] %s, failed to record copy\n",
+                __FUNCTION__);
+}
+
+void vDrawLayersCompose(draw_layer_t **layers, unsigned int count,
+                        unsigned int background)
+{
+    const draw_rect_t screen = { 0, 0, SCREEN_WIDTH, SCREEN_HEIGHT };
+    damage_list_t to_clear = { 0 };
+    unsigned long area = 0;
+    int cached = xDrawLayersCacheReady();
+
+    // Start recording the new frame's damage
+    damage.current = (damage.current + 1) % (configDRAW_BUFFER_AGE + 1);
+    damage.frames[damage.current].count = 0;
+
+    if (layers != damage.prev_layers || count != damage.prev_count) {
+        damage.prev_layers = layers;
+        damage.prev_count = count;
+        vDrawLayersInvalidate();
+    }
+
+    if (cached && !damage.cache_valid) {
+        vDrawLayersRenderCache(layers, count, background);
+    }
+
+    if (!configDRAW_DIRTY_REGIONS || damage.full_redraws) {
+        if (damage.full_redraws) {
+            damage.full_redraws--;
+        }
+        if (cached) {
+            vDrawLayersCopy(&screen);
+        }
+        else {
+            vDrawLayersRedrawAll(layers, count, background);
+        }
+        return;
+    }
+
+    // The back buffer still holds the frame drawn configDRAW_BUFFER_AGE
+    // frames ago, everything damaged since then must be recomposed
+    for (unsigned int i = 0; i <= configDRAW_BUFFER_AGE; i++)
+        if (i != damage.current)
+            for (unsigned int j = 0; j < damage.frames[i].count; j++) {
+                vDamageListAdd(&to_clear, damage.frames[i].rects[j]);
+            }
+
+    for (unsigned int i = 0; i < to_clear.count; i++) {
+        area += to_clear.rects[i].w * to_clear.rects[i].h;
+    }
+
+    if (area * 100 > (unsigned long)SCREEN_WIDTH * SCREEN_HEIGHT *
+        FULL_CLEAR_PERCENT) {
+        if (cached) {
+            vDrawLayersCopy(&screen);
+        }
+        else {
+            vDrawLayersRedrawAll(layers, count, background);
+        }
+        return;
+    }
+
+    // The cache already holds the layers composed over the background
+    if (cached) {
+        for (unsigned int i = 0; i < to_clear.count; i++) {
+            vDrawLayersCopy(&to_clear.rects[i]);
+        }
+        return;
+    }
+
+    for (unsigned int i = 0; i < to_clear.count; i++)
+        if (xDrawCommandFilledBox(to_clear.rects[i].x,
+                                  to_clear.rects[i].y, to_clear.rects[i].w,
+                                  to_clear.rects[i].h, background))
+            fprints(stderr, "[ERROR] %s, %s\n", __FUNCTION__,
+                    gfxGetErrorMessage());
+
+    // A redrawn layer damages anything drawn on top of it
+    for (unsigned int i = 0; i < count; i++)
+        for (unsigned int j = 0; j < to_clear.count; j++)
+            if (xRectsIntersect(&layers[i]->bounds, &to_clear.rects[j])) {
+                layers[i]->draw(layers[i]->args);
+                vDamageListAdd(&to_clear, layers[i]->bounds);
+                break;
+            }
+}
@@ -0,0 +1,100 @@
+/**
+ * @file fixed_step.c
+ * @author Alex Hoffman
+ * @date 23 January 2023
+ * @brief Runs a simulation in steps of a fixed length, independent of the
+ * frame rate
+ *
+ * @verbatim
+ ----------------------------------------------------------------------
+ Copyright (C) Alexander Hoffman, 2023
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ any later version.
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ----------------------------------------------------------------------
+ @endverbatim
+ */
+
+#include "FreeRTOS.h"
+
+#include "fixed_step.h"
+#include "journal.h"
+
+#define NS_PER_SECOND 1000000000ULL
+#define NS_PER_TICK (NS_PER_SECOND / configTICK_RATE_HZ)
+
+void vFixedStepInit(fixed_step_t *step, unsigned int rate,
+                    unsigned int max_substeps)
+{
+    step->period = NS_PER_SECOND / (rate ? rate : 1);
+    step->max_substeps = max_substeps ? max_substeps : 1;
+    step->steps = 0;
+    step->dropped = 0;
+    vFixedStepReset(step);
+}
+
+void vFixedStepReset(fixed_step_t *step)
+{
+    step->time = ullJournalNow();
+}
+
+unsigned int uFixedStepDue(fixed_step_t *step)
+{
+    uint64_t now = ullJournalNow();
+    uint64_t due;
+
+    if (now < step->time + step->period) {
+        return 0;
+    }
+
+    due = (now - step->time) / step->period;
+    step->time += due * step->period;
+
+    // The time of the dropped steps still passes, only nothing moves in it.
+    // A replay takes every step, it is not in a hurry.
+    if (due > step->max_substeps && !xJournalReplaying()) {
+        step->dropped += due - step->max_substeps;
+        due = step->max_substeps;
+    }
+    step->steps += due;
+
+    return due;
+}
+
+float fFixedStepAlpha(const fixed_step_t *step)
+{
+    uint64_t now = ullJournalNow();
+
+    if (now <= step->time) {
+        return 0;
+    }
+    if (now - step->time >= step->period) {
+        return 1;
+    }
+
+    return (float)(now - step->time) / step->period;
+}
+
+TickType_t xFixedStepTicksUntilNext(const fixed_step_t *step)
+{
+    uint64_t now = ullJournalNow();
+    uint64_t next = step->time + step->period;
+
+    if (next <= now) {
+        return 0;
+    }
+
+    return (next - now + NS_PER_TICK - 1) / NS_PER_TICK;
+}
+
+float fFixedStepSeconds(const fixed_step_t *step)
+{
+    return (float)step->period / NS_PER_SECOND;
+}
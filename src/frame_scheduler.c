@@ -0,0 +1,222 @@
+/**
+ * @file frame_scheduler.c
+ * @author Alex Hoffman
+ * @date 23 January 2023
+ * @brief Drives the tasks that take part in producing each frame
+ *
+ * @verbatim
+ ----------------------------------------------------------------------
+ Copyright (C) Alexander Hoffman, 2023
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ any later version.
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ----------------------------------------------------------------------
+ @endverbatim
+ */
+
+#include <string.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+#include "semphr.h"
+
+#include "gfx_print.h"
+
+#include "EmulatorConfig.h"
+#include "frame_scheduler.h"
+#include "journal.h"
+
+struct frame_subscriber {
+    const char *name;
+    frame_stage_e stage;
+    SemaphoreHandle_t go;
+    volatile unsigned char enabled;
+    // Frame numbers the subscriber was last released for and last finished
+    volatile unsigned long released;
+    volatile unsigned long completed;
+    frame_info_t frame;
+};
+
+static struct frame_scheduler {
+    TickType_t period;
+    frame_info_t frame;
+    // Given by subscribers when they finish, the scheduler then checks which
+    // subscribers are still outstanding
+    SemaphoreHandle_t done;
+    struct frame_subscriber subscribers[configFRAME_SCHEDULER_MAX_SUBSCRIBERS];
+    unsigned int count;
+    unsigned long missed;
+} scheduler = { 0 };
+
+int xFrameSchedulerInit(TickType_t period)
+{
+    scheduler.period = period;
+
+    scheduler.done = xSemaphoreCreateCounting(
+                         configFRAME_SCHEDULER_MAX_SUBSCRIBERS, 0);
+    if (!scheduler.done) {
+        PRINT_ERROR("Failed to create frame scheduler semaphore");
+        return -1;
+    }
+
+    return 0;
+}
+
+void vFrameSchedulerExit(void)
+{
+    for (unsigned int i = 0; i < scheduler.count; i++) {
+        vSemaphoreDelete(scheduler.subscribers[i].go);
+    }
+
+    if (scheduler.done) {
+        vSemaphoreDelete(scheduler.done);
+    }
+
+    memset(&scheduler, 0, sizeof(scheduler));
+}
+
+frame_subscriber_handle_t xFrameSchedulerSubscribe(frame_stage_e stage,
+        const char *name)
+{
+    struct frame_subscriber *subscriber = NULL;
+    SemaphoreHandle_t go = xSemaphoreCreateBinary();
+
+    if (!go) {
+        PRINT_ERROR("Failed to create semaphore for frame subscriber '%s'",
+                    name);
+        return NULL;
+    }
+
+    vTaskSuspendAll();
+    if (scheduler.count < configFRAME_SCHEDULER_MAX_SUBSCRIBERS) {
+        subscriber = &scheduler.subscribers[scheduler.count++];
+        subscriber->name = name;
+        subscriber->stage = stage;
+        subscriber->go = go;
+    }
+    xTaskResumeAll();
+
+    if (!subscriber) {
+        PRINT_ERROR("Too many frame subscribers to add '%s'", name);
+        vSemaphoreDelete(go);
+    }
+
+    return subscriber;
+}
+
+void vFrameSchedulerEnable(frame_subscriber_handle_t subscriber)
+{
+    subscriber->enabled = 1;
+}
+
+void vFrameSchedulerDisable(frame_subscriber_handle_t subscriber)
+{
+    subscriber->enabled = 0;
+}
+
+int xFrameSchedulerWait(frame_subscriber_handle_t subscriber,
+                        frame_info_t *frame)
+{
+    if (xSemaphoreTake(subscriber->go, portMAX_DELAY) != pdTRUE) {
+        return -1;
+    }
+
+    if (frame) {
+        *frame = subscriber->frame;
+    }
+
+    return 0;
+}
+
+void vFrameSchedulerDone(frame_subscriber_handle_t subscriber)
+{
+    subscriber->completed = subscriber->released;
+    xSemaphoreGive(scheduler.done);
+}
+
+frame_info_t xFrameSchedulerBeginFrame(void)
+{
+    scheduler.frame.number++;
+    scheduler.frame.start = xTaskGetTickCount();
+    scheduler.frame.deadline = scheduler.frame.start + scheduler.period;
+
+    // Discard completions of subscribers that finished after their deadline
+    while (xSemaphoreTake(scheduler.done, 0) == pdTRUE)
+        ;
+
+    return scheduler.frame;
+}
+
+static unsigned int uFrameSchedulerOutstanding(frame_stage_e stage)
+{
+    unsigned int outstanding = 0;
+
+    for (unsigned int i = 0; i < scheduler.count; i++)
+        if (scheduler.subscribers[i].stage == stage &&
+            scheduler.subscribers[i].released == scheduler.frame.number &&
+            scheduler.subscribers[i].completed != scheduler.frame.number) {
+            outstanding++;
+        }
+
+    return outstanding;
+}
+
+void vFrameSchedulerRunStage(frame_stage_e stage)
+{
+    struct frame_subscriber *subscriber;
+    TickType_t elapsed;
+
+    for (unsigned int i = 0; i < scheduler.count; i++) {
+        subscriber = &scheduler.subscribers[i];
+
+        // A subscriber still busy with an earlier frame has already been
+        // counted as missing that frame's deadline
+        if (subscriber->stage != stage || !subscriber->enabled ||
+            subscriber->released != subscriber->completed) {
+            continue;
+        }
+
+        subscriber->frame = scheduler.frame;
+        subscriber->released = scheduler.frame.number;
+        xSemaphoreGive(subscriber->go);
+    }
+
+    while (uFrameSchedulerOutstanding(stage)) {
+        // A replay has no deadlines, every subscriber takes part in every
+        // frame such that the replay does not depend on how fast it runs
+        if (xJournalReplaying()) {
+            xSemaphoreTake(scheduler.done, portMAX_DELAY);
+            continue;
+        }
+
+        elapsed = xTaskGetTickCount() - scheduler.frame.start;
+
+        if (elapsed >= scheduler.period ||
+            xSemaphoreTake(scheduler.done, scheduler.period - elapsed) !=
+            pdTRUE) {
+            break;
+        }
+    }
+
+    for (unsigned int i = 0; i < scheduler.count; i++) {
+        subscriber = &scheduler.subscribers[i];
+
+        if (subscriber->stage == stage &&
+            subscriber->released == scheduler.frame.number &&
+            subscriber->completed != scheduler.frame.number) {
+            scheduler.missed++;
+        }
+    }
+}
+
+unsigned long ulFrameSchedulerGetMissedDeadlines(void)
+{
+    return scheduler.missed;
+}
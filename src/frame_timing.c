@@ -0,0 +1,272 @@
+/**
+ * @file frame_timing.c
+ * @author Alex Hoffman
+ * @date 23 January 2023
+ * @brief Nanosecond resolution frame timing with per phase histograms
+ *
+ * @verbatim
+ ----------------------------------------------------------------------
+ Copyright (C) Alexander Hoffman, 2023
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ any later version.
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ----------------------------------------------------------------------
+ @endverbatim
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "gfx_print.h"
+
+#include "frame_timing.h"
+
+// Values below 2^SUB_BUCKET_BITS ns are recorded exactly, above that each
+// power of two is split into 2^(SUB_BUCKET_BITS - 1) linear buckets
+#define SUB_BUCKET_BITS 7
+#define SUB_BUCKET_COUNT (1 << SUB_BUCKET_BITS)
+#define SUB_BUCKET_HALF (SUB_BUCKET_COUNT / 2)
+// Largest recordable value is 2^MAX_VALUE_BITS ns (~18 minutes)
+#define MAX_VALUE_BITS 40
+// Last bucket collects everything that is too large to be recorded
+#define BUCKET_COUNT                                                   \
+    ((MAX_VALUE_BITS - SUB_BUCKET_BITS + 2) * SUB_BUCKET_HALF + 1)
+
+#define RECENT_FRAME_COUNT 64
+
+typedef struct histogram {
+    uint64_t count;
+    uint64_t total;
+    uint64_t min;
+    uint64_t max;
+    uint32_t buckets[BUCKET_COUNT];
+} histogram_t;
+
+static const char *phase_names[FRAME_PHASE_COUNT] = {
+    [FRAME_PHASE_FRAME] = "frame",
+    [FRAME_PHASE_DRAW] = "draw",
+    [FRAME_PHASE_RENDER] = "render",
+    [FRAME_PHASE_PRESENT] = "present",
+    [FRAME_PHASE_EVENTS] = "events",
+};
+
+static struct frame_timing {
+    histogram_t phases[FRAME_PHASE_COUNT];
+    uint64_t last_frame;
+    uint64_t recent[RECENT_FRAME_COUNT];
+    unsigned int recent_index;
+    const char *dump_filename;
+} timing = { 0 };
+
+static unsigned int uBucketIndex(uint64_t value)
+{
+    if (value < SUB_BUCKET_COUNT) {
+        return (unsigned int)value;
+    }
+
+    if (value >> MAX_VALUE_BITS) {
+        return BUCKET_COUNT - 1;
+    }
+
+    unsigned int msb = 63 - __builtin_clzll(value);
+    unsigned int shift = msb - SUB_BUCKET_BITS + 1;
+
+    return shift * SUB_BUCKET_HALF + (unsigned int)(value >> shift);
+}
+
+static uint64_t ullBucketLowestValue(unsigned int index)
+{
+    if (index < SUB_BUCKET_COUNT) {
+        return index;
+    }
+
+    unsigned int shift = index / SUB_BUCKET_HALF - 1;
+
+    return (uint64_t)(index - shift * SUB_BUCKET_HALF) << shift;
+}
+
+static uint64_t ullBucketHighestValue(unsigned int index)
+{
+    if (index < SUB_BUCKET_COUNT) {
+        return index;
+    }
+
+    unsigned int shift = index / SUB_BUCKET_HALF - 1;
+
+    return ullBucketLowestValue(index) + ((uint64_t)1 << shift) - 1;
+}
+
+static void vHistogramRecord(histogram_t *hist, uint64_t value)
+{
+    uint64_t prev;
+
+    // Frames are recorded from several tasks, atomics keep the
+    // histogram consistent if a task is preempted mid-update
+    __atomic_fetch_add(&hist->buckets[uBucketIndex(value)], 1,
+                       __ATOMIC_RELAXED);
+    __atomic_fetch_add(&hist->total, value, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&hist->count, 1, __ATOMIC_RELAXED);
+
+    prev = __atomic_load_n(&hist->max, __ATOMIC_RELAXED);
+    while (value > prev &&
+           !__atomic_compare_exchange_n(&hist->max, &prev, value, 1,
+                                        __ATOMIC_RELAXED,
+                                        __ATOMIC_RELAXED))
+        ;
+
+    prev = __atomic_load_n(&hist->min, __ATOMIC_RELAXED);
+    while ((!prev || value < prev) &&
+           !__atomic_compare_exchange_n(&hist->min, &prev, value, 1,
+                                        __ATOMIC_RELAXED,
+                                        __ATOMIC_RELAXED))
+        ;
+}
+
+static uint64_t ullHistogramPercentile(histogram_t *hist, uint64_t count,
+                                       double percentile)
+{
+    uint64_t target = (uint64_t)(count * percentile / 100.0 + 0.5);
+    uint64_t seen = 0;
+
+    if (!target) {
+        target = 1;
+    }
+
+    for (unsigned int i = 0; i < BUCKET_COUNT; i++) {
+        seen += __atomic_load_n(&hist->buckets[i], __ATOMIC_RELAXED);
+        if (seen >= target) {
+            return ullBucketHighestValue(i);
+        }
+    }
+
+    return hist->max;
+}
+
+uint64_t ullFrameTimingNow(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void vFrameTimingMarkFrame(void)
+{
+    uint64_t now = ullFrameTimingNow();
+
+    if (timing.last_frame) {
+        uint64_t duration = now - timing.last_frame;
+
+        vHistogramRecord(&timing.phases[FRAME_PHASE_FRAME], duration);
+        timing.recent[timing.recent_index] = duration;
+        timing.recent_index = (timing.recent_index + 1) % RECENT_FRAME_COUNT;
+    }
+
+    timing.last_frame = now;
+}
+
+void vFrameTimingRecordPhase(frame_phase_e phase, uint64_t start)
+{
+    vHistogramRecord(&timing.phases[phase], ullFrameTimingNow() - start);
+}
+
+void vFrameTimingGetSummary(frame_phase_e phase,
+                            frame_timing_summary_t *summary)
+{
+    histogram_t *hist = &timing.phases[phase];
+
+    memset(summary, 0, sizeof(*summary));
+
+    summary->count = __atomic_load_n(&hist->count, __ATOMIC_RELAXED);
+    if (!summary->count) {
+        return;
+    }
+
+    summary->min = hist->min;
+    summary->max = hist->max;
+    summary->mean = hist->total / summary->count;
+    summary->p50 = ullHistogramPercentile(hist, summary->count, 50.0);
+    summary->p95 = ullHistogramPercentile(hist, summary->count, 95.0);
+    summary->p99 = ullHistogramPercentile(hist, summary->count, 99.0);
+}
+
+double dFrameTimingGetRecentFPS(void)
+{
+    uint64_t total = 0;
+    unsigned int count = 0;
+
+    for (unsigned int i = 0; i < RECENT_FRAME_COUNT; i++)
+        if (timing.recent[i]) {
+            total += timing.recent[i];
+            count++;
+        }
+
+    if (!total) {
+        return 0.0;
+    }
+
+    return 1e9 * count / total;
+}
+
+int xFrameTimingDump(const char *filename)
+{
+    frame_timing_summary_t summary;
+    FILE *fp = fopen(filename, "w");
+
+    if (!fp) {
+        PRINT_ERROR("Failed to open frame timing file '%s'", filename);
+        return -1;
+    }
+
+    fprintf(fp, "# phase,count,min_ns,mean_ns,p50_ns,p95_ns,p99_ns,max_ns\n");
+    for (int phase = 0; phase < FRAME_PHASE_COUNT; phase++) {
+        vFrameTimingGetSummary(phase, &summary);
+        fprintf(fp, "%s,%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64
+                ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 "\n", phase_names[phase],
+                summary.count, summary.min, summary.mean, summary.p50,
+                summary.p95, summary.p99, summary.max);
+    }
+
+    fprintf(fp, "\n# phase,bucket_low_ns,bucket_high_ns,count\n");
+    for (int phase = 0; phase < FRAME_PHASE_COUNT; phase++)
+        for (unsigned int i = 0; i < BUCKET_COUNT; i++)
+            if (timing.phases[phase].buckets[i])
+                fprintf(fp, "%s,%" PRIu64 ",%" PRIu64 ",%u\n", phase_names[phase],
+                        ullBucketLowestValue(i),
+                        ullBucketHighestValue(i),
+                        timing.phases[phase].buckets[i]);
+
+    fclose(fp);
+
+    return 0;
+}
+
+static void vFrameTimingExit(void)
+{
+    if (timing.dump_filename) {
+        xFrameTimingDump(timing.dump_filename);
+    }
+}
+
+int xFrameTimingInit(const char *dump_filename)
+{
+    timing.dump_filename = dump_filename;
+
+    if (dump_filename && atexit(vFrameTimingExit)) {
+        PRINT_ERROR("Failed to register frame timing dump");
+        return -1;
+    }
+
+    return 0;
+}
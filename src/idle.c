@@ -0,0 +1,164 @@
+/**
+ * @file idle.c
+ * @author Alex Hoffman
+ * @date 23 January 2023
+ * @brief Policies for what the host thread does while FreeRTOS is idle
+ *
+ * @verbatim
+ ----------------------------------------------------------------------
+ Copyright (C) Alexander Hoffman, 2023
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ any later version.
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ----------------------------------------------------------------------
+ @endverbatim
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+#include "FreeRTOS.h"
+
+#include "EmulatorConfig.h"
+#include "idle.h"
+
+#define NS_PER_SEC 1000000000ULL
+#define TICK_PERIOD_NS (NS_PER_SEC / configTICK_RATE_HZ)
+
+#if defined(__x86_64__) || defined(__i386__)
+#define CPU_RELAX() __builtin_ia32_pause()
+#else
+#define CPU_RELAX() __asm__ __volatile__("" ::: "memory")
+#endif
+
+static const char *policy_names[IDLE_POLICY_COUNT] = {
+    [IDLE_POLICY_SLEEP] = "sleep",
+    [IDLE_POLICY_FUTEX] = "futex",
+    [IDLE_POLICY_SPIN_PARK] = "spin",
+};
+
+// Incremented by every vIdleWake, the idle task waits for it to change
+static uint32_t idle_events = 0;
+static uint32_t idle_events_seen = 0;
+
+static uint64_t ullIdleNow(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * NS_PER_SEC + ts.tv_nsec;
+}
+
+static struct timespec xIdleNextTick(uint64_t now)
+{
+    uint64_t next = (now / TICK_PERIOD_NS + 1) * TICK_PERIOD_NS;
+    struct timespec ts = { .tv_sec = next / NS_PER_SEC,
+                           .tv_nsec = next % NS_PER_SEC
+                         };
+
+    return ts;
+}
+
+// Returns 1 if vIdleWake has been called since the last time it returned 1
+static int xIdleConsumeEvents(void)
+{
+    uint32_t events = __atomic_load_n(&idle_events, __ATOMIC_ACQUIRE);
+
+    if (events == idle_events_seen) {
+        return 0;
+    }
+
+    idle_events_seen = events;
+
+    return 1;
+}
+
+static void vIdleFutexWait(void)
+{
+    struct timespec deadline = xIdleNextTick(ullIdleNow());
+
+    if (xIdleConsumeEvents()) {
+        return;
+    }
+
+    // Returns straight away if an event happens between the check above and
+    // the wait, as idle_events will no longer equal idle_events_seen
+    syscall(SYS_futex, &idle_events, FUTEX_WAIT_BITSET | FUTEX_PRIVATE_FLAG,
+            idle_events_seen, &deadline, NULL, FUTEX_BITSET_MATCH_ANY);
+
+    xIdleConsumeEvents();
+}
+
+static void vIdleSpinThenPark(void)
+{
+    uint64_t spin_until = ullIdleNow() + configIDLE_SPIN_US * 1000ULL;
+
+    do {
+        if (xIdleConsumeEvents()) {
+            return;
+        }
+        CPU_RELAX();
+    } while (ullIdleNow() < spin_until);
+
+    vIdleFutexWait();
+}
+
+void vIdleWait(idle_policy_e policy)
+{
+    struct timespec deadline;
+
+    switch (policy) {
+        case IDLE_POLICY_SLEEP:
+            deadline = xIdleNextTick(ullIdleNow());
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL);
+            break;
+        case IDLE_POLICY_FUTEX:
+            vIdleFutexWait();
+            break;
+        case IDLE_POLICY_SPIN_PARK:
+            vIdleSpinThenPark();
+            break;
+        default:
+            break;
+    }
+}
+
+void vIdleWake(void)
+{
+    // May be called from a signal handler
+    int saved_errno = errno;
+
+    __atomic_add_fetch(&idle_events, 1, __ATOMIC_RELEASE);
+    syscall(SYS_futex, &idle_events, FUTEX_WAKE | FUTEX_PRIVATE_FLAG, 1, NULL,
+            NULL, 0);
+
+    errno = saved_errno;
+}
+
+const char *pcIdlePolicyName(idle_policy_e policy)
+{
+    return policy < IDLE_POLICY_COUNT ? policy_names[policy] : "unknown";
+}
+
+idle_policy_e xIdlePolicyFromName(const char *name)
+{
+    for (int i = 0; i < IDLE_POLICY_COUNT; i++)
+        if (!strcmp(policy_names[i], name)) {
+            return i;
+        }
+
+    return IDLE_POLICY_COUNT;
+}
@@ -0,0 +1,387 @@
+/**
+ * @file journal.c
+ * @author Alex Hoffman
+ * @date 23 January 2023
+ * @brief Records the emulator's input and received data to replay a run
+ *
+ * @verbatim
+ ----------------------------------------------------------------------
+ Copyright (C) Alexander Hoffman, 2023
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ any later version.
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ----------------------------------------------------------------------
+ @endverbatim
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include "gfx_print.h"
+
+#include "EmulatorConfig.h"
+#include "frame_timing.h"
+#include "journal.h"
+
+#define JOURNAL_MAGIC 0x4c4e524a
+#define JOURNAL_VERSION 2
+#define RECORD_ALIGN 8
+#define RECORD_SIZE(LENGTH)                                            \
+    ((sizeof(journal_record_t) + (LENGTH) + RECORD_ALIGN - 1) &         \
+     ~(size_t)(RECORD_ALIGN - 1))
+
+// Start of the journal file, the records follow
+struct journal_header {
+    uint32_t magic;
+    uint32_t version;
+    // Bytes of records, stored after each record such that a recording is
+    // complete up to the last record even if the emulator crashes
+    uint64_t used;
+    uint64_t created; ///< Unix time the recording was started
+};
+
+static struct journal {
+    enum { JOURNAL_OFF, JOURNAL_RECORD, JOURNAL_REPLAY } mode;
+    pthread_mutex_t lock;
+    int fd;
+    struct journal_header *header;
+    size_t size;
+    uint32_t frame;
+    // Replay's clock, the recorded time of the latest record played
+    uint64_t time;
+    size_t position; ///< Offset of the next record to replay
+    journal_player_t players[JOURNAL_TYPE_COUNT];
+} journal = { .lock = PTHREAD_MUTEX_INITIALIZER, .fd = -1 };
+
+static int xJournalOpenRecord(const char *filename)
+{
+    journal.fd = open(filename, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC,
+                      0644);
+    if (journal.fd < 0) {
+        fprints(stderr, "Failed to open journal '%s': %s\n", filename,
+                strerror(errno));
+        goto err_open;
+    }
+
+    journal.size = configJOURNAL_GROW_SIZE;
+    if (ftruncate(journal.fd, journal.size)) {
+        goto err_map;
+    }
+
+    journal.header = mmap(NULL, journal.size, PROT_READ | PROT_WRITE,
+                          MAP_SHARED, journal.fd, 0);
+    if (journal.header == MAP_FAILED) {
+        goto err_map;
+    }
+
+    journal.header->magic = JOURNAL_MAGIC;
+    journal.header->version = JOURNAL_VERSION;
+    journal.header->used = 0;
+    journal.header->created = time(NULL);
+    journal.mode = JOURNAL_RECORD;
+
+    return 0;
+
+err_map:
+    fprints(stderr, "Failed to map journal '%s': %s\n", filename,
+            strerror(errno));
+    close(journal.fd);
+    journal.fd = -1;
+err_open:
+    return -1;
+}
+
+static int xJournalOpenReplay(const char *filename)
+{
+    struct stat st;
+
+    journal.fd = open(filename, O_RDONLY | O_CLOEXEC);
+    if (journal.fd < 0) {
+        fprints(stderr, "Failed to open journal '%s': %s\n", filename,
+                strerror(errno));
+        goto err_open;
+    }
+
+    if (fstat(journal.fd, &st) ||
+        (size_t)st.st_size < sizeof(struct journal_header)) {
+        fprints(stderr, "'%s' is not a journal\n", filename);
+        goto err_map;
+    }
+    journal.size = st.st_size;
+
+    journal.header = mmap(NULL, journal.size, PROT_READ, MAP_PRIVATE,
+                          journal.fd, 0);
+    if (journal.header == MAP_FAILED) {
+        fprints(stderr, "Failed to map journal '%s': %s\n", filename,
+                strerror(errno));
+        goto err_map;
+    }
+
+    if (journal.header->magic != JOURNAL_MAGIC ||
+        journal.header->version != JOURNAL_VERSION ||
+        journal.header->used > journal.size -
+        sizeof(struct journal_header)) {
+        fprints(stderr, "'%s' is not a journal or is damaged\n", filename);
+        goto err_header;
+    }
+
+    // Records are read in place, nothing is left to be read from the file
+    madvise(journal.header, journal.size, MADV_SEQUENTIAL);
+    journal.position = 0;
+
+    // Tasks started before the first frame see the time the recording
+    // started at
+    if (journal.header->used >= sizeof(journal_record_t)) {
+        journal.time = ((const journal_record_t *)(journal.header + 1))->time;
+    }
+    journal.mode = JOURNAL_REPLAY;
+
+    return 0;
+
+err_header:
+    munmap(journal.header, journal.size);
+err_map:
+    close(journal.fd);
+    journal.fd = -1;
+err_open:
+    return -1;
+}
+
+int xJournalInit(const char *record_file, const char *replay_file)
+{
+    if (record_file && replay_file) {
+        fprints(stderr, "Cannot record and replay a journal at once\n");
+        return -1;
+    }
+
+    if (record_file) {
+        return xJournalOpenRecord(record_file);
+    }
+    if (replay_file) {
+        return xJournalOpenReplay(replay_file);
+    }
+
+    return 0;
+}
+
+void vJournalExit(void)
+{
+    pthread_mutex_lock(&journal.lock);
+
+    if (journal.mode == JOURNAL_RECORD) {
+        size_t used = sizeof(struct journal_header) + journal.header->used;
+
+        msync(journal.header, used, MS_SYNC);
+        munmap(journal.header, journal.size);
+        if (ftruncate(journal.fd, used)) {
+            fprints(stderr, "Failed to truncate journal: %s\n",
+                    strerror(errno));
+        }
+    }
+    else if (journal.mode == JOURNAL_REPLAY) {
+        munmap(journal.header, journal.size);
+    }
+
+    if (journal.fd >= 0) {
+        close(journal.fd);
+        journal.fd = -1;
+    }
+    journal.mode = JOURNAL_OFF;
+
+    pthread_mutex_unlock(&journal.lock);
+}
+
+int xJournalRecording(void)
+{
+    return journal.mode == JOURNAL_RECORD;
+}
+
+int xJournalReplaying(void)
+{
+    return journal.mode == JOURNAL_REPLAY;
+}
+
+static int xJournalGrow(size_t needed)
+{
+    size_t size = journal.size + (needed > configJOURNAL_GROW_SIZE ?
+                                  needed : configJOURNAL_GROW_SIZE);
+    void *header;
+
+    if (ftruncate(journal.fd, size)) {
+        return -1;
+    }
+
+    header = mremap(journal.header, journal.size, size, MREMAP_MAYMOVE);
+    if (header == MAP_FAILED) {
+        return -1;
+    }
+
+    journal.header = header;
+    journal.size = size;
+
+    return 0;
+}
+
+void vJournalRecord(journal_type_e type, uint32_t source, uint8_t flags,
+                    uint64_t time, const void *data, size_t length)
+{
+    journal_record_t *record;
+    size_t offset;
+
+    if (journal.mode != JOURNAL_RECORD) {
+        return;
+    }
+
+    if (length > UINT16_MAX) {
+        length = UINT16_MAX;
+    }
+
+    pthread_mutex_lock(&journal.lock);
+
+    // The journal might have been closed while waiting for the lock
+    if (journal.mode != JOURNAL_RECORD) {
+        goto out;
+    }
+
+    offset = sizeof(struct journal_header) + journal.header->used;
+    if (offset + RECORD_SIZE(length) > journal.size &&
+        xJournalGrow(RECORD_SIZE(length))) {
+        fprints(stderr, "Failed to grow journal, recording stopped: %s\n",
+                strerror(errno));
+        journal.mode = JOURNAL_OFF;
+        munmap(journal.header, journal.size);
+        close(journal.fd);
+        journal.fd = -1;
+        goto out;
+    }
+
+    record = (journal_record_t *)((char *)journal.header + offset);
+    record->time = time;
+    record->frame = __atomic_load_n(&journal.frame, __ATOMIC_RELAXED);
+    record->source = source;
+    record->length = length;
+    record->type = type;
+    record->flags = flags;
+    if (length) {
+        memcpy(record + 1, data, length);
+    }
+
+    __atomic_store_n(&journal.header->used,
+                     journal.header->used + RECORD_SIZE(length),
+                     __ATOMIC_RELEASE);
+
+out:
+    pthread_mutex_unlock(&journal.lock);
+}
+
+void vJournalSetPlayer(journal_type_e type, journal_player_t player)
+{
+    if (type < JOURNAL_TYPE_COUNT) {
+        journal.players[type] = player;
+    }
+}
+
+uint64_t ullJournalNow(void)
+{
+    if (journal.mode == JOURNAL_REPLAY) {
+        return __atomic_load_n(&journal.time, __ATOMIC_RELAXED);
+    }
+
+    return ullFrameTimingNow();
+}
+
+int xJournalFrame(unsigned long frame)
+{
+    const journal_record_t *record;
+    size_t used;
+
+    if (journal.mode == JOURNAL_RECORD) {
+        __atomic_store_n(&journal.frame, (uint32_t)frame, __ATOMIC_RELAXED);
+        vJournalRecord(JOURNAL_FRAME, xTaskGetTickCount(), 0,
+                       ullFrameTimingNow(), NULL, 0);
+        return 0;
+    }
+
+    if (journal.mode != JOURNAL_REPLAY) {
+        return 0;
+    }
+
+    used = journal.header->used;
+    if (journal.position >= used) {
+        return 1;
+    }
+
+    while (journal.position + sizeof(journal_record_t) <= used) {
+        record = (const journal_record_t *)((const char *)(journal.header +
+                                            1) + journal.position);
+        // Recorded events were seen by the tasks from the next frame on,
+        // only the start of this frame is played now
+        if (record->frame > frame || (record->frame == frame &&
+                                      record->type != JOURNAL_FRAME)) {
+            break;
+        }
+
+        if (journal.position + RECORD_SIZE(record->length) > used) {
+            fprints(stderr, "Journal ends in a damaged record\n");
+            journal.position = used;
+            break;
+        }
+
+        // The replay's clock never goes back, eg. for a read recorded when
+        // it was dispatched rather than when it arrived
+        if (record->time > journal.time) {
+            __atomic_store_n(&journal.time, record->time, __ATOMIC_RELAXED);
+        }
+
+        if (record->type < JOURNAL_TYPE_COUNT &&
+            journal.players[record->type]) {
+            journal.players[record->type](record,
+                                          (const char *)(record + 1));
+        }
+
+        journal.position += RECORD_SIZE(record->length);
+
+        if (record->type == JOURNAL_FRAME && record->frame == frame) {
+            break;
+        }
+    }
+
+    // A truncated header at the end of the journal is never replayed
+    if (journal.position + sizeof(journal_record_t) > used) {
+        journal.position = used;
+    }
+
+    return 0;
+}
+
+uint32_t ulJournalSource(const char *name)
+{
+    uint32_t hash = 2166136261u;
+
+    while (*name) {
+        hash ^= (unsigned char)*name++;
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
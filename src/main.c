@@ -37,40 +37,128 @@
 #include "gfx_FreeRTOS_utils.h"
 #include "gfx_print.h"
 
-#include "AsyncIO.h"
-
 #include "demo_tasks.h"
+#include "assets.h"
 #include "async_sockets.h"
 #include "async_message_queues.h"
 #include "buttons.h"
 #include "draw.h"
-
-#ifdef TRACE_FUNCTIONS
-#include "tracer.h"
-#endif
+#include "draw_commands.h"
+#include "frame_scheduler.h"
+#include "options.h"
+#include "idle.h"
+#include "journal.h"
+#include "reactor.h"
+#include "renderer.h"
+#include "rx_ring.h"
+#include "tx_ring.h"
+#include "frame_timing.h"
+#include "text_cache.h"
+#include "sched_trace.h"
+#include "task_stats.h"
 
 static TaskHandle_t StateMachine = NULL;
 static TaskHandle_t BufferSwap = NULL;
 
-SemaphoreHandle_t DrawSignal = NULL;
-
 void vSwapBuffers(void *pvParameters)
 {
     TickType_t xLastWakeTime;
     xLastWakeTime = xTaskGetTickCount();
-    const TickType_t frameratePeriod = 20;
+    const TickType_t frameratePeriod = 1000 / configFPS_LIMIT_RATE;
+    const uint64_t replay_start = ullFrameTimingNow();
+    unsigned long frame_count = 0;
+    int preload_reported = 0;
+
+    uint64_t phase_start;
+    frame_info_t frame;
+
+    // Draw commands are executed on the renderer by this task
+    vRendererBind();
 
     while (1) {
-        gfxDrawUpdateScreen();
+        vFrameTimingMarkFrame();
+        frame = xFrameSchedulerBeginFrame();
+
+        // Input and received data of the frame are recorded or replayed
+        // before any task sees the frame
+        if (xJournalFrame(frame.number)) {
+            prints("Replayed %lu frames in %.3f s, %lu missed deadlines, "
+                   "exiting\n", frame.number - 1,
+                   (ullFrameTimingNow() - replay_start) / 1e9,
+                   ulFrameSchedulerGetMissedDeadlines());
+            exit(EXIT_SUCCESS);
+        }
+
+        // The loading threads cannot print, the frame that the preloaded
+        // assets were ready by is reported from here
+        if (!preload_reported && xAssetsPreloaded()) {
+            asset_stats_t asset_stats;
+
+            vAssetsGetStats(&asset_stats);
+            prints("Preloaded %u assets (%u failed) by frame %lu in %.2f ms, "
+                   "%.2f ms decoding, longest %.2f ms\n",
+                   asset_stats.ready, asset_stats.failed, frame.number,
+                   asset_stats.preload_time / 1e6,
+                   asset_stats.decode_time / 1e6,
+                   asset_stats.max_decode_time / 1e6);
+            preload_reported = 1;
+        }
+
+        vFrameSchedulerRunStage(FRAME_STAGE_UPDATE);
+        vFrameSchedulerRunStage(FRAME_STAGE_DRAW);
+
+        // Draw the frame that the drawing tasks have submitted
+        phase_start = ullFrameTimingNow();
+        vRendererCollect();
+        vDrawCommandsExecute();
+        vFrameTimingRecordPhase(FRAME_PHASE_RENDER, phase_start);
+
+        // A frame drawn on the renderer only, with nothing queued in the Gfx
+        // library, is presented here
+        phase_start = ullFrameTimingNow();
+        if (gfxDrawUpdateScreen()) {
+            vRendererPresent();
+        }
+        vFrameTimingRecordPhase(FRAME_PHASE_PRESENT, phase_start);
+
+        phase_start = ullFrameTimingNow();
         gfxEventFetchEvents(FETCH_EVENT_BLOCK);
-        xSemaphoreGive(DrawSignal);
-        vTaskDelayUntil(&xLastWakeTime,
-                        pdMS_TO_TICKS(frameratePeriod));
+        vFrameTimingRecordPhase(FRAME_PHASE_EVENTS, phase_start);
+
+        vFrameSchedulerRunStage(FRAME_STAGE_PRESENT);
+
+        // When uncapped the next frame starts as soon as this one is done
+        if (emulator_options.pacing != FRAME_PACING_UNCAPPED)
+            vTaskDelayUntil(&xLastWakeTime,
+                            pdMS_TO_TICKS(frameratePeriod));
+
+        if (emulator_options.frame_limit &&
+            ++frame_count >= emulator_options.frame_limit) {
+            state_machine_stats_t state_stats;
+
+            vStateMachineGetStats(&state_stats);
+            prints("Presented %lu frames, %lu missed deadlines, "
+                   "%lu state transitions (max latency %.2f ms), exiting\n",
+                   frame_count, ulFrameSchedulerGetMissedDeadlines(),
+                   state_stats.transitions, state_stats.max_latency / 1e6);
+            exit(EXIT_SUCCESS);
+        }
     }
 }
 
 int main(int argc, char *argv[])
 {
+    switch (xOptionsParse(argc, argv)) {
+        case 0:
+            break;
+        case 1:
+            return EXIT_SUCCESS;
+        default:
+            return EXIT_FAILURE;
+    }
+
+    vOptionsApplyRenderBackend();
+
     char *bin_folder_path = gfxUtilGetBinFolderPath(argv[0]);
 
     prints("Initializing: ");
@@ -89,6 +177,11 @@ int main(int argc, char *argv[])
         prints("drawing");
     }
 
+    if (xRendererInit()) {
+        PRINT_ERROR("Failed to init renderer");
+        goto err_renderer;
+    }
+
     if (gfxEventInit()) {
         PRINT_ERROR("Failed to initialize events");
         goto err_init_events;
@@ -110,22 +203,72 @@ int main(int argc, char *argv[])
         goto err_init_safe_print;
     }
 
-    atexit(aIODeinit);
+    // Images are decoded while the rest of the emulator starts
+    if (xAssetsInit(emulator_options.asset_manifest)) {
+        PRINT_ERROR("Failed to init assets");
+        goto err_assets;
+    }
+
+    atexit(vAssetsExit);
+    atexit(vTxRingDeinit);
+
+    if (xFrameTimingInit(emulator_options.frame_stats_file)) {
+        PRINT_ERROR("Failed to init frame timing");
+        goto err_frame_timing;
+    }
+
+    if (xJournalInit(emulator_options.record_file,
+                     emulator_options.replay_file)) {
+        PRINT_ERROR("Failed to init journal");
+        goto err_journal;
+    }
+
+    atexit(vJournalExit);
+
+    if (xSchedTraceInit(emulator_options.sched_trace_file)) {
+        PRINT_ERROR("Failed to init scheduler trace");
+        goto err_sched_trace;
+    }
 
-    //Load a second font for fun
+    atexit(vSchedTraceExit);
+
+    if (xTextCacheInit()) {
+        PRINT_ERROR("Failed to init text cache");
+        goto err_text_cache;
+    }
+
+    atexit(vTextCacheExit);
+
+    if (xDrawCommandsInit()) {
+        PRINT_ERROR("Failed to init draw commands");
+        goto err_draw_commands;
+    }
+
+    //Load a second font for fun, the asset threads might be looking up
+    //resources
+    vAssetsLockGfx();
     gfxFontLoadFont(FPS_FONT, DEFAULT_FONT_SIZE);
+    vAssetsUnlockGfx();
 
     if (xButtonsInit()) {
         PRINT_ERROR("Failed to init buttons");
         goto err_buttons_lock;
     }
 
-    DrawSignal = xSemaphoreCreateBinary(); // Screen buffer locking
-    if (!DrawSignal) {
-        PRINT_ERROR("Failed to create draw signal");
-        goto err_draw_signal;
+    if (xFrameSchedulerInit(pdMS_TO_TICKS(1000 / configFPS_LIMIT_RATE))) {
+        PRINT_ERROR("Failed to init frame scheduler");
+        goto err_frame_scheduler;
+    }
+
+    if (xReactorInit()) {
+        PRINT_ERROR("Failed to init reactor");
+        goto err_reactor;
     }
 
+    // Called in reverse order, the rings are closed before the reactor stops
+    atexit(vReactorExit);
+    atexit(vRxRingDeinit);
+
     // Message sending
     if (xTaskCreate(vStateMachineTask, "StateMachine",
                     512, NULL,
@@ -160,12 +303,19 @@ int main(int argc, char *argv[])
         goto err_statemachine;
     }
 
+    /** Task statistics */
+    if (xTaskStatsInit(emulator_options.stats_overlay,
+                       emulator_options.stats_udp_port)) {
+        goto err_task_stats;
+    }
+
     gfxFUtilPrintTaskStateList();
 
     vTaskStartScheduler();
 
     return EXIT_SUCCESS;
 
+err_task_stats:
 err_statemachine:
     vDeleteMessageQueueTasks();
 err_messagequeuetasks:
@@ -177,14 +327,24 @@ err_demotasks:
 err_bufferswap:
     vTaskDelete(StateMachine);
 err_statemachinetask:
-    vSemaphoreDelete(DrawSignal);
-err_draw_signal:
+err_reactor:
+    vFrameSchedulerExit();
+err_frame_scheduler:
     vButtonsExit();
 err_buttons_lock:
+    vDrawCommandsExit();
+err_draw_commands:
+err_text_cache:
+err_sched_trace:
+err_journal:
+err_frame_timing:
+    vAssetsExit();
+err_assets:
     gfxSoundExit();
 err_init_audio:
     gfxEventExit();
 err_init_events:
+err_renderer:
     gfxDrawExit();
 err_init_drawing:
     gfxSafePrintExit();
@@ -192,20 +352,19 @@ err_init_safe_print:
     return EXIT_FAILURE;
 }
 
-// cppcheck-suppress unusedFunction
-__attribute__((unused)) void vMainQueueSendPassed(void)
-{
-    /* This is just an example implementation of the "queue send" trace hook. */
-}
-
 // cppcheck-suppress unusedFunction
 __attribute__((unused)) void vApplicationIdleHook(void)
 {
 #ifdef __GCC_POSIX__
-    struct timespec xTimeToSleep, xTimeSlept;
     /* Makes the process more agreeable when using the Posix simulator. */
-    xTimeToSleep.tv_sec = 1;
-    xTimeToSleep.tv_nsec = 0;
-    nanosleep(&xTimeToSleep, &xTimeSlept);
+    vIdleWait(emulator_options.idle_policy);
 #endif
+    // Woken by the reactor's thread
+    vReactorWake();
+}
+
+// cppcheck-suppress unusedFunction
+__attribute__((unused)) void vApplicationTickHook(void)
+{
+    vReactorWakeFromISR();
 }
@@ -0,0 +1,200 @@
+/**
+ * @file options.c
+ * @author Alex Hoffman
+ * @date 23 January 2023
+ * @brief Command line options used to configure the emulator at startup
+ *
+ * @verbatim
+ ----------------------------------------------------------------------
+ Copyright (C) Alexander Hoffman, 2023
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ any later version.
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ----------------------------------------------------------------------
+ @endverbatim
+ */
+
+#include <getopt.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "gfx_print.h"
+
+#include "EmulatorConfig.h"
+#include "options.h"
+
+emulator_options_t emulator_options = {
+    .backend = RENDER_BACKEND_WINDOW,
+    .pacing = FRAME_PACING_FIXED,
+    .frame_limit = 0,
+    .frame_stats_file = NULL,
+    .sched_trace_file = NULL,
+    .stats_overlay = 0,
+    .stats_udp_port = 0,
+    .idle_policy = configIDLE_POLICY,
+    .sim_rate = configSIM_RATE_HZ,
+    .record_file = NULL,
+    .replay_file = NULL,
+    .asset_manifest = configASSET_MANIFEST,
+};
+
+static void vOptionsPrintUsage(const char *bin)
+{
+    printf("Usage: %s [options]\n"
+           "  --headless      Render into an offscreen framebuffer, no display required\n"
+           "  --uncapped      Present frames as fast as possible instead of at %d FPS\n"
+           "  --frames <n>    Exit after <n> frames have been presented\n"
+           "  --frame-stats <file>\n"
+           "                  Write frame timing histograms to <file> on exit\n"
+           "  --sched-trace <file>\n"
+           "                  Trace the scheduler into <file>, viewable with\n"
+           "                  chrome://tracing, needs -DTRACE_SCHEDULER=ON\n"
+           "  --stats-overlay Draw each task's CPU share and stack usage\n"
+           "  --stats-udp <port>\n"
+           "                  Send task statistics to <port> on localhost\n"
+           "  --idle <policy> What the idle task does while waiting, one of\n"
+           "                  sleep, futex or spin (default %s)\n"
+           "  --sim-rate <hz> Steps per second of the simulation (default %d)\n"
+           "  --record <file> Record input and received data into <file>\n"
+           "  --replay <file> Replay a recording, headless and uncapped, and\n"
+           "                  exit once it is over\n"
+           "  --manifest <file>\n"
+           "                  Assets to preload (default %s)\n"
+           "  --help          Show this message\n",
+           bin, configFPS_LIMIT_RATE, pcIdlePolicyName(configIDLE_POLICY),
+           configSIM_RATE_HZ, configASSET_MANIFEST);
+}
+
+int xOptionsParse(int argc, char *argv[])
+{
+    enum { OPT_HEADLESS = 256, OPT_UNCAPPED, OPT_FRAMES, OPT_FRAME_STATS,
+           OPT_SCHED_TRACE, OPT_STATS_OVERLAY, OPT_STATS_UDP, OPT_IDLE,
+           OPT_SIM_RATE, OPT_RECORD, OPT_REPLAY, OPT_MANIFEST, OPT_HELP
+         };
+
+    static const struct option long_options[] = {
+        { "headless", no_argument, NULL, OPT_HEADLESS },
+        { "uncapped", no_argument, NULL, OPT_UNCAPPED },
+        { "frames", required_argument, NULL, OPT_FRAMES },
+        { "frame-stats", required_argument, NULL, OPT_FRAME_STATS },
+        { "sched-trace", required_argument, NULL, OPT_SCHED_TRACE },
+        { "stats-overlay", no_argument, NULL, OPT_STATS_OVERLAY },
+        { "stats-udp", required_argument, NULL, OPT_STATS_UDP },
+        { "idle", required_argument, NULL, OPT_IDLE },
+        { "sim-rate", required_argument, NULL, OPT_SIM_RATE },
+        { "record", required_argument, NULL, OPT_RECORD },
+        { "replay", required_argument, NULL, OPT_REPLAY },
+        { "manifest", required_argument, NULL, OPT_MANIFEST },
+        { "help", no_argument, NULL, OPT_HELP },
+        { NULL, 0, NULL, 0 }
+    };
+
+    int opt;
+    char *end;
+    unsigned long port, rate;
+
+    while ((opt = getopt_long(argc, argv, "", long_options, NULL)) != -1) {
+        switch (opt) {
+            case OPT_HEADLESS:
+                emulator_options.backend = RENDER_BACKEND_HEADLESS;
+                break;
+            case OPT_UNCAPPED:
+                emulator_options.pacing = FRAME_PACING_UNCAPPED;
+                break;
+            case OPT_FRAMES:
+                emulator_options.frame_limit = strtoul(optarg, &end, 10);
+                if (*end != '\0') {
+                    PRINT_ERROR("Invalid frame count '%s'", optarg);
+                    return -1;
+                }
+                break;
+            case OPT_FRAME_STATS:
+                emulator_options.frame_stats_file = optarg;
+                break;
+            case OPT_SCHED_TRACE:
+                emulator_options.sched_trace_file = optarg;
+                break;
+            case OPT_STATS_OVERLAY:
+                emulator_options.stats_overlay = 1;
+                break;
+            case OPT_STATS_UDP:
+                port = strtoul(optarg, &end, 10);
+                if (*end != '\0' || !port || port > UINT16_MAX) {
+                    PRINT_ERROR("Invalid port '%s'", optarg);
+                    return -1;
+                }
+                emulator_options.stats_udp_port = port;
+                break;
+            case OPT_IDLE:
+                emulator_options.idle_policy = xIdlePolicyFromName(optarg);
+                if (emulator_options.idle_policy == IDLE_POLICY_COUNT) {
+                    PRINT_ERROR("Invalid idle policy '%s'", optarg);
+                    return -1;
+                }
+                break;
+            case OPT_SIM_RATE:
+                // At most one step per millisecond
+                rate = strtoul(optarg, &end, 10);
+                if (*end != '\0' || !rate || rate > 1000) {
+                    PRINT_ERROR("Invalid simulation rate '%s'", optarg);
+                    return -1;
+                }
+                emulator_options.sim_rate = rate;
+                break;
+            case OPT_RECORD:
+                emulator_options.record_file = optarg;
+                break;
+            case OPT_REPLAY:
+                emulator_options.replay_file = optarg;
+                break;
+            case OPT_MANIFEST:
+                emulator_options.asset_manifest = optarg;
+                break;
+            case OPT_HELP:
+                vOptionsPrintUsage(argv[0]);
+                return 1;
+            default:
+                vOptionsPrintUsage(argv[0]);
+                return -1;
+        }
+    }
+
+    if (emulator_options.record_file && emulator_options.replay_file) {
+        PRINT_ERROR("Cannot record while replaying");
+        return -1;
+    }
+
+    // A replay needs neither a display nor to wait for the frame rate
+    if (emulator_options.replay_file) {
+        emulator_options.backend = RENDER_BACKEND_HEADLESS;
+        emulator_options.pacing = FRAME_PACING_UNCAPPED;
+    }
+
+    return 0;
+}
+
+void vOptionsApplyRenderBackend(void)
+{
+    // SDL reads its hints from the environment if they have not been set
+    // programmatically, this lets us select the backend without the
+    // graphics library needing to know about it
+    if (emulator_options.backend == RENDER_BACKEND_HEADLESS) {
+        // The offscreen video driver keeps each window's framebuffer in
+        // memory, the software renderer then draws straight into it
+        setenv("SDL_VIDEODRIVER", "offscreen", 1);
+        setenv("SDL_RENDER_DRIVER", "software", 1);
+        setenv("SDL_AUDIODRIVER", "dummy", 1);
+    }
+
+    if (emulator_options.pacing == FRAME_PACING_UNCAPPED) {
+        setenv("SDL_RENDER_VSYNC", "0", 1);
+    }
+}
@@ -0,0 +1,859 @@
+/**
+ * @file reactor.c
+ * @author Alex Hoffman
+ * @date 23 January 2023
+ * @brief Single thread multiplexing all sockets and message queues
+ *
+ * @verbatim
+ ----------------------------------------------------------------------
+ Copyright (C) Alexander Hoffman, 2023
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ any later version.
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ----------------------------------------------------------------------
+ @endverbatim
+ */
+
+// accept4
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <mqueue.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include "gfx_print.h"
+
+#include "EmulatorConfig.h"
+#include "frame_timing.h"
+#include "idle.h"
+#include "journal.h"
+#include "reactor.h"
+
+#define REACTOR_TASK_STACK_SIZE 1024
+// Epoll data of the descriptor used to wake the reactor's thread
+#define WAKE_ID UINT64_MAX
+// Reads from one handle each time it is ready, so that a busy handle does
+// not hold up the others
+#define READ_BUDGET 8
+
+typedef enum handle_type {
+    HANDLE_FREE = 0,
+    HANDLE_FD,
+    HANDLE_MESSAGE_QUEUE,
+    HANDLE_LISTEN,
+    HANDLE_CONNECTION,
+    // Connection that has been closed, freed once its last read has been
+    // dispatched
+    HANDLE_CLOSED,
+} handle_type_e;
+
+struct reactor_handle {
+    handle_type_e type;
+    // Incremented each time the handle is freed, so that stale events and
+    // dispatch entries of a previous user of the handle are ignored
+    uint32_t generation;
+    // -1 for message queues and sockets replayed from the journal
+    int fd;
+    // Identifies the handle's reads in the journal across runs
+    uint32_t source;
+    reactor_callback_t callback;
+    reactor_ready_t ready;
+    void *args;
+    // Not being read because the dispatch queue was full
+    uint32_t parked;
+    reactor_handle_stats_t stats;
+};
+
+struct dispatch_entry {
+    struct reactor_handle *handle;
+    uint32_t generation;
+    size_t length;
+    uint64_t timestamp;
+    unsigned char closed;
+    char data[configREACTOR_MESSAGE_SIZE + 1];
+};
+
+static struct reactor {
+    int epoll_fd;
+    int wake_fd;
+    pthread_t thread;
+    volatile int running;
+    TaskHandle_t task;
+    // Protects the handles, held by the reactor's thread while it handles
+    // events
+    pthread_mutex_t lock;
+    struct reactor_handle handles[configREACTOR_MAX_HANDLES];
+    // Single producer, single consumer queue from the reactor's thread to
+    // the dispatch task
+    struct dispatch_entry *queue;
+    uint32_t head;
+    uint32_t tail;
+    uint32_t parked;
+    reactor_stats_t stats;
+} reactor = {
+    .epoll_fd = -1,
+    .wake_fd = -1,
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static uint64_t ullReactorHandleId(struct reactor_handle *handle)
+{
+    return (uint64_t)handle->generation << 32 | (handle - reactor.handles);
+}
+
+static struct reactor_handle *pxReactorLookup(uint64_t id)
+{
+    struct reactor_handle *handle;
+
+    if ((id & UINT32_MAX) >= configREACTOR_MAX_HANDLES) {
+        return NULL;
+    }
+
+    handle = &reactor.handles[id & UINT32_MAX];
+    if (handle->type == HANDLE_FREE || handle->generation != id >> 32) {
+        return NULL;
+    }
+
+    return handle;
+}
+
+// Must be called with the lock held
+static struct reactor_handle *pxReactorAlloc(handle_type_e type, int fd,
+        uint32_t source)
+{
+    struct reactor_handle *handle;
+    struct epoll_event event = { .events = EPOLLIN | EPOLLONESHOT };
+
+    for (unsigned int i = 0; i < configREACTOR_MAX_HANDLES; i++) {
+        handle = &reactor.handles[i];
+        if (handle->type != HANDLE_FREE) {
+            continue;
+        }
+
+        handle->type = type;
+        handle->fd = fd;
+        handle->source = source;
+        handle->parked = 0;
+        memset(&handle->stats, 0, sizeof(handle->stats));
+
+        event.data.u64 = ullReactorHandleId(handle);
+        if (fd >= 0 && epoll_ctl(reactor.epoll_fd, EPOLL_CTL_ADD, fd, &event)) {
+            fprints(stderr, "Failed to watch descriptor: %s\n",
+                    strerror(errno));
+            handle->type = HANDLE_FREE;
+            return NULL;
+        }
+
+        reactor.stats.handles++;
+        return handle;
+    }
+
+    fprints(stderr, "Too many reactor handles\n");
+    return NULL;
+}
+
+// Must be called with the lock held
+static void vReactorFree(struct reactor_handle *handle)
+{
+    handle->type = HANDLE_FREE;
+    handle->generation++;
+    if (__atomic_exchange_n(&handle->parked, 0, __ATOMIC_ACQ_REL)) {
+        __atomic_fetch_sub(&reactor.parked, 1, __ATOMIC_RELEASE);
+    }
+    reactor.stats.handles--;
+}
+
+static void vReactorClose(struct reactor_handle *handle)
+{
+    if (handle->fd < 0) {
+        return;
+    }
+
+    epoll_ctl(reactor.epoll_fd, EPOLL_CTL_DEL, handle->fd, NULL);
+
+    switch (handle->type) {
+        case HANDLE_MESSAGE_QUEUE:
+            mq_close(handle->fd);
+            break;
+        case HANDLE_LISTEN:
+        case HANDLE_CONNECTION:
+            close(handle->fd);
+            break;
+        default:
+            break;
+    }
+}
+
+void vReactorRearm(reactor_handle_t handle)
+{
+    struct epoll_event event = {
+        .events = EPOLLIN | EPOLLONESHOT,
+        .data.u64 = ullReactorHandleId(handle),
+    };
+
+    if (handle->fd < 0) {
+        return;
+    }
+
+    epoll_ctl(reactor.epoll_fd, EPOLL_CTL_MOD, handle->fd, &event);
+}
+
+static int xReactorFull(void)
+{
+    return reactor.tail - __atomic_load_n(&reactor.head, __ATOMIC_ACQUIRE) ==
+           configREACTOR_QUEUE_LENGTH;
+}
+
+// Returns 1 if the dispatch queue is full, the handle is then not read until
+// the dispatch task has made room and unparked it
+static int xReactorParkIfFull(struct reactor_handle *handle)
+{
+    if (!xReactorFull()) {
+        return 0;
+    }
+
+    handle->stats.parked++;
+    if (!__atomic_exchange_n(&handle->parked, 1, __ATOMIC_ACQ_REL)) {
+        __atomic_fetch_add(&reactor.parked, 1, __ATOMIC_RELEASE);
+    }
+
+    // The dispatch task may have emptied the queue and looked for parked
+    // handles before this one was parked, nothing would then unpark it
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (xReactorFull()) {
+        return 1;
+    }
+
+    // Unless the dispatch task has already unparked and rearmed it
+    if (!__atomic_exchange_n(&handle->parked, 0, __ATOMIC_ACQ_REL)) {
+        return 1;
+    }
+    __atomic_fetch_sub(&reactor.parked, 1, __ATOMIC_RELEASE);
+
+    return 0;
+}
+
+static void vReactorPublish(struct dispatch_entry *entry)
+{
+    unsigned int queued;
+
+    __atomic_store_n(&reactor.tail, reactor.tail + 1, __ATOMIC_RELEASE);
+
+    queued = reactor.tail - __atomic_load_n(&reactor.head, __ATOMIC_ACQUIRE);
+    if (queued > reactor.stats.max_queued) {
+        reactor.stats.max_queued = queued;
+    }
+}
+
+static void vReactorRead(struct reactor_handle *handle)
+{
+    struct dispatch_entry *entry;
+    ssize_t length;
+
+    for (unsigned int i = 0; i < READ_BUDGET; i++) {
+        // The data stays where it is until there is room for it
+        if (xReactorParkIfFull(handle)) {
+            return;
+        }
+
+        entry = &reactor.queue[reactor.tail % configREACTOR_QUEUE_LENGTH];
+        entry->handle = handle;
+        entry->generation = handle->generation;
+        entry->closed = 0;
+
+        if (handle->type == HANDLE_MESSAGE_QUEUE) {
+            length = mq_receive(handle->fd, entry->data,
+                                configREACTOR_MESSAGE_SIZE, NULL);
+        }
+        else {
+            length = read(handle->fd, entry->data,
+                          configREACTOR_MESSAGE_SIZE);
+        }
+
+        if (length < 0 && errno == EINTR) {
+            continue;
+        }
+
+        // The connection's handle is freed by the dispatch task once the
+        // reads before it have been dispatched
+        if (handle->type == HANDLE_CONNECTION && length <= 0 &&
+            !(length < 0 && errno == EAGAIN)) {
+            vReactorClose(handle);
+            handle->type = HANDLE_CLOSED;
+            entry->closed = 1;
+            vReactorPublish(entry);
+            return;
+        }
+
+        if (length < 0) {
+            break;
+        }
+
+        entry->length = length;
+        entry->data[length] = '\0';
+        entry->timestamp = ullFrameTimingNow();
+        vReactorPublish(entry);
+
+        // Data arriving is our equivalent of an interrupt
+        vIdleWake();
+    }
+
+    vReactorRearm(handle);
+}
+
+static void vReactorAccept(struct reactor_handle *listener)
+{
+    struct reactor_handle *handle;
+    int fd;
+
+    while ((fd = accept4(listener->fd, NULL, NULL,
+                         SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+        handle = pxReactorAlloc(HANDLE_CONNECTION, fd, listener->source);
+        if (!handle) {
+            close(fd);
+            continue;
+        }
+
+        handle->callback = listener->callback;
+        handle->args = listener->args;
+    }
+
+    vReactorRearm(listener);
+}
+
+static void *vReactorThread(void *args)
+{
+    struct epoll_event events[configREACTOR_MAX_EVENTS];
+    struct reactor_handle *handle;
+    int count;
+
+    while (reactor.running) {
+        count = epoll_wait(reactor.epoll_fd, events,
+                           configREACTOR_MAX_EVENTS, -1);
+        if (count < 0) {
+            continue;
+        }
+
+        reactor.stats.wakeups++;
+
+        pthread_mutex_lock(&reactor.lock);
+        for (int i = 0; i < count; i++) {
+            handle = pxReactorLookup(events[i].data.u64);
+            if (!handle) {
+                continue;
+            }
+
+            handle->stats.ready++;
+            reactor.stats.events++;
+
+            switch (handle->type) {
+                case HANDLE_FD:
+                    // The ready function posts at most one entry
+                    if (!xReactorParkIfFull(handle)) {
+                        handle->ready(handle, handle->args);
+                    }
+                    break;
+                case HANDLE_LISTEN:
+                    vReactorAccept(handle);
+                    break;
+                case HANDLE_MESSAGE_QUEUE:
+                case HANDLE_CONNECTION:
+                    vReactorRead(handle);
+                    break;
+                default:
+                    break;
+            }
+        }
+        pthread_mutex_unlock(&reactor.lock);
+    }
+
+    return NULL;
+}
+
+static void vReactorDispatch(struct dispatch_entry *entry)
+{
+    struct reactor_handle *handle = entry->handle;
+    uint64_t latency;
+
+    // The handle was removed after the entry was queued
+    if (handle->generation != entry->generation) {
+        return;
+    }
+
+    if (entry->closed) {
+        pthread_mutex_lock(&reactor.lock);
+        vReactorFree(handle);
+        pthread_mutex_unlock(&reactor.lock);
+        return;
+    }
+
+    latency = ullFrameTimingNow() - entry->timestamp;
+    handle->stats.dispatched++;
+    handle->stats.total_latency += latency;
+    if (latency > handle->stats.max_latency) {
+        handle->stats.max_latency = latency;
+    }
+
+    // Descriptors added with xReactorAddFd are recorded by their owners
+    if (handle->type != HANDLE_FD) {
+        vJournalRecord(JOURNAL_READ, handle->source, 0, entry->timestamp,
+                       entry->data, entry->length);
+    }
+
+    handle->callback(entry->length, entry->data, handle->args);
+}
+
+// Called while replaying a journal from the task presenting the frames, in
+// place of the dispatch task handing on a read. Reads from connections are
+// handed to their listening socket's handler.
+static void vReactorPlay(const journal_record_t *record, const char *data)
+{
+    static char buffer[configREACTOR_MESSAGE_SIZE + 1];
+    struct reactor_handle *handle;
+    reactor_callback_t callback = NULL;
+    void *args = NULL;
+    size_t length;
+
+    pthread_mutex_lock(&reactor.lock);
+    for (unsigned int i = 0; i < configREACTOR_MAX_HANDLES; i++) {
+        handle = &reactor.handles[i];
+
+        if ((handle->type == HANDLE_MESSAGE_QUEUE ||
+             handle->type == HANDLE_LISTEN) &&
+            handle->source == record->source) {
+            callback = handle->callback;
+            args = handle->args;
+            handle->stats.dispatched++;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&reactor.lock);
+
+    if (!callback) {
+        return;
+    }
+
+    length = record->length < configREACTOR_MESSAGE_SIZE ?
+             record->length : configREACTOR_MESSAGE_SIZE;
+    memcpy(buffer, data, length);
+    buffer[length] = '\0';
+
+    callback(length, buffer, args);
+}
+
+static void vReactorUnpark(void)
+{
+    struct reactor_handle *handle;
+
+    for (unsigned int i = 0; i < configREACTOR_MAX_HANDLES; i++) {
+        handle = &reactor.handles[i];
+
+        if (__atomic_exchange_n(&handle->parked, 0, __ATOMIC_ACQ_REL)) {
+            __atomic_fetch_sub(&reactor.parked, 1, __ATOMIC_RELEASE);
+            vReactorRearm(handle);
+        }
+    }
+}
+
+// Whether the dispatch task has reads to dispatch or handles to unpark
+static int xReactorPending(void)
+{
+    return __atomic_load_n(&reactor.tail, __ATOMIC_ACQUIRE) !=
+           __atomic_load_n(&reactor.head, __ATOMIC_ACQUIRE) ||
+           __atomic_load_n(&reactor.parked, __ATOMIC_ACQUIRE);
+}
+
+void vReactorWake(void)
+{
+    if (reactor.task && xReactorPending()) {
+        xTaskNotifyGive(reactor.task);
+    }
+}
+
+void vReactorWakeFromISR(void)
+{
+    // The notification is not lost if the dispatch task has yet to block,
+    // the next tick notifies it again while work is pending
+    if (reactor.task && xReactorPending()) {
+        vTaskNotifyGiveFromISR(reactor.task, NULL);
+    }
+}
+
+static void vReactorDispatchTask(void *pvParameters)
+{
+    uint32_t head;
+
+    while (1) {
+        // Handles parked while the queue was full are read again once the
+        // queue has room. Pairs with the fence in xReactorParkIfFull, either
+        // the handle sees the room made or it is seen parked here.
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&reactor.parked, __ATOMIC_ACQUIRE)) {
+            vReactorUnpark();
+        }
+
+        head = reactor.head;
+
+        // The reactor's thread cannot notify a task, it wakes the idle task
+        // which passes the notification on, or the next tick does
+        if (head == __atomic_load_n(&reactor.tail, __ATOMIC_ACQUIRE)) {
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            continue;
+        }
+
+        vReactorDispatch(&reactor.queue[head % configREACTOR_QUEUE_LENGTH]);
+        __atomic_store_n(&reactor.head, head + 1, __ATOMIC_RELEASE);
+    }
+}
+
+int xReactorInit(void)
+{
+    struct epoll_event event = { .events = EPOLLIN, .data.u64 = WAKE_ID };
+    sigset_t all, old;
+    int ret;
+
+    vJournalSetPlayer(JOURNAL_READ, vReactorPlay);
+
+    reactor.queue = calloc(configREACTOR_QUEUE_LENGTH,
+                           sizeof(struct dispatch_entry));
+    if (!reactor.queue) {
+        PRINT_ERROR("Failed to allocate reactor dispatch queue");
+        goto err_queue;
+    }
+
+    reactor.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (reactor.epoll_fd < 0) {
+        PRINT_ERROR("Failed to create epoll instance: %s", strerror(errno));
+        goto err_epoll;
+    }
+
+    reactor.wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (reactor.wake_fd < 0 ||
+        epoll_ctl(reactor.epoll_fd, EPOLL_CTL_ADD, reactor.wake_fd,
+                  &event)) {
+        PRINT_ERROR("Failed to create reactor wake descriptor");
+        goto err_wake;
+    }
+
+    if (xTaskCreate(vReactorDispatchTask, "ReactorDispatch",
+                    REACTOR_TASK_STACK_SIZE, NULL, configMAX_PRIORITIES - 1,
+                    &reactor.task) != pdPASS) {
+        PRINT_TASK_ERROR("ReactorDispatch");
+        goto err_task;
+    }
+
+    // The reactor's thread must not handle the signals that drive the
+    // FreeRTOS scheduler
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &old);
+    reactor.running = 1;
+    ret = pthread_create(&reactor.thread, NULL, vReactorThread, NULL);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (ret) {
+        PRINT_ERROR("Failed to start reactor thread: %s", strerror(ret));
+        reactor.running = 0;
+        goto err_thread;
+    }
+
+    return 0;
+
+err_thread:
+    vTaskDelete(reactor.task);
+    reactor.task = NULL;
+err_task:
+err_wake:
+    if (reactor.wake_fd >= 0) {
+        close(reactor.wake_fd);
+        reactor.wake_fd = -1;
+    }
+    close(reactor.epoll_fd);
+    reactor.epoll_fd = -1;
+err_epoll:
+    free(reactor.queue);
+    reactor.queue = NULL;
+err_queue:
+    return -1;
+}
+
+static void vReactorPrintStats(void)
+{
+    reactor_handle_stats_t stats;
+
+    printf("Reactor: %lu wakeups, %lu events, at most %u reads queued\n",
+           reactor.stats.wakeups, reactor.stats.events,
+           reactor.stats.max_queued);
+
+    for (unsigned int i = 0; i < configREACTOR_MAX_HANDLES; i++) {
+        if (reactor.handles[i].type == HANDLE_FREE) {
+            continue;
+        }
+
+        vReactorGetHandleStats(&reactor.handles[i], &stats);
+        printf("Reactor handle %u: %lu ready, %lu dispatched, %lu parked, "
+               "latency mean %.1fus max %.1fus\n", i, stats.ready,
+               stats.dispatched, stats.parked, stats.dispatched ?
+               stats.total_latency / 1e3 / stats.dispatched : 0.0,
+               stats.max_latency / 1e3);
+    }
+}
+
+void vReactorExit(void)
+{
+    uint64_t wake = 1;
+
+    if (!reactor.running) {
+        return;
+    }
+
+    reactor.running = 0;
+    if (write(reactor.wake_fd, &wake, sizeof(wake)) < 0) {
+        fprints(stderr, "Failed to wake reactor thread\n");
+    }
+    pthread_join(reactor.thread, NULL);
+
+    vReactorPrintStats();
+
+    for (unsigned int i = 0; i < configREACTOR_MAX_HANDLES; i++)
+        if (reactor.handles[i].type != HANDLE_FREE) {
+            vReactorClose(&reactor.handles[i]);
+            vReactorFree(&reactor.handles[i]);
+        }
+
+    close(reactor.wake_fd);
+    close(reactor.epoll_fd);
+    reactor.wake_fd = -1;
+    reactor.epoll_fd = -1;
+}
+
+reactor_handle_t xReactorAddFd(int fd, reactor_ready_t ready,
+                               reactor_callback_t callback, void *args)
+{
+    struct reactor_handle *handle;
+
+    pthread_mutex_lock(&reactor.lock);
+    handle = pxReactorAlloc(HANDLE_FD, fd, 0);
+    if (handle) {
+        handle->ready = ready;
+        handle->callback = callback;
+        handle->args = args;
+    }
+    pthread_mutex_unlock(&reactor.lock);
+
+    return handle;
+}
+
+int xReactorPost(reactor_handle_t handle, const void *data, size_t length)
+{
+    struct dispatch_entry *entry;
+
+    if (length > configREACTOR_MESSAGE_SIZE) {
+        fprints(stderr, "Posted %zu bytes, more than a read can hold\n",
+                length);
+        return -1;
+    }
+
+    // The reactor's thread only calls a ready function while there is room
+    entry = &reactor.queue[reactor.tail % configREACTOR_QUEUE_LENGTH];
+    entry->handle = handle;
+    entry->generation = handle->generation;
+    entry->closed = 0;
+    entry->length = length;
+    memcpy(entry->data, data, length);
+    entry->data[length] = '\0';
+    entry->timestamp = ullFrameTimingNow();
+    vReactorPublish(entry);
+
+    vIdleWake();
+
+    return 0;
+}
+
+void vReactorRemove(reactor_handle_t handle)
+{
+    pthread_mutex_lock(&reactor.lock);
+    if (handle->type != HANDLE_FREE && handle->type != HANDLE_CLOSED) {
+        vReactorClose(handle);
+        vReactorFree(handle);
+    }
+    pthread_mutex_unlock(&reactor.lock);
+}
+
+static int xReactorQueueName(const char *name, char *path)
+{
+    // POSIX message queue names start with a slash
+    if (snprintf(path, NAME_MAX, "%s%s", name[0] == '/' ? "" : "/", name) >=
+        NAME_MAX) {
+        fprints(stderr, "Message queue name '%s' too long\n", name);
+        return -1;
+    }
+
+    return 0;
+}
+
+reactor_handle_t xReactorOpenMessageQueue(const char *name, long max_messages,
+        long message_size,
+        reactor_callback_t callback,
+        void *args)
+{
+    struct mq_attr attr = {
+        .mq_maxmsg = max_messages,
+        .mq_msgsize = message_size,
+    };
+    struct reactor_handle *handle;
+    char path[NAME_MAX];
+    mqd_t mq;
+
+    if (message_size > configREACTOR_MESSAGE_SIZE) {
+        fprints(stderr, "Message size of queue '%s' too large\n", name);
+        return NULL;
+    }
+
+    if (xReactorQueueName(name, path)) {
+        return NULL;
+    }
+
+    // The queue's messages are replayed from the journal, see vReactorPlay
+    if (xJournalReplaying()) {
+        mq = -1;
+    }
+    else {
+        mq = mq_open(path, O_RDONLY | O_CREAT | O_NONBLOCK | O_CLOEXEC,
+                     0644, &attr);
+        if (mq < 0) {
+            fprints(stderr, "Failed to open message queue '%s': %s\n",
+                    path, strerror(errno));
+            return NULL;
+        }
+    }
+
+    pthread_mutex_lock(&reactor.lock);
+    handle = pxReactorAlloc(HANDLE_MESSAGE_QUEUE, mq,
+                            ulJournalSource(path));
+    if (handle) {
+        handle->callback = callback;
+        handle->args = args;
+    }
+    pthread_mutex_unlock(&reactor.lock);
+
+    if (!handle && mq >= 0) {
+        mq_close(mq);
+    }
+
+    return handle;
+}
+
+int xReactorMessageQueuePut(const char *name, char *buffer)
+{
+    char path[NAME_MAX];
+    mqd_t mq;
+    int ret;
+
+    if (xReactorQueueName(name, path)) {
+        return -1;
+    }
+
+    // Only what was received is replayed, nothing is sent
+    if (xJournalReplaying()) {
+        return 0;
+    }
+
+    mq = mq_open(path, O_WRONLY | O_NONBLOCK | O_CLOEXEC);
+    if (mq < 0) {
+        return -1;
+    }
+
+    ret = mq_send(mq, buffer, strlen(buffer), 0);
+    mq_close(mq);
+
+    return ret;
+}
+
+reactor_handle_t xReactorOpenTCPSocket(char *addr, in_port_t port,
+                                       reactor_callback_t callback,
+                                       void *args)
+{
+    struct sockaddr_in sa = {
+        .sin_family = AF_INET,
+        .sin_port = htons(port),
+        .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+    };
+    struct reactor_handle *handle;
+    int fd, reuse = 1;
+
+    if (addr && inet_pton(AF_INET, addr, &sa.sin_addr) != 1) {
+        fprints(stderr, "Invalid address '%s'\n", addr);
+        return NULL;
+    }
+
+    // The connections' reads are replayed from the journal, see
+    // vReactorPlay
+    if (xJournalReplaying()) {
+        fd = -1;
+        goto add;
+    }
+
+    fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        fprints(stderr, "Failed to open TCP socket: %s\n", strerror(errno));
+        return NULL;
+    }
+
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+    if (bind(fd, (struct sockaddr *)&sa, sizeof(sa)) ||
+        listen(fd, SOMAXCONN)) {
+        fprints(stderr, "Failed to listen on TCP port %d: %s\n", port,
+                strerror(errno));
+        close(fd);
+        return NULL;
+    }
+
+add:
+    pthread_mutex_lock(&reactor.lock);
+    handle = pxReactorAlloc(HANDLE_LISTEN, fd, port);
+    if (handle) {
+        handle->callback = callback;
+        handle->args = args;
+    }
+    pthread_mutex_unlock(&reactor.lock);
+
+    if (!handle && fd >= 0) {
+        close(fd);
+    }
+
+    return handle;
+}
+
+void vReactorGetHandleStats(reactor_handle_t handle,
+                            reactor_handle_stats_t *stats)
+{
+    *stats = handle->stats;
+}
+
+void vReactorGetStats(reactor_stats_t *stats)
+{
+    *stats = reactor.stats;
+    stats->queued = __atomic_load_n(&reactor.tail, __ATOMIC_RELAXED) -
+                    __atomic_load_n(&reactor.head, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,248 @@
+/**
+ * @file renderer.c
+ * @author Alex Hoffman
+ * @date 23 January 2023
+ * @brief Direct access to the SDL renderer for the task presenting frames
+ *
+ * @verbatim
+ ----------------------------------------------------------------------
+ Copyright (C) Alexander Hoffman, 2023
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ any later version.
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ----------------------------------------------------------------------
+ @endverbatim
+ */
+
+#include <string.h>
+
+#include <SDL2/SDL.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include "gfx_print.h"
+
+#include "renderer.h"
+
+// The Gfx library creates one window, its ID is the first one unless
+// something else created windows before it
+#define MAX_WINDOW_ID 8
+
+struct renderer_texture {
+    struct renderer_texture *next; ///< Next deleted texture
+    SDL_Surface *surface; ///< Pixels, until uploaded
+    SDL_Texture *texture; ///< Only used by the rendering task
+    unsigned char target;
+    unsigned char failed;
+    int width;
+    int height;
+};
+
+static struct renderer {
+    SDL_Renderer *renderer;
+    TaskHandle_t task;
+    int targets_supported;
+    // Textures deleted since the rendering task last collected them
+    struct renderer_texture *deleted;
+} renderer = { 0 };
+
+int xRendererInit(void)
+{
+    SDL_Window *window;
+
+    for (Uint32 id = 1; id <= MAX_WINDOW_ID; id++)
+        if ((window = SDL_GetWindowFromID(id)) &&
+            (renderer.renderer = SDL_GetRenderer(window))) {
+            break;
+        }
+
+    if (!renderer.renderer) {
+        PRINT_ERROR("Failed to find the renderer: %s", SDL_GetError());
+        return -1;
+    }
+
+    renderer.targets_supported =
+        SDL_RenderTargetSupported(renderer.renderer) == SDL_TRUE;
+
+    return 0;
+}
+
+void vRendererBind(void)
+{
+    renderer.task = xTaskGetCurrentTaskHandle();
+}
+
+SDL_Renderer *pxRendererGet(void)
+{
+    if (!renderer.task || renderer.task != xTaskGetCurrentTaskHandle()) {
+        return NULL;
+    }
+
+    return renderer.renderer;
+}
+
+int xRendererTargetsSupported(void)
+{
+    return renderer.targets_supported;
+}
+
+static renderer_texture_handle_t pxRendererTextureAlloc(int width,
+        int height)
+{
+    renderer_texture_handle_t texture =
+        pvPortMalloc(sizeof(struct renderer_texture));
+
+    if (!texture) {
+        fprints(stderr, "[ERROR] %s, failed to allocate texture\n",
+                __FUNCTION__);
+        return NULL;
+    }
+
+    memset(texture, 0, sizeof(struct renderer_texture));
+    texture->width = width;
+    texture->height = height;
+
+    return texture;
+}
+
+renderer_texture_handle_t xRendererTextureCreate(SDL_Surface *surface)
+{
+    renderer_texture_handle_t texture;
+
+    if (!surface) {
+        return NULL;
+    }
+
+    if (!(texture = pxRendererTextureAlloc(surface->w, surface->h))) {
+        SDL_FreeSurface(surface);
+        return NULL;
+    }
+
+    texture->surface = surface;
+
+    return texture;
+}
+
+renderer_texture_handle_t xRendererTargetCreate(int width, int height)
+{
+    renderer_texture_handle_t texture;
+
+    if (!renderer.targets_supported || width <= 0 || height <= 0) {
+        return NULL;
+    }
+
+    if ((texture = pxRendererTextureAlloc(width, height))) {
+        texture->target = 1;
+    }
+
+    return texture;
+}
+
+void vRendererTextureDelete(renderer_texture_handle_t texture)
+{
+    if (!texture) {
+        return;
+    }
+
+    vTaskSuspendAll();
+    texture->next = renderer.deleted;
+    renderer.deleted = texture;
+    xTaskResumeAll();
+}
+
+static int xRendererTextureUpload(renderer_texture_handle_t texture)
+{
+    if (texture->target) {
+        texture->texture = SDL_CreateTexture(renderer.renderer,
+                                             SDL_PIXELFORMAT_RGBA8888,
+                                             SDL_TEXTUREACCESS_TARGET,
+                                             texture->width,
+                                             texture->height);
+    }
+    else {
+        texture->texture = SDL_CreateTextureFromSurface(renderer.renderer,
+                           texture->surface);
+    }
+
+    if (!texture->texture) {
+        fprints(stderr, "[ERROR] %s, %s\n", __FUNCTION__, SDL_GetError());
+        return -1;
+    }
+
+    SDL_SetTextureBlendMode(texture->texture, SDL_BLENDMODE_BLEND);
+
+    if (texture->surface) {
+        SDL_FreeSurface(texture->surface);
+        texture->surface = NULL;
+    }
+
+    return 0;
+}
+
+SDL_Texture *pxRendererTextureGet(renderer_texture_handle_t texture)
+{
+    if (!texture || !pxRendererGet()) {
+        return NULL;
+    }
+
+    // A texture that cannot be created is only reported once
+    if (!texture->texture && !texture->failed &&
+        xRendererTextureUpload(texture)) {
+        texture->failed = 1;
+    }
+
+    return texture->texture;
+}
+
+void vRendererTextureGetSize(renderer_texture_handle_t texture, int *width,
+                             int *height)
+{
+    if (width) {
+        *width = texture ? texture->width : 0;
+    }
+    if (height) {
+        *height = texture ? texture->height : 0;
+    }
+}
+
+void vRendererCollect(void)
+{
+    struct renderer_texture *deleted, *next;
+
+    if (!pxRendererGet()) {
+        return;
+    }
+
+    vTaskSuspendAll();
+    deleted = renderer.deleted;
+    renderer.deleted = NULL;
+    xTaskResumeAll();
+
+    for (; deleted; deleted = next) {
+        next = deleted->next;
+        if (deleted->texture) {
+            SDL_DestroyTexture(deleted->texture);
+        }
+        if (deleted->surface) {
+            SDL_FreeSurface(deleted->surface);
+        }
+        vPortFree(deleted);
+    }
+}
+
+void vRendererPresent(void)
+{
+    SDL_Renderer *current = pxRendererGet();
+
+    if (current) {
+        SDL_RenderPresent(current);
+    }
+}
@@ -0,0 +1,418 @@
+/**
+ * @file rx_ring.c
+ * @author Alex Hoffman
+ * @date 23 January 2023
+ * @brief Zero-copy receive path for UDP sockets
+ *
+ * @verbatim
+ ----------------------------------------------------------------------
+ Copyright (C) Alexander Hoffman, 2023
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ any later version.
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ----------------------------------------------------------------------
+ @endverbatim
+ */
+
+// recvmmsg
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#include "gfx_print.h"
+
+#include "EmulatorConfig.h"
+#include "frame_timing.h"
+#include "journal.h"
+#include "reactor.h"
+#include "rx_ring.h"
+
+#if configRX_RING_BUFFERS % 64
+#error "configRX_RING_BUFFERS must be a multiple of 64"
+#endif
+
+#define FREE_WORDS (configRX_RING_BUFFERS / 64)
+
+// A batch is posted to the reactor's dispatch task as its buffer indices
+#if configRX_RING_BATCH * 4 > configREACTOR_MESSAGE_SIZE
+#error "A batch of buffer indices must fit into a reactor read"
+#endif
+
+struct rx_ring {
+    int fd;
+    in_port_t port;
+    reactor_handle_t handle;
+    rx_ring_callback_t callback;
+    void *args;
+
+    size_t buffer_size;
+    char *memory;
+    rx_buffer_t buffers[configRX_RING_BUFFERS];
+    // Set bits mark the buffers that are not lent out
+    uint64_t free[FREE_WORDS];
+    // Set while all buffers are lent out, the socket is then not watched
+    // until a buffer is released
+    uint32_t starved;
+    // Set while the dispatch task lends buffers to the handler, a handler
+    // closing its own ring only marks it closed, it is freed once the batch
+    // has been handed on
+    unsigned char delivering;
+    unsigned char closed;
+
+    rx_ring_stats_t stats;
+    struct rx_ring *next;
+};
+
+static struct rx_ring *rings = NULL;
+static pthread_mutex_t rings_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static unsigned int uRxRingClaim(struct rx_ring *ring, unsigned int *indices,
+                                 unsigned int count)
+{
+    unsigned int claimed = 0;
+    uint64_t bits;
+
+    for (unsigned int w = 0; w < FREE_WORDS && claimed < count; w++) {
+        if (!__atomic_load_n(&ring->free[w], __ATOMIC_RELAXED)) {
+            continue;
+        }
+
+        // Take the whole word and give back what is not needed, so that a
+        // concurrent release is never lost
+        bits = __atomic_exchange_n(&ring->free[w], 0, __ATOMIC_ACQUIRE);
+        while (bits && claimed < count) {
+            indices[claimed++] = w * 64 + __builtin_ctzll(bits);
+            bits &= bits - 1;
+        }
+
+        if (bits) {
+            __atomic_fetch_or(&ring->free[w], bits, __ATOMIC_RELEASE);
+        }
+    }
+
+    return claimed;
+}
+
+static void vRxRingPut(struct rx_ring *ring, unsigned int index)
+{
+    __atomic_fetch_or(&ring->free[index / 64], 1ULL << (index % 64),
+                      __ATOMIC_RELEASE);
+}
+
+void vRxRingRelease(rx_buffer_t *buffer)
+{
+    struct rx_ring *ring = buffer->ring;
+
+    vRxRingPut(ring, buffer->index);
+
+    if (__atomic_exchange_n(&ring->starved, 0, __ATOMIC_SEQ_CST) &&
+        ring->handle) {
+        vReactorRearm(ring->handle);
+    }
+}
+
+// Called from the reactor's thread when datagrams are waiting
+static void vRxRingReady(reactor_handle_t handle, void *args)
+{
+    struct rx_ring *ring = args;
+    struct mmsghdr msgs[configRX_RING_BATCH];
+    struct iovec iovs[configRX_RING_BATCH];
+    unsigned int indices[configRX_RING_BATCH];
+    unsigned int count;
+    rx_buffer_t *buffer;
+    uint64_t now;
+    int received;
+
+    count = uRxRingClaim(ring, indices, configRX_RING_BATCH);
+    if (!count) {
+        // A buffer may have been released before starved was set
+        __atomic_store_n(&ring->starved, 1, __ATOMIC_SEQ_CST);
+        count = uRxRingClaim(ring, indices, configRX_RING_BATCH);
+        if (!count) {
+            ring->stats.starved++;
+            return;
+        }
+        __atomic_store_n(&ring->starved, 0, __ATOMIC_SEQ_CST);
+    }
+
+    // Datagrams and their source addresses are written straight into
+    // the claimed buffers
+    for (unsigned int i = 0; i < count; i++) {
+        buffer = &ring->buffers[indices[i]];
+
+        iovs[i].iov_base = buffer->data;
+        iovs[i].iov_len = ring->buffer_size;
+        memset(&msgs[i], 0, sizeof(msgs[i]));
+        msgs[i].msg_hdr.msg_name = &buffer->source;
+        msgs[i].msg_hdr.msg_namelen = sizeof(buffer->source);
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    received = recvmmsg(ring->fd, msgs, count, MSG_DONTWAIT, NULL);
+    if (received < 0) {
+        if (errno != EAGAIN && errno != EINTR) {
+            ring->stats.errors++;
+        }
+        received = 0;
+    }
+
+    for (unsigned int i = received; i < count; i++) {
+        vRxRingPut(ring, indices[i]);
+    }
+
+    if (!received) {
+        goto rearm;
+    }
+
+    now = ullFrameTimingNow();
+    ring->stats.received += received;
+    ring->stats.batches++;
+
+    for (int i = 0; i < received; i++) {
+        buffer = &ring->buffers[indices[i]];
+
+        buffer->length = msgs[i].msg_len;
+        buffer->truncated = !!(msgs[i].msg_hdr.msg_flags & MSG_TRUNC);
+        buffer->timestamp = now;
+        buffer->data[buffer->length] = '\0';
+
+        if (buffer->truncated) {
+            ring->stats.truncated++;
+        }
+
+        vJournalRecord(JOURNAL_DATAGRAM, ring->port, buffer->truncated, now,
+                       buffer->data, buffer->length);
+    }
+
+    // The buffers are lent to the handler from the dispatch task
+    xReactorPost(handle, indices, received * sizeof(indices[0]));
+rearm:
+    vReactorRearm(handle);
+}
+
+static void vRxRingFree(struct rx_ring *ring)
+{
+    if (ring->fd >= 0) {
+        close(ring->fd);
+    }
+    free(ring->memory);
+    free(ring);
+}
+
+// Called from the reactor's dispatch task with the indices of the buffers
+// vRxRingReady received into
+static void vRxRingDeliver(size_t length, char *data, void *args)
+{
+    struct rx_ring *ring = args;
+    unsigned int index;
+
+    ring->delivering = 1;
+    for (size_t i = 0; i + sizeof(index) <= length && !ring->closed;
+         i += sizeof(index)) {
+        memcpy(&index, data + i, sizeof(index));
+        ring->callback(&ring->buffers[index], ring->args);
+    }
+    ring->delivering = 0;
+
+    if (ring->closed) {
+        vRxRingFree(ring);
+    }
+}
+
+// Called while replaying a journal from the task presenting the frames, in
+// place of the reactor receiving the datagram
+static void vRxRingPlay(const journal_record_t *record, const char *data)
+{
+    struct rx_ring *ring;
+    rx_buffer_t *buffer;
+    unsigned int index;
+
+    pthread_mutex_lock(&rings_lock);
+    for (ring = rings; ring; ring = ring->next)
+        if (ring->port == record->source) {
+            break;
+        }
+    pthread_mutex_unlock(&rings_lock);
+
+    if (!ring) {
+        return;
+    }
+
+    if (!uRxRingClaim(ring, &index, 1)) {
+        ring->stats.starved++;
+        return;
+    }
+
+    buffer = &ring->buffers[index];
+    buffer->length = record->length < ring->buffer_size ?
+                     record->length : ring->buffer_size;
+    buffer->truncated = record->flags || record->length > ring->buffer_size;
+    buffer->timestamp = record->time;
+    memset(&buffer->source, 0, sizeof(buffer->source));
+    memcpy(buffer->data, data, buffer->length);
+    buffer->data[buffer->length] = '\0';
+
+    ring->stats.received++;
+    ring->stats.batches++;
+    if (buffer->truncated) {
+        ring->stats.truncated++;
+    }
+
+    ring->callback(buffer, ring->args);
+}
+
+static int xRxRingBind(char *addr, in_port_t port)
+{
+    struct sockaddr_in sa = {
+        .sin_family = AF_INET,
+        .sin_port = htons(port),
+        .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+    };
+    int fd;
+
+    if (addr && inet_pton(AF_INET, addr, &sa.sin_addr) != 1) {
+        fprints(stderr, "Invalid address '%s'\n", addr);
+        return -1;
+    }
+
+    fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        fprints(stderr, "Failed to open UDP socket: %s\n", strerror(errno));
+        return -1;
+    }
+
+    if (bind(fd, (struct sockaddr *)&sa, sizeof(sa))) {
+        fprints(stderr, "Failed to bind UDP socket to port %d: %s\n", port,
+                strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+rx_ring_handle_t xRxRingOpenUDP(char *addr, in_port_t port,
+                                size_t buffer_size,
+                                rx_ring_callback_t callback, void *args)
+{
+    struct rx_ring *ring;
+
+    ring = calloc(1, sizeof(struct rx_ring));
+    if (!ring) {
+        goto err_ring;
+    }
+
+    // One extra byte per buffer for the null terminator
+    ring->memory = calloc(configRX_RING_BUFFERS, buffer_size + 1);
+    if (!ring->memory) {
+        goto err_memory;
+    }
+
+    ring->buffer_size = buffer_size;
+    ring->callback = callback;
+    ring->args = args;
+
+    for (unsigned int i = 0; i < configRX_RING_BUFFERS; i++) {
+        ring->buffers[i].data = ring->memory + i * (buffer_size + 1);
+        ring->buffers[i].ring = ring;
+        ring->buffers[i].index = i;
+    }
+    memset(ring->free, 0xff, sizeof(ring->free));
+    ring->port = port;
+
+    // The datagrams are replayed from the journal, see vRxRingPlay
+    if (xJournalReplaying()) {
+        ring->fd = -1;
+        vJournalSetPlayer(JOURNAL_DATAGRAM, vRxRingPlay);
+        goto add;
+    }
+
+    ring->fd = xRxRingBind(addr, port);
+    if (ring->fd < 0) {
+        goto err_socket;
+    }
+
+    ring->handle = xReactorAddFd(ring->fd, vRxRingReady, vRxRingDeliver,
+                                 ring);
+    if (!ring->handle) {
+        goto err_handle;
+    }
+
+add:
+    pthread_mutex_lock(&rings_lock);
+    ring->next = rings;
+    rings = ring;
+    pthread_mutex_unlock(&rings_lock);
+
+    return ring;
+
+err_handle:
+    close(ring->fd);
+err_socket:
+    free(ring->memory);
+err_memory:
+    free(ring);
+err_ring:
+    return NULL;
+}
+
+static void vRxRingStop(struct rx_ring *ring)
+{
+    // No batch is delivered once the handle is removed
+    if (ring->handle) {
+        vReactorRemove(ring->handle);
+    }
+
+    if (ring->delivering) {
+        ring->closed = 1;
+        return;
+    }
+
+    vRxRingFree(ring);
+}
+
+void vRxRingClose(rx_ring_handle_t ring)
+{
+    struct rx_ring **it;
+
+    pthread_mutex_lock(&rings_lock);
+    for (it = &rings; *it; it = &(*it)->next)
+        if (*it == ring) {
+            *it = ring->next;
+            break;
+        }
+    pthread_mutex_unlock(&rings_lock);
+
+    vRxRingStop(ring);
+}
+
+void vRxRingDeinit(void)
+{
+    struct rx_ring *ring;
+
+    pthread_mutex_lock(&rings_lock);
+    while ((ring = rings)) {
+        rings = ring->next;
+        vRxRingStop(ring);
+    }
+    pthread_mutex_unlock(&rings_lock);
+}
+
+void vRxRingGetStats(rx_ring_handle_t ring, rx_ring_stats_t *stats)
+{
+    *stats = ring->stats;
+}
@@ -0,0 +1,439 @@
+/**
+ * @file sched_trace.c
+ * @author Alex Hoffman
+ * @date 23 January 2023
+ * @brief Records FreeRTOS scheduler events into a Chrome trace timeline
+ *
+ * @verbatim
+ ----------------------------------------------------------------------
+ Copyright (C) Alexander Hoffman, 2023
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ any later version.
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ----------------------------------------------------------------------
+ @endverbatim
+ */
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include "gfx_print.h"
+
+#include "EmulatorConfig.h"
+#include "frame_timing.h"
+#include "sched_trace.h"
+
+#if configSCHED_TRACE_EVENTS & (configSCHED_TRACE_EVENTS - 1)
+#error "configSCHED_TRACE_EVENTS must be a power of two"
+#endif
+
+// How often the writer thread turns recorded events into the trace
+#define WRITER_INTERVAL_NS 10000000L
+
+// The event at position pos is free while its sequence is pos and recorded
+// while it is pos + 1, the same as the transmit rings
+struct sched_record {
+    uint32_t sequence;
+    uint32_t event;
+    uint64_t timestamp;
+    void *task;
+    union {
+        void *object;
+        char name[configMAX_TASK_NAME_LEN];
+    };
+};
+
+typedef enum task_state {
+    TASK_STATE_NONE = 0,
+    TASK_STATE_RUNNING,
+    TASK_STATE_READY,
+    TASK_STATE_DELAYED,
+    TASK_STATE_SUSPENDED,
+    TASK_STATE_BLOCKED_RECEIVE,
+    TASK_STATE_BLOCKED_SEND,
+    TASK_STATE_BLOCKED_NOTIFY,
+} task_state_e;
+
+static const char *state_names[] = {
+    [TASK_STATE_RUNNING] = "Running",
+    [TASK_STATE_READY] = "Ready",
+    [TASK_STATE_DELAYED] = "Delayed",
+    [TASK_STATE_SUSPENDED] = "Suspended",
+    [TASK_STATE_BLOCKED_RECEIVE] = "Blocked on receive",
+    [TASK_STATE_BLOCKED_SEND] = "Blocked on send",
+    [TASK_STATE_BLOCKED_NOTIFY] = "Blocked on notification",
+};
+
+// Only used by the writer thread
+struct sched_task {
+    void *task;
+    unsigned int tid;
+    task_state_e state;
+    uint64_t since;
+    void *object;
+    // State the running task enters once it is switched out
+    task_state_e pending;
+    void *pending_object;
+};
+
+static struct {
+    volatile int recording;
+    FILE *fp;
+    uint64_t start;
+
+    struct sched_record records[configSCHED_TRACE_EVENTS];
+    uint32_t tail;
+    uint32_t head;
+    unsigned long dropped;
+
+    pthread_t thread;
+    volatile int running;
+
+    struct sched_task tasks[configSCHED_TRACE_MAX_TASKS];
+    unsigned int task_count;
+    unsigned int next_tid;
+    struct sched_task *current;
+} trace;
+
+void vSchedTraceRecord(sched_event_e event, void *task, void *object)
+{
+    struct sched_record *record;
+    uint32_t pos;
+    int32_t diff;
+
+    if (!trace.recording) {
+        return;
+    }
+
+    // Only one task runs at a time, but the kernel can still be entered
+    // from the tick's signal handler while a task is recording
+    pos = __atomic_load_n(&trace.tail, __ATOMIC_RELAXED);
+    while (1) {
+        record = &trace.records[pos & (configSCHED_TRACE_EVENTS - 1)];
+        diff = (int32_t)(__atomic_load_n(&record->sequence,
+                                         __ATOMIC_ACQUIRE) - pos);
+
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&trace.tail, &pos, pos + 1, 1,
+                                            __ATOMIC_RELAXED,
+                                            __ATOMIC_RELAXED)) {
+                break;
+            }
+        }
+        else if (diff < 0) {
+            __atomic_fetch_add(&trace.dropped, 1, __ATOMIC_RELAXED);
+            return;
+        }
+        else {
+            pos = __atomic_load_n(&trace.tail, __ATOMIC_RELAXED);
+        }
+    }
+
+    record->event = event;
+    record->timestamp = ullFrameTimingNow();
+    record->task = task;
+    if (event == SCHED_EVENT_CREATE) {
+        strncpy(record->name, pcTaskGetName(task), configMAX_TASK_NAME_LEN);
+        record->name[configMAX_TASK_NAME_LEN - 1] = '\0';
+    }
+    else {
+        record->object = object;
+    }
+
+    __atomic_store_n(&record->sequence, pos + 1, __ATOMIC_RELEASE);
+}
+
+static double dSchedTraceUs(uint64_t timestamp)
+{
+    return timestamp > trace.start ? (timestamp - trace.start) / 1000.0 : 0;
+}
+
+static struct sched_task *pxSchedTraceTask(void *task, const char *name)
+{
+    struct sched_task *entry = NULL;
+
+    if (!task) {
+        return trace.current;
+    }
+
+    for (unsigned int i = 0; i < trace.task_count; i++) {
+        if (trace.tasks[i].task == task) {
+            entry = &trace.tasks[i];
+            break;
+        }
+        // Reuse the entry of a deleted task
+        if (!trace.tasks[i].task && !entry) {
+            entry = &trace.tasks[i];
+        }
+    }
+    if (entry && entry->task == task) {
+        return entry;
+    }
+
+    if (!entry) {
+        if (trace.task_count == configSCHED_TRACE_MAX_TASKS) {
+            return NULL;
+        }
+        entry = &trace.tasks[trace.task_count++];
+    }
+
+    memset(entry, 0, sizeof(struct sched_task));
+    entry->task = task;
+    entry->tid = ++trace.next_tid;
+
+    // Tasks created before recording started are only known by address
+    fprintf(trace.fp, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+            "\"tid\":%u,\"args\":{\"name\":", entry->tid);
+    if (name) {
+        fprintf(trace.fp, "\"%s\"}}", name);
+    }
+    else {
+        fprintf(trace.fp, "\"Task %p\"}}", task);
+    }
+
+    return entry;
+}
+
+static void vSchedTraceSetState(struct sched_task *task, task_state_e state,
+                                void *object, uint64_t timestamp)
+{
+    if (task->state != TASK_STATE_NONE && timestamp > task->since) {
+        fprintf(trace.fp, ",\n{\"name\":\"%s\",\"cat\":\"state\","
+                "\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,"
+                "\"dur\":%.3f", state_names[task->state], task->tid,
+                dSchedTraceUs(task->since),
+                (timestamp - task->since) / 1000.0);
+        if (task->object) {
+            fprintf(trace.fp, ",\"args\":{\"object\":\"%p\"}", task->object);
+        }
+        fprintf(trace.fp, "}");
+    }
+
+    task->state = state;
+    task->object = object;
+    task->since = timestamp;
+}
+
+static void vSchedTraceInstant(struct sched_task *task, const char *name,
+                               void *object, uint64_t timestamp)
+{
+    fprintf(trace.fp, ",\n{\"name\":\"%s\",\"cat\":\"ipc\",\"ph\":\"i\","
+            "\"s\":\"t\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,"
+            "\"args\":{\"object\":\"%p\"}}", name, task->tid,
+            dSchedTraceUs(timestamp), object);
+}
+
+static void vSchedTraceBlock(struct sched_task *task, task_state_e state,
+                             void *object)
+{
+    task->pending = state;
+    task->pending_object = object;
+}
+
+static void vSchedTraceHandle(struct sched_record *record)
+{
+    struct sched_task *task;
+
+    task = pxSchedTraceTask(record->task, record->event ==
+                            SCHED_EVENT_CREATE ? record->name : NULL);
+    if (!task) {
+        return;
+    }
+
+    switch (record->event) {
+        case SCHED_EVENT_CREATE:
+            break;
+        case SCHED_EVENT_DELETE:
+            vSchedTraceSetState(task, TASK_STATE_NONE, NULL,
+                                record->timestamp);
+            if (trace.current == task) {
+                trace.current = NULL;
+            }
+            task->task = NULL;
+            break;
+        case SCHED_EVENT_SWITCHED_IN:
+            trace.current = task;
+            vSchedTraceSetState(task, TASK_STATE_RUNNING, NULL,
+                                record->timestamp);
+            break;
+        case SCHED_EVENT_SWITCHED_OUT:
+            // Without a reason to block the task was preempted
+            vSchedTraceSetState(task, task->pending ? task->pending :
+                                TASK_STATE_READY, task->pending_object,
+                                record->timestamp);
+            task->pending = TASK_STATE_NONE;
+            task->pending_object = NULL;
+            break;
+        case SCHED_EVENT_READY:
+            if (task->state != TASK_STATE_RUNNING) {
+                vSchedTraceSetState(task, TASK_STATE_READY, NULL,
+                                    record->timestamp);
+            }
+            break;
+        case SCHED_EVENT_DELAY:
+            vSchedTraceBlock(task, TASK_STATE_DELAYED, NULL);
+            break;
+        case SCHED_EVENT_SUSPEND:
+            if (task->state == TASK_STATE_RUNNING) {
+                vSchedTraceBlock(task, TASK_STATE_SUSPENDED, NULL);
+            }
+            else {
+                vSchedTraceSetState(task, TASK_STATE_SUSPENDED, NULL,
+                                    record->timestamp);
+            }
+            break;
+        case SCHED_EVENT_BLOCK_RECEIVE:
+            vSchedTraceBlock(task, TASK_STATE_BLOCKED_RECEIVE,
+                             record->object);
+            break;
+        case SCHED_EVENT_BLOCK_SEND:
+            vSchedTraceBlock(task, TASK_STATE_BLOCKED_SEND, record->object);
+            break;
+        case SCHED_EVENT_BLOCK_NOTIFY:
+            vSchedTraceBlock(task, TASK_STATE_BLOCKED_NOTIFY, NULL);
+            break;
+        case SCHED_EVENT_SEND:
+            vSchedTraceInstant(task, "Send", record->object,
+                               record->timestamp);
+            break;
+        case SCHED_EVENT_RECEIVE:
+            vSchedTraceInstant(task, "Receive", record->object,
+                               record->timestamp);
+            break;
+        case SCHED_EVENT_NOTIFY:
+            // Shown on the notifying task, the notified task is the object
+            if (trace.current) {
+                vSchedTraceInstant(trace.current, "Notify", record->task,
+                                   record->timestamp);
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+static void vSchedTraceDrain(void)
+{
+    struct sched_record *record;
+
+    while (1) {
+        record = &trace.records[trace.head & (configSCHED_TRACE_EVENTS - 1)];
+        if (__atomic_load_n(&record->sequence, __ATOMIC_ACQUIRE) !=
+            trace.head + 1) {
+            break;
+        }
+
+        vSchedTraceHandle(record);
+
+        __atomic_store_n(&record->sequence,
+                         trace.head + configSCHED_TRACE_EVENTS,
+                         __ATOMIC_RELEASE);
+        trace.head++;
+    }
+}
+
+static void *vSchedTraceThread(void *args)
+{
+    struct timespec interval = { .tv_nsec = WRITER_INTERVAL_NS };
+
+    while (trace.running) {
+        nanosleep(&interval, NULL);
+        vSchedTraceDrain();
+    }
+
+    return NULL;
+}
+
+int xSchedTraceInit(const char *filename)
+{
+    sigset_t all, old;
+    int ret;
+
+    if (!filename) {
+        return 0;
+    }
+
+#ifndef TRACE_SCHEDULER
+    fprints(stderr, "Scheduler trace needs a build with TRACE_SCHEDULER\n");
+#endif
+
+    trace.fp = fopen(filename, "w");
+    if (!trace.fp) {
+        fprints(stderr, "Failed to open scheduler trace '%s'\n", filename);
+        return -1;
+    }
+
+    for (unsigned int i = 0; i < configSCHED_TRACE_EVENTS; i++) {
+        trace.records[i].sequence = i;
+    }
+
+    trace.start = ullFrameTimingNow();
+    fprintf(trace.fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n"
+            "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,"
+            "\"args\":{\"name\":\"FreeRTOS\"}}");
+
+    // The writer thread must not handle the signals that drive the FreeRTOS
+    // scheduler
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &old);
+    trace.running = 1;
+    ret = pthread_create(&trace.thread, NULL, vSchedTraceThread, NULL);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (ret) {
+        fprints(stderr, "Failed to start scheduler trace writer: %s\n",
+                strerror(ret));
+        trace.running = 0;
+        fclose(trace.fp);
+        trace.fp = NULL;
+        return -1;
+    }
+
+    trace.recording = 1;
+
+    return 0;
+}
+
+void vSchedTraceExit(void)
+{
+    uint64_t now = ullFrameTimingNow();
+
+    if (!trace.fp) {
+        return;
+    }
+
+    trace.recording = 0;
+    trace.running = 0;
+    pthread_join(trace.thread, NULL);
+
+    vSchedTraceDrain();
+
+    // Close the spans that are still open
+    for (unsigned int i = 0; i < trace.task_count; i++) {
+        if (trace.tasks[i].task) {
+            vSchedTraceSetState(&trace.tasks[i], TASK_STATE_NONE, NULL, now);
+        }
+    }
+
+    fprintf(trace.fp, "\n]}\n");
+    fclose(trace.fp);
+    trace.fp = NULL;
+
+    if (trace.dropped) {
+        fprints(stderr, "Scheduler trace dropped %lu events\n",
+                trace.dropped);
+    }
+}
@@ -0,0 +1,426 @@
+/**
+ * @file shm_queue.c
+ * @author Alex Hoffman
+ * @date 23 January 2023
+ * @brief Shared memory message queues for communicating with local processes
+ *
+ * @verbatim
+ ----------------------------------------------------------------------
+ Copyright (C) Alexander Hoffman, 2023
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ any later version.
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ----------------------------------------------------------------------
+ @endverbatim
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#include "gfx_print.h"
+
+#include "idle.h"
+#include "shm_queue.h"
+
+#define SHM_QUEUE_MAGIC 0x53484d51
+#define CACHE_LINE 64
+// How long the receiver waits for a put before checking again whether it
+// has been stopped
+#define RECEIVER_WAIT_NS 100000000L
+
+// Shared by all processes using the queue. The sequence of the slot at
+// position pos is pos while the slot is free and pos + 1 while it holds a
+// message, the same as the transmit rings.
+struct shm_queue_header {
+    uint32_t magic;
+    uint32_t slot_count;
+    uint32_t slot_size;
+    uint32_t slot_stride;
+    uint32_t dropped;
+    // Producers and the receiver each get their own cache line
+    uint32_t tail __attribute__((aligned(CACHE_LINE)));
+    uint32_t head __attribute__((aligned(CACHE_LINE)));
+    // Futex the receiver waits on, incremented for every message put
+    uint32_t doorbell;
+    uint32_t sleeping;
+};
+
+struct shm_slot {
+    uint32_t sequence;
+    uint32_t length;
+    char data[];
+};
+
+struct shm_queue {
+    char name[NAME_MAX];
+    struct shm_queue_header *header;
+    char *slots;
+    size_t size;
+    // Copies of the header's geometry, validated when mapping, such that
+    // another process rewriting the header cannot move slots out of the
+    // mapping
+    uint32_t slot_count;
+    uint32_t slot_size;
+    uint32_t slot_stride;
+    // Only set for the receiving side
+    int owner;
+    pthread_t thread;
+    volatile int running;
+    shm_queue_callback_t callback;
+    void *args;
+    shm_queue_stats_t stats;
+};
+
+static struct shm_slot *pxShmQueueSlot(struct shm_queue *queue, uint32_t pos)
+{
+    uint32_t index = pos & (queue->slot_count - 1);
+
+    return (struct shm_slot *)(queue->slots +
+                               (size_t)index * queue->slot_stride);
+}
+
+static long lShmQueueFutex(uint32_t *word, int op, uint32_t value,
+                           const struct timespec *timeout)
+{
+    // Not private, the other side of the futex may be another process
+    return syscall(SYS_futex, word, op, value, timeout, NULL, 0);
+}
+
+static int xShmQueueName(const char *name, char *path)
+{
+    // POSIX shared memory names start with a slash
+    if (snprintf(path, NAME_MAX, "%s%s", name[0] == '/' ? "" : "/", name) >=
+        NAME_MAX) {
+        fprints(stderr, "Shared memory name '%s' too long\n", name);
+        return -1;
+    }
+
+    return 0;
+}
+
+char *pcShmQueueReserve(shm_queue_handle_t queue)
+{
+    struct shm_queue_header *header = queue->header;
+    struct shm_slot *slot;
+    uint32_t pos;
+    int32_t diff;
+
+    pos = __atomic_load_n(&header->tail, __ATOMIC_RELAXED);
+    while (1) {
+        slot = pxShmQueueSlot(queue, pos);
+        diff = (int32_t)(__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) -
+                         pos);
+
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&header->tail, &pos, pos + 1, 1,
+                                            __ATOMIC_RELAXED,
+                                            __ATOMIC_RELAXED)) {
+                return slot->data;
+            }
+        }
+        else if (diff < 0) {
+            __atomic_fetch_add(&header->dropped, 1, __ATOMIC_RELAXED);
+            return NULL;
+        }
+        else {
+            pos = __atomic_load_n(&header->tail, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+void vShmQueueCommit(shm_queue_handle_t queue, char *data, size_t length)
+{
+    struct shm_queue_header *header = queue->header;
+    struct shm_slot *slot =
+        (struct shm_slot *)(data - offsetof(struct shm_slot, data));
+    // The slot was reserved at the position whose sequence it still holds
+    uint32_t pos = __atomic_load_n(&slot->sequence, __ATOMIC_RELAXED);
+
+    // The slot still has to be handed on, the receiver drops it
+    if (length > queue->slot_size) {
+        __atomic_fetch_add(&header->dropped, 1, __ATOMIC_RELAXED);
+        length = UINT32_MAX;
+    }
+
+    slot->length = length;
+    __atomic_store_n(&slot->sequence, pos + 1, __ATOMIC_RELEASE);
+
+    __atomic_fetch_add(&header->doorbell, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&header->sleeping, __ATOMIC_SEQ_CST)) {
+        lShmQueueFutex(&header->doorbell, FUTEX_WAKE, 1, NULL);
+    }
+}
+
+int xShmQueuePut(shm_queue_handle_t queue, const char *data, size_t length)
+{
+    char *slot;
+
+    if (length > queue->slot_size) {
+        __atomic_fetch_add(&queue->header->dropped, 1, __ATOMIC_RELAXED);
+        return -1;
+    }
+
+    slot = pcShmQueueReserve(queue);
+    if (!slot) {
+        return -1;
+    }
+
+    memcpy(slot, data, length);
+    vShmQueueCommit(queue, slot, length);
+
+    return 0;
+}
+
+static int xShmQueueReceive(struct shm_queue *queue)
+{
+    struct shm_queue_header *header = queue->header;
+    uint32_t head = header->head;
+    struct shm_slot *slot = pxShmQueueSlot(queue, head);
+    uint32_t length;
+
+    if (__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) != head + 1) {
+        return 0;
+    }
+
+    // The length is written by another process, never trust it
+    length = __atomic_load_n(&slot->length, __ATOMIC_RELAXED);
+    if (length > queue->slot_size) {
+        queue->stats.invalid++;
+    }
+    else {
+        queue->callback(length, slot->data, queue->args);
+        queue->stats.received++;
+    }
+
+    __atomic_store_n(&slot->sequence, head + queue->slot_count,
+                     __ATOMIC_RELEASE);
+    __atomic_store_n(&header->head, head + 1, __ATOMIC_RELEASE);
+
+    return 1;
+}
+
+static void *vShmQueueThread(void *args)
+{
+    struct shm_queue *queue = args;
+    struct shm_queue_header *header = queue->header;
+    struct timespec timeout = { .tv_nsec = RECEIVER_WAIT_NS };
+    uint32_t doorbell;
+
+    while (queue->running) {
+        if (xShmQueueReceive(queue)) {
+            continue;
+        }
+
+        doorbell = __atomic_load_n(&header->doorbell, __ATOMIC_SEQ_CST);
+        __atomic_store_n(&header->sleeping, 1, __ATOMIC_SEQ_CST);
+
+        // A message put before sleeping was set does not ring the doorbell
+        if (!xShmQueueReceive(queue)) {
+            // Woken, or the doorbell rang before the wait started
+            if (!lShmQueueFutex(&header->doorbell, FUTEX_WAIT, doorbell,
+                                &timeout) || errno == EAGAIN) {
+                queue->stats.wakeups++;
+
+                // Messages arriving are our equivalent of an interrupt
+                vIdleWake();
+            }
+        }
+
+        __atomic_store_n(&header->sleeping, 0, __ATOMIC_SEQ_CST);
+    }
+
+    return NULL;
+}
+
+static struct shm_queue *pxShmQueueMap(const char *name, int flags,
+                                       size_t size)
+{
+    struct shm_queue *queue = calloc(1, sizeof(struct shm_queue));
+    struct stat st;
+    int fd;
+
+    if (!queue) {
+        fprints(stderr, "Failed to allocate shared memory queue\n");
+        goto err_queue;
+    }
+
+    if (xShmQueueName(name, queue->name)) {
+        goto err_name;
+    }
+
+    fd = shm_open(queue->name, flags | O_RDWR | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        fprints(stderr, "Failed to open shared memory '%s': %s\n",
+                queue->name, strerror(errno));
+        goto err_name;
+    }
+
+    if (flags & O_CREAT) {
+        if (ftruncate(fd, size)) {
+            goto err_size;
+        }
+    }
+    else {
+        if (fstat(fd, &st) || (size_t)st.st_size <
+            sizeof(struct shm_queue_header)) {
+            goto err_size;
+        }
+        size = st.st_size;
+    }
+
+    queue->header = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+                         0);
+    if (queue->header == MAP_FAILED) {
+        goto err_size;
+    }
+    close(fd);
+
+    queue->size = size;
+    queue->slots = (char *)queue->header +
+                   sizeof(struct shm_queue_header);
+
+    return queue;
+
+err_size:
+    fprints(stderr, "Failed to map shared memory '%s'\n", queue->name);
+    close(fd);
+    if (flags & O_CREAT) {
+        shm_unlink(queue->name);
+    }
+err_name:
+    free(queue);
+err_queue:
+    return NULL;
+}
+
+shm_queue_handle_t xShmQueueOpen(const char *name, unsigned int slot_count,
+                                 size_t slot_size,
+                                 shm_queue_callback_t callback, void *args)
+{
+    // Slots are kept aligned so that their sequences can be used atomically
+    size_t stride = (offsetof(struct shm_slot, data) + slot_size + 7) & ~7UL;
+    struct shm_queue *queue;
+    sigset_t all, old;
+    int ret;
+
+    if (!slot_count || slot_count & (slot_count - 1)) {
+        fprints(stderr, "Shared memory queue length must be a power of two\n");
+        return NULL;
+    }
+
+    queue = pxShmQueueMap(name, O_CREAT,
+                          sizeof(struct shm_queue_header) +
+                          slot_count * stride);
+    if (!queue) {
+        return NULL;
+    }
+
+    queue->owner = 1;
+    queue->callback = callback;
+    queue->args = args;
+
+    // Any previous contents are discarded, the header is only marked valid
+    // once the slots are ready
+    memset(queue->header, 0, sizeof(struct shm_queue_header));
+    queue->header->slot_count = slot_count;
+    queue->header->slot_size = slot_size;
+    queue->header->slot_stride = stride;
+    queue->slot_count = slot_count;
+    queue->slot_size = slot_size;
+    queue->slot_stride = stride;
+    for (unsigned int i = 0; i < slot_count; i++) {
+        pxShmQueueSlot(queue, i)->sequence = i;
+    }
+    __atomic_store_n(&queue->header->magic, SHM_QUEUE_MAGIC,
+                     __ATOMIC_RELEASE);
+
+    // The receiving thread must not handle the signals that drive the
+    // FreeRTOS scheduler
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &old);
+    queue->running = 1;
+    ret = pthread_create(&queue->thread, NULL, vShmQueueThread, queue);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (ret) {
+        fprints(stderr, "Failed to start shared memory receiver: %s\n",
+                strerror(ret));
+        queue->running = 0;
+        vShmQueueClose(queue);
+        return NULL;
+    }
+
+    return queue;
+}
+
+shm_queue_handle_t xShmQueueAttach(const char *name)
+{
+    struct shm_queue *queue = pxShmQueueMap(name, 0, 0);
+    struct shm_queue_header *header;
+
+    if (!queue) {
+        return NULL;
+    }
+
+    header = queue->header;
+    queue->slot_count = header->slot_count;
+    queue->slot_size = header->slot_size;
+    queue->slot_stride = header->slot_stride;
+    if (__atomic_load_n(&header->magic, __ATOMIC_ACQUIRE) !=
+        SHM_QUEUE_MAGIC || !queue->slot_count ||
+        queue->slot_count & (queue->slot_count - 1) ||
+        queue->slot_stride % 8 ||
+        queue->slot_stride < offsetof(struct shm_slot, data) ||
+        queue->slot_size > queue->slot_stride -
+        offsetof(struct shm_slot, data) ||
+        sizeof(struct shm_queue_header) +
+        (size_t)queue->slot_count * queue->slot_stride > queue->size) {
+        fprints(stderr, "Shared memory '%s' is not a queue\n", queue->name);
+        vShmQueueClose(queue);
+        return NULL;
+    }
+
+    return queue;
+}
+
+void vShmQueueClose(shm_queue_handle_t queue)
+{
+    if (queue->running) {
+        queue->running = 0;
+        __atomic_fetch_add(&queue->header->doorbell, 1, __ATOMIC_SEQ_CST);
+        lShmQueueFutex(&queue->header->doorbell, FUTEX_WAKE, 1, NULL);
+        pthread_join(queue->thread, NULL);
+    }
+
+    munmap(queue->header, queue->size);
+    if (queue->owner) {
+        shm_unlink(queue->name);
+    }
+    free(queue);
+}
+
+void vShmQueueGetStats(shm_queue_handle_t queue, shm_queue_stats_t *stats)
+{
+    *stats = queue->stats;
+    stats->dropped = __atomic_load_n(&queue->header->dropped,
+                                     __ATOMIC_RELAXED);
+}
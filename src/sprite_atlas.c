@@ -0,0 +1,471 @@
+/**
+ * @file sprite_atlas.c
+ * @author Alex Hoffman
+ * @date 23 January 2023
+ * @brief Packs spritesheets into shared textures and draws their sprites
+ * in batches
+ *
+ * @verbatim
+ ----------------------------------------------------------------------
+ Copyright (C) Alexander Hoffman, 2023
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ any later version.
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ----------------------------------------------------------------------
+ @endverbatim
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <SDL2/SDL.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include "gfx_print.h"
+
+#include "assets.h"
+#include "renderer.h"
+#include "sprite_atlas.h"
+
+#define SHEET_NAME_LENGTH 128
+
+typedef struct atlas_sheet {
+    char filename[SHEET_NAME_LENGTH];
+    unsigned int columns;
+    unsigned int rows;
+    unsigned int width;
+    unsigned int height;
+    unsigned int x;
+    unsigned int y;
+    unsigned int spacing_x;
+    unsigned int spacing_y;
+    asset_handle_t asset; ///< Pixels of the image, until the atlas is built
+    // Where the sheet's sprites were packed to
+    unsigned int page;
+    unsigned int atlas_x;
+    unsigned int atlas_y;
+} atlas_sheet_t;
+
+typedef struct atlas_page {
+    unsigned int width;
+    unsigned int height;
+    renderer_texture_handle_t texture;
+} atlas_page_t;
+
+struct sprite_atlas {
+    unsigned char built;
+    unsigned int sheet_count;
+    unsigned int page_count;
+    atlas_sheet_t sheets[configSPRITE_ATLAS_MAX_SHEETS];
+    atlas_page_t pages[configSPRITE_ATLAS_MAX_PAGES];
+};
+
+sprite_atlas_handle_t xSpriteAtlasCreate(void)
+{
+    sprite_atlas_handle_t atlas = pvPortMalloc(sizeof(struct sprite_atlas));
+
+    if (!atlas) {
+        PRINT_ERROR("Failed to allocate sprite atlas");
+        return NULL;
+    }
+
+    memset(atlas, 0, sizeof(struct sprite_atlas));
+
+    return atlas;
+}
+
+static void vSpriteAtlasReleaseImages(sprite_atlas_handle_t atlas)
+{
+    for (unsigned int i = 0; i < atlas->sheet_count; i++) {
+        vAssetRelease(atlas->sheets[i].asset);
+        atlas->sheets[i].asset = NULL;
+    }
+}
+
+void vSpriteAtlasDelete(sprite_atlas_handle_t atlas)
+{
+    vSpriteAtlasReleaseImages(atlas);
+
+    for (unsigned int i = 0; i < atlas->page_count; i++) {
+        vRendererTextureDelete(atlas->pages[i].texture);
+    }
+
+    vPortFree(atlas);
+}
+
+int xSpriteAtlasAddSheet(sprite_atlas_handle_t atlas, const char *filename,
+                         unsigned int columns, unsigned int rows,
+                         unsigned int width, unsigned int height,
+                         unsigned int x, unsigned int y,
+                         unsigned int spacing_x, unsigned int spacing_y)
+{
+    atlas_sheet_t *sheet;
+
+    if (atlas->built || atlas->sheet_count == configSPRITE_ATLAS_MAX_SHEETS ||
+        !columns || !rows || strlen(filename) >= SHEET_NAME_LENGTH) {
+        PRINT_ERROR("Cannot add '%s' to sprite atlas", filename);
+        return -1;
+    }
+
+    sheet = &atlas->sheets[atlas->sheet_count];
+    memset(sheet, 0, sizeof(atlas_sheet_t));
+    strcpy(sheet->filename, filename);
+    sheet->columns = columns;
+    sheet->rows = rows;
+    sheet->width = width;
+    sheet->height = height;
+    sheet->x = x;
+    sheet->y = y;
+    sheet->spacing_x = spacing_x;
+    sheet->spacing_y = spacing_y;
+
+    // Decoding starts now, sheets cut from the same file share its pixels
+    if (!(sheet->asset = xAssetRequest(filename, ASSET_PIXELS))) {
+        PRINT_ERROR("Cannot request '%s' for sprite atlas", filename);
+        return -1;
+    }
+
+    return atlas->sheet_count++;
+}
+
+// Waits for every sheet's image to be decoded
+static int xSpriteAtlasLoadImages(sprite_atlas_handle_t atlas,
+                                  SDL_Surface **images)
+{
+    atlas_sheet_t *sheet;
+
+    for (unsigned int i = 0; i < atlas->sheet_count; i++) {
+        sheet = &atlas->sheets[i];
+
+        if (xAssetWait(sheet->asset, portMAX_DELAY) ||
+            !(images[i] = xAssetGetPixels(sheet->asset))) {
+            PRINT_ERROR("Failed to load '%s'", sheet->filename);
+            return -1;
+        }
+
+        if (!sheet->width) {
+            sheet->width = images[i]->w / sheet->columns;
+        }
+        if (!sheet->height) {
+            sheet->height = images[i]->h / sheet->rows;
+        }
+
+        if (!sheet->width || !sheet->height ||
+            sheet->x + sheet->columns * (sheet->width + sheet->spacing_x) -
+            sheet->spacing_x > (unsigned int)images[i]->w ||
+            sheet->y + sheet->rows * (sheet->height + sheet->spacing_y) -
+            sheet->spacing_y > (unsigned int)images[i]->h) {
+            PRINT_ERROR("Sprites do not fit into '%s'", sheet->filename);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+// Places the sheets, tallest first, on shelves filling each page from the
+// top, a sheet's sprites are packed without spacing
+static int xSpriteAtlasPack(sprite_atlas_handle_t atlas)
+{
+    unsigned int order[configSPRITE_ATLAS_MAX_SHEETS];
+    unsigned int x = 0, y = 0, shelf_height = 0, w, h;
+    atlas_sheet_t *sheet;
+    atlas_page_t *page;
+
+    for (unsigned int i = 0; i < atlas->sheet_count; i++) {
+        unsigned int j = i;
+
+        for (; j && atlas->sheets[order[j - 1]].height *
+             atlas->sheets[order[j - 1]].rows <
+             atlas->sheets[i].height * atlas->sheets[i].rows; j--) {
+            order[j] = order[j - 1];
+        }
+        order[j] = i;
+    }
+
+    atlas->page_count = 1;
+    page = &atlas->pages[0];
+
+    for (unsigned int i = 0; i < atlas->sheet_count; i++) {
+        sheet = &atlas->sheets[order[i]];
+        w = sheet->columns * sheet->width;
+        h = sheet->rows * sheet->height;
+
+        if (w > configSPRITE_ATLAS_SIZE || h > configSPRITE_ATLAS_SIZE) {
+            PRINT_ERROR("Sprites of '%s' do not fit into an atlas page",
+                        sheet->filename);
+            return -1;
+        }
+
+        if (x + w > configSPRITE_ATLAS_SIZE) {
+            x = 0;
+            y += shelf_height;
+            shelf_height = 0;
+        }
+
+        if (y + h > configSPRITE_ATLAS_SIZE) {
+            if (atlas->page_count == configSPRITE_ATLAS_MAX_PAGES) {
+                PRINT_ERROR("Sprite atlas needs more than %d pages",
+                            configSPRITE_ATLAS_MAX_PAGES);
+                return -1;
+            }
+            page = &atlas->pages[atlas->page_count++];
+            x = y = shelf_height = 0;
+        }
+
+        sheet->page = page - atlas->pages;
+        sheet->atlas_x = x;
+        sheet->atlas_y = y;
+
+        x += w;
+        if (h > shelf_height) {
+            shelf_height = h;
+        }
+        if (x > page->width) {
+            page->width = x;
+        }
+        if (y + h > page->height) {
+            page->height = y + h;
+        }
+    }
+
+    return 0;
+}
+
+static int xSpriteAtlasCopySprites(sprite_atlas_handle_t atlas,
+                                   SDL_Surface **images,
+                                   SDL_Surface **pages)
+{
+    atlas_sheet_t *sheet;
+
+    for (unsigned int i = 0; i < atlas->page_count; i++) {
+        pages[i] = SDL_CreateRGBSurfaceWithFormat(0, atlas->pages[i].width,
+                   atlas->pages[i].height, 32,
+                   SDL_PIXELFORMAT_RGBA32);
+        if (!pages[i]) {
+            PRINT_ERROR("Failed to create atlas page: %s", SDL_GetError());
+            return -1;
+        }
+    }
+
+    for (unsigned int i = 0; i < atlas->sheet_count; i++) {
+        sheet = &atlas->sheets[i];
+
+        // Copy the sprites' alpha into the transparent page
+        SDL_SetSurfaceBlendMode(images[i], SDL_BLENDMODE_NONE);
+
+        for (unsigned int row = 0; row < sheet->rows; row++)
+            for (unsigned int column = 0; column < sheet->columns;
+                 column++) {
+                SDL_Rect src = {
+                    sheet->x + column * (sheet->width + sheet->spacing_x),
+                    sheet->y + row * (sheet->height + sheet->spacing_y),
+                    sheet->width, sheet->height
+                };
+                SDL_Rect dst = {
+                    sheet->atlas_x + column * sheet->width,
+                    sheet->atlas_y + row * sheet->height,
+                    sheet->width, sheet->height
+                };
+
+                SDL_BlitSurface(images[i], &src, pages[sheet->page], &dst);
+            }
+    }
+
+    return 0;
+}
+
+// The pages become textures, uploaded by the task presenting the frames
+// when they are first drawn
+static int xSpriteAtlasCreateTextures(sprite_atlas_handle_t atlas,
+                                      SDL_Surface **pages)
+{
+    for (unsigned int i = 0; i < atlas->page_count; i++) {
+        // Owned by the texture, even if it could not be created
+        atlas->pages[i].texture = xRendererTextureCreate(pages[i]);
+        pages[i] = NULL;
+
+        if (!atlas->pages[i].texture) {
+            PRINT_ERROR("Failed to create sprite atlas page");
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+int xSpriteAtlasBuild(sprite_atlas_handle_t atlas)
+{
+    SDL_Surface *images[configSPRITE_ATLAS_MAX_SHEETS] = { 0 };
+    SDL_Surface *pages[configSPRITE_ATLAS_MAX_PAGES] = { 0 };
+    int ret = -1;
+
+    if (atlas->built || !atlas->sheet_count) {
+        return -1;
+    }
+
+    if (xSpriteAtlasLoadImages(atlas, images) ||
+        xSpriteAtlasPack(atlas) ||
+        xSpriteAtlasCopySprites(atlas, images, pages) ||
+        xSpriteAtlasCreateTextures(atlas, pages)) {
+        goto out;
+    }
+
+    atlas->built = 1;
+    ret = 0;
+
+out:
+    for (unsigned int i = 0; i < atlas->page_count; i++)
+        if (pages[i]) {
+            SDL_FreeSurface(pages[i]);
+        }
+
+    // The pixels are no longer needed once copied into the pages
+    vSpriteAtlasReleaseImages(atlas);
+
+    return ret;
+}
+
+int xSpriteAtlasLoaded(sprite_atlas_handle_t atlas)
+{
+    asset_state_e state;
+
+    for (unsigned int i = 0; i < atlas->sheet_count; i++) {
+        state = xAssetGetState(atlas->sheets[i].asset);
+        if (state == ASSET_QUEUED || state == ASSET_LOADING) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+int xSpriteAtlasGetSpriteSize(sprite_atlas_handle_t atlas, int sheet,
+                              unsigned int *width, unsigned int *height)
+{
+    if (!atlas->built || sheet < 0 || sheet >= (int)atlas->sheet_count) {
+        return -1;
+    }
+
+    if (width) {
+        *width = atlas->sheets[sheet].width;
+    }
+    if (height) {
+        *height = atlas->sheets[sheet].height;
+    }
+
+    return 0;
+}
+
+void vSpriteSequenceInit(sprite_sequence_t *sequence, int sheet,
+                         unsigned char column, unsigned char row,
+                         int direction, unsigned int frames,
+                         unsigned int period)
+{
+    sequence->sheet = sheet;
+    sequence->column = column;
+    sequence->row = row;
+    sequence->direction = direction;
+    sequence->frames = frames ? frames : 1;
+    sequence->period = period ? period : 1;
+    sequence->elapsed = 0;
+}
+
+void vSpriteSequenceStep(sprite_sequence_t *sequence, unsigned int ms)
+{
+    // Wrapped at a whole loop of the sequence so that it never overflows
+    sequence->elapsed = (sequence->elapsed + ms) %
+                        ((unsigned long)sequence->frames * sequence->period);
+}
+
+void vSpriteSequenceReset(sprite_sequence_t *sequence)
+{
+    sequence->elapsed = 0;
+}
+
+void vSpriteBatchBegin(sprite_batch_t *batch, sprite_atlas_handle_t atlas)
+{
+    batch->atlas = atlas;
+    batch->count = 0;
+}
+
+int xSpriteBatchAdd(sprite_batch_t *batch, int sheet, unsigned char column,
+                    unsigned char row, signed short x, signed short y)
+{
+    sprite_atlas_handle_t atlas = batch->atlas;
+    draw_sprite_t *sprite;
+
+    if (batch->count == configSPRITE_BATCH_LENGTH || !atlas ||
+        !atlas->built || sheet < 0 || sheet >= (int)atlas->sheet_count) {
+        return -1;
+    }
+
+    batch->pages[batch->count] = atlas->sheets[sheet].page;
+    sprite = &batch->sprites[batch->count++];
+    sprite->x = x;
+    sprite->y = y;
+    // Pages are packed without spacing between a sheet's sprites
+    sprite->width = atlas->sheets[sheet].width;
+    sprite->height = atlas->sheets[sheet].height;
+    sprite->source_x = atlas->sheets[sheet].atlas_x + column * sprite->width;
+    sprite->source_y = atlas->sheets[sheet].atlas_y + row * sprite->height;
+
+    return 0;
+}
+
+int xSpriteBatchAddSequence(sprite_batch_t *batch,
+                            const sprite_sequence_t *sequence,
+                            signed short x, signed short y)
+{
+    unsigned int frame = sequence->elapsed / sequence->period;
+    unsigned char column = sequence->column, row = sequence->row;
+
+    switch (sequence->direction) {
+        case SPRITE_SEQUENCE_HORIZONTAL_POS:
+            column += frame;
+            break;
+        case SPRITE_SEQUENCE_HORIZONTAL_NEG:
+            column -= frame;
+            break;
+        case SPRITE_SEQUENCE_VERTICAL_POS:
+            row += frame;
+            break;
+        case SPRITE_SEQUENCE_VERTICAL_NEG:
+            row -= frame;
+            break;
+        default:
+            break;
+    }
+
+    return xSpriteBatchAdd(batch, sequence->sheet, column, row, x, y);
+}
+
+int xSpriteBatchSubmit(sprite_batch_t *batch)
+{
+    unsigned int start = 0, end;
+    int ret = 0;
+
+    // Consecutive sprites on the same page become one command, the order
+    // of the sprites is kept where they overlap
+    while (start < batch->count) {
+        for (end = start + 1; end < batch->count &&
+             batch->pages[end] == batch->pages[start]; end++)
+            ;
+
+        ret |= xDrawCommandSprites(
+                   batch->atlas->pages[batch->pages[start]].texture,
+                   &batch->sprites[start], end - start);
+        start = end;
+    }
+
+    return ret;
+}
@@ -2,22 +2,46 @@
 #include "semphr.h"
 #include "queue.h"
 
+#include "gfx_print.h"
+
 #include "buttons.h"
 #include "main.h"
 #include "demo_tasks.h"
+#include "journal.h"
 #include "state_machine.h"
 #include "states.h"
 
+typedef struct state_event {
+    state_event_type_e type;
+    uint64_t timestamp;
+} state_event_t;
+
+static QueueHandle_t StateEventQueue = NULL;
+static state_machine_stats_t state_stats = { 0 };
+
 int vCheckStateInput(void)
 {
-    if (xSemaphoreTake(buttons.lock, 0) == pdTRUE) {
-        if (buttons.buttons[KEYCODE(C)]) {
-            buttons.buttons[KEYCODE(C)] = 0;
-            xSemaphoreGive(buttons.lock);
-            xStatesIncrementState();
-            return 0;
+    static buttons_reader_t reader = { 0 };
+    button_edge_t edge;
+
+    // Every press of C counts, even if it was released again before the
+    // drawing task polled the buttons
+    while (xButtonsNextEdge(&reader, &edge))
+        if (edge.pressed && edge.scancode == KEYCODE(C)) {
+            xStateMachinePostEvent(STATE_EVENT_NEXT, edge.timestamp);
         }
-        xSemaphoreGive(buttons.lock);
+
+    return 0;
+}
+
+int xStateMachinePostEvent(state_event_type_e type, uint64_t timestamp)
+{
+    state_event_t event = { .type = type, .timestamp = timestamp };
+
+    if (!StateEventQueue ||
+        xQueueSend(StateEventQueue, &event, 0) != pdTRUE) {
+        state_stats.dropped++;
+        return -1;
     }
 
     return 0;
@@ -25,14 +49,56 @@ int vCheckStateInput(void)
 
 void vStateMachineTask(void *pvParameters)
 {
+    uint64_t last_transition = 0, latency;
+    state_event_t event;
+
+    // Enter the starting state
+    uStatesRun();
+
     while (1) {
+        if (xQueueReceive(StateEventQueue, &event, portMAX_DELAY) !=
+            pdTRUE) {
+            continue;
+        }
+
+        if (last_transition && event.timestamp - last_transition <
+            (uint64_t)STATE_DEBOUNCE_DELAY * 1000000) {
+            state_stats.debounced++;
+            continue;
+        }
+
+        switch (event.type) {
+            case STATE_EVENT_NEXT:
+                xStatesIncrementState();
+                break;
+            case STATE_EVENT_PREVIOUS:
+                xStatesDecrementState();
+                break;
+            default:
+                continue;
+        }
+
+        // Runs the exit and enter functions of the transition
         uStatesRun();
-        vTaskDelay(pdMS_TO_TICKS(STATE_MACHINE_PERIOD));
+
+        last_transition = event.timestamp;
+        latency = ullJournalNow() - event.timestamp;
+        state_stats.transitions++;
+        state_stats.total_latency += latency;
+        if (latency > state_stats.max_latency) {
+            state_stats.max_latency = latency;
+        }
     }
 }
 
 int xStateMachineInit(void)
 {
+    StateEventQueue = xQueueCreate(STATE_QUEUE_LENGTH, sizeof(state_event_t));
+    if (!StateEventQueue) {
+        PRINT_ERROR("Failed to create state event queue");
+        return -1;
+    }
+
     if (uStatesInit()) {
         return -1;
     }
@@ -49,3 +115,8 @@ int xStateMachineInit(void)
 
     return 0;
 }
+
+void vStateMachineGetStats(state_machine_stats_t *stats)
+{
+    *stats = state_stats;
+}
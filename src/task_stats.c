@@ -0,0 +1,350 @@
+/**
+ * @file task_stats.c
+ * @author Alex Hoffman
+ * @date 23 January 2023
+ * @brief Periodic sampling of each task's CPU share
+ *
+ * @verbatim
+ ----------------------------------------------------------------------
+ Copyright (C) Alexander Hoffman, 2023
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ any later version.
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ----------------------------------------------------------------------
+ @endverbatim
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+#include "semphr.h"
+
+#include "gfx_print.h"
+
+#include "EmulatorConfig.h"
+#include "frame_timing.h"
+#include "reactor.h"
+#include "task_stats.h"
+#include "tx_ring.h"
+
+#ifdef HEAP_POOL_TLSF
+#include "heap_stats.h"
+#endif
+
+// Counted by traceTASK_SWITCHED_IN, see FreeRTOSConfig.h
+unsigned long ulTaskStatsContextSwitches = 0;
+
+static struct {
+    TaskHandle_t task;
+    SemaphoreHandle_t lock;
+    int overlay;
+    tx_ring_handle_t udp;
+
+    // Sized for all tasks, grown when tasks are created
+    UBaseType_t capacity;
+    TaskStatus_t *status;
+    task_stats_entry_t *entries;
+
+    // Run time of each task at the previous sample, by task number
+    struct task_run_time {
+        UBaseType_t number;
+        configRUN_TIME_COUNTER_TYPE run_time;
+    } *previous;
+    unsigned int previous_count;
+    configRUN_TIME_COUNTER_TYPE previous_total;
+    unsigned long previous_switches;
+
+    task_stats_sample_t sample;
+    int valid;
+} stats;
+
+static configRUN_TIME_COUNTER_TYPE xTaskStatsPreviousRunTime(UBaseType_t
+        number)
+{
+    for (unsigned int i = 0; i < stats.previous_count; i++) {
+        if (stats.previous[i].number == number) {
+            return stats.previous[i].run_time;
+        }
+    }
+
+    // Created since the previous sample
+    return 0;
+}
+
+static int xTaskStatsCompare(const void *a, const void *b)
+{
+    const task_stats_entry_t *x = a, *y = b;
+
+    return (x->cpu < y->cpu) - (x->cpu > y->cpu);
+}
+
+static void vTaskStatsSend(task_stats_sample_t *sample)
+{
+    char line[configTX_RING_MESSAGE_SIZE];
+    reactor_stats_t reactor;
+    int length;
+
+    length = snprintf(line, sizeof(line),
+                      "time=%llu switches=%.0f ready=%u tasks=%u "
+                      "shown=%u "
+                      "heap_peak=%zu heap_total=%zu heap_fragmentation=%.2f\n",
+                      (unsigned long long)sample->timestamp,
+                      sample->switches, sample->ready, sample->total_tasks,
+                      sample->count, sample->heap_peak, sample->heap_total,
+                      sample->heap_fragmentation);
+    xTxRingPut(stats.udp, line, length);
+
+    for (unsigned int i = 0; i < sample->count; i++) {
+        length = snprintf(line, sizeof(line),
+                          "task=%s cpu=%.1f priority=%lu\n",
+                          sample->tasks[i].name, sample->tasks[i].cpu,
+                          (unsigned long)sample->tasks[i].priority);
+        xTxRingPut(stats.udp, line, length);
+    }
+
+    vReactorGetStats(&reactor);
+    length = snprintf(line, sizeof(line),
+                      "reactor wakeups=%lu events=%lu handles=%u queued=%u "
+                      "max_queued=%u\n",
+                      reactor.wakeups, reactor.events, reactor.handles,
+                      reactor.queued, reactor.max_queued);
+    xTxRingPut(stats.udp, line, length);
+}
+
+// Makes room for the status of count tasks
+static int xTaskStatsReserve(UBaseType_t count)
+{
+    struct task_run_time *previous;
+    task_stats_entry_t *entries;
+    TaskStatus_t *status;
+
+    if (count <= stats.capacity) {
+        return 0;
+    }
+
+    // Some room for tasks created before the next sample
+    count += 4;
+    status = pvPortMalloc(count * sizeof(TaskStatus_t));
+    entries = pvPortMalloc(count * sizeof(task_stats_entry_t));
+    previous = pvPortMalloc(count * sizeof(struct task_run_time));
+    if (!status || !entries || !previous) {
+        vPortFree(status);
+        vPortFree(entries);
+        vPortFree(previous);
+        return -1;
+    }
+
+    if (stats.previous_count) {
+        memcpy(previous, stats.previous,
+               stats.previous_count * sizeof(struct task_run_time));
+    }
+
+    vPortFree(stats.status);
+    vPortFree(stats.entries);
+    vPortFree(stats.previous);
+    stats.status = status;
+    stats.entries = entries;
+    stats.previous = previous;
+    stats.capacity = count;
+
+    return 0;
+}
+
+// Reads the status of all tasks, growing the arrays if tasks were created
+static UBaseType_t uxTaskStatsGetSystemState(configRUN_TIME_COUNTER_TYPE
+        *total)
+{
+    UBaseType_t count = 0;
+
+    // uxTaskGetSystemState returns 0 if there are more tasks than room
+    for (int attempt = 0; !count && attempt < 2; attempt++) {
+        if (xTaskStatsReserve(uxTaskGetNumberOfTasks())) {
+            fprints(stderr, "Failed to allocate task statistics\n");
+            return 0;
+        }
+
+        count = uxTaskGetSystemState(stats.status, stats.capacity, total);
+    }
+
+    return count;
+}
+
+static void vTaskStatsRemember(UBaseType_t count,
+                               configRUN_TIME_COUNTER_TYPE total,
+                               unsigned long switches)
+{
+    for (UBaseType_t i = 0; i < count; i++) {
+        stats.previous[i].number = stats.status[i].xTaskNumber;
+        stats.previous[i].run_time = stats.status[i].ulRunTimeCounter;
+    }
+    stats.previous_count = count;
+    stats.previous_total = total;
+    stats.previous_switches = switches;
+}
+
+// The first sample is only a baseline, the run time before it is not part
+// of any period
+static void vTaskStatsBaseline(void)
+{
+    configRUN_TIME_COUNTER_TYPE total;
+    UBaseType_t count;
+
+    count = uxTaskStatsGetSystemState(&total);
+    vTaskStatsRemember(count, total, ulTaskStatsContextSwitches);
+}
+
+static void vTaskStatsSample(void)
+{
+    task_stats_sample_t *sample = &stats.sample;
+    configRUN_TIME_COUNTER_TYPE total, elapsed;
+    unsigned long switches = ulTaskStatsContextSwitches;
+    UBaseType_t count;
+#ifdef HEAP_POOL_TLSF
+    heap_stats_t heap;
+#endif
+
+    count = uxTaskStatsGetSystemState(&total);
+    elapsed = total - stats.previous_total;
+    if (!count || !elapsed) {
+        return;
+    }
+
+    for (UBaseType_t i = 0; i < count; i++) {
+        TaskStatus_t *status = &stats.status[i];
+        task_stats_entry_t *entry = &stats.entries[i];
+
+        strncpy(entry->name, status->pcTaskName, configMAX_TASK_NAME_LEN);
+        entry->name[configMAX_TASK_NAME_LEN - 1] = '\0';
+        entry->state = status->eCurrentState;
+        entry->priority = status->uxCurrentPriority;
+        entry->cpu = 100.0f * (status->ulRunTimeCounter -
+                               xTaskStatsPreviousRunTime(
+                                   status->xTaskNumber)) / elapsed;
+    }
+
+    // All tasks are sorted, the busiest are kept in the sample
+    qsort(stats.entries, count, sizeof(task_stats_entry_t),
+          xTaskStatsCompare);
+
+    xSemaphoreTake(stats.lock, portMAX_DELAY);
+
+    sample->timestamp = ullFrameTimingNow();
+    sample->switches = (switches - stats.previous_switches) * 1e9f / elapsed;
+    sample->ready = 0;
+    sample->total_tasks = count;
+    sample->count = count < configTASK_STATS_MAX_TASKS ? count :
+                    configTASK_STATS_MAX_TASKS;
+    memcpy(sample->tasks, stats.entries,
+           sample->count * sizeof(task_stats_entry_t));
+
+    for (UBaseType_t i = 0; i < count; i++) {
+        if (stats.status[i].eCurrentState == eReady) {
+            sample->ready++;
+        }
+    }
+
+#ifdef HEAP_POOL_TLSF
+    vHeapGetStats(&heap);
+    sample->heap_total = heap.total;
+    sample->heap_peak = heap.peak_used;
+    sample->heap_fragmentation = heap.fragmentation;
+#endif
+    stats.valid = 1;
+
+    xSemaphoreGive(stats.lock);
+
+    vTaskStatsRemember(count, total, switches);
+
+    if (stats.udp) {
+        vTaskStatsSend(sample);
+    }
+}
+
+static void vTaskStatsTask(void *pvParameters)
+{
+    TickType_t last_wake = xTaskGetTickCount();
+
+    vTaskStatsBaseline();
+
+    while (1) {
+        vTaskDelayUntil(&last_wake, pdMS_TO_TICKS(configTASK_STATS_PERIOD_MS));
+        vTaskStatsSample();
+    }
+}
+
+int xTaskStatsInit(int overlay, in_port_t udp_port)
+{
+    if (!overlay && !udp_port) {
+        return 0;
+    }
+
+    stats.lock = xSemaphoreCreateMutex();
+    if (!stats.lock) {
+        PRINT_ERROR("Failed to create task stats lock");
+        goto err_lock;
+    }
+
+    if (udp_port) {
+        stats.udp = xTxRingOpenUDP(NULL, udp_port);
+        if (!stats.udp) {
+            PRINT_ERROR("Failed to open task stats UDP stream");
+            goto err_udp;
+        }
+    }
+
+    // Runs above the other tasks so that it is not starved by the task it
+    // is meant to find
+    if (xTaskCreate(vTaskStatsTask, "TaskStats", 512, NULL,
+                    configMAX_PRIORITIES - 1, &stats.task) != pdPASS) {
+        PRINT_TASK_ERROR("TaskStats");
+        goto err_task;
+    }
+
+    stats.overlay = overlay;
+
+    return 0;
+
+err_task:
+    if (stats.udp) {
+        vTxRingClose(stats.udp);
+        stats.udp = NULL;
+    }
+err_udp:
+    vSemaphoreDelete(stats.lock);
+    stats.lock = NULL;
+err_lock:
+    return -1;
+}
+
+int xTaskStatsOverlayEnabled(void)
+{
+    return stats.overlay;
+}
+
+int xTaskStatsGetSample(task_stats_sample_t *sample)
+{
+    int ret = -1;
+
+    if (!stats.lock) {
+        return -1;
+    }
+
+    xSemaphoreTake(stats.lock, portMAX_DELAY);
+    if (stats.valid) {
+        memcpy(sample, &stats.sample, sizeof(task_stats_sample_t));
+        ret = 0;
+    }
+    xSemaphoreGive(stats.lock);
+
+    return ret;
+}
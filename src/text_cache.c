@@ -0,0 +1,437 @@
+/**
+ * @file text_cache.c
+ * @author Alex Hoffman
+ * @date 23 January 2023
+ * @brief Glyph atlases and a string layout cache for drawing HUD text
+ *
+ * @verbatim
+ ----------------------------------------------------------------------
+ Copyright (C) Alexander Hoffman, 2023
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ any later version.
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ----------------------------------------------------------------------
+ @endverbatim
+ */
+
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <SDL2/SDL.h>
+#include <SDL2/SDL_ttf.h>
+
+#include "FreeRTOS.h"
+#include "semphr.h"
+
+#include "gfx_draw.h"
+#include "gfx_font.h"
+#include "gfx_print.h"
+#include "gfx_utils.h"
+
+#include "assets.h"
+#include "renderer.h"
+#include "text_cache.h"
+
+#define FIRST_GLYPH ' '
+#define LAST_GLYPH '~'
+#define GLYPH_COUNT (LAST_GLYPH - FIRST_GLYPH + 1)
+#define ATLAS_COLUMNS 16
+#define ATLAS_ROWS ((GLYPH_COUNT + ATLAS_COLUMNS - 1) / ATLAS_COLUMNS)
+
+#define MAX_FONT_FACES 8
+#define STRING_CACHE_SIZE 64
+#define MAX_CACHED_STRING 128
+#define FONT_NAME_LENGTH 64
+
+typedef struct font_face {
+    char name[FONT_NAME_LENGTH];
+    ssize_t size;
+    unsigned char failed;
+    int height;
+    int cell_width;
+    int advances[GLYPH_COUNT];
+    // White glyphs in a grid of ATLAS_COLUMNS cells per row, strings are
+    // composed from them
+    SDL_Surface *atlas;
+} font_face_t;
+
+// A recently drawn string, rendered in white into a texture that is tinted
+// when it is drawn
+typedef struct cached_string {
+    font_face_t *face;
+    uint32_t hash;
+    char str[MAX_CACHED_STRING];
+    unsigned short length;
+    int width;
+    renderer_texture_handle_t texture; ///< NULL until first drawn
+} cached_string_t;
+
+static struct text_cache {
+    SemaphoreHandle_t lock;
+    font_face_t faces[MAX_FONT_FACES];
+    unsigned int face_count;
+    cached_string_t strings[STRING_CACHE_SIZE];
+} cache = { 0 };
+
+static uint32_t ulHashString(const char *str)
+{
+    uint32_t hash = 2166136261u;
+
+    while (*str) {
+        hash = (hash ^ (unsigned char)*str++) * 16777619u;
+    }
+
+    return hash;
+}
+
+static TTF_Font *pxOpenFont(font_face_t *face)
+{
+    char path[PATH_MAX];
+    TTF_Font *font;
+    char *found;
+
+    // Copied, the asset threads' lookups might overwrite the result
+    vAssetsLockGfx();
+    found = gfxUtilFindResourcePath(face->name);
+    if (found) {
+        snprintf(path, sizeof(path), "%s", found);
+    }
+    vAssetsUnlockGfx();
+
+    if (!found) {
+        PRINT_ERROR("Could not find font '%s'", face->name);
+        return NULL;
+    }
+
+    if (!TTF_WasInit() && TTF_Init()) {
+        PRINT_ERROR("Failed to init SDL_ttf: %s", TTF_GetError());
+        return NULL;
+    }
+
+    font = TTF_OpenFont(path, face->size);
+    if (!font) {
+        PRINT_ERROR("Failed to open font '%s': %s", path, TTF_GetError());
+    }
+
+    return font;
+}
+
+// Rasterises every printable glyph in white into a grid of equally sized
+// cells
+static SDL_Surface *pxBuildAtlas(font_face_t *face, TTF_Font *font)
+{
+    SDL_Color white = { .r = 0xFF, .g = 0xFF, .b = 0xFF, .a = 0xFF };
+    SDL_Surface *atlas, *glyph;
+
+    atlas = SDL_CreateRGBSurfaceWithFormat(0,
+                                           face->cell_width * ATLAS_COLUMNS,
+                                           face->height * ATLAS_ROWS, 32,
+                                           SDL_PIXELFORMAT_RGBA32);
+    if (!atlas) {
+        PRINT_ERROR("Failed to create glyph atlas: %s", SDL_GetError());
+        return NULL;
+    }
+
+    for (int i = 0; i < GLYPH_COUNT; i++) {
+        SDL_Rect src = { 0, 0, face->cell_width, face->height };
+        SDL_Rect dst = { (i % ATLAS_COLUMNS) * face->cell_width,
+                         (i / ATLAS_COLUMNS) * face->height,
+                         face->cell_width, face->height
+                       };
+
+        if (!(glyph = TTF_RenderGlyph_Blended(font, FIRST_GLYPH + i,
+                                              white))) {
+            continue;
+        }
+
+        // Copy the glyph's alpha into the transparent atlas
+        SDL_SetSurfaceBlendMode(glyph, SDL_BLENDMODE_NONE);
+        SDL_BlitSurface(glyph, &src, atlas, &dst);
+        SDL_FreeSurface(glyph);
+    }
+
+    // Glyphs that overlap within a string are blended when composed
+    SDL_SetSurfaceBlendMode(atlas, SDL_BLENDMODE_BLEND);
+
+    return atlas;
+}
+
+static font_face_t *pxGetFace(const char *font_name, ssize_t size)
+{
+    font_face_t *face;
+    TTF_Font *font;
+    int minx, maxx, miny, maxy;
+
+    for (unsigned int i = 0; i < cache.face_count; i++)
+        if (cache.faces[i].size == size &&
+            !strcmp(cache.faces[i].name, font_name)) {
+            return cache.faces[i].failed ? NULL : &cache.faces[i];
+        }
+
+    if (cache.face_count == MAX_FONT_FACES) {
+        return NULL;
+    }
+
+    face = &cache.faces[cache.face_count++];
+    strncpy(face->name, font_name, FONT_NAME_LENGTH - 1);
+    face->size = size;
+
+    if (!(font = pxOpenFont(face))) {
+        face->failed = 1;
+        return NULL;
+    }
+
+    face->height = TTF_FontHeight(font);
+
+    for (int i = 0; i < GLYPH_COUNT; i++) {
+        if (TTF_GlyphMetrics(font, FIRST_GLYPH + i, &minx, &maxx, &miny,
+                             &maxy, &face->advances[i])) {
+            face->advances[i] = 0;
+        }
+        if (face->advances[i] > face->cell_width) {
+            face->cell_width = face->advances[i];
+        }
+        if (maxx > face->cell_width) {
+            face->cell_width = maxx;
+        }
+    }
+
+    if (!(face->atlas = pxBuildAtlas(face, font))) {
+        face->failed = 1;
+    }
+
+    TTF_CloseFont(font);
+
+    return face->failed ? NULL : face;
+}
+
+static cached_string_t *pxGetLayout(font_face_t *face, const char *str)
+{
+    uint32_t hash = ulHashString(str);
+    cached_string_t *entry = &cache.strings[hash % STRING_CACHE_SIZE];
+    size_t length = strlen(str);
+    int x = 0;
+
+    if (length >= MAX_CACHED_STRING) {
+        return NULL;
+    }
+
+    if (entry->face == face && entry->hash == hash &&
+        !strcmp(entry->str, str)) {
+        return entry;
+    }
+
+    for (size_t i = 0; i < length; i++)
+        if (str[i] >= FIRST_GLYPH && str[i] <= LAST_GLYPH) {
+            x += face->advances[str[i] - FIRST_GLYPH];
+        }
+
+    // The string that the entry held is no longer drawn from it
+    vRendererTextureDelete(entry->texture);
+
+    entry->face = face;
+    entry->hash = hash;
+    entry->length = length;
+    entry->width = x;
+    entry->texture = NULL;
+    memcpy(entry->str, str, length + 1);
+
+    return entry;
+}
+
+// Composes the string from its font's glyph atlas into a texture
+static renderer_texture_handle_t xRenderString(cached_string_t *entry)
+{
+    font_face_t *face = entry->face;
+    SDL_Surface *surface;
+    int x = 0;
+
+    surface = SDL_CreateRGBSurfaceWithFormat(0, entry->width, face->height,
+              32, SDL_PIXELFORMAT_RGBA32);
+    if (!surface) {
+        fprints(stderr, "[ERROR] %s, %s\n", __FUNCTION__, SDL_GetError());
+        return NULL;
+    }
+
+    for (unsigned short i = 0; i < entry->length; i++) {
+        int glyph = entry->str[i] - FIRST_GLYPH;
+        SDL_Rect src, dst = { x, 0, face->cell_width, face->height };
+
+        if (glyph < 0 || glyph >= GLYPH_COUNT) {
+            continue; // Unprintable characters
+        }
+
+        // Spaces are left transparent
+        if (glyph) {
+            src.x = (glyph % ATLAS_COLUMNS) * face->cell_width;
+            src.y = (glyph / ATLAS_COLUMNS) * face->height;
+            src.w = face->cell_width;
+            src.h = face->height;
+            SDL_BlitSurface(face->atlas, &src, surface, &dst);
+        }
+        x += face->advances[glyph];
+    }
+
+    return xRendererTextureCreate(surface);
+}
+
+static int xTextCacheFallbackDraw(const char *font_name, ssize_t size,
+                                  unsigned int colour, const char *str,
+                                  ssize_t x, ssize_t y, int *width,
+                                  int *height)
+{
+    font_handle_t cur_font = gfxFontGetCurFontHandle();
+    ssize_t prev_font_size = gfxFontGetCurFontSize();
+    int ret;
+
+    gfxFontSelectFontFromName((char *)font_name);
+    gfxFontSetSize(size);
+
+    if (width || height) {
+        ret = gfxGetTextSize((char *)str, width, height);
+    }
+    else {
+        ret = gfxDrawText((char *)str, x, y, colour);
+    }
+
+    gfxFontSelectFontFromHandle(cur_font);
+    gfxFontPutFontHandle(cur_font);
+    gfxFontSetSize(prev_font_size);
+
+    return ret;
+}
+
+int xTextCacheGetTextSize(const char *font_name, ssize_t size,
+                          const char *str, int *width, int *height)
+{
+    cached_string_t *layout = NULL;
+    font_face_t *face;
+    int ret = 0;
+
+    if (xSemaphoreTake(cache.lock, portMAX_DELAY) != pdTRUE) {
+        return -1;
+    }
+
+    if ((face = pxGetFace(font_name, size))) {
+        layout = pxGetLayout(face, str);
+    }
+
+    if (layout) {
+        if (width) {
+            *width = layout->width;
+        }
+        if (height) {
+            *height = face->height;
+        }
+    }
+
+    xSemaphoreGive(cache.lock);
+
+    if (!layout) {
+        int w, h;
+
+        ret = xTextCacheFallbackDraw(font_name, size, 0, str, 0, 0, &w, &h);
+        if (width) {
+            *width = w;
+        }
+        if (height) {
+            *height = h;
+        }
+    }
+
+    return ret;
+}
+
+int xTextCacheDrawText(const char *font_name, ssize_t size,
+                       unsigned int colour, const char *str, ssize_t x,
+                       ssize_t y)
+{
+    SDL_Renderer *renderer = pxRendererGet();
+    cached_string_t *layout = NULL;
+    SDL_Texture *texture = NULL;
+    font_face_t *face;
+    SDL_Rect dst;
+    int ret = 0;
+
+    // Strings are only rendered by the task presenting the frames
+    if (!renderer) {
+        return xTextCacheFallbackDraw(font_name, size, colour, str, x, y,
+                                      NULL, NULL);
+    }
+
+    if (xSemaphoreTake(cache.lock, portMAX_DELAY) != pdTRUE) {
+        return -1;
+    }
+
+    if ((face = pxGetFace(font_name, size))) {
+        layout = pxGetLayout(face, str);
+    }
+
+    // An empty string has no texture
+    if (layout && layout->width && !layout->texture) {
+        layout->texture = xRenderString(layout);
+    }
+
+    if (layout && layout->texture) {
+        texture = pxRendererTextureGet(layout->texture);
+    }
+
+    if (texture) {
+        dst.x = x;
+        dst.y = y;
+        dst.w = layout->width;
+        dst.h = face->height;
+
+        ret |= SDL_SetTextureColorMod(texture, (colour >> 16) & 0xFF,
+                                      (colour >> 8) & 0xFF, colour & 0xFF);
+        ret |= SDL_RenderCopy(renderer, texture, NULL, &dst);
+    }
+    else if (layout && layout->width) {
+        ret = -1;
+    }
+
+    xSemaphoreGive(cache.lock);
+
+    if (!layout) {
+        return xTextCacheFallbackDraw(font_name, size, colour, str, x, y,
+                                      NULL, NULL);
+    }
+
+    return ret;
+}
+
+int xTextCacheInit(void)
+{
+    cache.lock = xSemaphoreCreateMutex();
+    if (!cache.lock) {
+        PRINT_ERROR("Failed to create text cache lock");
+        return -1;
+    }
+
+    return 0;
+}
+
+void vTextCacheExit(void)
+{
+    // The strings' textures are destroyed with the renderer
+    for (unsigned int i = 0; i < cache.face_count; i++)
+        if (cache.faces[i].atlas) {
+            SDL_FreeSurface(cache.faces[i].atlas);
+        }
+
+    if (cache.lock) {
+        vSemaphoreDelete(cache.lock);
+    }
+
+    memset(&cache, 0, sizeof(cache));
+}
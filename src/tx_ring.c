@@ -0,0 +1,717 @@
+/**
+ * @file tx_ring.c
+ * @author Alex Hoffman
+ * @date 23 January 2023
+ * @brief Batched transmit path for UDP and TCP sockets
+ *
+ * @verbatim
+ ----------------------------------------------------------------------
+ Copyright (C) Alexander Hoffman, 2023
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ any later version.
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ ----------------------------------------------------------------------
+ @endverbatim
+ */
+
+// sendmmsg
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+
+#include "gfx_print.h"
+
+#include "EmulatorConfig.h"
+#include "frame_timing.h"
+#include "journal.h"
+#include "tx_ring.h"
+
+#define NS_PER_MS 1000000ULL
+
+#if configTX_RING_SLOTS & (configTX_RING_SLOTS - 1)
+#error "configTX_RING_SLOTS must be a power of two"
+#endif
+
+// Each slot's sequence tells producers and the I/O thread whose turn it is,
+// the slot at position pos is free while its sequence is pos and holds a
+// message while it is pos + 1
+struct tx_slot {
+    uint32_t sequence;
+    uint32_t length;
+    char data[configTX_RING_MESSAGE_SIZE];
+};
+
+struct tx_ring {
+    int type;
+    int fd;
+    // A TCP connection is being established, it is complete once the
+    // socket can be written to
+    int connecting;
+    // Waiting for the socket to be writable before sending again
+    int blocked;
+    // Index of the socket in the I/O thread's poll set while blocked
+    unsigned int poll_index;
+    // When a TCP ring tries to connect again after failing to, see
+    // ullFrameTimingNow
+    uint64_t retry_at;
+    // Set once the ring is closed or the I/O thread stopped, what has not
+    // been sent by then is discarded
+    uint64_t deadline;
+    struct sockaddr_in destination;
+    // Next position to be put to, shared by the producers
+    uint32_t tail;
+    // Next position to be sent, only written by the I/O thread
+    uint32_t head;
+    // Bytes of the message at head already written to a TCP socket
+    size_t offset;
+    volatile int closing;
+    // Set while replaying a journal, messages are counted but not sent
+    int discard;
+    struct tx_slot slots[configTX_RING_SLOTS];
+    tx_ring_stats_t stats;
+    struct tx_ring *next;
+};
+
+static struct tx_io {
+    pthread_t thread;
+    int started;
+    volatile int running;
+    // Incremented for every message put, wake_fd is written to while the
+    // I/O thread is sleeping
+    uint32_t doorbell;
+    uint32_t sleeping;
+    int wake_fd;
+    // Rings are added with the lock held but only removed by the I/O
+    // thread, which sends without holding the lock
+    struct tx_ring *rings;
+    pthread_mutex_t lock;
+    // The wake descriptor followed by the sockets of blocked rings
+    struct pollfd *polls;
+    unsigned int poll_capacity;
+} io = { .wake_fd = -1, .lock = PTHREAD_MUTEX_INITIALIZER };
+
+static void vTxRingRingDoorbell(void)
+{
+    uint64_t wake = 1;
+
+    __atomic_fetch_add(&io.doorbell, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&io.sleeping, __ATOMIC_SEQ_CST) &&
+        write(io.wake_fd, &wake, sizeof(wake)) < 0) {
+        // Only fails if the counter would overflow, in which case the
+        // thread is woken anyway
+    }
+}
+
+int xTxRingPut(tx_ring_handle_t ring, const char *data, size_t length)
+{
+    struct tx_slot *slot;
+    uint32_t pos, queued;
+    int32_t diff;
+
+    if (length > configTX_RING_MESSAGE_SIZE) {
+        __atomic_fetch_add(&ring->stats.dropped, 1, __ATOMIC_RELAXED);
+        return -1;
+    }
+
+    if (ring->discard) {
+        __atomic_fetch_add(&ring->stats.queued, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&ring->stats.sent, 1, __ATOMIC_RELAXED);
+        return 0;
+    }
+
+    pos = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+    while (1) {
+        slot = &ring->slots[pos & (configTX_RING_SLOTS - 1)];
+        diff = (int32_t)(__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) -
+                         pos);
+
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&ring->tail, &pos, pos + 1, 1,
+                                            __ATOMIC_RELAXED,
+                                            __ATOMIC_RELAXED)) {
+                break;
+            }
+        }
+        else if (diff < 0) {
+            // The I/O thread has not sent the message put here a lap ago
+            __atomic_fetch_add(&ring->stats.dropped, 1, __ATOMIC_RELAXED);
+            return -1;
+        }
+        else {
+            pos = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+        }
+    }
+
+    memcpy(slot->data, data, length);
+    slot->length = length;
+    __atomic_store_n(&slot->sequence, pos + 1, __ATOMIC_RELEASE);
+
+    __atomic_fetch_add(&ring->stats.queued, 1, __ATOMIC_RELAXED);
+    queued = pos + 1 - __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+    if (queued > ring->stats.max_queued) {
+        ring->stats.max_queued = queued;
+    }
+
+    vTxRingRingDoorbell();
+
+    return 0;
+}
+
+unsigned int uTxRingQueued(tx_ring_handle_t ring)
+{
+    return __atomic_load_n(&ring->tail, __ATOMIC_RELAXED) -
+           __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+}
+
+static void vTxRingConsume(struct tx_ring *ring, unsigned int count)
+{
+    for (unsigned int i = 0; i < count; i++, ring->head++)
+        __atomic_store_n(&ring->slots[ring->head &
+                                      (configTX_RING_SLOTS - 1)].sequence,
+                         ring->head + configTX_RING_SLOTS, __ATOMIC_RELEASE);
+}
+
+// Discards the messages that are queued, they are counted as errors
+static unsigned int uTxRingDiscard(struct tx_ring *ring)
+{
+    unsigned int count = 0;
+    uint32_t pos;
+
+    for (pos = ring->head;
+         __atomic_load_n(&ring->slots[pos & (configTX_RING_SLOTS - 1)]
+                         .sequence, __ATOMIC_ACQUIRE) == pos + 1;
+         pos++) {
+        count++;
+    }
+
+    ring->stats.errors += count;
+    ring->offset = 0;
+    vTxRingConsume(ring, count);
+
+    return count;
+}
+
+static unsigned int uTxRingSendDatagrams(struct tx_ring *ring,
+        struct iovec *iovs, unsigned int count)
+{
+    struct mmsghdr msgs[configTX_RING_BATCH] = { 0 };
+    int sent;
+
+    for (unsigned int i = 0; i < count; i++) {
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    sent = sendmmsg(ring->fd, msgs, count, 0);
+    ring->stats.batches++;
+
+    if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        ring->blocked = 1;
+        return 0;
+    }
+    if (sent < 0 && errno == EINTR) {
+        return 0;
+    }
+
+    // sendmmsg only fails if the first datagram could not be sent, eg.
+    // because nothing is listening on the port, discard it and carry on
+    // with the rest
+    if (sent < 0) {
+        ring->stats.errors++;
+        sent = 1;
+    }
+    else {
+        ring->stats.sent += sent;
+    }
+
+    return sent;
+}
+
+// Starts connecting, a TCP connection is only established once the socket
+// can be written to
+static int xTxRingConnect(struct tx_ring *ring)
+{
+    ring->fd = socket(AF_INET, ring->type | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (ring->fd < 0) {
+        return -1;
+    }
+
+    if (!connect(ring->fd, (struct sockaddr *)&ring->destination,
+                 sizeof(ring->destination))) {
+        return 0;
+    }
+
+    if (errno == EINPROGRESS) {
+        ring->connecting = 1;
+        ring->blocked = 1;
+        return 0;
+    }
+
+    close(ring->fd);
+    ring->fd = -1;
+    return -1;
+}
+
+// Closes a broken connection, the message partly written to it is
+// discarded as the peer could not tell where its remainder starts
+static void vTxRingDisconnect(struct tx_ring *ring)
+{
+    close(ring->fd);
+    ring->fd = -1;
+    ring->connecting = 0;
+    ring->blocked = 0;
+    ring->retry_at = ullFrameTimingNow() +
+                     configTX_RING_RECONNECT_MS * NS_PER_MS;
+
+    if (ring->offset) {
+        ring->offset = 0;
+        ring->stats.errors++;
+        vTxRingConsume(ring, 1);
+    }
+}
+
+// Whether the ring can send, connecting if the previous attempt was at
+// least configTX_RING_RECONNECT_MS ago
+static int xTxRingStreamConnected(struct tx_ring *ring)
+{
+    socklen_t length = sizeof(int);
+    int error = 0;
+
+    if (ring->fd < 0) {
+        if (ullFrameTimingNow() < ring->retry_at) {
+            return 0;
+        }
+
+        if (xTxRingConnect(ring)) {
+            ring->retry_at = ullFrameTimingNow() +
+                             configTX_RING_RECONNECT_MS * NS_PER_MS;
+            return 0;
+        }
+    }
+
+    if (ring->blocked) {
+        return 0;
+    }
+
+    if (ring->connecting) {
+        // The socket became writable, connecting either worked or failed
+        if (getsockopt(ring->fd, SOL_SOCKET, SO_ERROR, &error, &length) ||
+            error) {
+            vTxRingDisconnect(ring);
+            return 0;
+        }
+
+        ring->connecting = 0;
+    }
+
+    return 1;
+}
+
+static unsigned int uTxRingSendStream(struct tx_ring *ring,
+                                      struct iovec *iovs, unsigned int count)
+{
+    struct msghdr msg = { .msg_iov = iovs, .msg_iovlen = count };
+    unsigned int consumed = 0;
+    ssize_t written;
+
+    // The messages wait in the ring until there is a connection
+    if (!xTxRingStreamConnected(ring)) {
+        return 0;
+    }
+
+    written = sendmsg(ring->fd, &msg, MSG_NOSIGNAL);
+    ring->stats.batches++;
+
+    if (written < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            ring->blocked = 1;
+        }
+        else if (errno != EINTR) {
+            vTxRingDisconnect(ring);
+        }
+
+        return 0;
+    }
+
+    for (; consumed < count && (size_t)written >= iovs[consumed].iov_len;
+         consumed++) {
+        written -= iovs[consumed].iov_len;
+        ring->offset = 0;
+    }
+    ring->offset += written;
+    ring->stats.sent += consumed;
+
+    return consumed;
+}
+
+// Returns the number of messages sent or discarded
+static unsigned int uTxRingFlush(struct tx_ring *ring, int running)
+{
+    struct iovec iovs[configTX_RING_BATCH];
+    struct tx_slot *slot;
+    unsigned int count, consumed;
+    uint64_t now = ullFrameTimingNow();
+    uint32_t pos;
+
+    // A peer that cannot be reached does not keep the ring from being
+    // closed
+    if ((ring->closing || !running) && !ring->deadline) {
+        ring->deadline = now + configTX_RING_LINGER_MS * NS_PER_MS;
+    }
+    if (ring->deadline && now >= ring->deadline) {
+        return uTxRingDiscard(ring);
+    }
+
+    if (ring->blocked) {
+        return 0;
+    }
+
+    for (count = 0; count < configTX_RING_BATCH; count++) {
+        pos = ring->head + count;
+        slot = &ring->slots[pos & (configTX_RING_SLOTS - 1)];
+        if (__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) != pos + 1) {
+            break;
+        }
+
+        iovs[count].iov_base = slot->data;
+        iovs[count].iov_len = slot->length;
+    }
+
+    if (!count) {
+        return 0;
+    }
+
+    if (ring->type == SOCK_DGRAM) {
+        consumed = uTxRingSendDatagrams(ring, iovs, count);
+    }
+    else {
+        iovs[0].iov_base = (char *)iovs[0].iov_base + ring->offset;
+        iovs[0].iov_len -= ring->offset;
+        consumed = uTxRingSendStream(ring, iovs, count);
+    }
+
+    vTxRingConsume(ring, consumed);
+
+    return consumed;
+}
+
+static void vTxRingFree(struct tx_ring *ring)
+{
+    if (ring->fd >= 0) {
+        close(ring->fd);
+    }
+    free(ring);
+}
+
+static void vTxRingRemove(struct tx_ring *ring)
+{
+    struct tx_ring **it;
+
+    pthread_mutex_lock(&io.lock);
+    for (it = &io.rings; *it != ring; it = &(*it)->next)
+        ;
+    *it = ring->next;
+    pthread_mutex_unlock(&io.lock);
+
+    vTxRingFree(ring);
+}
+
+// Adds a blocked ring's socket to the poll set
+static int xTxRingPoll(struct tx_ring *ring, unsigned int *count)
+{
+    struct pollfd *polls;
+
+    if (*count == io.poll_capacity) {
+        polls = realloc(io.polls, (*count + 4) * sizeof(struct pollfd));
+        if (!polls) {
+            return -1;
+        }
+        io.polls = polls;
+        io.poll_capacity = *count + 4;
+    }
+
+    ring->poll_index = *count;
+    io.polls[(*count)++] = (struct pollfd) {
+        .fd = ring->fd, .events = POLLOUT
+    };
+
+    return 0;
+}
+
+// Waits for a message to be put, a blocked socket to become writable or
+// a ring's next connection attempt or deadline
+static void vTxRingSleep(struct tx_ring *rings, uint32_t doorbell)
+{
+    uint64_t now = ullFrameTimingNow(), wake_at = UINT64_MAX, value;
+    unsigned int count = 1;
+    struct tx_ring *ring;
+    int timeout = -1;
+    ssize_t ret;
+
+    io.polls[0] = (struct pollfd) {
+        .fd = io.wake_fd, .events = POLLIN
+    };
+
+    for (ring = rings; ring; ring = ring->next) {
+        ring->poll_index = 0;
+
+        // Without room in the poll set the socket is checked again after a
+        // millisecond
+        if (ring->blocked && xTxRingPoll(ring, &count)) {
+            wake_at = now;
+        }
+
+        if (!uTxRingQueued(ring)) {
+            continue;
+        }
+        if (ring->fd < 0 && ring->retry_at < wake_at) {
+            wake_at = ring->retry_at;
+        }
+        if (ring->deadline && ring->deadline < wake_at) {
+            wake_at = ring->deadline;
+        }
+    }
+
+    if (wake_at != UINT64_MAX) {
+        timeout = wake_at > now ? (wake_at - now + NS_PER_MS - 1) /
+                  NS_PER_MS : 0;
+        timeout = timeout ? timeout : 1;
+    }
+
+    __atomic_store_n(&io.sleeping, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&io.doorbell, __ATOMIC_SEQ_CST) == doorbell) {
+        poll(io.polls, count, timeout);
+    }
+    __atomic_store_n(&io.sleeping, 0, __ATOMIC_SEQ_CST);
+
+    // Resets the descriptor, fails with EAGAIN if it was not written to
+    ret = read(io.wake_fd, &value, sizeof(value));
+    (void)ret;
+
+    for (ring = rings; ring; ring = ring->next)
+        if (ring->blocked && (!ring->poll_index ||
+                              io.polls[ring->poll_index].revents)) {
+            ring->blocked = 0;
+        }
+}
+
+static void *vTxRingThread(void *args)
+{
+    struct tx_ring *rings, *ring, *next;
+    unsigned int progress;
+    uint32_t doorbell;
+    int running, pending;
+
+    while (1) {
+        doorbell = __atomic_load_n(&io.doorbell, __ATOMIC_SEQ_CST);
+        progress = 0;
+        pending = 0;
+
+        pthread_mutex_lock(&io.lock);
+        rings = io.rings;
+        running = io.running;
+        pthread_mutex_unlock(&io.lock);
+
+        // Rings added since are picked up on the next pass
+        for (ring = rings; ring; ring = next) {
+            next = ring->next;
+            progress += uTxRingFlush(ring, running);
+
+            if (ring->closing && !uTxRingQueued(ring)) {
+                if (ring == rings) {
+                    rings = next;
+                }
+                vTxRingRemove(ring);
+            }
+            else if (uTxRingQueued(ring)) {
+                pending = 1;
+            }
+        }
+
+        // Only stop once everything queued has been sent or discarded
+        if (progress) {
+            continue;
+        }
+        if (!running && !pending) {
+            break;
+        }
+
+        vTxRingSleep(rings, doorbell);
+    }
+
+    return NULL;
+}
+
+static int xTxRingStartThread(void)
+{
+    sigset_t all, old;
+    int ret;
+
+    if (io.started) {
+        return 0;
+    }
+
+    io.polls = calloc(1, sizeof(struct pollfd));
+    io.poll_capacity = 1;
+    io.wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (!io.polls || io.wake_fd < 0) {
+        fprints(stderr, "Failed to create transmit thread's descriptor\n");
+        goto err_wake;
+    }
+
+    // The I/O thread must not handle the signals that drive the FreeRTOS
+    // scheduler
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &old);
+    io.running = 1;
+    ret = pthread_create(&io.thread, NULL, vTxRingThread, NULL);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (ret) {
+        fprints(stderr, "Failed to start transmit thread: %s\n",
+                strerror(ret));
+        io.running = 0;
+        goto err_wake;
+    }
+
+    io.started = 1;
+
+    return 0;
+
+err_wake:
+    if (io.wake_fd >= 0) {
+        close(io.wake_fd);
+        io.wake_fd = -1;
+    }
+    free(io.polls);
+    io.polls = NULL;
+    io.poll_capacity = 0;
+    return -1;
+}
+
+static tx_ring_handle_t xTxRingOpen(int type, char *addr, in_port_t port)
+{
+    struct tx_ring *ring = calloc(1, sizeof(struct tx_ring));
+
+    if (!ring) {
+        fprints(stderr, "Failed to allocate transmit ring\n");
+        goto err_ring;
+    }
+
+    ring->type = type;
+    ring->fd = -1;
+    ring->destination.sin_family = AF_INET;
+    ring->destination.sin_port = htons(port);
+    ring->destination.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    if (addr &&
+        inet_pton(AF_INET, addr, &ring->destination.sin_addr) != 1) {
+        fprints(stderr, "Invalid address '%s'\n", addr);
+        goto err_addr;
+    }
+
+    for (unsigned int i = 0; i < configTX_RING_SLOTS; i++) {
+        ring->slots[i].sequence = i;
+    }
+
+    // The peers' replies, if any, are replayed from the journal
+    if (xJournalReplaying()) {
+        ring->discard = 1;
+        return ring;
+    }
+
+    // Connecting a UDP socket only sets its destination
+    if (type == SOCK_DGRAM && xTxRingConnect(ring)) {
+        fprints(stderr, "Failed to open UDP socket to port %d: %s\n", port,
+                strerror(errno));
+        goto err_addr;
+    }
+
+    pthread_mutex_lock(&io.lock);
+    if (xTxRingStartThread()) {
+        pthread_mutex_unlock(&io.lock);
+        goto err_thread;
+    }
+    ring->next = io.rings;
+    io.rings = ring;
+    pthread_mutex_unlock(&io.lock);
+
+    return ring;
+
+err_thread:
+    if (ring->fd >= 0) {
+        close(ring->fd);
+    }
+err_addr:
+    free(ring);
+err_ring:
+    return NULL;
+}
+
+tx_ring_handle_t xTxRingOpenUDP(char *addr, in_port_t port)
+{
+    return xTxRingOpen(SOCK_DGRAM, addr, port);
+}
+
+tx_ring_handle_t xTxRingOpenTCP(char *addr, in_port_t port)
+{
+    return xTxRingOpen(SOCK_STREAM, addr, port);
+}
+
+void vTxRingClose(tx_ring_handle_t ring)
+{
+    if (ring->discard) {
+        vTxRingFree(ring);
+        return;
+    }
+
+    // The I/O thread frees the ring once it has sent what is left
+    ring->closing = 1;
+    vTxRingRingDoorbell();
+}
+
+void vTxRingDeinit(void)
+{
+    struct tx_ring *ring;
+
+    if (!io.started) {
+        return;
+    }
+
+    io.running = 0;
+    vTxRingRingDoorbell();
+    pthread_join(io.thread, NULL);
+    io.started = 0;
+
+    while ((ring = io.rings)) {
+        io.rings = ring->next;
+        vTxRingFree(ring);
+    }
+
+    close(io.wake_fd);
+    io.wake_fd = -1;
+    free(io.polls);
+    io.polls = NULL;
+    io.poll_capacity = 0;
+}
+
+void vTxRingGetStats(tx_ring_handle_t ring, tx_ring_stats_t *stats)
+{
+    *stats = ring->stats;
+}